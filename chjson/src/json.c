@@ -115,6 +115,7 @@ void delete_json(json_t *json) {
     string_t *s;
     
     key_val_pair_t kvp;
+    hash_map_cursor_t cur;
 
     string_t **key_ptr;
     json_t **val_ptr;
@@ -122,8 +123,8 @@ void delete_json(json_t *json) {
     switch (json->type) {
     case CHJSON_OBJECT:
         hm = json_as_object(json);
-        hm_reset_iterator(hm);
-        while ((kvp = hm_next_kvp(hm)) != HASH_MAP_EXHAUSTED) {
+        hm_cursor_init(hm, &cur);
+        while ((kvp = hm_cursor_next(hm, &cur)) != HASH_MAP_EXHAUSTED) {
             key_ptr = (string_t **)kvp_key(hm, kvp);
             val_ptr = (json_t **)kvp_val(hm, kvp);
 
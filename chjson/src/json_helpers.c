@@ -90,9 +90,11 @@ static stream_state_t json_to_stream_helper(json_t *json, out_stream_t *os,
         // We don't append a comma on the first iteration!
         first = true;
 
+        // A cursor, so that the same object can be written by many threads at once.
         key_val_pair_t kvp;
-        hm_reset_iterator(hm);
-        while ((kvp = hm_next_kvp(hm)) != HASH_MAP_EXHAUSTED) {
+        hash_map_cursor_t cur;
+        hm_cursor_init(hm, &cur);
+        while ((kvp = hm_cursor_next(hm, &cur)) != HASH_MAP_EXHAUSTED) {
             string_t *key = *(string_t **)kvp_key(hm, kvp);
             json_t *val = *(json_t **)kvp_val(hm, kvp);
 
@@ -158,7 +158,10 @@ chatroom_status_t chatroom_login(chatroom_state_t *cs, channel_id_t id, const ch
 
     string_t *new_username = new_string_from_cstr(username);
 
-    if (hm_contains(cs->mailboxes, &new_username)) {
+    // A username is hashed once for both the check and the put.
+    uint32_t username_hash = hm_hash(cs->mailboxes, &new_username);
+
+    if (hm_get_hashed(cs->mailboxes, &new_username, username_hash)) {
         delete_string(new_username);
         status = CHATROOM_USERNAME_TAKEN;
 
@@ -173,7 +176,7 @@ chatroom_status_t chatroom_login(chatroom_state_t *cs, channel_id_t id, const ch
 
     // Slightly dangerous, we are using the same string pointer in both maps.
     // This is to help with logout logic.
-    hm_put(cs->mailboxes, &new_username, &mb);
+    hm_put_hashed(cs->mailboxes, &new_username, username_hash, &mb);
     
     status = CHATROOM_SUCCESS;
 
@@ -308,7 +308,11 @@ int main(int argc, char **argv) {
     username = argv[1];
     ip = argc < 3 ? "127.0.0.1" : argv[2];
 
-    int client_fd = client_connect(ip, CHATROOM_PORT);
+    // Each RPC is a small request followed by a small response, Nagle only adds latency.
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.tcp_nodelay = true;
+
+    int client_fd = client_connect_opts(ip, CHATROOM_PORT, &opts);
 
     if (client_fd == -1) {
         log_fatal("Failed to connect to server");
@@ -5,6 +5,7 @@
 
 #include "chrpc/channel.h"
 #include "chrpc/channel_fd.h"
+#include "chrpc/rpc_acceptor.h"
 #include "chrpc/rpc_server.h"
 #include "chrpc/serial_type.h"
 #include "chrpc/serial_value.h"
@@ -14,6 +15,8 @@
 #include "chsys/mem.h"
 #include "chsys/log.h"
 #include "chsys/sock.h"
+#include "chsys/event.h"
+#include "chsys/time.h"
 
 #include "chutil/map.h"
 #include "chutil/string.h"
@@ -178,6 +181,19 @@ static void chatroom_on_disconnect(channel_id_t id, chatroom_state_t *cs) {
     }
 }
 
+#define CHATROOM_EXIT_CHECK_NS (100 * SYS_NS_PER_MS)
+
+static void chatroom_exit_check_cb(sys_event_loop_t *loop, sys_event_source_t *src, 
+        uint32_t events, void *arg) {
+    (void)src;
+    (void)events;
+    (void)arg;
+
+    if (sys_sig_exit_requested()) {
+        sys_event_loop_stop(loop);
+    }
+}
+
 void run_chat_server(void) {
     chatroom_state_t *cs = new_chatroom_state();
 
@@ -249,52 +265,41 @@ void run_chat_server(void) {
         log_fatal("Failed to create server");
     }
 
-    int server_fd = create_server(CHATROOM_PORT, 5);
-    if (server_fd < 0) {
-        log_fatal("Failed to create server socket");
-    }
-
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    channel_status_t chn_status;
-
-    while (!sys_sig_exit_requested()) {
-        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-
-        if (client_fd < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
-            log_fatal("Unknown error accepting client"); 
+    chrpc_acceptor_attrs_t acc_attrs = {
+        .num_threads = 1,
+        .batch_size = 0, // Default.
+        .sock_opts = SOCK_OPTS_DEFAULT,
+        .chn_cfg = {
+            .queue_depth = 5,
+            .write_over = false, 
+            .max_msg_size = 0x1000,
+            .read_chunk_size = 0x1000
         }
+    };
 
-        if (client_fd > 0) {
-            channel_fd_config_t client_cfg = {
-                .queue_depth = 5,
-                .write_fd = client_fd,
-                .read_fd = client_fd,
-                .write_over = false, 
-                .max_msg_size = 0x1000,
-                .read_chunk_size = 0x1000
-            };
-
-            channel_t *client_chn;
-            chn_status = new_channel(CHANNEL_FD_IMPL, &client_chn, &client_cfg);
+    acc_attrs.sock_opts.backlog = 64;
+    acc_attrs.sock_opts.reuse_addr = true;
+    acc_attrs.sock_opts.tcp_nodelay = true; // Inherited by accepted clients.
 
-            if (chn_status != CHN_SUCCESS) {
-                log_fatal("Failure to create client channel from socket fd");
-            } 
+    chrpc_acceptor_t *acc;
+    status = new_chrpc_acceptor(&acc, server, CHATROOM_PORT, &acc_attrs);
+    if (status != CHRPC_SUCCESS) {
+        log_fatal("Failed to create acceptor");
+    }
 
-            status = chrpc_server_give_channel(server, client_chn);
+    sys_event_loop_t *loop = new_sys_event_loop(0);
 
-            if (status != CHRPC_SUCCESS) {
-                log_fatal("Failure to give client to server");
-            }
-        }
+    // Signals are handled on their own thread, so epoll_wait is never interrupted.
+    // Check for an exit request every so often instead.
+    sys_event_add_timer(loop, CHATROOM_EXIT_CHECK_NS, CHATROOM_EXIT_CHECK_NS, 
+            chatroom_exit_check_cb, NULL);
 
-        sleep(1);
-    }
+    sys_event_loop_run(loop);
 
     log_info("Shutting down chatroom");
     
-    close(server_fd);
+    delete_sys_event_loop(loop);
+    delete_chrpc_acceptor(acc);
     delete_chrpc_server(server);
     delete_chatroom_state(cs);
 }
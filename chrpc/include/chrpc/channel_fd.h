@@ -3,6 +3,7 @@
 #define CHRPC_CHANNEL_FD_H
 
 #include "chrpc/channel.h"
+#include "chrpc/channel_fd_uring.h"
 
 #include <pthread.h>
 #include "chutil/queue.h"
@@ -40,7 +41,12 @@ typedef struct _channel_fd_config_t {
     size_t max_msg_size;
 
     // How much we should read in every go, this CAN be larger than max_msg_size.
+    // (Unused with a uring, reads go into the uring's buffers)
     size_t read_chunk_size;
+
+    // When given, all reads and writes go through this io_uring instead of read/write.
+    // (See chrpc/channel_fd_uring.h) The uring must outlive the channel.
+    chn_fd_uring_t *uring;
 } channel_fd_config_t;
 
 typedef struct _channel_fd_t {
@@ -59,6 +65,9 @@ typedef struct _channel_fd_t {
 
     pthread_mutex_t mut;
     queue_t *q;
+
+    // Only used when cfg.uring is given.
+    chn_fd_uring_io_t uring_io;
 } channel_fd_t;
 
 extern const channel_impl_t * const CHANNEL_FD_IMPL;
@@ -72,4 +81,15 @@ channel_status_t chn_fd_refresh(channel_fd_t *chn_fd);
 channel_status_t chn_fd_incoming_len(channel_fd_t *chn_fd, size_t *len);
 channel_status_t chn_fd_receive(channel_fd_t *chn_fd, void *buf, size_t len, size_t *readden); 
 
+// Parses len bytes read from the fd, pushing any complete messages onto the queue.
+// NOTE: Assumes the channel lock is held. (Used by the uring backend)
+void chn_fd_process_bytes(channel_fd_t *chn_fd, const uint8_t *data, size_t len);
+
+// Returns the channel's (non-blocking) read fd, so it can be watched by an event loop.
+// (See chsys/event.h, chn_fd_refresh always reads until EAGAIN)
+//
+// Returns -1 once the read end has been closed. (e.g. after refresh sees EOF)
+// The fd is still owned by the channel.
+int chn_fd_read_fd(channel_fd_t *chn_fd);
+
 #endif
@@ -0,0 +1,141 @@
+
+#ifndef CHRPC_CHANNEL_FD_URING_H
+#define CHRPC_CHANNEL_FD_URING_H
+
+#include "chrpc/channel.h"
+#include "chsys/uring.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// io_uring backend for channel_fd_t.
+//
+// A chn_fd_uring_t is one io_uring shared by many fd channels.
+// To use it, set the uring field of a channel_fd_config_t. The framing, the queue, and the
+// channel interface are all the same as a regular fd channel, only the I/O differs.
+//
+// Reads:
+// When the channel is created, a read is armed on its read fd. For sockets this is a single
+// multishot recv which stays armed for the life of the channel. (For other fds, such as pipes,
+// a read is re-armed after each completion) Data lands in a provided buffer ring shared by
+// all channels of the uring.
+//
+// chn_refresh on ANY channel of a uring drains ALL pending completions, copying data into each
+// channel's queue. So, a worker refreshing many channels pays for no syscalls when nothing
+// has arrived, and at most one when something has.
+//
+// Writes:
+// chn_send frames the message into a per-channel pending buffer. If the channel has no send
+// in flight, the pending buffer is submitted right away as a single send. Otherwise,
+// it is sent as soon as the in flight send completes. So, bursts of small messages are
+// coalesced into a few large sends, while each channel's bytes stay in order.
+//
+// Unlike a regular fd channel, chn_send returns once the message is queued, not once
+// it is written. A failed write is reported by the next chn_send. Deleting a channel
+// waits for its queued sends to finish, for at most CHN_FD_URING_CLOSE_TIMEOUT_NS,
+// after which they are cancelled.
+//
+// Threads waiting on a channel (a full pending buffer, or a delete) release the uring's
+// lock while they wait, so a slow peer only ever holds up its own channel.
+//
+// NOTE: Requests belong to the thread which submitted them. If that thread exits, its
+// requests are cancelled, and re-armed by the next refresh.
+//
+// A chn_fd_uring_t is thread safe, but all of its channels share one lock.
+// For the most throughput, give each worker thread its own uring.
+
+typedef struct _chn_fd_uring_config_t {
+    // Size of the submission queue. The completion queue is 4x this.
+    unsigned int entries;
+
+    // Number of receive buffers, must be a power of 2.
+    unsigned int num_bufs;
+
+    // Size of each receive buffer.
+    size_t buf_size;
+
+    // Once a channel has this many bytes waiting to be sent, chn_send blocks until
+    // some are written. (Only the sending thread blocks, not the uring)
+    size_t max_pending_send;
+} chn_fd_uring_config_t;
+
+#define CHN_FD_URING_DEFAULT_CFG { \
+    .entries = 256, \
+    .num_bufs = 256, \
+    .buf_size = 0x1000, \
+    .max_pending_send = 0x100000, \
+}
+
+// How long deleting a channel waits for its sends before cancelling them.
+#define CHN_FD_URING_CLOSE_TIMEOUT_NS (1000ULL * 1000 * 1000)
+
+typedef struct _chn_fd_uring_t {
+    chn_fd_uring_config_t cfg;
+
+    pthread_mutex_t mut;
+
+    // Broadcast after completions are reaped, when there are waiters.
+    // (Waiters also reap themselves, in case no other thread is)
+    pthread_cond_t reaped;
+    size_t num_waiters;
+
+    sys_uring_t ring;
+    sys_uring_buf_ring_t bufs;
+} chn_fd_uring_t;
+
+// Returns NULL if io_uring (or provided buffer rings) are unavailable on this system.
+// Callers should fall back to regular fd channels in that case.
+chn_fd_uring_t *new_chn_fd_uring(const chn_fd_uring_config_t *cfg);
+
+// All channels using the uring must be deleted first.
+void delete_chn_fd_uring(chn_fd_uring_t *uring);
+
+// Submits all queued operations and processes all completions, for every channel of the uring.
+// (chn_refresh on any of its channels does the same thing)
+void chn_fd_uring_flush(chn_fd_uring_t *uring);
+
+// Per channel io_uring state. (Lives in channel_fd_t)
+// All fields are protected by the uring's lock.
+typedef struct _chn_fd_uring_io_t {
+    bool read_is_sock;
+    bool write_is_sock;
+
+    bool recv_inflight;
+
+    // Set once the channel is being deleted, so reads are not re-armed.
+    bool closing;
+
+    // The in flight send. [send_off, send_len) is still to be written.
+    bool send_inflight;
+    uint8_t *send_buf;
+    size_t send_cap;
+    size_t send_len;
+    size_t send_off;
+
+    // Messages queued behind the in flight send.
+    uint8_t *pend_buf;
+    size_t pend_cap;
+    size_t pend_len;
+
+    // Set when a write fails.
+    bool write_failed;
+
+    // Set once a delete gives up on the in flight send, so it's not resubmitted.
+    bool send_cancelled;
+} chn_fd_uring_io_t;
+
+// Used by channel_fd.c
+
+struct _channel_fd_t;
+
+channel_status_t chn_fd_uring_attach(struct _channel_fd_t *chn_fd);
+
+// Cancels the channel's read, and waits for its sends. (See CHN_FD_URING_CLOSE_TIMEOUT_NS)
+void chn_fd_uring_detach(struct _channel_fd_t *chn_fd);
+
+channel_status_t chn_fd_uring_send(struct _channel_fd_t *chn_fd, const void *msg, size_t len);
+channel_status_t chn_fd_uring_refresh(struct _channel_fd_t *chn_fd);
+
+#endif
@@ -0,0 +1,112 @@
+
+#ifndef CHRPC_RPC_ACCEPTOR_H
+#define CHRPC_RPC_ACCEPTOR_H
+
+#include "chrpc/channel_fd.h"
+#include "chrpc/rpc_server.h"
+#include "chrpc/serial_type.h"
+#include "chsys/event.h"
+#include "chsys/sock.h"
+#include "chsys/time.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// An acceptor accepts connections on one or more listening sockets, and gives them
+// to an RPC server as fd channels.
+//
+// Each listening socket gets its own acceptor thread. A thread sleeps in epoll until its
+// socket has pending connections, then accepts (accept4) until the backlog is empty.
+// Accepted connections are wrapped in channels and given to the server in batches,
+// so the server's lock is taken once per batch rather than once per connection.
+//
+// When the server is full, the connections which don't fit are closed right away.
+
+// Used when batch_size is 0.
+#define CHRPC_ACCEPTOR_DEFAULT_BATCH_SIZE 64
+
+// When accept fails because the process is out of fds (or memory), accepting
+// pauses for this long.
+#define CHRPC_ACCEPTOR_RETRY_NS (10 * SYS_NS_PER_MS)
+
+typedef struct _chrpc_acceptor_attrs_t {
+    // Only used by new_chrpc_acceptor. (When created from fds, there is one thread per fd)
+    //
+    // With more than one thread, each thread gets its own SO_REUSEPORT socket, and
+    // the kernel spreads incoming connections between them.
+    size_t num_threads;
+
+    // Max number of connections given to the server in one call. (0 for the default)
+    size_t batch_size;
+
+    // Only used by new_chrpc_acceptor, options of the listening sockets.
+    // The sockets are always non-blocking, and reuse_port is set when num_threads > 1.
+    //
+    // NOTE: tcp_* options are inherited by accepted connections.
+    sock_opts_t sock_opts;
+
+    // Every accepted connection's channel is created with this config.
+    // (write_fd and read_fd are ignored)
+    //
+    // max_msg_size must be at least CHRPC_SERVER_BUF_MIN_SIZE, and no larger
+    // than the server's max_msg_size.
+    channel_fd_config_t chn_cfg;
+} chrpc_acceptor_attrs_t;
+
+struct _chrpc_acceptor_t;
+
+typedef struct _chrpc_acceptor_thread_t {
+    struct _chrpc_acceptor_t *acc;
+
+    // OWNED by the acceptor.
+    int listen_fd;
+
+    sys_event_loop_t *loop;
+
+    // Non-NULL while accepting is paused. (See CHRPC_ACCEPTOR_RETRY_NS)
+    sys_event_source_t *retry;
+
+    // Channels of the batch being built.
+    channel_t **batch;
+
+    pthread_t id;
+} chrpc_acceptor_thread_t;
+
+typedef struct _chrpc_acceptor_t {
+    chrpc_acceptor_attrs_t attrs;
+
+    // NOT owned by the acceptor, the server must outlive the acceptor.
+    chrpc_server_t *server;
+
+    size_t num_threads;
+    chrpc_acceptor_thread_t *threads;
+
+    // Connections given to the server, and connections closed because the server
+    // was full (or a channel couldn't be created).
+    atomic_uint_fast64_t num_accepted;
+    atomic_uint_fast64_t num_rejected;
+} chrpc_acceptor_t;
+
+// Creates an acceptor listening on the given TCP port on all interfaces.
+//
+// Returns CHRPC_SERVER_CREATION_ERROR if the attributes are invalid, or a
+// listening socket cannot be created.
+chrpc_status_t new_chrpc_acceptor(chrpc_acceptor_t **acc, chrpc_server_t *server, int port,
+        const chrpc_acceptor_attrs_t *attrs);
+
+// Creates an acceptor with one thread per given listening socket.
+// (e.g. Unix sockets from create_unix_server)
+//
+// The acceptor OWNS the given fds, even if this call fails.
+// The fds are made non-blocking.
+chrpc_status_t new_chrpc_acceptor_from_fds(chrpc_acceptor_t **acc, chrpc_server_t *server,
+        const int *listen_fds, size_t num_fds, const chrpc_acceptor_attrs_t *attrs);
+
+// Stops and joins all acceptor threads, then closes the listening sockets.
+// Connections already given to the server are unaffected.
+void delete_chrpc_acceptor(chrpc_acceptor_t *acc);
+
+#endif
@@ -6,6 +6,7 @@
 #include "chrpc/channel_local2.h"
 #include "chrpc/serial_type.h"
 #include "chrpc/serial_value.h"
+#include "chutil/hash.h"
 #include "chutil/map.h"
 #include "chutil/queue.h"
 #include "chutil/string.h"
@@ -53,7 +54,7 @@ typedef enum _chrpc_server_command_t {
 typedef chrpc_server_command_t (*chrpc_endpoint_ft)(channel_id_t id, void *server_state, chrpc_value_t **ret, chrpc_value_t **args, uint32_t num_args);
 
 static inline uint32_t chrpc_channel_id_hash_func(const void *id) {
-    return ((*(const channel_id_t *)id * 12342343) + 7) * 3;
+    return hash_fold32(hash_mix64(*(const channel_id_t *)id));
 }
 
 static inline bool chrpc_channel_id_equals_func(const void *id0, const void *id1) {
@@ -142,14 +143,28 @@ typedef struct _chrpc_server_attrs_t {
     // I feel a little weird that this is not in the endpoint set definition.
     // But at the same time, this isn't really an endpoint is it?
     chrpc_server_disconnect_ft on_disconnect;
+
+    // Worker placement, both options are off when zeroed.
+    //
+    // When pin_workers is true, each worker is pinned to a single CPU, 
+    // going round robin over the CPUs available to the server.
+    //
+    // When use_numa_node is true, the CPUs available to the server are only those 
+    // of numa_node. (Otherwise, all CPUs this process may run on)
+    //
+    // When either is set, worker buffers are prefaulted by their worker,
+    // so their pages are placed on the worker's local node.
+    bool pin_workers;
+    bool use_numa_node;
+    int numa_node;
 } chrpc_server_attrs_t;
 
 typedef struct _chrpc_queue_ele_t {
     // Given channel ID.
     channel_id_t id;
 
-    // Number of seconds since last request.
-    time_t since_last_req;
+    // Monotonic time of the last request. (Or of when the channel was given)
+    uint64_t last_req_ns;
 
     channel_t *chn;
 } chrpc_queue_ele_t;
@@ -269,4 +284,11 @@ static inline void *chrpc_server_state(chrpc_server_t *server) {
 // In this case, it is the user's responsibility to cleanup the channel.
 chrpc_status_t chrpc_server_give_channel(chrpc_server_t *server, channel_t *chn);
 
+// Gives many channels at once, taking the server's lock only once.
+//
+// Channels are given in order, *given is set to the number given. (Always a prefix of chns)
+// Returns CHRPC_SUCCESS if all channels were given. Otherwise, returns why chns[*given]
+// could not be given. (e.g. CHRPC_SERVER_FULL) The user keeps ownership of chns[*given] onward.
+chrpc_status_t chrpc_server_give_channels(chrpc_server_t *server, channel_t **chns, size_t num, size_t *given);
+
 #endif
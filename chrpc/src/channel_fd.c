@@ -69,11 +69,12 @@ channel_status_t new_channel_fd(channel_fd_t **chn_fd, const channel_fd_config_t
     chn->cfg = *cfg;  
     chn->write_fd = cfg->write_fd;
     chn->read_fd = cfg->read_fd;
-    chn->read_chunk = (uint8_t *)safe_malloc(cfg->read_chunk_size);
+    chn->read_chunk = cfg->uring ? NULL : (uint8_t *)safe_malloc_large(cfg->read_chunk_size);
     chn->msg_buf_fill = 0;
-    chn->msg_buf = (uint8_t *)safe_malloc(CHN_FD_MSG_SIZE(cfg->max_msg_size));
-    chn->write_buf = (uint8_t *)safe_malloc(CHN_FD_MSG_SIZE(cfg->max_msg_size));
+    chn->msg_buf = (uint8_t *)safe_malloc_large(CHN_FD_MSG_SIZE(cfg->max_msg_size));
+    chn->write_buf = (uint8_t *)safe_malloc_large(CHN_FD_MSG_SIZE(cfg->max_msg_size));
     chn->q = new_queue(cfg->queue_depth, sizeof(channel_msg_t));
+    memset(&(chn->uring_io), 0, sizeof(chn_fd_uring_io_t));
 
     if (chn->read_fd < 0) {
         int read_fd = dup(cfg->write_fd);
@@ -89,12 +90,25 @@ channel_status_t new_channel_fd(channel_fd_t **chn_fd, const channel_fd_config_t
         return CHN_UNKNOWN_ERROR;
     }
 
+    if (cfg->uring) {
+        channel_status_t status = chn_fd_uring_attach(chn);
+        if (status != CHN_SUCCESS) {
+            delete_channel_fd(chn);
+            return status;
+        }
+    }
+
     *chn_fd = chn;
 
     return CHN_SUCCESS;
 }
 
 channel_status_t delete_channel_fd(channel_fd_t *chn_fd) {
+    if (chn_fd->cfg.uring) {
+        // The uring may still be using our fds and buffers.
+        chn_fd_uring_detach(chn_fd);
+    }
+
     if (chn_fd->read_fd >= 0) {
         close(chn_fd->read_fd);
     }
@@ -109,9 +123,11 @@ channel_status_t delete_channel_fd(channel_fd_t *chn_fd) {
     }
 
     delete_queue(chn_fd->q);
-    safe_free(chn_fd->read_chunk);
-    safe_free(chn_fd->msg_buf);
-    safe_free(chn_fd->write_buf);
+    if (chn_fd->read_chunk) {
+        safe_free_large(chn_fd->read_chunk);
+    }
+    safe_free_large(chn_fd->msg_buf);
+    safe_free_large(chn_fd->write_buf);
 
     pthread_mutex_destroy(&(chn_fd->mut));
     safe_free(chn_fd);
@@ -130,6 +146,10 @@ channel_status_t chn_fd_send(channel_fd_t *chn_fd, const void *msg, size_t len)
         return CHN_INVALID_MSG_SIZE;
     }
 
+    if (chn_fd->cfg.uring) {
+        return chn_fd_uring_send(chn_fd, msg, len);
+    }
+
     channel_status_t status = CHN_SUCCESS;
 
     pthread_mutex_lock(&(chn_fd->mut));
@@ -169,7 +189,7 @@ end:
 }
 
 // NOTE: Assumes we have the channel lock, returns new value of read_chunk_pos.
-static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk_pos, size_t readden) {
+static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, const uint8_t *chunk, size_t read_chunk_pos, size_t readden) {
     if (read_chunk_pos >= readden) {
         return read_chunk_pos;
     }
@@ -178,7 +198,7 @@ static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk
     if (chn_fd->msg_buf_fill == 0) {
         while (read_chunk_pos < readden) {
             // We found our magic value!
-            if (chn_fd->read_chunk[read_chunk_pos] == CHN_FD_START_MAGIC) {
+            if (chunk[read_chunk_pos] == CHN_FD_START_MAGIC) {
                 chn_fd->msg_buf[0] = CHN_FD_START_MAGIC;
 
                 chn_fd->msg_buf_fill++;
@@ -207,7 +227,7 @@ static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk
             bytes_to_read = length_bytes_needed; 
         }
 
-        memcpy(chn_fd->msg_buf + chn_fd->msg_buf_fill, chn_fd->read_chunk + read_chunk_pos, bytes_to_read);
+        memcpy(chn_fd->msg_buf + chn_fd->msg_buf_fill, chunk + read_chunk_pos, bytes_to_read);
         
         chn_fd->msg_buf_fill += bytes_to_read;
         read_chunk_pos += bytes_to_read;
@@ -233,7 +253,7 @@ static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk
             bytes_to_read = msg_bytes_needed;
         }
 
-        memcpy(chn_fd->msg_buf + chn_fd->msg_buf_fill, chn_fd->read_chunk + read_chunk_pos, bytes_to_read);
+        memcpy(chn_fd->msg_buf + chn_fd->msg_buf_fill, chunk + read_chunk_pos, bytes_to_read);
 
         chn_fd->msg_buf_fill += bytes_to_read;
         read_chunk_pos += bytes_to_read;
@@ -246,7 +266,7 @@ static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk
     // If we make it here, the buffer holds everything except maybe the ending magic value.
     if (chn_fd->msg_buf_fill < (sizeof(uint8_t) + sizeof(uint32_t) + msg_length + sizeof(uint8_t))) {
         // Uh-Oh, we failed to read the end message value :,(
-        if (chn_fd->read_chunk[read_chunk_pos] != CHN_FD_END_MAGIC) {
+        if (chunk[read_chunk_pos] != CHN_FD_END_MAGIC) {
             chn_fd->msg_buf_fill = 0;
             read_chunk_pos++;
 
@@ -289,7 +309,18 @@ static size_t _chn_fd_process_single_msg(channel_fd_t *chn_fd, size_t read_chunk
     return read_chunk_pos;
 }
 
+void chn_fd_process_bytes(channel_fd_t *chn_fd, const uint8_t *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        pos = _chn_fd_process_single_msg(chn_fd, data, pos, len);
+    }
+}
+
 channel_status_t chn_fd_refresh(channel_fd_t *chn_fd) {
+    if (chn_fd->cfg.uring) {
+        return chn_fd_uring_refresh(chn_fd);
+    }
+
     channel_status_t status = CHN_SUCCESS;
 
     pthread_mutex_lock(&(chn_fd->mut));
@@ -305,10 +336,7 @@ channel_status_t chn_fd_refresh(channel_fd_t *chn_fd) {
 
     int readden;
     while ((readden = read(chn_fd->read_fd, chn_fd->read_chunk, chn_fd->cfg.read_chunk_size)) > 0) {
-        size_t read_chunk_pos = 0;
-        while (read_chunk_pos < (size_t)readden) {
-            read_chunk_pos = _chn_fd_process_single_msg(chn_fd, read_chunk_pos, readden);
-        }
+        chn_fd_process_bytes(chn_fd, chn_fd->read_chunk, (size_t)readden);
     }
 
     // EOF is still a success!
@@ -385,3 +413,10 @@ end:
     return return_status;
 }
 
+int chn_fd_read_fd(channel_fd_t *chn_fd) {
+    pthread_mutex_lock(&(chn_fd->mut));
+    int read_fd = chn_fd->read_fd;
+    pthread_mutex_unlock(&(chn_fd->mut));
+
+    return read_fd;
+}
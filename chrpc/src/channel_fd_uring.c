@@ -0,0 +1,460 @@
+#include "chrpc/channel_fd_uring.h"
+#include "chrpc/channel_fd.h"
+#include "chrpc/channel.h"
+#include "chsys/log.h"
+#include "chsys/mem.h"
+#include "chsys/time.h"
+#include "chsys/uring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// All channels of a uring share one buffer group.
+#define CHN_FD_URING_BGID 0
+
+// An SQE's user_data is its channel's address, with the operation in the low bits.
+// (Channels are malloc'd, so these bits are always free)
+#define CHN_FD_URING_OP_RECV   0x0ULL
+#define CHN_FD_URING_OP_SEND   0x1ULL
+#define CHN_FD_URING_OP_CANCEL 0x2ULL
+#define CHN_FD_URING_OP_MASK   0x3ULL
+
+// Longest a waiter sleeps before reaping for itself.
+#define CHN_FD_URING_WAIT_NS (1000ULL * 1000)
+
+static inline uint64_t op_data(channel_fd_t *chn_fd, uint64_t op) {
+    return (uint64_t)(uintptr_t)chn_fd | op;
+}
+
+chn_fd_uring_t *new_chn_fd_uring(const chn_fd_uring_config_t *cfg) {
+    if (!cfg || cfg->entries == 0 || cfg->buf_size == 0 || cfg->max_pending_send == 0) {
+        return NULL;
+    }
+
+    chn_fd_uring_t *uring = (chn_fd_uring_t *)safe_malloc(sizeof(chn_fd_uring_t));
+    uring->cfg = *cfg;
+
+    if (!sys_uring_init(&(uring->ring), cfg->entries, cfg->entries * 4)) {
+        safe_free(uring);
+        return NULL;
+    }
+
+    if (!sys_uring_buf_ring_init(&(uring->ring), &(uring->bufs), CHN_FD_URING_BGID,
+                cfg->num_bufs, cfg->buf_size)) {
+        sys_uring_cleanup(&(uring->ring));
+        safe_free(uring);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&(uring->mut), NULL)) {
+        sys_uring_buf_ring_cleanup(&(uring->ring), &(uring->bufs));
+        sys_uring_cleanup(&(uring->ring));
+        safe_free(uring);
+        return NULL;
+    }
+
+    // Timed waits are against the monotonic clock.
+    pthread_condattr_t attr;
+    bool cond_init = pthread_condattr_init(&attr) == 0;
+    if (cond_init) {
+        cond_init = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 &&
+            pthread_cond_init(&(uring->reaped), &attr) == 0;
+        pthread_condattr_destroy(&attr);
+    }
+
+    if (!cond_init) {
+        pthread_mutex_destroy(&(uring->mut));
+        sys_uring_buf_ring_cleanup(&(uring->ring), &(uring->bufs));
+        sys_uring_cleanup(&(uring->ring));
+        safe_free(uring);
+        return NULL;
+    }
+
+    uring->num_waiters = 0;
+
+    return uring;
+}
+
+void delete_chn_fd_uring(chn_fd_uring_t *uring) {
+    pthread_cond_destroy(&(uring->reaped));
+    pthread_mutex_destroy(&(uring->mut));
+
+    sys_uring_buf_ring_cleanup(&(uring->ring), &(uring->bufs));
+    sys_uring_cleanup(&(uring->ring));
+
+    safe_free(uring);
+}
+
+static void reap_all(chn_fd_uring_t *uring);
+
+// NOTE: All static functions below assume the uring lock is held.
+
+// Returns an SQE, submitting (and reaping) to make room if needed.
+static struct io_uring_sqe *uring_sqe(chn_fd_uring_t *uring) {
+    struct io_uring_sqe *sqe;
+
+    while (!(sqe = sys_uring_get_sqe(&(uring->ring)))) {
+        // -EBUSY here means the kernel wants us to make room in the CQ first.
+        sys_uring_submit(&(uring->ring), 0);
+        reap_all(uring);
+    }
+
+    return sqe;
+}
+
+static void arm_recv(chn_fd_uring_t *uring, channel_fd_t *chn_fd) {
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+    struct io_uring_sqe *sqe = uring_sqe(uring);
+
+    if (io->read_is_sock) {
+        // Stays armed until an error, EOF, or the buffer ring runs dry.
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+        sqe->off = (uint64_t)-1; // Current position.
+    }
+
+    sqe->fd = chn_fd->read_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = CHN_FD_URING_BGID;
+    sqe->len = 0; // Use the whole buffer.
+    sqe->user_data = op_data(chn_fd, CHN_FD_URING_OP_RECV);
+
+    io->recv_inflight = true;
+}
+
+// Sends [send_off, send_len) of the send buffer.
+static void submit_send(chn_fd_uring_t *uring, channel_fd_t *chn_fd) {
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+    struct io_uring_sqe *sqe = uring_sqe(uring);
+
+    if (io->write_is_sock) {
+        // MSG_WAITALL has the kernel retry short sends itself.
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    } else {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = (uint64_t)-1;
+    }
+
+    sqe->fd = chn_fd->write_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(io->send_buf + io->send_off);
+    sqe->len = (uint32_t)(io->send_len - io->send_off);
+    sqe->user_data = op_data(chn_fd, CHN_FD_URING_OP_SEND);
+
+    io->send_inflight = true;
+}
+
+// Moves everything pending into a new send.
+static void start_send(chn_fd_uring_t *uring, channel_fd_t *chn_fd) {
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    // Swap buffers, so neither ever needs to be copied.
+    uint8_t *buf = io->send_buf;
+    size_t cap = io->send_cap;
+
+    io->send_buf = io->pend_buf;
+    io->send_cap = io->pend_cap;
+    io->send_len = io->pend_len;
+    io->send_off = 0;
+
+    io->pend_buf = buf;
+    io->pend_cap = cap;
+    io->pend_len = 0;
+
+    submit_send(uring, chn_fd);
+}
+
+static void handle_recv(chn_fd_uring_t *uring, channel_fd_t *chn_fd, int32_t res, uint32_t flags) {
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = sys_uring_cqe_bid(flags);
+
+        if (res > 0) {
+            pthread_mutex_lock(&(chn_fd->mut));
+            chn_fd_process_bytes(chn_fd, sys_uring_buf_ring_buf(&(uring->bufs), bid), (size_t)res);
+            pthread_mutex_unlock(&(chn_fd->mut));
+        }
+
+        sys_uring_buf_ring_recycle(&(uring->bufs), bid);
+    }
+
+    if (flags & IORING_CQE_F_MORE) {
+        // Still armed.
+        return;
+    }
+
+    io->recv_inflight = false;
+
+    if (io->closing) {
+        return;
+    }
+
+    // ENOBUFS means every buffer was in use, they've been recycled since.
+    // ECANCELED usually means the thread which armed the read exited.
+    if (res > 0 || res == -ENOBUFS || res == -ECANCELED || res == -EINTR || res == -EAGAIN) {
+        arm_recv(uring, chn_fd);
+        return;
+    }
+
+    // EOF or a real error, same as a regular fd channel.
+    pthread_mutex_lock(&(chn_fd->mut));
+    if (chn_fd->read_fd >= 0) {
+        close(chn_fd->read_fd);
+        chn_fd->read_fd = -1;
+    }
+    pthread_mutex_unlock(&(chn_fd->mut));
+}
+
+static void handle_send(chn_fd_uring_t *uring, channel_fd_t *chn_fd, int32_t res) {
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    // The channel is being deleted, whatever is left is dropped.
+    if (io->send_cancelled) {
+        io->send_inflight = false;
+        io->write_failed = true;
+        io->pend_len = 0;
+        return;
+    }
+
+    if (res == -EINTR || res == -EAGAIN) {
+        submit_send(uring, chn_fd);
+        return;
+    }
+
+    if (res <= 0) {
+        io->send_inflight = false;
+        io->write_failed = true;
+        io->pend_len = 0;
+        return;
+    }
+
+    io->send_off += (size_t)res;
+
+    if (io->send_off < io->send_len) {
+        submit_send(uring, chn_fd);
+        return;
+    }
+
+    io->send_inflight = false;
+
+    if (io->pend_len > 0) {
+        start_send(uring, chn_fd);
+    }
+}
+
+static void reap_all(chn_fd_uring_t *uring) {
+    struct io_uring_cqe *cqe;
+    bool reaped = false;
+
+    while ((cqe = sys_uring_peek_cqe(&(uring->ring)))) {
+        reaped = true;
+
+        // The CQE is copied out and released first, since handling it may submit.
+        uint64_t data = cqe->user_data;
+        int32_t res = cqe->res;
+        uint32_t flags = cqe->flags;
+
+        sys_uring_cqe_seen(&(uring->ring));
+
+        uint64_t op = data & CHN_FD_URING_OP_MASK;
+        if (op == CHN_FD_URING_OP_CANCEL) {
+            continue;
+        }
+
+        channel_fd_t *chn_fd = (channel_fd_t *)(uintptr_t)(data & ~CHN_FD_URING_OP_MASK);
+
+        if (op == CHN_FD_URING_OP_RECV) {
+            handle_recv(uring, chn_fd, res, flags);
+        } else {
+            handle_send(uring, chn_fd, res);
+        }
+    }
+
+    if (reaped && uring->num_waiters > 0) {
+        pthread_cond_broadcast(&(uring->reaped));
+    }
+}
+
+static void flush(chn_fd_uring_t *uring) {
+    reap_all(uring);
+
+    if (sys_uring_sq_pending(&(uring->ring)) > 0) {
+        sys_uring_submit(&(uring->ring), 0);
+
+        // Sends often complete during the submit itself.
+        reap_all(uring);
+    }
+}
+
+// Releases the uring lock until completions are reaped, or CHN_FD_URING_WAIT_NS passes.
+// Then reaps, as no other thread may be.
+//
+// The lock is shared by every channel of the uring, so it must never be held
+// while waiting on a single channel.
+static void uring_wait(chn_fd_uring_t *uring) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t ns = (uint64_t)ts.tv_nsec + CHN_FD_URING_WAIT_NS;
+    ts.tv_sec += (time_t)(ns / SYS_NS_PER_S);
+    ts.tv_nsec = (long)(ns % SYS_NS_PER_S);
+
+    uring->num_waiters++;
+    pthread_cond_timedwait(&(uring->reaped), &(uring->mut), &ts);
+    uring->num_waiters--;
+
+    flush(uring);
+}
+
+void chn_fd_uring_flush(chn_fd_uring_t *uring) {
+    pthread_mutex_lock(&(uring->mut));
+    flush(uring);
+    pthread_mutex_unlock(&(uring->mut));
+}
+
+static bool is_sock(int fd) {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+channel_status_t chn_fd_uring_attach(channel_fd_t *chn_fd) {
+    chn_fd_uring_t *uring = chn_fd->cfg.uring;
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    io->read_is_sock = is_sock(chn_fd->read_fd);
+    io->write_is_sock = is_sock(chn_fd->write_fd);
+
+    pthread_mutex_lock(&(uring->mut));
+
+    arm_recv(uring, chn_fd);
+    flush(uring);
+
+    pthread_mutex_unlock(&(uring->mut));
+
+    return CHN_SUCCESS;
+}
+
+void chn_fd_uring_detach(channel_fd_t *chn_fd) {
+    chn_fd_uring_t *uring = chn_fd->cfg.uring;
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    pthread_mutex_lock(&(uring->mut));
+
+    io->closing = true;
+
+    if (io->recv_inflight) {
+        struct io_uring_sqe *sqe = uring_sqe(uring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = op_data(chn_fd, CHN_FD_URING_OP_RECV);
+        sqe->user_data = CHN_FD_URING_OP_CANCEL;
+    }
+
+    // Queued sends are still delivered, like a regular fd channel, whose sends have all
+    // been written by the time it can be deleted. However, a peer which stopped reading
+    // can't hold up the delete forever.
+    uint64_t deadline = sys_now_ns() + CHN_FD_URING_CLOSE_TIMEOUT_NS;
+
+    flush(uring);
+
+    while (io->recv_inflight || io->send_inflight) {
+        if (io->send_inflight && !io->send_cancelled && sys_now_ns() >= deadline) {
+            struct io_uring_sqe *sqe = uring_sqe(uring);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = op_data(chn_fd, CHN_FD_URING_OP_SEND);
+            sqe->user_data = CHN_FD_URING_OP_CANCEL;
+
+            io->send_cancelled = true;
+            flush(uring);
+
+            continue;
+        }
+
+        uring_wait(uring);
+    }
+
+    pthread_mutex_unlock(&(uring->mut));
+
+    if (io->send_buf) {
+        safe_free(io->send_buf);
+    }
+
+    if (io->pend_buf) {
+        safe_free(io->pend_buf);
+    }
+}
+
+channel_status_t chn_fd_uring_send(channel_fd_t *chn_fd, const void *msg, size_t len) {
+    chn_fd_uring_t *uring = chn_fd->cfg.uring;
+    chn_fd_uring_io_t *io = &(chn_fd->uring_io);
+
+    channel_status_t status = CHN_SUCCESS;
+    size_t write_size = CHN_FD_MSG_SIZE(len);
+
+    pthread_mutex_lock(&(uring->mut));
+
+    if (chn_fd->write_fd < 0 || io->write_failed) {
+        status = CHN_CANNOT_WRITE;
+        goto end;
+    }
+
+    // Backpressure, wait for the in flight send to make room.
+    while (io->send_inflight && !io->write_failed &&
+            io->pend_len + write_size > uring->cfg.max_pending_send) {
+        uring_wait(uring);
+    }
+
+    if (io->write_failed) {
+        status = CHN_CANNOT_WRITE;
+        goto end;
+    }
+
+    if (io->pend_len + write_size > io->pend_cap) {
+        size_t new_cap = io->pend_cap ? io->pend_cap : write_size;
+        while (new_cap < io->pend_len + write_size) {
+            new_cap *= 2;
+        }
+
+        io->pend_buf = io->pend_buf
+            ? (uint8_t *)safe_realloc(io->pend_buf, new_cap)
+            : (uint8_t *)safe_malloc(new_cap);
+        io->pend_cap = new_cap;
+    }
+
+    uint8_t *frame = io->pend_buf + io->pend_len;
+    uint32_t len32 = (uint32_t)len;
+
+    frame[0] = CHN_FD_START_MAGIC;
+    memcpy(frame + sizeof(uint8_t), &len32, sizeof(uint32_t));
+    memcpy(frame + sizeof(uint8_t) + sizeof(uint32_t), msg, len);
+    frame[sizeof(uint8_t) + sizeof(uint32_t) + len] = CHN_FD_END_MAGIC;
+
+    io->pend_len += write_size;
+
+    if (!io->send_inflight) {
+        start_send(uring, chn_fd);
+    }
+
+    flush(uring);
+
+end:
+    pthread_mutex_unlock(&(uring->mut));
+    return status;
+}
+
+channel_status_t chn_fd_uring_refresh(channel_fd_t *chn_fd) {
+    chn_fd_uring_t *uring = chn_fd->cfg.uring;
+
+    pthread_mutex_lock(&(uring->mut));
+    flush(uring);
+    pthread_mutex_unlock(&(uring->mut));
+
+    return CHN_SUCCESS;
+}
@@ -0,0 +1,273 @@
+
+// Needed for accept4.
+#define _GNU_SOURCE
+
+#define CHSYS_LOG_MODULE "chrpc"
+
+#include "chrpc/rpc_acceptor.h"
+
+#include "chrpc/channel.h"
+#include "chrpc/channel_fd.h"
+#include "chrpc/rpc_server.h"
+#include "chsys/event.h"
+#include "chsys/log.h"
+#include "chsys/mem.h"
+#include "chsys/sock.h"
+#include "chsys/wrappers.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void chrpc_acceptor_drain(chrpc_acceptor_thread_t *t);
+
+static void chrpc_acceptor_retry_cb(sys_event_loop_t *loop, sys_event_source_t *src,
+        uint32_t events, void *arg) {
+    (void)events;
+
+    chrpc_acceptor_thread_t *t = (chrpc_acceptor_thread_t *)arg;
+
+    sys_event_remove(loop, src);
+    t->retry = NULL;
+
+    chrpc_acceptor_drain(t);
+}
+
+// Gives the first n channels of the batch to the server.
+// Whatever the server doesn't take is deleted.
+static void chrpc_acceptor_give_batch(chrpc_acceptor_thread_t *t, size_t n) {
+    chrpc_acceptor_t *acc = t->acc;
+
+    size_t given;
+    chrpc_status_t status = chrpc_server_give_channels(acc->server, t->batch, n, &given);
+
+    atomic_fetch_add(&(acc->num_accepted), given);
+
+    if (status != CHRPC_SUCCESS) {
+        log_warn_rl(1, 5, "Server refused %zu connections (status %u)", n - given, status);
+
+        for (size_t i = given; i < n; i++) {
+            delete_channel(t->batch[i]);
+        }
+
+        atomic_fetch_add(&(acc->num_rejected), n - given);
+    }
+}
+
+// The listening socket is edge-triggered, so we must accept until the backlog is empty.
+static void chrpc_acceptor_drain(chrpc_acceptor_thread_t *t) {
+    chrpc_acceptor_t *acc = t->acc;
+
+    // Accepting is paused, the retry timer will pick up where we left off.
+    if (t->retry) {
+        return;
+    }
+
+    bool empty = false;
+
+    while (!empty) {
+        size_t n = 0;
+
+        while (n < acc->attrs.batch_size) {
+            int fd = accept4(t->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) {
+                // The client gave up before we got to it.
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    empty = true;
+                    break;
+                }
+
+                // Connections will stay in the backlog until we have room for them.
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    log_warn_rl(1, 5, "Out of resources accepting connections, pausing");
+
+                    t->retry = sys_event_add_timer(t->loop, CHRPC_ACCEPTOR_RETRY_NS, 0,
+                            chrpc_acceptor_retry_cb, t);
+                    if (!(t->retry)) {
+                        log_fatal("Failed to create acceptor retry timer");
+                    }
+
+                    empty = true;
+                    break;
+                }
+
+                // Only a bad listening socket is our fault.
+                if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK) {
+                    log_fatal("Error accepting connection (%s)", strerror(errno));
+                }
+
+                // Linux passes the new connection's pending network errors through accept.
+                // (EPROTO, EPERM, ENETDOWN, EHOSTUNREACH, ETIMEDOUT, ...)
+                // That connection is gone, but the next may be fine.
+                log_warn_rl(1, 5, "Error accepting connection (%s)", strerror(errno));
+                continue;
+            }
+
+            channel_fd_config_t cfg = acc->attrs.chn_cfg;
+            cfg.write_fd = fd;
+            cfg.read_fd = -1;
+
+            // On failure, the channel constructor closes fd.
+            channel_t *chn;
+            if (new_channel(CHANNEL_FD_IMPL, &chn, &cfg) != CHN_SUCCESS) {
+                atomic_fetch_add(&(acc->num_rejected), 1);
+                continue;
+            }
+
+            t->batch[n++] = chn;
+        }
+
+        if (n > 0) {
+            chrpc_acceptor_give_batch(t, n);
+        }
+    }
+}
+
+static void chrpc_acceptor_accept_cb(sys_event_loop_t *loop, sys_event_source_t *src,
+        uint32_t events, void *arg) {
+    (void)loop;
+    (void)src;
+    (void)events;
+
+    chrpc_acceptor_drain((chrpc_acceptor_thread_t *)arg);
+}
+
+static void *chrpc_acceptor_routine(void *arg) {
+    chrpc_acceptor_thread_t *t = (chrpc_acceptor_thread_t *)arg;
+
+    // Connections may have arrived before the loop started.
+    chrpc_acceptor_drain(t);
+    sys_event_loop_run(t->loop);
+
+    return NULL;
+}
+
+chrpc_status_t new_chrpc_acceptor_from_fds(chrpc_acceptor_t **acc, chrpc_server_t *server,
+        const int *listen_fds, size_t num_fds, const chrpc_acceptor_attrs_t *attrs) {
+    const channel_fd_config_t *chn_cfg = &(attrs->chn_cfg);
+
+    bool valid = acc && server && num_fds > 0 &&
+        chn_cfg->queue_depth > 0 && chn_cfg->read_chunk_size > 0 &&
+        chn_cfg->max_msg_size >= CHRPC_SERVER_BUF_MIN_SIZE &&
+        chn_cfg->max_msg_size <= server->attrs.max_msg_size;
+
+    for (size_t i = 0; valid && i < num_fds; i++) {
+        if (listen_fds[i] < 0 || sock_set_nonblocking(listen_fds[i], true)) {
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        for (size_t i = 0; i < num_fds; i++) {
+            if (listen_fds[i] >= 0) {
+                close(listen_fds[i]);
+            }
+        }
+
+        return CHRPC_SERVER_CREATION_ERROR;
+    }
+
+    chrpc_acceptor_t *a = (chrpc_acceptor_t *)safe_malloc(sizeof(chrpc_acceptor_t));
+
+    a->attrs = *attrs;
+    if (a->attrs.batch_size == 0) {
+        a->attrs.batch_size = CHRPC_ACCEPTOR_DEFAULT_BATCH_SIZE;
+    }
+
+    a->server = server;
+    atomic_init(&(a->num_accepted), 0);
+    atomic_init(&(a->num_rejected), 0);
+
+    a->num_threads = num_fds;
+    a->threads = (chrpc_acceptor_thread_t *)safe_malloc(sizeof(chrpc_acceptor_thread_t) * num_fds);
+
+    for (size_t i = 0; i < num_fds; i++) {
+        chrpc_acceptor_thread_t *t = &(a->threads[i]);
+
+        t->acc = a;
+        t->listen_fd = listen_fds[i];
+        t->retry = NULL;
+        t->batch = (channel_t **)safe_malloc(sizeof(channel_t *) * a->attrs.batch_size);
+
+        // A single listening socket never produces more than one event per wait.
+        t->loop = new_sys_event_loop(4);
+
+        if (!sys_event_add_fd(t->loop, t->listen_fd, SYS_EV_READ, chrpc_acceptor_accept_cb, t)) {
+            log_fatal("Failed to watch listening socket");
+        }
+    }
+
+    // Only start threads once every loop is set up.
+    for (size_t i = 0; i < num_fds; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "chrpc-a%zu", i);
+
+        sys_thread_placement_t placement = SYS_THREAD_PLACEMENT_DEFAULT;
+        placement.name = name;
+
+        safe_pthread_create_placed(&(a->threads[i].id), &placement, chrpc_acceptor_routine, &(a->threads[i]));
+    }
+
+    *acc = a;
+    return CHRPC_SUCCESS;
+}
+
+chrpc_status_t new_chrpc_acceptor(chrpc_acceptor_t **acc, chrpc_server_t *server, int port,
+        const chrpc_acceptor_attrs_t *attrs) {
+    if (attrs->num_threads == 0) {
+        return CHRPC_SERVER_CREATION_ERROR;
+    }
+
+    sock_opts_t opts = attrs->sock_opts;
+    opts.nonblocking = true;
+    if (attrs->num_threads > 1) {
+        opts.reuse_port = true;
+    }
+
+    int *fds = (int *)safe_malloc(sizeof(int) * attrs->num_threads);
+
+    for (size_t i = 0; i < attrs->num_threads; i++) {
+        fds[i] = create_server_opts(port, &opts);
+
+        if (fds[i] < 0) {
+            for (size_t j = 0; j < i; j++) {
+                close(fds[j]);
+            }
+            safe_free(fds);
+
+            return CHRPC_SERVER_CREATION_ERROR;
+        }
+    }
+
+    chrpc_status_t status = new_chrpc_acceptor_from_fds(acc, server, fds, attrs->num_threads, attrs);
+    safe_free(fds);
+
+    return status;
+}
+
+void delete_chrpc_acceptor(chrpc_acceptor_t *acc) {
+    for (size_t i = 0; i < acc->num_threads; i++) {
+        sys_event_loop_stop(acc->threads[i].loop);
+    }
+
+    for (size_t i = 0; i < acc->num_threads; i++) {
+        chrpc_acceptor_thread_t *t = &(acc->threads[i]);
+
+        safe_pthread_join(t->id, NULL);
+
+        // Closes the retry timer, if there is one.
+        delete_sys_event_loop(t->loop);
+        close(t->listen_fd);
+        safe_free(t->batch);
+    }
+
+    safe_free(acc->threads);
+    safe_free(acc);
+}
@@ -8,6 +8,7 @@
 #include "chrpc/serial_type.h"
 #include "chrpc/serial_value.h"
 #include "chsys/mem.h"
+#include "chsys/time.h"
 #include "chsys/wrappers.h"
 #include "chutil/list.h"
 #include "chutil/map.h"
@@ -149,9 +150,9 @@ chrpc_status_t chrpc_client_send_request(chrpc_client_t *client, const char *nam
 
     size_t readden;
     bool message_received = false;
-    useconds_t time_waited = 0;
+    const sys_deadline_t deadline = sys_deadline_in_us(client->attrs.timeout);
 
-    while (time_waited < client->attrs.timeout) {
+    while (true) {
         // Before every sleep we refresh and poll the channel.
         chn_status = chn_refresh(client->chn);
         if (chn_status != CHN_SUCCESS) {
@@ -170,8 +171,14 @@ chrpc_status_t chrpc_client_send_request(chrpc_client_t *client, const char *nam
             break;
         }
 
-        usleep(client->attrs.cadence);
-        time_waited += client->attrs.cadence;
+        uint64_t remaining = sys_deadline_remaining_ns(deadline);
+        if (remaining == 0) {
+            break;
+        }
+
+        // Don't oversleep the deadline.
+        uint64_t cadence = (uint64_t)client->attrs.cadence * SYS_NS_PER_US;
+        sys_sleep_ns(cadence < remaining ? cadence : remaining);
     }
 
     // No message was received :,(
@@ -1,4 +1,6 @@
 
+#define CHSYS_LOG_MODULE "chrpc"
+
 #include "chrpc/rpc_server.h"
 
 #include "chrpc/channel.h"
@@ -6,7 +8,9 @@
 #include "chrpc/serial_helpers.h"
 #include "chrpc/serial_type.h"
 #include "chrpc/serial_value.h"
+#include "chsys/arena.h"
 #include "chsys/mem.h"
+#include "chsys/time.h"
 #include "chsys/wrappers.h"
 #include "chutil/list.h"
 #include "chutil/map.h"
@@ -101,12 +105,10 @@ chrpc_endpoint_set_t *new_chrpc_endpoint_set(chrpc_endpoint_t **eps, size_t num_
         chrpc_endpoint_t *ep = eps[i];
 
         // Two endpoints with same name NOT ALLOWED.
-        if (hm_contains(hm, &(ep->name))) {
+        if (!hm_upsert(hm, &(ep->name), &ep)) {
             delete_hash_map(hm);
             return NULL;
         }
-
-        hm_put(hm, &(ep->name), &ep);
     }
 
     chrpc_endpoint_set_t *ep_set = 
@@ -230,7 +232,8 @@ static chrpc_status_t chrpc_send_response(const chrpc_endpoint_t *ep, chrpc_valu
             delete_chrpc_value(ret_val);
         }         
 
-        log_warn("%s returned a value of the incorrect type");
+        // A misbehaving endpoint could hit this on every request.
+        log_warn_rl(1, 5, "%s returned a value of the incorrect type", s_get_cstr(ep->name));
 
         return CHRPC_SERVER_INTERNAL_ERROR;
     }
@@ -326,7 +329,10 @@ static chrpc_status_t chrpc_handle_request(chrpc_value_t *req, chrpc_queue_ele_t
     }
 
     chrpc_status_t status = CHRPC_SUCCESS;
-    chrpc_value_t **given_args = (chrpc_value_t **)safe_malloc(sizeof(chrpc_value_t *) * ep->num_args);
+
+    // The args array only lives for the duration of this request, so it comes from
+    // the worker's scratch arena. (Reset by the worker after every request)
+    chrpc_value_t **given_args = (chrpc_value_t **)scratch_alloc(sizeof(chrpc_value_t *) * ep->num_args);
 
     uint8_t parsed_values = 0;
 
@@ -371,7 +377,6 @@ static chrpc_status_t chrpc_handle_request(chrpc_value_t *req, chrpc_queue_ele_t
     for (uint8_t i = 0; i < parsed_values; i++) {
         delete_chrpc_value(given_args[i]); 
     }
-    safe_free(given_args);
     
     return status;
 }
@@ -424,7 +429,12 @@ static void *chrpc_server_worker_routine(void *arg) {
     // This buffer will be populated when receiving messages,
     // then written over when serializing the response.
     // (I don't think I really need 2 buffers for this)
-    uint8_t *buf = (uint8_t *)safe_malloc(server->attrs.max_msg_size);
+    //
+    // When placed, the buffer is touched here so that it is local to this worker.
+    const bool placed = server->attrs.pin_workers || server->attrs.use_numa_node;
+    uint8_t *buf = (uint8_t *)(placed 
+            ? safe_malloc_large_prefault(server->attrs.max_msg_size)
+            : safe_malloc_large(server->attrs.max_msg_size));
 
     while (true) {
 
@@ -434,7 +444,7 @@ static void *chrpc_server_worker_routine(void *arg) {
         safe_pthread_mutex_unlock(&(server->should_exit_mut));
 
         if (should_exit) {
-            safe_free(buf);
+            safe_free_large(buf);
             return NULL;
         }
 
@@ -448,7 +458,7 @@ static void *chrpc_server_worker_routine(void *arg) {
         safe_pthread_mutex_unlock(&(server->q_mut));
 
         if (e) {
-            usleep(server->attrs.worker_usleep_amt);
+            sys_sleep_us(server->attrs.worker_usleep_amt);
             continue;
         } 
 
@@ -463,23 +473,27 @@ static void *chrpc_server_worker_routine(void *arg) {
         // sent back to the client, this field will be SUCCESS.
         chrpc_status_t status = chrpc_poll_channel(&ele, server, buf);
 
+        // Request boundary, everything allocated from the scratch arena
+        // while handling the request can be released at once.
+        sys_scratch_reset();
+
         // Whether or not we should disconnect the channel at the end.
         bool disconnect = false;
 
         // Whether or not the worker should wait a bit before looking for more work.
         bool pause = false;
 
-        time_t now = time(NULL);
+        uint64_t now = sys_now_ns();
         
         if (status == CHRPC_CLIENT_CHANNEL_EMTPY) {
             if (server->attrs.idle_timeout > 0 && 
-                    (now - ele.since_last_req) > server->attrs.idle_timeout) {
+                    (now - ele.last_req_ns) > (uint64_t)server->attrs.idle_timeout * SYS_NS_PER_S) {
                 disconnect = true;
             } 
 
             pause = true;
         } else if (status == CHRPC_SUCCESS) {
-            ele.since_last_req = now;
+            ele.last_req_ns = now;
         } else {
             // An error or requested disconnect. (No pause in this case)
             disconnect = true; 
@@ -502,7 +516,7 @@ static void *chrpc_server_worker_routine(void *arg) {
         }
 
         if (pause) {
-            usleep(server->attrs.worker_usleep_amt);
+            sys_sleep_us(server->attrs.worker_usleep_amt);
         }
     }
 
@@ -549,9 +563,57 @@ chrpc_status_t new_chrpc_server(chrpc_server_t **server, void *ss, const chrpc_s
     );
 
     // Finally, spawn workers....
+    size_t num_cpus = 0;
+    int *cpus = NULL;
+
+    // The node may have no CPUs this process is allowed to use. (Or may not exist)
+    bool use_numa_node = s->attrs.use_numa_node;
+    if (use_numa_node && sys_numa_node_cpus(s->attrs.numa_node, NULL, 0) == 0) {
+        log_warn("NUMA node %d has no usable CPUs, workers won't be placed on it", s->attrs.numa_node);
+        use_numa_node = false;
+    }
+
+    if (s->attrs.pin_workers) {
+        num_cpus = use_numa_node 
+            ? sys_numa_node_cpus(s->attrs.numa_node, NULL, 0)
+            : sys_allowed_cpus(NULL, 0);
+
+        if (num_cpus > 0) {
+            cpus = (int *)safe_malloc(sizeof(int) * num_cpus);
+            size_t written = use_numa_node 
+                ? sys_numa_node_cpus(s->attrs.numa_node, cpus, num_cpus)
+                : sys_allowed_cpus(cpus, num_cpus);
+
+            // The affinity may have changed in between.
+            if (written < num_cpus) {
+                num_cpus = written;
+            }
+        }
+    }
+
     size_t i;
     for (i = 0; i < s->attrs.num_workers; i++) {
-        safe_pthread_create(&(s->worker_ids[i]), NULL, chrpc_server_worker_routine, (void *)s);
+        // Thread names are truncated to 15 characters anyway.
+        char name[32];
+        snprintf(name, sizeof(name), "chrpc-w%zu", i);
+
+        sys_thread_placement_t placement = SYS_THREAD_PLACEMENT_DEFAULT;
+        placement.name = name;
+
+        if (use_numa_node) {
+            placement.numa_node = s->attrs.numa_node;
+        }
+
+        if (num_cpus > 0) {
+            placement.cpus = &(cpus[i % num_cpus]);
+            placement.num_cpus = 1;
+        }
+
+        safe_pthread_create_placed(&(s->worker_ids[i]), &placement, chrpc_server_worker_routine, (void *)s);
+    }
+
+    if (cpus) {
+        safe_free(cpus);
     }
 
     *server = s;
@@ -593,43 +655,68 @@ void delete_chrpc_server(chrpc_server_t *server) {
 }
 
 chrpc_status_t chrpc_server_give_channel(chrpc_server_t *server, channel_t *chn) {
-    if (!chn) {
-        return CHRPC_ARGUMENT_MISMATCH;
-    }
+    size_t given;
+    return chrpc_server_give_channels(server, &chn, 1, &given);
+}
 
-    size_t mms;
-    chrpc_status_t status = chn_max_msg_size(chn, &mms);
+chrpc_status_t chrpc_server_give_channels(chrpc_server_t *server, channel_t **chns, size_t num, size_t *given) {
+    *given = 0;
 
-    if (status != CHRPC_SUCCESS || mms < CHRPC_SERVER_BUF_MIN_SIZE || server->attrs.max_msg_size < mms) {
-        return CHRPC_BUFFER_TOO_SMALL;
+    // First, find the longest prefix of valid channels.
+    // (This is done outside of the lock)
+    chrpc_status_t status = CHRPC_SUCCESS;
+    size_t valid;
+
+    for (valid = 0; valid < num; valid++) {
+        if (!(chns[valid])) {
+            status = CHRPC_ARGUMENT_MISMATCH;
+            break;
+        }
+
+        size_t mms;
+        chrpc_status_t mms_status = chn_max_msg_size(chns[valid], &mms);
+
+        if (mms_status != CHRPC_SUCCESS || mms < CHRPC_SERVER_BUF_MIN_SIZE || server->attrs.max_msg_size < mms) {
+            status = CHRPC_BUFFER_TOO_SMALL;
+            break;
+        }
+    }
+
+    if (valid == 0) {
+        return status;
     }
 
-    int ret_val;
+    uint64_t now_ns = sys_now_ns();
 
     safe_pthread_mutex_lock(&(server->q_mut));
 
-    if (server->num_channels == q_cap(server->q)) {
-        ret_val = CHRPC_SERVER_FULL;
-        goto end;
-    } 
+    size_t room = q_cap(server->q) - server->num_channels;
 
-    if (server->id_counter == UINT64_MAX) {
-        ret_val = CHRPC_SERVER_FULL;
-        goto end;
+    // IDs are never reused, so there must be one left for each channel.
+    if ((uint64_t)(UINT64_MAX - server->id_counter) < room) {
+        room = (size_t)(UINT64_MAX - server->id_counter);
     }
 
-    chrpc_queue_ele_t ele = {
-        .chn = chn,
-        .id = server->id_counter++,
-        .since_last_req = time(NULL)
-    };
+    if (room < valid) {
+        valid = room;
+        status = CHRPC_SERVER_FULL;
+    }
 
-    q_push(server->q, &ele);
-    server->num_channels++; 
-    ret_val = CHRPC_SUCCESS;
+    for (size_t i = 0; i < valid; i++) {
+        chrpc_queue_ele_t ele = {
+            .chn = chns[i],
+            .id = server->id_counter++,
+            .last_req_ns = now_ns
+        };
+
+        q_push(server->q, &ele);
+    }
+
+    server->num_channels += valid;
 
-end:
     safe_pthread_mutex_unlock(&(server->q_mut));
 
-    return ret_val;
+    *given = valid;
+
+    return status;
 }
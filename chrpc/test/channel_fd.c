@@ -5,7 +5,12 @@
 #include "chrpc/channel_helpers.h"
 #include "channel.h"
 #include "unity/unity.h"
+#include "chsys/event.h"
+#include "chsys/sock.h"
+#include "chsys/time.h"
+#include "chsys/wrappers.h"
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 static void new_channel_fd_pipe(channel_t **a2b, channel_t **b2a) {
@@ -320,6 +325,383 @@ static void test_channel_fd_no_writeover(void) {
     delete_channel(chn);
 }
 
+static void channel_fd_refresh_cb(sys_event_loop_t *loop, sys_event_source_t *src,
+        uint32_t events, void *arg) {
+    (void)loop;
+    (void)src;
+
+    TEST_ASSERT_TRUE(events & SYS_EV_READ);
+    TEST_ASSERT_TRUE(CHN_SUCCESS == chn_refresh((channel_t *)arg));
+}
+
+static void test_channel_fd_event_loop(void) {
+    int pipe_fds[2]; // Remeber, read then write.
+    TEST_ASSERT_EQUAL_INT(0, pipe(pipe_fds));
+
+    int read_fd = pipe_fds[0];
+    int write_fd = pipe_fds[1];
+
+    channel_fd_config_t chn_cfg = {
+        .max_msg_size = 0x10,
+        .read_chunk_size = 0x20,
+
+        .queue_depth = 2,
+        .write_over = false,
+        
+        .write_fd = write_fd, 
+        .read_fd = read_fd,
+    };
+
+    channel_t *chn;
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, &chn, &chn_cfg));
+
+    int chn_read_fd = chn_fd_read_fd((channel_fd_t *)(chn->channel));
+    TEST_ASSERT_EQUAL_INT(read_fd, chn_read_fd);
+
+    sys_event_loop_t *loop = new_sys_event_loop(0);
+    sys_event_source_t *src = sys_event_add_fd(loop, chn_read_fd, SYS_EV_READ,
+            channel_fd_refresh_cb, chn);
+    TEST_ASSERT_NOT_NULL(src);
+
+    // Nothing to read yet.
+    TEST_ASSERT_EQUAL_INT(0, sys_event_loop_run_once(loop, 0));
+
+    uint8_t send_buf[] = {
+        CHN_FD_START_MAGIC,
+        2, 0, 0, 0,
+        2, 3,
+        CHN_FD_END_MAGIC
+    };
+    int send_buf_size = sizeof(send_buf) / sizeof(uint8_t);
+    TEST_ASSERT_EQUAL_INT(send_buf_size, write(write_fd, send_buf, send_buf_size));
+
+    // The callback refreshes the channel, so the message should be waiting after.
+    TEST_ASSERT_EQUAL_INT(1, sys_event_loop_run_once(loop, 1000));
+
+    uint8_t recv_buf[0x10];
+    size_t len;
+    TEST_ASSERT_TRUE(CHN_SUCCESS == chn_receive(chn, recv_buf, sizeof(recv_buf), &len));
+    TEST_ASSERT_EQUAL_size_t(2, len);
+    TEST_ASSERT_EQUAL_UINT8(3, recv_buf[1]);
+
+    // Edge-triggered, with the pipe drained there should be nothing new.
+    TEST_ASSERT_EQUAL_INT(0, sys_event_loop_run_once(loop, 0));
+
+    sys_event_remove(loop, src);
+    delete_sys_event_loop(loop);
+
+    delete_channel(chn);
+}
+
+static chn_fd_uring_t *new_test_chn_fd_uring(void) {
+    chn_fd_uring_config_t cfg = CHN_FD_URING_DEFAULT_CFG;
+    cfg.entries = 32;
+    cfg.num_bufs = 16;
+    cfg.buf_size = 0x80;
+
+    return new_chn_fd_uring(&cfg);
+}
+
+static void test_channel_fd_uring_bytewise(void) {
+    chn_fd_uring_t *uring = new_test_chn_fd_uring();
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    int pipe_fds[2]; // Remeber, read then write.
+    TEST_ASSERT_EQUAL_INT(0, pipe(pipe_fds));
+
+    int read_fd = pipe_fds[0];
+    int write_fd = pipe_fds[1];
+
+    channel_fd_config_t chn_cfg = {
+        .max_msg_size = 0x20,
+        .read_chunk_size = 0x20,
+
+        .queue_depth = 2,
+        .write_over = true,
+        
+        .write_fd = write_fd, 
+        .read_fd = read_fd,
+
+        .uring = uring
+    };
+
+    channel_t *chn;
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, &chn, &chn_cfg));
+
+    test_channel_fd_bytewise(chn, write_fd);
+
+    delete_channel(chn);
+    delete_chn_fd_uring(uring);
+}
+
+// Both ends of a socketpair, driven by the same uring.
+static void new_channel_fd_uring_socketpair(chn_fd_uring_t *uring, size_t queue_depth,
+        channel_t **a2b, channel_t **b2a) {
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, create_socketpair(SOCK_STREAM, NULL, fds));
+
+    channel_fd_config_t a2b_cfg = {
+        .max_msg_size = 0x100,
+        .read_chunk_size = 0x80,
+        .queue_depth = queue_depth,
+        .write_over = false,
+        
+        .read_fd = -1,
+        .write_fd = fds[0],
+
+        .uring = uring
+    };
+
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, a2b, &a2b_cfg));
+
+    channel_fd_config_t b2a_cfg = a2b_cfg;
+    b2a_cfg.write_fd = fds[1];
+
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, b2a, &b2a_cfg));
+}
+
+static void test_channel_fd_uring_echo(void) {
+    chn_fd_uring_t *uring = new_test_chn_fd_uring();
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    channel_t *a2b;
+    channel_t *b2a;
+    new_channel_fd_uring_socketpair(uring, 1, &a2b, &b2a);
+
+    channel_echo_thread_t *et = new_channel_echo_thread(b2a);
+    TEST_ASSERT_NOT_NULL(et);
+
+    test_chn_echo(a2b, 5);
+    test_chn_stressful_echo(a2b, 5);
+
+    TEST_ASSERT_EQUAL_INT(CHN_SUCCESS, 
+            delete_channel_echo_thread(et));
+
+    delete_channel(a2b);
+    delete_channel(b2a);
+    delete_chn_fd_uring(uring);
+}
+
+static void test_channel_fd_uring_coalesced_sends(void) {
+    chn_fd_uring_t *uring = new_test_chn_fd_uring();
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    const uint8_t num_msgs = 50;
+
+    // The receiving queue holds every message, so none are dropped.
+    channel_t *a2b;
+    channel_t *b2a;
+    new_channel_fd_uring_socketpair(uring, num_msgs, &a2b, &b2a);
+
+    // Many sends back to back, with no refreshes in between.
+    // Messages queued behind an in flight send go out together, in order.
+    for (uint8_t i = 0; i < num_msgs; i++) {
+        uint8_t msg[3] = {i, i, i};
+        TEST_ASSERT_TRUE(CHN_SUCCESS == chn_send(a2b, msg, sizeof(msg)));
+    }
+
+    uint8_t expected = 0;
+    for (uint32_t tries = 0; expected < num_msgs && tries < 1000; tries++) {
+        TEST_ASSERT_TRUE(CHN_SUCCESS == chn_refresh(b2a));
+
+        uint8_t buf[0x10];
+        size_t len;
+        while (chn_receive(b2a, buf, sizeof(buf), &len) == CHN_SUCCESS) {
+            TEST_ASSERT_EQUAL_size_t(3, len);
+            TEST_ASSERT_EQUAL_UINT8(expected, buf[0]);
+            TEST_ASSERT_EQUAL_UINT8(expected, buf[2]);
+            expected++;
+        }
+
+        if (expected < num_msgs) {
+            sys_sleep_us(1000);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_UINT8(num_msgs, expected);
+
+    delete_channel(a2b);
+    delete_channel(b2a);
+    delete_chn_fd_uring(uring);
+}
+
+static void test_channel_fd_uring_eof(void) {
+    chn_fd_uring_t *uring = new_test_chn_fd_uring();
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, create_socketpair(SOCK_STREAM, NULL, fds));
+
+    channel_fd_config_t cfg = {
+        .max_msg_size = 0x100,
+        .read_chunk_size = 0x80,
+        .queue_depth = 1,
+        .write_over = false,
+        
+        .read_fd = -1,
+        .write_fd = fds[0],
+
+        .uring = uring
+    };
+
+    channel_t *chn;
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, &chn, &cfg));
+
+    close(fds[1]);
+
+    channel_fd_t *chn_fd = (channel_fd_t *)(chn->channel);
+    for (uint32_t tries = 0; chn_fd_read_fd(chn_fd) >= 0 && tries < 100; tries++) {
+        TEST_ASSERT_TRUE(CHN_SUCCESS == chn_refresh(chn));
+        sys_sleep_us(1000);
+    }
+
+    TEST_ASSERT_EQUAL_INT(-1, chn_fd_read_fd(chn_fd));
+
+    delete_channel(chn);
+    delete_chn_fd_uring(uring);
+}
+
+// A channel whose peer never reads. (The peer's fd is left in peer_fd)
+static channel_t *new_channel_fd_uring_stalled(chn_fd_uring_t *uring, int *peer_fd) {
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, create_socketpair(SOCK_STREAM, NULL, fds));
+
+    channel_fd_config_t cfg = {
+        .max_msg_size = 0x100,
+        .read_chunk_size = 0x80,
+        .queue_depth = 1,
+        .write_over = false,
+        
+        .read_fd = -1,
+        .write_fd = fds[0],
+
+        .uring = uring
+    };
+
+    channel_t *chn;
+    TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel(CHANNEL_FD_IMPL, &chn, &cfg));
+
+    *peer_fd = fds[1];
+    return chn;
+}
+
+typedef struct _stalled_sender_arg_t {
+    channel_t *chn;
+    channel_status_t status;
+} stalled_sender_arg_t;
+
+static void *stalled_sender_routine(void *arg) {
+    stalled_sender_arg_t *sa = (stalled_sender_arg_t *)arg;
+
+    uint8_t msg[0x100];
+    memset(msg, 0xAB, sizeof(msg));
+
+    // Blocks once the socket and pending buffer are full, until the peer goes away.
+    while ((sa->status = chn_send(sa->chn, msg, sizeof(msg))) == CHN_SUCCESS);
+
+    return NULL;
+}
+
+static void test_channel_fd_uring_stalled_peer(void) {
+    chn_fd_uring_config_t cfg = CHN_FD_URING_DEFAULT_CFG;
+    cfg.entries = 32;
+    cfg.num_bufs = 16;
+    cfg.buf_size = 0x80;
+    cfg.max_pending_send = 0x1000;
+
+    chn_fd_uring_t *uring = new_chn_fd_uring(&cfg);
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    int peer_fd;
+    stalled_sender_arg_t sa = {
+        .chn = new_channel_fd_uring_stalled(uring, &peer_fd),
+        .status = CHN_SUCCESS
+    };
+
+    pthread_t sender;
+    safe_pthread_create(&sender, NULL, stalled_sender_routine, &sa);
+
+    // Give the sender time to fill up and block.
+    sys_sleep_ms(50);
+
+    // Other channels of the uring keep working meanwhile.
+    channel_t *a2b;
+    channel_t *b2a;
+    new_channel_fd_uring_socketpair(uring, 1, &a2b, &b2a);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        uint8_t msg[3] = {i, i, i};
+        TEST_ASSERT_TRUE(CHN_SUCCESS == chn_send(a2b, msg, sizeof(msg)));
+
+        uint8_t buf[0x10];
+        size_t len;
+        channel_status_t status = CHN_NO_INCOMING_MSG;
+
+        for (uint32_t tries = 0; status == CHN_NO_INCOMING_MSG && tries < 1000; tries++) {
+            TEST_ASSERT_TRUE(CHN_SUCCESS == chn_refresh(b2a));
+            status = chn_receive(b2a, buf, sizeof(buf), &len);
+
+            if (status == CHN_NO_INCOMING_MSG) {
+                sys_sleep_us(1000);
+            }
+        }
+
+        TEST_ASSERT_TRUE(CHN_SUCCESS == status);
+        TEST_ASSERT_EQUAL_UINT8(i, buf[0]);
+    }
+
+    // The sender is still blocked, until its peer is closed.
+    TEST_ASSERT_TRUE(CHN_SUCCESS == sa.status);
+
+    close(peer_fd);
+    safe_pthread_join(sender, NULL);
+
+    TEST_ASSERT_TRUE(CHN_CANNOT_WRITE == sa.status);
+
+    delete_channel(sa.chn);
+    delete_channel(a2b);
+    delete_channel(b2a);
+    delete_chn_fd_uring(uring);
+}
+
+static void test_channel_fd_uring_stalled_delete(void) {
+    chn_fd_uring_t *uring = new_test_chn_fd_uring();
+    if (!uring) {
+        return; // Skip on systems without io_uring.
+    }
+
+    int peer_fd;
+    channel_t *chn = new_channel_fd_uring_stalled(uring, &peer_fd);
+
+    // More than the socket can buffer, but less than the pending limit.
+    uint8_t msg[0x100];
+    memset(msg, 0xAB, sizeof(msg));
+
+    for (size_t i = 0; i < 2000; i++) {
+        TEST_ASSERT_TRUE(CHN_SUCCESS == chn_send(chn, msg, sizeof(msg)));
+    }
+
+    // The peer is still open, but the delete gives up on the send.
+    uint64_t start = sys_now_ns();
+    delete_channel(chn);
+    uint64_t elapsed = sys_now_ns() - start;
+
+    TEST_ASSERT_TRUE(elapsed < 5 * CHN_FD_URING_CLOSE_TIMEOUT_NS);
+
+    close(peer_fd);
+    delete_chn_fd_uring(uring);
+}
+
 void channel_fd_tests(void) {
     RUN_TEST(test_channel_fd_echo);
     RUN_TEST(test_channel_fd_stressful_echo);
@@ -331,4 +713,13 @@ void channel_fd_tests(void) {
 
     RUN_TEST(test_channel_fd_writeover);
     RUN_TEST(test_channel_fd_no_writeover);
+
+    RUN_TEST(test_channel_fd_event_loop);
+
+    RUN_TEST(test_channel_fd_uring_bytewise);
+    RUN_TEST(test_channel_fd_uring_echo);
+    RUN_TEST(test_channel_fd_uring_coalesced_sends);
+    RUN_TEST(test_channel_fd_uring_eof);
+    RUN_TEST(test_channel_fd_uring_stalled_peer);
+    RUN_TEST(test_channel_fd_uring_stalled_delete);
 }
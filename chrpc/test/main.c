@@ -21,7 +21,7 @@ void setUp(void) {
 }
 
 void tearDown(void) {
-    TEST_ASSERT_EQUAL_size_t(0, sys_get_malloc_count());
+    TEST_ASSERT_EQUAL_size_t(0, sys_get_malloc_count_exact());
 }
 
 int main(void) {
@@ -10,12 +10,19 @@
 #include <pthread.h>
 
 #include "chrpc/channel.h"
+#include "chrpc/channel_fd.h"
+#include "chrpc/rpc_acceptor.h"
 #include "chrpc/rpc_server.h"
 #include "chrpc/rpc_client.h"
 #include "chrpc/serial_type.h"
 #include "chrpc/serial_value.h"
 
 #include "chsys/mem.h"
+#include "chsys/sock.h"
+#include "chsys/time.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 typedef struct _basic_message_t {
     uint32_t sender_id;
@@ -107,7 +114,8 @@ static chrpc_server_command_t basic_server_disconnect(channel_id_t id, basic_ser
 }
 
 #define BASIC_SERVER_MAX_CLIENTS 16
-chrpc_server_t *new_basic_server(void) {
+// When placed, workers are pinned to the CPUs of NUMA node 0.
+static chrpc_server_t *new_basic_server_p(bool placed) {
     chrpc_endpoint_set_t *eps = new_chrpc_endpoint_set_va(
         new_chrpc_endpoint_va(
             "push_msg",
@@ -149,7 +157,10 @@ chrpc_server_t *new_basic_server(void) {
         .max_msg_size = 0x1000,
         .num_workers = BASIC_SERVER_MAX_CLIENTS,
         .on_disconnect = NULL,
-        .worker_usleep_amt = 100
+        .worker_usleep_amt = 100,
+        .pin_workers = placed,
+        .use_numa_node = placed,
+        .numa_node = 0
     };
 
     chrpc_status_t status = new_chrpc_server(
@@ -161,6 +172,10 @@ chrpc_server_t *new_basic_server(void) {
     return server;
 }
 
+chrpc_server_t *new_basic_server(void) {
+    return new_basic_server_p(false);
+}
+
 static void delete_basic_server(chrpc_server_t *server) {
     basic_server_state_t *bss = (basic_server_state_t *)chrpc_server_state(server); 
     delete_chrpc_server(server); // Always delete server before the server state.
@@ -409,6 +424,20 @@ static void test_basic_server_parallel_clients(void) {
     delete_basic_server(server);
 }
 
+static void test_basic_server_placed_workers(void) {
+    chrpc_server_t *server = new_basic_server_p(true);
+    
+    pthread_t client_workers[BASIC_SERVER_MAX_CLIENTS];
+    for (size_t i = 0; i < BASIC_SERVER_MAX_CLIENTS; i++) {
+        safe_pthread_create(&(client_workers[i]), NULL, test_basic_server_parallel_clients_routine, server);
+    }
+    for (size_t i = 0; i < BASIC_SERVER_MAX_CLIENTS; i++) {
+        safe_pthread_join(client_workers[i], NULL);
+    }
+
+    delete_basic_server(server);
+}
+
 static void test_too_many_clients(void) {
     chrpc_status_t status;
     chrpc_server_t *server = new_basic_server();
@@ -489,11 +518,189 @@ static void test_small_channel(void) {
     delete_channel_local2_core(core);
 }
 
+static void test_give_channels(void) {
+    chrpc_server_t *server = new_basic_server();
+
+    // 2 more channels than the server can take.
+    const size_t num = BASIC_SERVER_MAX_CLIENTS + 2;
+
+    channel_local2_core_t *cores[BASIC_SERVER_MAX_CLIENTS + 2];
+    channel_t *a2bs[BASIC_SERVER_MAX_CLIENTS + 2];
+    channel_t *b2as[BASIC_SERVER_MAX_CLIENTS + 2];
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT_TRUE(CHN_SUCCESS == new_channel_local2_pipe(&BASIC_CHN_CFG, &(cores[i]), &(a2bs[i]), &(b2as[i])));
+    }
+
+    size_t given;
+    chrpc_status_t status = chrpc_server_give_channels(server, b2as, num, &given);
+    TEST_ASSERT_TRUE(status == CHRPC_SERVER_FULL);
+    TEST_ASSERT_EQUAL_size_t(BASIC_SERVER_MAX_CLIENTS, given);
+
+    // The server is full, nothing else can be given.
+    status = chrpc_server_give_channels(server, b2as + given, num - given, &given);
+    TEST_ASSERT_TRUE(status == CHRPC_SERVER_FULL);
+    TEST_ASSERT_EQUAL_size_t(0, given);
+
+    delete_basic_server(server);
+
+    for (size_t i = 0; i < num; i++) {
+        if (i >= BASIC_SERVER_MAX_CLIENTS) {
+            delete_channel(b2as[i]);
+        }
+
+        delete_channel(a2bs[i]);
+        delete_channel_local2_core(cores[i]);
+    }
+}
+
+#define ACCEPTOR_TEST_PATH "@chrpc-test-acceptor"
+
+static const chrpc_acceptor_attrs_t ACCEPTOR_TEST_ATTRS = {
+    .num_threads = 1,
+    .batch_size = 4,
+    .sock_opts = SOCK_OPTS_DEFAULT,
+    .chn_cfg = {
+        .queue_depth = 1,
+        .write_fd = -1,
+        .read_fd = -1,
+        .write_over = false,
+        .max_msg_size = 0x1000,
+        .read_chunk_size = 0x1000,
+        .uring = NULL
+    }
+};
+
+static chrpc_acceptor_t *new_test_acceptor(chrpc_server_t *server) {
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.backlog = 64;
+
+    int fd = create_unix_server(ACCEPTOR_TEST_PATH, SOCK_STREAM, &opts);
+    TEST_ASSERT_TRUE(fd >= 0);
+
+    chrpc_acceptor_t *acc;
+    chrpc_status_t status = new_chrpc_acceptor_from_fds(&acc, server, &fd, 1, &ACCEPTOR_TEST_ATTRS);
+    TEST_ASSERT_TRUE(status == CHRPC_SUCCESS);
+
+    return acc;
+}
+
+static channel_t *new_test_acceptor_channel(void) {
+    int fd = unix_connect(ACCEPTOR_TEST_PATH, SOCK_STREAM, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    channel_fd_config_t cfg = ACCEPTOR_TEST_ATTRS.chn_cfg;
+    cfg.write_fd = fd;
+
+    channel_t *chn;
+    if (new_channel(CHANNEL_FD_IMPL, &chn, &cfg) != CHN_SUCCESS) {
+        return NULL;
+    }
+
+    return chn;
+}
+
+// Waits up to a second for the acceptor to handle num connections.
+static void wait_for_acceptor(chrpc_acceptor_t *acc, uint64_t num) {
+    for (size_t i = 0; i < 1000; i++) {
+        if (atomic_load(&(acc->num_accepted)) + atomic_load(&(acc->num_rejected)) >= num) {
+            return;
+        }
+        sys_sleep_us(1000);
+    }
+}
+
+static void *test_acceptor_clients_routine(void *arg) {
+    (void)arg;
+
+    channel_t *chn = new_test_acceptor_channel();
+    if (!chn) {
+        return NULL;
+    }
+
+    chrpc_client_t *client;
+    chrpc_status_t status = new_chrpc_client(&client, chn, &BASIC_CLIENT_ATTRS);
+
+    if (status != CHRPC_SUCCESS) {
+        delete_channel(chn);
+        return NULL;
+    }
+
+    uint32_t iter = 0;
+    while (status == CHRPC_SUCCESS && iter < 5) {
+        uint32_t len;
+        status = basic_client_push_msg(client, &len, 1, "Hello");
+        iter++;
+    }
+
+    if (status == CHRPC_SUCCESS) {
+        chrpc_client_send_argless_request(client, "disconnect", NULL);
+    }
+
+    delete_chrpc_client(client);
+
+    return NULL;
+}
+
+static void test_acceptor_clients(void) {
+    chrpc_server_t *server = new_basic_server();
+    chrpc_acceptor_t *acc = new_test_acceptor(server);
+
+    pthread_t client_workers[BASIC_SERVER_MAX_CLIENTS];
+    for (size_t i = 0; i < BASIC_SERVER_MAX_CLIENTS; i++) {
+        safe_pthread_create(&(client_workers[i]), NULL, test_acceptor_clients_routine, NULL);
+    }
+    for (size_t i = 0; i < BASIC_SERVER_MAX_CLIENTS; i++) {
+        safe_pthread_join(client_workers[i], NULL);
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(BASIC_SERVER_MAX_CLIENTS, atomic_load(&(acc->num_accepted)));
+    TEST_ASSERT_EQUAL_UINT64(0, atomic_load(&(acc->num_rejected)));
+
+    basic_server_state_t *bss = (basic_server_state_t *)chrpc_server_state(server);
+    TEST_ASSERT_EQUAL_size_t(BASIC_SERVER_MAX_CLIENTS * 5, l_len(bss->q));
+
+    delete_chrpc_acceptor(acc);
+    delete_basic_server(server);
+}
+
+static void test_acceptor_full(void) {
+    chrpc_server_t *server = new_basic_server();
+    chrpc_acceptor_t *acc = new_test_acceptor(server);
+
+    const size_t num = BASIC_SERVER_MAX_CLIENTS + 4;
+    channel_t *chns[BASIC_SERVER_MAX_CLIENTS + 4];
+
+    for (size_t i = 0; i < num; i++) {
+        chns[i] = new_test_acceptor_channel();
+        TEST_ASSERT_NOT_NULL(chns[i]);
+    }
+
+    wait_for_acceptor(acc, num);
+
+    // Connections which didn't fit are closed.
+    TEST_ASSERT_EQUAL_UINT64(BASIC_SERVER_MAX_CLIENTS, atomic_load(&(acc->num_accepted)));
+    TEST_ASSERT_EQUAL_UINT64(4, atomic_load(&(acc->num_rejected)));
+
+    delete_chrpc_acceptor(acc);
+    delete_basic_server(server);
+
+    for (size_t i = 0; i < num; i++) {
+        delete_channel(chns[i]);
+    }
+}
+
 void chrpc_simple_rpc_tests(void) {
     RUN_TEST(test_basic_server_creation);
     RUN_TEST(test_basic_server_correct_usage);
     RUN_TEST(test_basic_server_incorrect_usage);
     RUN_TEST(test_basic_server_parallel_clients);
+    RUN_TEST(test_basic_server_placed_workers);
     RUN_TEST(test_too_many_clients);
     RUN_TEST(test_small_channel);
+    RUN_TEST(test_give_channels);
+    RUN_TEST(test_acceptor_clients);
+    RUN_TEST(test_acceptor_full);
 }
@@ -0,0 +1,80 @@
+
+#ifndef CHSYS_ARENA_H
+#define CHSYS_ARENA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// An arena is a simple bump allocator.
+// Memory is handed out from large blocks, and is never freed individually.
+// Instead, the whole arena is reset (or deleted) at once.
+//
+// Arenas are NOT threadsafe. Use one arena per thread, or use the scratch arena below.
+//
+// NOTE: Arena blocks are allocated using safe_malloc, so an arena which is never
+// deleted will show up as a memory leak.
+
+// All returned memory will be aligned to this many bytes.
+#define ARENA_ALIGNMENT 16
+
+// Used when the given block size is 0.
+#define ARENA_DEFAULT_BLOCK_SIZE 0x4000
+
+typedef struct _arena_block_t {
+    struct _arena_block_t *next;
+
+    // Number of usable bytes in this block.
+    size_t cap;
+    size_t used;
+} arena_block_t;
+
+typedef struct _arena_t {
+    // Whether or not blocks are counted by the system malloc count.
+    bool counted;
+
+    size_t block_size;
+
+    // Blocks form a singly linked list.
+    // All blocks before curr are considered full.
+    // All blocks after curr are empty. (Left over from before a reset)
+    arena_block_t *first;
+    arena_block_t *curr;
+} arena_t;
+
+arena_t *new_arena(size_t block_size);
+void delete_arena(arena_t *a);
+
+// Returns NULL if s is 0.
+// Requests larger than the arena's block size are given their own block.
+void *arena_alloc(arena_t *a, size_t s);
+
+// Copies the given memory into the arena.
+void *arena_copy(arena_t *a, const void *mem, size_t s);
+
+// All memory allocated from the arena is released.
+// Blocks are kept around to be reused by future allocations.
+void arena_reset(arena_t *a);
+
+// Number of bytes currently handed out by the arena. (Including alignment padding)
+size_t arena_used(arena_t *a);
+
+// Every thread has its own scratch arena, it is lazily created on first use
+// and deleted when its thread exits.
+//
+// The scratch arena is meant for short lived memory, for example, memory which
+// only lives for the duration of a single request. Reset it at the end of each unit of work.
+//
+// NOTE: Unlike user created arenas, scratch arenas are owned by the system and
+// are NOT counted by the malloc count.
+arena_t *sys_scratch_arena(void);
+
+static inline void *scratch_alloc(size_t s) {
+    return arena_alloc(sys_scratch_arena(), s);
+}
+
+static inline void sys_scratch_reset(void) {
+    arena_reset(sys_scratch_arena());
+}
+
+#endif
@@ -0,0 +1,133 @@
+
+#ifndef CHSYS_EVENT_H
+#define CHSYS_EVENT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// An edge-triggered event loop built on epoll.
+//
+// Sources are registered with a callback. Each time the loop sees a source become
+// ready, the callback is called on the thread running the loop.
+//
+// Edge-triggered means a callback is only called when a source goes from not
+// ready to ready. So, a read callback MUST read until EAGAIN (e.g. accept in a loop,
+// or call chn_refresh, which always drains its fd), otherwise it may never be called again.
+// All watched fds should be non-blocking.
+//
+// Besides plain fds, the loop can own two kinds of sources:
+// Timers (timerfd), which fire after a delay, and optionally at an interval.
+// Notifiers (eventfd), which fire when sys_event_notify is called from any thread.
+//
+// A sys_event_loop_t is NOT thread safe. All calls except sys_event_notify and
+// sys_event_loop_stop must come from the thread which runs the loop.
+
+#define SYS_EV_READ  0x1U
+#define SYS_EV_WRITE 0x2U
+
+// Reported only, these never need to be requested.
+#define SYS_EV_HUP   0x4U
+#define SYS_EV_ERR   0x8U
+
+typedef enum _sys_event_source_kind_t {
+    SYS_EVENT_SOURCE_FD = 0,
+    SYS_EVENT_SOURCE_TIMER,
+    SYS_EVENT_SOURCE_NOTIFIER,
+} sys_event_source_kind_t;
+
+struct _sys_event_loop_t;
+struct _sys_event_source_t;
+
+// events is some combination of the SYS_EV_* flags.
+typedef void (*sys_event_ft)(struct _sys_event_loop_t *loop,
+        struct _sys_event_source_t *src, uint32_t events, void *arg);
+
+typedef struct _sys_event_source_t {
+    sys_event_source_kind_t kind;
+
+    int fd;
+    uint32_t interest;
+
+    sys_event_ft cb;
+    void *arg;
+
+    // For timers, the number of expirations since the last callback.
+    // For notifiers, the number of sys_event_notify calls since the last callback.
+    // (The loop reads the counter before calling the callback)
+    uint64_t count;
+
+    // All live sources are kept in a list, so they can be cleaned up on delete.
+    struct _sys_event_source_t *prev;
+    struct _sys_event_source_t *next;
+
+    // Set once the source has been removed. Removed sources are freed after
+    // the current batch of events is dispatched.
+    bool removed;
+    struct _sys_event_source_t *next_removed;
+} sys_event_source_t;
+
+typedef struct _sys_event_loop_t {
+    int epoll_fd;
+
+    // Used to break out of epoll_wait from sys_event_loop_stop.
+    int wake_fd;
+    atomic_bool stop;
+
+    size_t max_events;
+    void *events;
+
+    sys_event_source_t *sources;
+    sys_event_source_t *removed;
+} sys_event_loop_t;
+
+// max_events is the max number of events handled per epoll_wait call.
+// (0 for a default)
+sys_event_loop_t *new_sys_event_loop(size_t max_events);
+
+// Removes all sources still registered.
+// Timer and notifier fds are closed, plain fds are NOT.
+void delete_sys_event_loop(sys_event_loop_t *loop);
+
+// Watches fd, which is NOT owned by the loop.
+// interest is some combination of SYS_EV_READ and SYS_EV_WRITE.
+//
+// Returns NULL if the fd cannot be watched.
+sys_event_source_t *sys_event_add_fd(sys_event_loop_t *loop, int fd, uint32_t interest,
+        sys_event_ft cb, void *arg);
+
+// Changes what a plain fd source is watched for.
+// Returns false on error.
+bool sys_event_modify_fd(sys_event_loop_t *loop, sys_event_source_t *src, uint32_t interest);
+
+// Creates a timer which first fires after initial_ns, then every interval_ns.
+// (An interval of 0 means the timer fires once)
+sys_event_source_t *sys_event_add_timer(sys_event_loop_t *loop, uint64_t initial_ns,
+        uint64_t interval_ns, sys_event_ft cb, void *arg);
+
+// Creates a notifier. Its callback is called on the loop's thread after
+// sys_event_notify is called on it.
+sys_event_source_t *sys_event_add_notifier(sys_event_loop_t *loop, sys_event_ft cb, void *arg);
+
+// Thread safe.
+// Many notifications made before the loop gets to the source result in a single callback.
+void sys_event_notify(sys_event_source_t *notifier);
+
+// Stops watching a source. This is safe to call from within any callback,
+// including the source's own. A removed source's callback is never called again.
+//
+// NOTE: If a plain fd is to be closed, remove its source first.
+void sys_event_remove(sys_event_loop_t *loop, sys_event_source_t *src);
+
+// Waits up to timeout_ms (-1 to wait forever) for events, and dispatches them.
+// Returns the number of events dispatched, or -1 on error.
+int sys_event_loop_run_once(sys_event_loop_t *loop, int timeout_ms);
+
+// Dispatches events until sys_event_loop_stop is called.
+void sys_event_loop_run(sys_event_loop_t *loop);
+
+// Thread safe. Makes sys_event_loop_run return after its current batch of events.
+void sys_event_loop_stop(sys_event_loop_t *loop);
+
+#endif
@@ -0,0 +1,134 @@
+
+#ifndef CHSYS_EXECUTOR_H
+#define CHSYS_EXECUTOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A work stealing thread pool.
+//
+// Each worker owns a Chase-Lev deque. Tasks submitted from a worker are pushed onto
+// that worker's deque, and popped in LIFO order. Tasks submitted from any other thread
+// go onto a shared injection queue. A worker with no local work first checks the
+// injection queue, then tries to steal from the other workers. (FIFO end)
+//
+// Idle workers park on a futex rather than sleep-polling, and are woken by submissions.
+//
+// Futures:
+// executor_submit returns a future which MUST be joined exactly once.
+// Joining from a worker of the same executor runs other tasks while waiting,
+// so recursive fork/join style code never deadlocks the pool. Any other thread,
+// including a worker of a different executor, parks until the task is done.
+
+typedef void *(*executor_task_ft)(void *arg);
+
+typedef struct _executor_task_t {
+    executor_task_ft fn;
+    void *arg;
+
+    // NULL for spawned tasks.
+    struct _executor_future_t *future;
+
+    // Used by the injection queue.
+    struct _executor_task_t *next;
+} executor_task_t;
+
+typedef struct _executor_future_t {
+    // A submitted task lives in its future, so that one allocation covers both.
+    executor_task_t task;
+
+    // EXECUTOR_FUTURE_* below. Also the futex word joiners wait on.
+    atomic_uint state;
+    void *result;
+
+    // The executor the task was submitted to.
+    struct _executor_t *exec;
+} executor_future_t;
+
+#define EXECUTOR_FUTURE_PENDING 0
+#define EXECUTOR_FUTURE_DONE 1
+
+// Pending, with a thread parked on the future.
+#define EXECUTOR_FUTURE_WAITED 2
+
+// A deque's buffer. Only the owner pushes/grows, thieves just read.
+typedef struct _executor_deque_array_t {
+    size_t cap;
+
+    // Arrays which have been outgrown are kept until the executor is deleted,
+    // as a thief may still be reading from them.
+    struct _executor_deque_array_t *retired;
+
+    _Atomic(executor_task_t *) slots[];
+} executor_deque_array_t;
+
+typedef struct _executor_deque_t {
+    _Alignas(64) atomic_llong top;
+    _Alignas(64) atomic_llong bottom;
+    _Atomic(executor_deque_array_t *) array;
+} executor_deque_t;
+
+typedef struct _executor_worker_t {
+    struct _executor_t *exec;
+    size_t index;
+
+    pthread_t thread;
+    executor_deque_t deque;
+
+    // Used to pick steal victims.
+    uint64_t rng;
+} executor_worker_t;
+
+typedef struct _executor_t {
+    size_t num_workers;
+    executor_worker_t *workers;
+
+    // Tasks submitted from outside the pool.
+    pthread_mutex_t inject_mut;
+    executor_task_t *inject_head;
+    executor_task_t *inject_tail;
+
+    // Cheap check so that workers don't take the mutex just to find the queue empty.
+    atomic_size_t inject_len;
+
+    // Bumped on every submission. Parked workers wait on this.
+    _Alignas(64) atomic_uint epoch;
+    atomic_uint num_parked;
+
+    // Tasks submitted but not yet finished.
+    atomic_size_t pending;
+
+    atomic_bool stop;
+} executor_t;
+
+// When num_workers is 0, one worker is created per CPU this process may run on.
+executor_t *new_executor(size_t num_workers);
+
+// Waits for all submitted tasks to finish (Including tasks they submit),
+// then stops and joins all workers.
+//
+// NOTE: Must not be called from within a task.
+void delete_executor(executor_t *e);
+
+// Runs fn(arg) on the pool, with no way to wait on it.
+void executor_spawn(executor_t *e, executor_task_ft fn, void *arg);
+
+// Runs fn(arg) on the pool. The returned future must be joined.
+executor_future_t *executor_submit(executor_t *e, executor_task_ft fn, void *arg);
+
+// Waits for the future's task to finish, frees the future, and returns the
+// task's return value.
+void *executor_join(executor_future_t *f);
+
+static inline bool executor_future_done(const executor_future_t *f) {
+    return atomic_load_explicit(&(f->state), memory_order_acquire) == EXECUTOR_FUTURE_DONE;
+}
+
+// Returns the index of the calling worker within its executor,
+// or -1 if the caller is not an executor worker.
+int executor_current_worker(void);
+
+#endif
@@ -3,6 +3,9 @@
 #define CHSYS_LOG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #define ANSI_CNTRL(code_str) "\x1B[" code_str "m"
 
@@ -53,16 +56,207 @@ typedef enum _sys_log_level_t {
     SYS_FATAL
 } sys_log_level_t;
 
+typedef struct _log_level_style_t {
+    const char *label;
+    const char *label_style;
+    const char *msg_style;
+} log_level_style_t;
+
+const log_level_style_t *log_level_style(sys_log_level_t level);
+
 // If aquire lock is true, this call will aquire the system lock before printing.
 // Otherwise, it won't.
+//
+// NOTE: This does NOT check any log levels, use the macros below for that.
+// Quiet mode is checked before the lock is acquired.
 void log_any_p(bool aquire_lock, sys_log_level_t level, const char *fmt,...);
 
-#define log_info_p(al,...)   log_any_p(al,SYS_INFO,__VA_ARGS__)
-#define log_warn_p(al,...)   log_any_p(al,SYS_WARN,__VA_ARGS__)
+// Log Levels
+//
+// Info and warn logs below CHSYS_LOG_MIN_LEVEL are compiled out entirely.
+// (e.g. -DCHSYS_LOG_MIN_LEVEL=SYS_WARN)
+// Their arguments are still type checked, but never evaluated.
+//
+// Past that, every log call checks the runtime level of its module.
+// A module is just a name. A source file picks its module by defining CHSYS_LOG_MODULE
+// as a string literal BEFORE including any headers. (Files which don't are in the
+// "default" module)
+//
+// Both checks happen before any locking or formatting.
+//
+// Fatal logs are never compiled out or filtered, they always exit.
+
+#ifndef CHSYS_LOG_MIN_LEVEL
+#define CHSYS_LOG_MIN_LEVEL SYS_INFO
+#endif
+
+typedef struct _log_module_t {
+    const char *name;
+
+    // Minimum level which is logged.
+    atomic_int level;
+
+    // Modules register themselves the first time they log, so that
+    // their level can be changed by name.
+    atomic_bool registered;
+    struct _log_module_t *next;
+} log_module_t;
+
+#define LOG_MODULE_INIT(n) { \
+    .name = (n), \
+    .level = SYS_INFO, \
+    .registered = false, \
+    .next = NULL, \
+}
+
+// Sets the level of every module, clearing any per module levels.
+void sys_log_set_level(sys_log_level_t level);
+
+// Sets the level of all modules with the given name, 
+// including ones which have not logged yet.
+void sys_log_set_module_level(const char *name, sys_log_level_t level);
+
+// Used by the macros below.
+void log_module_register(log_module_t *m);
+
+static inline bool log_module_enabled(log_module_t *m, sys_log_level_t level) {
+    if (!atomic_load_explicit(&(m->registered), memory_order_acquire)) {
+        log_module_register(m);
+    }
+
+    return (int)level >= atomic_load_explicit(&(m->level), memory_order_relaxed);
+}
+
+#ifdef CHSYS_LOG_MODULE
+// Each file in a module gets its own copy, the registry keeps them in sync.
+static log_module_t _chsys_log_module = LOG_MODULE_INIT(CHSYS_LOG_MODULE);
+static inline log_module_t *chsys_log_module(void) {
+    return &_chsys_log_module;
+}
+#else
+extern log_module_t chsys_default_log_module;
+static inline log_module_t *chsys_log_module(void) {
+    return &chsys_default_log_module;
+}
+#endif
+
+#define log_level_p(al,level,...) \
+    do { \
+        if ((level) >= CHSYS_LOG_MIN_LEVEL && \
+                log_module_enabled(chsys_log_module(), (level))) { \
+            log_any_p(al,level,__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define log_info_p(al,...)   log_level_p(al,SYS_INFO,__VA_ARGS__)
+#define log_warn_p(al,...)   log_level_p(al,SYS_WARN,__VA_ARGS__)
 #define log_fatal_p(al,...)  log_any_p(al,SYS_FATAL,__VA_ARGS__)
 
-#define log_info(...)   log_any_p(true,SYS_INFO,__VA_ARGS__)
-#define log_warn(...)   log_any_p(true,SYS_WARN,__VA_ARGS__)
-#define log_fatal(...)  log_any_p(true,SYS_FATAL,__VA_ARGS__)
+#define log_info(...)   log_info_p(true,__VA_ARGS__)
+#define log_warn(...)   log_warn_p(true,__VA_ARGS__)
+#define log_fatal(...)  log_fatal_p(true,__VA_ARGS__)
+
+// Rate Limiting
+//
+// The _rl variants give each call site its own token bucket.
+// A call site may log up to burst lines at once, refilling at per_sec lines per second.
+// Lines over the limit are dropped, and counted. The next line which makes it through
+// is followed by a line saying how many were dropped.
+//
+// The bucket is a single atomic, so checking it never blocks.
+
+typedef struct _log_rate_limit_t {
+    uint64_t interval_ns;
+    uint64_t burst_ns;
+
+    // Theoretical arrival time of the next line. (GCRA)
+    atomic_uint_least64_t tat;
+
+    atomic_size_t suppressed;
+} log_rate_limit_t;
+
+#define LOG_RATE_LIMIT_INIT(per_sec, burst) { \
+    .interval_ns = 1000000000ULL / (per_sec), \
+    .burst_ns = (1000000000ULL / (per_sec)) * (burst), \
+    .tat = 0, \
+    .suppressed = 0, \
+}
+
+// Returns true if a line may be logged. 
+// If lines were suppressed before this one, *suppressed is set to how many.
+bool log_rate_limit_pass(log_rate_limit_t *rl, size_t *suppressed);
+
+#define log_level_rl_p(al,level,per_sec,burst,...) \
+    do { \
+        static log_rate_limit_t _rl = LOG_RATE_LIMIT_INIT(per_sec, burst); \
+        size_t _suppressed = 0; \
+        if ((level) >= CHSYS_LOG_MIN_LEVEL && \
+                log_module_enabled(chsys_log_module(), (level)) && \
+                log_rate_limit_pass(&_rl, &_suppressed)) { \
+            log_any_p(al,level,__VA_ARGS__); \
+            if (_suppressed > 0) { \
+                log_any_p(al,level,"(%zu similar lines suppressed)",_suppressed); \
+            } \
+        } \
+    } while (0)
+
+#define log_info_rl_p(al,per_sec,burst,...) log_level_rl_p(al,SYS_INFO,per_sec,burst,__VA_ARGS__)
+#define log_warn_rl_p(al,per_sec,burst,...) log_level_rl_p(al,SYS_WARN,per_sec,burst,__VA_ARGS__)
+
+#define log_info_rl(per_sec,burst,...) log_info_rl_p(true,per_sec,burst,__VA_ARGS__)
+#define log_warn_rl(per_sec,burst,...) log_warn_rl_p(true,per_sec,burst,__VA_ARGS__)
+
+// Asynchronous Logging
+//
+// Once started, log calls no longer acquire the system lock or write anything themselves.
+// Instead, each line is formatted straight into a slot of a bounded lock-free ring buffer.
+// A background flusher thread drains the ring in batches using writev.
+//
+// If the ring is full, new lines are dropped (and counted) rather than blocking the caller.
+// The flusher will report how many lines were dropped.
+//
+// Lines longer than SYS_LOG_ASYNC_LINE_SIZE are truncated.
+//
+// Pending lines are always flushed by safe_exit (So also by a fatal log).
+// Lines still in the ring when the process exits some other way are lost.
+
+#define SYS_LOG_ASYNC_LINE_SIZE 256
+#define SYS_LOG_ASYNC_DEFAULT_CAP 4096
+
+typedef struct _sys_log_async_config_t {
+    // Where to write log lines. A negative value means stdout.
+    int fd;
+
+    // Number of line slots in the ring, must be a power of 2.
+    // When 0, SYS_LOG_ASYNC_DEFAULT_CAP is used.
+    size_t ring_cap;
+
+    // How long the flusher sleeps when the ring is empty. 
+    // When 0, 1000 is used.
+    unsigned long flush_interval_us;
+} sys_log_async_config_t;
+
+// Requires sys_init to have been called.
+// cfg can be NULL to use all defaults.
+void sys_log_async_start(const sys_log_async_config_t *cfg);
+
+// Stops the flusher thread after flushing all pending lines.
+// Logging goes back to being synchronous.
+//
+// NOTE: No other thread should be logging when this is called,
+// as the ring buffer is freed.
+void sys_log_async_stop(void);
+
+bool sys_log_async_enabled(void);
+
+// Blocks until all lines logged before this call are written.
+void sys_log_async_flush(void);
+
+// Total number of lines dropped because the ring was full.
+size_t sys_log_async_dropped(void);
+
+// NOTE: This is called by safe_fork in the child process. 
+// (Threads don't survive a fork, so the flusher must be respawned)
+void sys_log_async_after_fork(void);
 
 #endif
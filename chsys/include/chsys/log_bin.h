@@ -0,0 +1,65 @@
+
+#ifndef CHSYS_LOG_BIN_H
+#define CHSYS_LOG_BIN_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chsys/log.h"
+
+// Binary Logging
+//
+// Once started, log calls no longer format anything. Instead, each call records
+// the ID of its format string, a timestamp, and the raw bytes of its arguments into
+// a per-thread buffer. Buffers are written to the given fd when they fill up,
+// when their thread exits, or when flushed.
+//
+// The first time a format string is seen, its text is written to the fd with a
+// new ID. Format strings are identified by address, so they should be string literals.
+// (Which they always are when using the log_* macros)
+//
+// Rendering happens offline using sys_log_binary_decode. (See the chlog-decode tool)
+//
+// Supported conversions are everything printf supports except %n and wide
+// characters/strings. A format string using either is recorded without its arguments.
+// Strings are truncated to LOG_BIN_MAX_STR bytes.
+//
+// NOTE: The decoder expects the same data model as the machine which wrote the log.
+// NOTE: The pid is cached when logging starts, and refreshed by safe_fork. A child made
+// with a plain fork keeps recording its parent's pid.
+//
+// Pending records are always flushed by safe_exit. (So also by a fatal log)
+
+#define LOG_BIN_MAX_STR 1024
+#define LOG_BIN_MAX_ARGS 32
+
+// Requires sys_init to have been called.
+// The fd is NOT closed by this module.
+// Binary and async logging cannot be used at the same time.
+void sys_log_binary_start(int fd);
+
+// Flushes all buffers and goes back to regular logging.
+//
+// NOTE: No other thread should be logging when this is called.
+void sys_log_binary_stop(void);
+
+bool sys_log_binary_enabled(void);
+
+// Writes out the buffers of every thread.
+void sys_log_binary_flush(void);
+
+// NOTE: This is called by safe_fork in the child process.
+// Records buffered at the time of the fork belong to the parent and are discarded.
+void sys_log_binary_after_fork(void);
+
+// Used by log_any_p when binary logging is enabled.
+void log_binary_record(sys_log_level_t level, const char *fmt, va_list args);
+
+// Renders a binary log as text, one line per record.
+// Returns false if the input is malformed or from an incompatible machine.
+// (Lines rendered before the error are still written)
+bool sys_log_binary_decode(FILE *in, FILE *out, bool color);
+
+#endif
@@ -4,16 +4,28 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 // All these calls require init_sys to be called.
 // before being used.
 
-void *safe_malloc_p(bool acquire_lock, size_t s);
+// The _at versions take the callsite of the allocation.
+// This is only used when memory profiling is enabled. (See below)
+void *safe_malloc_at_p(bool acquire_lock, size_t s, const char *file, int line);
+void *safe_realloc_at_p(bool acquire_lock, void *mem, size_t s, const char *file, int line);
+
+static inline void *safe_malloc_p(bool acquire_lock, size_t s) {
+    return safe_malloc_at_p(acquire_lock, s, NULL, 0);
+}
+
 static inline void *safe_malloc(size_t s) {
     return safe_malloc_p(true, s);
 }
 
-void *safe_realloc_p(bool acquire_lock, void *mem, size_t s);
+static inline void *safe_realloc_p(bool acquire_lock, void *mem, size_t s) {
+    return safe_realloc_at_p(acquire_lock, mem, s, NULL, 0);
+}
+
 static inline void *safe_realloc(void *mem, size_t s) {
     return safe_realloc_p(true, mem, s);
 }
@@ -23,4 +35,85 @@ static inline void safe_free(void *mem) {
     safe_free_p(true, mem);
 }
 
+// Large Buffers
+//
+// Meant for large, long lived buffers. Buffers of at least SAFE_LARGE_THRESHOLD bytes 
+// are given their own anonymous mapping. Mappings of 2MB or more are huge page aligned 
+// and advised to use transparent huge pages. (If the system allows)
+//
+// Smaller buffers (or if mmap fails) come from safe_malloc.
+// Either way, a large buffer counts as a single malloc in the system malloc count.
+//
+// If prefault is true, the buffer's pages are faulted in right away, instead of
+// on first touch.
+//
+// NOTE: Memory from these calls MUST be freed with safe_free_large, and memory
+// from safe_malloc must NEVER be given to safe_free_large or safe_realloc_large.
+
+#define SAFE_LARGE_THRESHOLD 0x40000
+
+void *safe_malloc_large_p(bool acquire_lock, size_t s, bool prefault);
+static inline void *safe_malloc_large(size_t s) {
+    return safe_malloc_large_p(true, s, false);
+}
+
+static inline void *safe_malloc_large_prefault(size_t s) {
+    return safe_malloc_large_p(true, s, true);
+}
+
+void *safe_realloc_large_p(bool acquire_lock, void *mem, size_t s);
+static inline void *safe_realloc_large(void *mem, size_t s) {
+    return safe_realloc_large_p(true, mem, s);
+}
+
+void safe_free_large_p(bool acquire_lock, void *mem);
+static inline void safe_free_large(void *mem) {
+    safe_free_large_p(true, mem);
+}
+
+// Thread Caching
+//
+// When enabled, small blocks (<= 512 bytes) freed by a thread are cached and reused by
+// that same thread, skipping the system allocator entirely. Blocks freed by a thread
+// other than the one which allocated them are fine, they simply join the freeing thread's cache.
+// Overflowing caches give batches of blocks back to a shared depot for other threads to use.
+//
+// Caching can be enabled at any time. (Usually right after sys_init)
+// Or, build chsys with CHSYS_MEM_CACHE defined to have it enabled from the start.
+//
+// NOTE: Cached blocks are never given back to the system, they only return to the depot
+// when their thread exits.
+void sys_mem_cache_enable(void);
+bool sys_mem_cache_enabled(void);
+
+// Memory Profiling
+//
+// When profiling is enabled, every allocation records where it came from.
+// For every callsite we keep live bytes, peak live bytes, alloc/free counts,
+// and a histogram of allocation sizes.
+//
+// Define CHSYS_MEM_PROFILE before including this header (or with -D) to have
+// safe_malloc/safe_realloc record __FILE__ and __LINE__. Allocations made by code
+// compiled without it are all grouped under an unknown callsite.
+//
+// NOTE: Stats are kept in per-thread tables, so profiling does not serialize
+// allocating threads. Peak bytes are tracked per thread, so the reported peak of
+// a callsite used by many threads is an upper bound.
+#ifdef CHSYS_MEM_PROFILE
+#define safe_malloc(s)      safe_malloc_at_p(true, (s), __FILE__, __LINE__)
+#define safe_realloc(m, s)  safe_realloc_at_p(true, (m), (s), __FILE__, __LINE__)
+#endif
+
+// Profiling must be enabled BEFORE any memory is allocated with safe_malloc.
+// (Profiled blocks carry a small header, blocks allocated before profiling don't)
+//
+// Once enabled, profiling cannot be disabled. A text report will be printed
+// on safe_exit.
+void sys_mem_profile_enable(void);
+bool sys_mem_profile_enabled(void);
+
+// Prints a report of all callsites sorted by live bytes (Then by total bytes allocated).
+// If json is true, the report is printed as a JSON array.
+void sys_mem_profile_report(FILE *fp, bool json);
+
 #endif
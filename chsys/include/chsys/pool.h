@@ -0,0 +1,88 @@
+
+#ifndef CHSYS_POOL_H
+#define CHSYS_POOL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// A pool is a slab allocator for small objects of repeated sizes.
+//
+// Objects are grouped into size classes (powers of 2 from POOL_MIN_OBJ_SIZE to POOL_MAX_OBJ_SIZE).
+// Each class is carved out of large slabs. Freed objects are kept on free lists
+// to be reused, they are never given back to the system until the pool is deleted.
+//
+// Every thread using a pool has its own cache of free lists, so the common case
+// of alloc/free requires no locking at all. When a thread's cache runs dry
+// (or overflows), objects are moved to/from a shared depot in batches.
+//
+// Pools are threadsafe. Objects can be freed on a different thread than the one
+// which allocated them.
+//
+// NOTE: Slabs are allocated using safe_malloc, however, individual objects are not
+// counted by the system malloc count.
+//
+// NOTE: Requests larger than POOL_MAX_OBJ_SIZE are forwarded to safe_malloc.
+
+#define POOL_MIN_OBJ_SIZE   16
+#define POOL_MAX_OBJ_SIZE   2048
+#define POOL_NUM_CLASSES    8
+
+#define POOL_SLAB_SIZE      0x10000
+
+// Max number of objects a thread will cache per class.
+#define POOL_CACHE_CAP      64
+
+// Number of objects moved between a thread cache and the depot at once.
+#define POOL_BATCH_SIZE     32
+
+typedef struct _pool_obj_t {
+    struct _pool_obj_t *next;
+} pool_obj_t;
+
+typedef struct _pool_free_list_t {
+    size_t len;
+    pool_obj_t *head;
+} pool_free_list_t;
+
+struct _pool_t;
+
+typedef struct _pool_cache_t {
+    struct _pool_t *pool;
+
+    // All caches of a pool form a doubly linked list.
+    // (Protected by the pool's mutex)
+    struct _pool_cache_t *prev;
+    struct _pool_cache_t *next;
+
+    pool_free_list_t lists[POOL_NUM_CLASSES];
+} pool_cache_t;
+
+typedef struct _pool_t {
+    pthread_key_t cache_key;
+
+    // Protects everything below.
+    pthread_mutex_t mut;
+
+    pool_free_list_t depot[POOL_NUM_CLASSES];
+
+    // All slabs ever allocated by this pool.
+    // (The first word of every slab is used to point to the next slab)
+    void *slabs;
+
+    pool_cache_t *caches;
+} pool_t;
+
+pool_t *new_pool(void);
+
+// All memory allocated from the pool is released.
+// No other thread should be using the pool when this is called.
+void delete_pool(pool_t *p);
+
+// Returns NULL if s is 0.
+void *pool_alloc(pool_t *p, size_t s);
+
+// NOTE: s MUST be the same size given when the memory was allocated.
+void pool_free(pool_t *p, void *mem, size_t s);
+
+#endif
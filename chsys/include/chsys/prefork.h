@@ -0,0 +1,90 @@
+
+#ifndef CHSYS_PREFORK_H
+#define CHSYS_PREFORK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+// A prefork pool forks a fixed number of worker processes, and supervises them
+// from the calling process.
+//
+// Each worker is its own process, with its own system state and system lock.
+// So, for example, each worker can run its own chrpc_server_t, accepting clients
+// from a listening socket created by the pool.
+//
+// Shutdown:
+// When the supervising process receives a SIGINT, all workers are sent a SIGINT.
+// Workers which do not exit within the shutdown timeout are killed.
+//
+// A worker's SIGINT behavior is the same as any other process using chsys.
+// (It is inherited from the supervisor at the time of the fork)
+// If the worker would like to poll sys_sig_exit_requested, it should call
+// sys_set_sig_exit(false) itself.
+
+// Called within each worker process.
+// listen_fd is -1 when the pool was not given a port.
+// The worker process exits with safe_exit(0) once this returns.
+typedef void (*sys_prefork_worker_ft)(size_t worker_index, int listen_fd, void *arg);
+
+typedef struct _sys_prefork_pool_attrs_t {
+    size_t num_workers;
+
+    // When non-negative, the pool creates a listening socket on this port.
+    // (See create_server)
+    int port;
+    int pending_conns;
+
+    // When true, each worker binds its own socket with SO_REUSEPORT,
+    // and the kernel balances connections between workers.
+    // Otherwise, one socket is created before forking, and shared by all workers.
+    bool reuse_port;
+
+    // Whether or not workers which exit while the pool is being supervised
+    // should be replaced.
+    bool restart_workers;
+
+    // Total number of restarts allowed. 0 means no limit.
+    size_t max_restarts;
+
+    // How long the supervisor sleeps between checks on its workers.
+    uint32_t poll_interval_ms;
+
+    // How long workers are given to exit after being sent a SIGINT.
+    uint32_t shutdown_timeout_ms;
+} sys_prefork_pool_attrs_t;
+
+typedef struct _sys_prefork_pool_t {
+    sys_prefork_pool_attrs_t attrs;
+
+    sys_prefork_worker_ft worker;
+    void *arg;
+
+    // -1 when there is no shared socket.
+    int listen_fd;
+
+    size_t restarts;
+
+    // One pid per worker slot, 0 when the slot's worker is not running.
+    pid_t *pids;
+    size_t num_live;
+} sys_prefork_pool_t;
+
+// Forks all workers right away.
+// This will log fatal if the socket cannot be created.
+sys_prefork_pool_t *new_sys_prefork_pool(const sys_prefork_pool_attrs_t *attrs,
+        sys_prefork_worker_ft worker, void *arg);
+
+// Waits on workers, restarting them as configured.
+//
+// Returns once a SIGINT is received, or once there are no workers left.
+// For the SIGINT case to be possible, sys_set_sig_exit(false) must be called beforehand.
+// (Otherwise, the SIGINT exits the supervisor, and safe_exit kills all workers)
+void sys_prefork_pool_supervise(sys_prefork_pool_t *pool);
+
+// Sends a SIGINT to all running workers, and waits for them to exit.
+// Workers still running after the shutdown timeout are sent a SIGKILL.
+void delete_sys_prefork_pool(sys_prefork_pool_t *pool);
+
+#endif
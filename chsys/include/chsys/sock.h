@@ -1,15 +1,120 @@
 
-
 #ifndef CHSYS_SOCK_H
 #define CHSYS_SOCK_H
 
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// Socket Options
+//
+// Passed into the *_opts constructors below. Fields left 0/false keep the
+// kernel's default.
+
+typedef struct _sock_opts_t {
+    // listen backlog, only used by servers. (Must be positive)
+    int backlog;
+
+    bool nonblocking;
+
+    bool reuse_addr;
+
+    // Many sockets can be bound to the same port (Even across processes),
+    // and the kernel will spread incoming connections between them.
+    bool reuse_port;
+
+    // TCP only. Disables Nagle's algorithm, small writes are sent right away rather
+    // than held back until earlier data is acked. This is almost always what
+    // request/response traffic wants.
+    bool tcp_nodelay;
+
+    // TCP only. Acks right away rather than delaying.
+    // NOTE: The kernel may clear this on its own, it is not permanent.
+    bool tcp_quickack;
+
+    // Buffer sizes in bytes.
+    int sndbuf;
+    int rcvbuf;
+
+    // Microseconds to busy poll the device queue on blocking reads.
+    // This is best effort, raising it above net.core.busy_read requires CAP_NET_ADMIN,
+    // and failures are ignored.
+    int busy_poll_us;
+} sock_opts_t;
+
+#define SOCK_OPTS_DEFAULT { \
+    .backlog = 16, \
+    .nonblocking = false, \
+    .reuse_addr = false, \
+    .reuse_port = false, \
+    .tcp_nodelay = false, \
+    .tcp_quickack = false, \
+    .sndbuf = 0, \
+    .rcvbuf = 0, \
+    .busy_poll_us = 0, \
+}
+
+// Applies the given options to an existing socket. (e.g. one returned by accept,
+// which does not inherit the options of its listening socket)
+// backlog and reuse_* are ignored here, they only matter before bind.
+//
+// Returns 0 on success, -1 on failure.
+int sock_apply_opts(int sockfd, const sock_opts_t *opts);
+
+// Returns 0 on success, -1 on failure.
+int sock_set_nonblocking(int fd, bool nonblocking);
+
+// TCP
+
 // Returns sockfd on success, and -1 on failure.
 int client_connect(const char *ipaddr, int port);
 
+// Same as client_connect, with the given options.
+// (opts can be NULL for SOCK_OPTS_DEFAULT)
+//
+// NOTE: The socket is connected before being made non-blocking.
+int client_connect_opts(const char *ipaddr, int port, const sock_opts_t *opts);
+
 // Returns sockfd on success, and negative number on failure.
 //
 // NOTE: The returned server socket will be non-blocking!
 // Always accept connection in a loop!
 int create_server(int port, int pending_conns);
 
+// Same as create_server, except the socket is bound with SO_REUSEPORT.
+// Many such sockets can be bound to the same port (Even across processes),
+// and the kernel will spread incoming connections between them.
+int create_reuseport_server(int port, int pending_conns);
+
+// Creates a TCP server listening on all interfaces with the given options.
+// (opts can be NULL for SOCK_OPTS_DEFAULT)
+//
+// tcp_* options set on a listening socket are inherited by accepted sockets on Linux.
+//
+// Returns sockfd on success, and -1 on failure.
+int create_server_opts(int port, const sock_opts_t *opts);
+
+// Unix Domain Sockets
+//
+// type is SOCK_STREAM or SOCK_SEQPACKET. (SEQPACKET preserves message boundaries)
+//
+// A path starting with '@' is placed in the abstract namespace. (No file is created,
+// and the name disappears with the last socket)
+// Otherwise, an existing socket at path (e.g. left by an old server) is unlinked before
+// binding. If anything other than a socket is at path, creating the server fails.
+// The path must be shorter than sizeof(sun_path). (108 bytes on Linux)
+//
+// tcp_* options are ignored for Unix sockets.
+
+// Returns sockfd on success, and -1 on failure.
+int create_unix_server(const char *path, int type, const sock_opts_t *opts);
+
+// Returns sockfd on success, and -1 on failure.
+int unix_connect(const char *path, int type, const sock_opts_t *opts);
+
+// Creates a connected pair of Unix sockets. (See socketpair(2))
+// Here type can also be SOCK_DGRAM. Both ends get the given options.
+//
+// Returns 0 on success, -1 on failure.
+int create_socketpair(int type, const sock_opts_t *opts, int fds[2]);
+
 #endif
@@ -48,6 +48,8 @@ static inline void sys_unlock(void) {
     sys_unlock_p(true);
 }
 
+// NOTE: The quiet flag is atomic, acquire_lock is ignored.
+// When quiet, all logs other than fatal logs are dropped.
 void sys_set_quiet_p(bool acquire_lock, bool q);
 static inline void sys_set_quiet(bool q) {
     sys_set_quiet_p(true, q);
@@ -58,6 +60,19 @@ static inline bool sys_is_quiet(void) {
     return sys_is_quiet_p(true);
 }
 
+// NOTE: The malloc count is kept in per-thread sharded atomic counters.
+// None of the below malloc count calls actually acquire the system lock,
+// acquire_lock only matters if something must be logged.
+//
+// Both getters sum all shards. The sum is only exact once all other threads
+// have stopped allocating, while they run it is just an estimate.
+//
+// sys_get_malloc_count is safe to call at any time. A negative sum may just be a
+// racy read, so it is logged as a warning and returned as 0.
+//
+// sys_get_malloc_count_exact is for when no other thread is allocating. (e.g. leak checks)
+// There, a negative sum means more frees than mallocs, which is fatal.
+// safe_exit does the same check, failing the exit on underflow.
 void sys_inc_malloc_count_p(bool acquire_lock);
 static inline void sys_inc_malloc_count(void) {
     sys_inc_malloc_count_p(true);
@@ -73,6 +88,11 @@ static inline size_t sys_get_malloc_count(void) {
     return sys_get_malloc_count_p(true);
 }
 
+size_t sys_get_malloc_count_exact_p(bool acquire_lock);
+static inline size_t sys_get_malloc_count_exact(void) {
+    return sys_get_malloc_count_exact_p(true);
+}
+
 void sys_reset_malloc_count_p(bool acquire_lock);
 static inline void sys_reset_malloc_count(void) {
     sys_reset_malloc_count_p(true);
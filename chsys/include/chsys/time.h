@@ -0,0 +1,112 @@
+
+#ifndef CHSYS_TIME_H
+#define CHSYS_TIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Monotonic Clock
+//
+// All times below are in nanoseconds from CLOCK_MONOTONIC.
+// They are only meaningful relative to each other. (Within one boot)
+
+#define SYS_NS_PER_US 1000ULL
+#define SYS_NS_PER_MS 1000000ULL
+#define SYS_NS_PER_S  1000000000ULL
+
+static inline uint64_t sys_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * SYS_NS_PER_S + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t sys_now_us(void) {
+    return sys_now_ns() / SYS_NS_PER_US;
+}
+
+static inline uint64_t sys_now_ms(void) {
+    return sys_now_ns() / SYS_NS_PER_MS;
+}
+
+// Sleeps for at least ns nanoseconds, even if interrupted by a signal.
+void sys_sleep_ns(uint64_t ns);
+
+static inline void sys_sleep_us(uint64_t us) {
+    sys_sleep_ns(us * SYS_NS_PER_US);
+}
+
+static inline void sys_sleep_ms(uint64_t ms) {
+    sys_sleep_ns(ms * SYS_NS_PER_MS);
+}
+
+// Cycle Counter
+//
+// sys_cycles reads the CPU's cycle counter directly (rdtsc on x86, cntvct_el0 on arm64),
+// which is much cheaper than a clock_gettime call. It is meant for measuring short
+// intervals on hot paths. On other architectures it falls back to sys_now_ns.
+//
+// Converting cycles to nanoseconds requires a calibration, which is done once, the
+// first time a conversion is requested. (It takes about 10ms)
+//
+// NOTE: This assumes an invariant counter. (Which is true of all modern x86 and arm64 CPUs)
+// Readings from different cores may be slightly out of sync.
+
+static inline uint64_t sys_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return sys_now_ns();
+#endif
+}
+
+// Number of cycles per nanosecond.
+double sys_cycles_per_ns(void);
+
+static inline uint64_t sys_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)((double)cycles / sys_cycles_per_ns());
+}
+
+// Deadlines
+//
+// A deadline is a point in time on the monotonic clock.
+
+typedef struct _sys_deadline_t {
+    uint64_t at_ns;
+} sys_deadline_t;
+
+// A deadline which never passes.
+#define SYS_DEADLINE_NEVER ((sys_deadline_t){.at_ns = UINT64_MAX})
+
+static inline sys_deadline_t sys_deadline_in_ns(uint64_t ns) {
+    uint64_t now = sys_now_ns();
+
+    // Saturate rather than wrap.
+    return (sys_deadline_t){.at_ns = ns > UINT64_MAX - now ? UINT64_MAX : now + ns};
+}
+
+static inline sys_deadline_t sys_deadline_in_us(uint64_t us) {
+    return sys_deadline_in_ns(us * SYS_NS_PER_US);
+}
+
+static inline sys_deadline_t sys_deadline_in_ms(uint64_t ms) {
+    return sys_deadline_in_ns(ms * SYS_NS_PER_MS);
+}
+
+static inline bool sys_deadline_passed(sys_deadline_t d) {
+    return d.at_ns != UINT64_MAX && sys_now_ns() >= d.at_ns;
+}
+
+// Returns 0 if the deadline has passed.
+static inline uint64_t sys_deadline_remaining_ns(sys_deadline_t d) {
+    uint64_t now = sys_now_ns();
+    return now >= d.at_ns ? 0 : d.at_ns - now;
+}
+
+#endif
@@ -0,0 +1,131 @@
+
+#ifndef CHSYS_URING_H
+#define CHSYS_URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A minimal io_uring wrapper, built directly on the io_uring syscalls.
+// (So there is no dependency on liburing)
+//
+// Usage:
+// Get SQEs with sys_uring_get_sqe and fill them in, then call sys_uring_submit
+// to hand all of them to the kernel with one syscall.
+// Completions are read straight from the shared CQ ring with sys_uring_peek_cqe
+// and sys_uring_cqe_seen, which never make a syscall.
+//
+// A sys_uring_t is NOT thread safe, callers must serialize access themselves.
+//
+// NOTE: Requests are owned by the thread which submitted them. If that thread exits,
+// its in-flight requests are cancelled. (They complete with -ECANCELED)
+
+typedef struct _sys_uring_t {
+    int fd;
+
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+
+    // Submission queue.
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_flags;
+    struct io_uring_sqe *sqes;
+
+    // SQEs handed out, but not yet submitted, are in [sqe_head, sqe_tail).
+    unsigned int sqe_head;
+    unsigned int sqe_tail;
+
+    // Completion queue.
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+
+    // Same as sq_ring when the kernel maps both rings together.
+    void *cq_ring;
+    size_t cq_ring_size;
+
+    size_t sqes_size;
+} sys_uring_t;
+
+// entries is the SQ size, the CQ is given cq_entries. (0 for the kernel default of 2x entries)
+//
+// Returns false if io_uring is not available. (Old kernel, or blocked by seccomp)
+bool sys_uring_init(sys_uring_t *u, unsigned int entries, unsigned int cq_entries);
+void sys_uring_cleanup(sys_uring_t *u);
+
+// Returns a zeroed SQE, or NULL if the SQ is full. (Submit, then try again)
+struct io_uring_sqe *sys_uring_get_sqe(sys_uring_t *u);
+
+// Number of SQEs waiting to be submitted.
+static inline unsigned int sys_uring_sq_pending(const sys_uring_t *u) {
+    return u->sqe_tail - u->sqe_head;
+}
+
+// Submits all pending SQEs, and waits for at least wait_nr completions.
+// No syscall is made when there is nothing to submit, nothing to wait for,
+// and the CQ has not overflowed.
+//
+// Returns the number of SQEs submitted, or -errno.
+int sys_uring_submit(sys_uring_t *u, unsigned int wait_nr);
+
+// Returns the next completion, or NULL if there isn't one.
+// The CQE must be marked seen before the next can be peeked.
+static inline struct io_uring_cqe *sys_uring_peek_cqe(sys_uring_t *u) {
+    unsigned int head = *(u->cq_head);
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &(u->cqes[head & *(u->cq_mask)]);
+}
+
+static inline void sys_uring_cqe_seen(sys_uring_t *u) {
+    __atomic_store_n(u->cq_head, *(u->cq_head) + 1, __ATOMIC_RELEASE);
+}
+
+// Provided Buffer Rings
+//
+// A group of equal sized buffers the kernel picks from when a read completes.
+// (See IOSQE_BUFFER_SELECT) The buffer used is given in the CQE's flags.
+// Once done with a buffer, give it back with sys_uring_buf_ring_recycle.
+
+typedef struct _sys_uring_buf_ring_t {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+
+    uint16_t bgid;
+    unsigned int entries;
+    uint16_t tail;
+
+    size_t buf_size;
+    uint8_t *bufs;
+} sys_uring_buf_ring_t;
+
+// entries must be a power of 2, no larger than 32768.
+// Returns false if buffer rings are not supported. (Linux 5.19+)
+bool sys_uring_buf_ring_init(sys_uring_t *u, sys_uring_buf_ring_t *br, uint16_t bgid,
+        unsigned int entries, size_t buf_size);
+void sys_uring_buf_ring_cleanup(sys_uring_t *u, sys_uring_buf_ring_t *br);
+
+static inline uint8_t *sys_uring_buf_ring_buf(const sys_uring_buf_ring_t *br, uint16_t bid) {
+    return br->bufs + ((size_t)bid * br->buf_size);
+}
+
+// Gives buffer bid back to the kernel.
+void sys_uring_buf_ring_recycle(sys_uring_buf_ring_t *br, uint16_t bid);
+
+// Given a CQE's flags, returns the id of the buffer used by the completion.
+// (Only valid if IORING_CQE_F_BUFFER is set)
+static inline uint16_t sys_uring_cqe_bid(uint32_t cqe_flags) {
+    return (uint16_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+#endif
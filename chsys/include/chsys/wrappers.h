@@ -10,12 +10,62 @@
 // of error checking code.
 
 #include <pthread.h>
+#include <stdlib.h>
 
 void safe_pthread_create(pthread_t *t, const pthread_attr_t *attr, 
         void *(*start_routine)(void *), void *arg);
 
 void safe_pthread_join(pthread_t t, void **ret_val);
 
+// Thread Placement
+//
+// CPUs are identified by their kernel index. NUMA node CPU lists are read from sysfs,
+// no NUMA library is needed.
+//
+// A thread spawned with a placement has its affinity set before it starts running,
+// so anything it allocates and touches first will be placed on its local node.
+
+typedef struct _sys_thread_placement_t {
+    // CPUs the thread is allowed to run on.
+    // When num_cpus is 0, there is no such restriction.
+    const int *cpus;
+    size_t num_cpus;
+
+    // When non-negative, the thread is only allowed to run on CPUs of this node.
+    // (If cpus are given too, the thread runs on CPUs in both sets)
+    int numa_node;
+
+    // When non-NULL, the thread's name. (Visible in top, gdb, etc.)
+    // Truncated to 15 characters.
+    const char *name;
+} sys_thread_placement_t;
+
+#define SYS_THREAD_PLACEMENT_DEFAULT { \
+    .cpus = NULL, \
+    .num_cpus = 0, \
+    .numa_node = -1, \
+    .name = NULL, \
+}
+
+// CPUs outside of this process's own affinity are ignored.
+// If the placement leaves the thread with no CPUs (e.g. the given node doesn't exist),
+// a warning is logged and the thread is spawned without any affinity.
+// placement can be NULL.
+void safe_pthread_create_placed(pthread_t *t, const sys_thread_placement_t *placement,
+        void *(*start_routine)(void *), void *arg);
+
+// Writes up to cap CPUs this process may run on into cpus.
+// Returns the total number of such CPUs.
+size_t sys_allowed_cpus(int *cpus, size_t cap);
+
+// Writes up to cap CPUs of the given NUMA node which this process may run on into cpus.
+// Returns the total number of such CPUs, 0 if the node is not found, or if the
+// process may not run on any of its CPUs.
+size_t sys_numa_node_cpus(int node, int *cpus, size_t cap);
+
+// Returns the number of NUMA nodes, 1 if this cannot be determined.
+size_t sys_num_numa_nodes(void);
+
 void safe_pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr);
 void safe_pthread_mutex_destroy(pthread_mutex_t *m);
 
@@ -0,0 +1,192 @@
+
+#include "chsys/arena.h"
+#include "chsys/mem.h"
+#include "chsys/log.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// The block header is padded so that the data which follows it is aligned.
+#define ARENA_BLOCK_HDR_SIZE \
+    ((sizeof(arena_block_t) + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+static inline uint8_t *ab_data(arena_block_t *ab) {
+    return (uint8_t *)ab + ARENA_BLOCK_HDR_SIZE;
+}
+
+static inline size_t align_up(size_t s) {
+    return (s + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+static arena_block_t *new_arena_block(arena_t *a, size_t cap) {
+    arena_block_t *ab;
+
+    if (a->counted) {
+        ab = (arena_block_t *)safe_malloc(ARENA_BLOCK_HDR_SIZE + cap);
+    } else {
+        ab = (arena_block_t *)malloc(ARENA_BLOCK_HDR_SIZE + cap);
+        if (!ab) {
+            log_fatal("Failed to malloc arena block");
+        }
+    }
+
+    ab->next = NULL;
+    ab->cap = cap;
+    ab->used = 0;
+
+    return ab;
+}
+
+static void delete_arena_block(arena_t *a, arena_block_t *ab) {
+    if (a->counted) {
+        safe_free(ab);
+    } else {
+        free(ab);
+    }
+}
+
+static void init_arena(arena_t *a, bool counted, size_t block_size) {
+    a->counted = counted;
+    a->block_size = block_size == 0 ? ARENA_DEFAULT_BLOCK_SIZE : align_up(block_size);
+    a->first = new_arena_block(a, a->block_size);
+    a->curr = a->first;
+}
+
+static void deinit_arena(arena_t *a) {
+    arena_block_t *iter = a->first;
+    arena_block_t *next;
+
+    while (iter) {
+        next = iter->next;
+        delete_arena_block(a, iter);
+        iter = next;
+    }
+}
+
+arena_t *new_arena(size_t block_size) {
+    arena_t *a = (arena_t *)safe_malloc(sizeof(arena_t));
+    init_arena(a, true, block_size);
+
+    return a;
+}
+
+void delete_arena(arena_t *a) {
+    deinit_arena(a);
+    safe_free(a);
+}
+
+void *arena_alloc(arena_t *a, size_t s) {
+    if (s == 0) {
+        return NULL;
+    }
+
+    s = align_up(s);
+
+    arena_block_t *ab = a->curr;
+
+    // Fast path, room in the current block.
+    if (ab->cap - ab->used >= s) {
+        void *mem = ab_data(ab) + ab->used;
+        ab->used += s;
+
+        return mem;
+    }
+
+    // Otherwise, look for a left over block which is large enough.
+    // Blocks which are skipped are left empty until the next reset.
+    arena_block_t *prev = ab;
+    ab = ab->next;
+
+    while (ab && ab->cap < s) {
+        prev = ab;
+        ab = ab->next;
+    }
+
+    if (!ab) {
+        ab = new_arena_block(a, s > a->block_size ? s : a->block_size);
+        prev->next = ab;
+    }
+
+    ab->used = s;
+    a->curr = ab;
+
+    return ab_data(ab);
+}
+
+void *arena_copy(arena_t *a, const void *mem, size_t s) {
+    void *cpy = arena_alloc(a, s);
+
+    if (cpy) {
+        memcpy(cpy, mem, s);
+    }
+
+    return cpy;
+}
+
+void arena_reset(arena_t *a) {
+    // Only blocks up to and including curr can be in use.
+    arena_block_t *iter = a->first;
+
+    while (iter != a->curr) {
+        iter->used = 0;
+        iter = iter->next;
+    }
+
+    a->curr->used = 0;
+    a->curr = a->first;
+}
+
+size_t arena_used(arena_t *a) {
+    size_t used = 0;
+
+    arena_block_t *iter = a->first;
+    while (iter) {
+        used += iter->used;
+        iter = iter->next;
+    }
+
+    return used;
+}
+
+// Scratch arenas.
+
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t scratch_key;
+
+static _Thread_local arena_t *scratch = NULL;
+
+static void delete_scratch_arena(void *arg) {
+    arena_t *a = (arena_t *)arg;
+
+    deinit_arena(a);
+    free(a);
+}
+
+static void create_scratch_key(void) {
+    if (pthread_key_create(&scratch_key, delete_scratch_arena)) {
+        log_fatal("Failed to create scratch arena key");
+    }
+}
+
+arena_t *sys_scratch_arena(void) {
+    if (scratch) {
+        return scratch;
+    }
+
+    pthread_once(&scratch_key_once, create_scratch_key);
+
+    arena_t *a = (arena_t *)malloc(sizeof(arena_t));
+    if (!a) {
+        log_fatal("Failed to malloc scratch arena");
+    }
+
+    init_arena(a, false, ARENA_DEFAULT_BLOCK_SIZE);
+
+    if (pthread_setspecific(scratch_key, a)) {
+        log_fatal("Failed to register scratch arena");
+    }
+
+    scratch = a;
+    return a;
+}
@@ -0,0 +1,332 @@
+
+#include "chsys/event.h"
+#include "chsys/log.h"
+#include "chsys/mem.h"
+#include "chsys/time.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define SYS_EVENT_DEFAULT_MAX_EVENTS 64
+
+static uint32_t to_epoll_events(uint32_t interest) {
+    uint32_t events = EPOLLET | EPOLLRDHUP;
+
+    if (interest & SYS_EV_READ) {
+        events |= EPOLLIN;
+    }
+
+    if (interest & SYS_EV_WRITE) {
+        events |= EPOLLOUT;
+    }
+
+    return events;
+}
+
+static uint32_t from_epoll_events(uint32_t events) {
+    uint32_t evs = 0;
+
+    if (events & EPOLLIN) {
+        evs |= SYS_EV_READ;
+    }
+
+    if (events & EPOLLOUT) {
+        evs |= SYS_EV_WRITE;
+    }
+
+    if (events & (EPOLLHUP | EPOLLRDHUP)) {
+        evs |= SYS_EV_HUP;
+    }
+
+    if (events & EPOLLERR) {
+        evs |= SYS_EV_ERR;
+    }
+
+    return evs;
+}
+
+sys_event_loop_t *new_sys_event_loop(size_t max_events) {
+    if (max_events == 0) {
+        max_events = SYS_EVENT_DEFAULT_MAX_EVENTS;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_fatal("Failed to create epoll instance");
+    }
+
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        log_fatal("Failed to create eventfd");
+    }
+
+    // The wake fd is the only registration without a source.
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLET,
+        .data.ptr = NULL
+    };
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev)) {
+        log_fatal("Failed to watch wake fd");
+    }
+
+    sys_event_loop_t *loop = (sys_event_loop_t *)safe_malloc(sizeof(sys_event_loop_t));
+
+    loop->epoll_fd = epoll_fd;
+    loop->wake_fd = wake_fd;
+    atomic_init(&(loop->stop), false);
+
+    loop->max_events = max_events;
+    loop->events = safe_malloc(sizeof(struct epoll_event) * max_events);
+
+    loop->sources = NULL;
+    loop->removed = NULL;
+
+    return loop;
+}
+
+static void free_removed_sources(sys_event_loop_t *loop) {
+    sys_event_source_t *iter = loop->removed;
+
+    while (iter) {
+        sys_event_source_t *next = iter->next_removed;
+        safe_free(iter);
+        iter = next;
+    }
+
+    loop->removed = NULL;
+}
+
+void delete_sys_event_loop(sys_event_loop_t *loop) {
+    while (loop->sources) {
+        sys_event_remove(loop, loop->sources);
+    }
+
+    free_removed_sources(loop);
+
+    close(loop->wake_fd);
+    close(loop->epoll_fd);
+
+    safe_free(loop->events);
+    safe_free(loop);
+}
+
+// Creates a source and starts watching its fd.
+// Returns NULL on failure.
+static sys_event_source_t *add_source(sys_event_loop_t *loop, sys_event_source_kind_t kind,
+        int fd, uint32_t interest, sys_event_ft cb, void *arg) {
+    sys_event_source_t *src = (sys_event_source_t *)safe_malloc(sizeof(sys_event_source_t));
+
+    src->kind = kind;
+    src->fd = fd;
+    src->interest = interest;
+    src->cb = cb;
+    src->arg = arg;
+    src->count = 0;
+    src->removed = false;
+    src->next_removed = NULL;
+
+    struct epoll_event ev = {
+        .events = to_epoll_events(interest),
+        .data.ptr = src
+    };
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        safe_free(src);
+        return NULL;
+    }
+
+    src->prev = NULL;
+    src->next = loop->sources;
+    if (loop->sources) {
+        loop->sources->prev = src;
+    }
+    loop->sources = src;
+
+    return src;
+}
+
+sys_event_source_t *sys_event_add_fd(sys_event_loop_t *loop, int fd, uint32_t interest,
+        sys_event_ft cb, void *arg) {
+    if (fd < 0) {
+        return NULL;
+    }
+
+    return add_source(loop, SYS_EVENT_SOURCE_FD, fd, interest, cb, arg);
+}
+
+bool sys_event_modify_fd(sys_event_loop_t *loop, sys_event_source_t *src, uint32_t interest) {
+    if (src->kind != SYS_EVENT_SOURCE_FD || src->removed) {
+        return false;
+    }
+
+    struct epoll_event ev = {
+        .events = to_epoll_events(interest),
+        .data.ptr = src
+    };
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, src->fd, &ev)) {
+        return false;
+    }
+
+    src->interest = interest;
+
+    return true;
+}
+
+sys_event_source_t *sys_event_add_timer(sys_event_loop_t *loop, uint64_t initial_ns,
+        uint64_t interval_ns, sys_event_ft cb, void *arg) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        log_fatal("Failed to create timerfd");
+    }
+
+    // An all zero it_value disarms the timer.
+    if (initial_ns == 0) {
+        initial_ns = 1;
+    }
+
+    struct itimerspec its = {
+        .it_value = {
+            .tv_sec = (time_t)(initial_ns / SYS_NS_PER_S),
+            .tv_nsec = (long)(initial_ns % SYS_NS_PER_S)
+        },
+        .it_interval = {
+            .tv_sec = (time_t)(interval_ns / SYS_NS_PER_S),
+            .tv_nsec = (long)(interval_ns % SYS_NS_PER_S)
+        }
+    };
+
+    if (timerfd_settime(fd, 0, &its, NULL)) {
+        log_fatal("Failed to arm timerfd");
+    }
+
+    sys_event_source_t *src = add_source(loop, SYS_EVENT_SOURCE_TIMER, fd, SYS_EV_READ, cb, arg);
+    if (!src) {
+        log_fatal("Failed to watch timerfd");
+    }
+
+    return src;
+}
+
+sys_event_source_t *sys_event_add_notifier(sys_event_loop_t *loop, sys_event_ft cb, void *arg) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        log_fatal("Failed to create eventfd");
+    }
+
+    sys_event_source_t *src = add_source(loop, SYS_EVENT_SOURCE_NOTIFIER, fd, SYS_EV_READ, cb, arg);
+    if (!src) {
+        log_fatal("Failed to watch eventfd");
+    }
+
+    return src;
+}
+
+void sys_event_notify(sys_event_source_t *notifier) {
+    uint64_t one = 1;
+
+    // EAGAIN means the counter is about to overflow, a wake up is pending either way.
+    if (write(notifier->fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_fatal("Failed to write to eventfd");
+    }
+}
+
+void sys_event_remove(sys_event_loop_t *loop, sys_event_source_t *src) {
+    if (src->removed) {
+        return;
+    }
+
+    // A plain fd may have been closed already, in which case epoll has already
+    // dropped it, so errors are ignored.
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+
+    if (src->kind != SYS_EVENT_SOURCE_FD) {
+        close(src->fd);
+    }
+
+    if (src->prev) {
+        src->prev->next = src->next;
+    } else {
+        loop->sources = src->next;
+    }
+
+    if (src->next) {
+        src->next->prev = src->prev;
+    }
+
+    // There may still be events for this source later in the current batch,
+    // so it can't be freed yet.
+    src->removed = true;
+    src->next_removed = loop->removed;
+    loop->removed = src;
+}
+
+int sys_event_loop_run_once(sys_event_loop_t *loop, int timeout_ms) {
+    struct epoll_event *events = (struct epoll_event *)loop->events;
+
+    int n = epoll_wait(loop->epoll_fd, events, (int)loop->max_events, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int dispatched = 0;
+
+    for (int i = 0; i < n; i++) {
+        sys_event_source_t *src = (sys_event_source_t *)events[i].data.ptr;
+
+        if (!src) {
+            // The wake fd, just drain it.
+            uint64_t val;
+            while (read(loop->wake_fd, &val, sizeof(val)) > 0);
+
+            continue;
+        }
+
+        if (src->removed) {
+            continue;
+        }
+
+        if (src->kind != SYS_EVENT_SOURCE_FD) {
+            // Both timerfds and eventfds are read as a single 8 byte counter, which resets it.
+            uint64_t count;
+            if (read(src->fd, &count, sizeof(count)) != sizeof(count)) {
+                // Spurious, e.g. the timer was already read.
+                continue;
+            }
+
+            src->count = count;
+        }
+
+        src->cb(loop, src, from_epoll_events(events[i].events), src->arg);
+        dispatched++;
+    }
+
+    free_removed_sources(loop);
+
+    return dispatched;
+}
+
+void sys_event_loop_run(sys_event_loop_t *loop) {
+    while (!atomic_load(&(loop->stop))) {
+        if (sys_event_loop_run_once(loop, -1) < 0) {
+            log_fatal("Event loop failed to wait on events");
+        }
+    }
+
+    // Allow the loop to be run again.
+    atomic_store(&(loop->stop), false);
+}
+
+void sys_event_loop_stop(sys_event_loop_t *loop) {
+    atomic_store(&(loop->stop), true);
+
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_fatal("Failed to wake event loop");
+    }
+}
@@ -0,0 +1,503 @@
+
+// Needed for syscall.
+#define _GNU_SOURCE
+
+#include "chsys/executor.h"
+#include "chsys/log.h"
+#include "chsys/mem.h"
+#include "chsys/wrappers.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define EXECUTOR_DEQUE_INIT_CAP 256
+
+// Max number of tasks a worker moves from the injection queue at once.
+#define EXECUTOR_INJECT_BATCH 32
+
+// Number of times an idle worker looks for work before parking.
+#define EXECUTOR_SPIN_ROUNDS 64
+
+static _Thread_local executor_worker_t *executor_self = NULL;
+
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+    // Spurious wake ups and EINTR are fine, all callers recheck their condition.
+    syscall(SYS_futex, (unsigned int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int n) {
+    syscall(SYS_futex, (unsigned int *)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__ ("pause");
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+// Chase-Lev Deque
+//
+// The owner pushes and pops at the bottom, thieves steal from the top.
+// Memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli 2013).
+
+static executor_deque_array_t *new_deque_array(size_t cap) {
+    executor_deque_array_t *a = (executor_deque_array_t *)safe_malloc(
+            sizeof(executor_deque_array_t) + (cap * sizeof(_Atomic(executor_task_t *))));
+
+    a->cap = cap;
+    a->retired = NULL;
+
+    return a;
+}
+
+static void init_deque(executor_deque_t *d) {
+    atomic_init(&(d->top), 0);
+    atomic_init(&(d->bottom), 0);
+    atomic_init(&(d->array), new_deque_array(EXECUTOR_DEQUE_INIT_CAP));
+}
+
+static void cleanup_deque(executor_deque_t *d) {
+    executor_deque_array_t *a = atomic_load_explicit(&(d->array), memory_order_relaxed);
+
+    while (a) {
+        executor_deque_array_t *next = a->retired;
+        safe_free(a);
+        a = next;
+    }
+}
+
+static inline executor_task_t *deque_array_get(executor_deque_array_t *a, long long i) {
+    return atomic_load_explicit(&(a->slots[(size_t)i & (a->cap - 1)]), memory_order_relaxed);
+}
+
+static inline void deque_array_put(executor_deque_array_t *a, long long i, executor_task_t *t) {
+    atomic_store_explicit(&(a->slots[(size_t)i & (a->cap - 1)]), t, memory_order_relaxed);
+}
+
+// Owner only.
+static executor_deque_array_t *deque_grow(executor_deque_t *d, executor_deque_array_t *a,
+        long long top, long long bottom) {
+    executor_deque_array_t *grown = new_deque_array(a->cap * 2);
+
+    for (long long i = top; i < bottom; i++) {
+        deque_array_put(grown, i, deque_array_get(a, i));
+    }
+
+    grown->retired = a;
+    atomic_store_explicit(&(d->array), grown, memory_order_release);
+
+    return grown;
+}
+
+// Owner only.
+static void deque_push(executor_deque_t *d, executor_task_t *t) {
+    long long b = atomic_load_explicit(&(d->bottom), memory_order_relaxed);
+    long long top = atomic_load_explicit(&(d->top), memory_order_acquire);
+    executor_deque_array_t *a = atomic_load_explicit(&(d->array), memory_order_relaxed);
+
+    if (b - top > (long long)a->cap - 1) {
+        a = deque_grow(d, a, top, b);
+    }
+
+    deque_array_put(a, b, t);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&(d->bottom), b + 1, memory_order_relaxed);
+}
+
+// Owner only.
+static executor_task_t *deque_pop(executor_deque_t *d) {
+    long long b = atomic_load_explicit(&(d->bottom), memory_order_relaxed) - 1;
+    executor_deque_array_t *a = atomic_load_explicit(&(d->array), memory_order_relaxed);
+
+    atomic_store_explicit(&(d->bottom), b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    long long top = atomic_load_explicit(&(d->top), memory_order_relaxed);
+
+    if (top > b) {
+        // Empty.
+        atomic_store_explicit(&(d->bottom), b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    executor_task_t *t = deque_array_get(a, b);
+
+    if (top == b) {
+        // Last task, race thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&(d->top), &top, top + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+            t = NULL;
+        }
+
+        atomic_store_explicit(&(d->bottom), b + 1, memory_order_relaxed);
+    }
+
+    return t;
+}
+
+// Any thread.
+// Returns NULL if the deque is empty, or if the steal lost a race.
+static executor_task_t *deque_steal(executor_deque_t *d) {
+    long long top = atomic_load_explicit(&(d->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&(d->bottom), memory_order_acquire);
+
+    if (top >= b) {
+        return NULL;
+    }
+
+    executor_deque_array_t *a = atomic_load_explicit(&(d->array), memory_order_acquire);
+    executor_task_t *t = deque_array_get(a, top);
+
+    if (!atomic_compare_exchange_strong_explicit(&(d->top), &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return t;
+}
+
+// Executor
+
+static void executor_task_done(executor_t *e) {
+    if (atomic_fetch_sub(&(e->pending), 1) == 1 && atomic_load(&(e->stop))) {
+        // The executor is being deleted and this was the last task, wake everyone so
+        // they can exit.
+        atomic_fetch_add(&(e->epoch), 1);
+        futex_wake(&(e->epoch), INT_MAX);
+    }
+}
+
+static void executor_run(executor_t *e, executor_task_t *t) {
+    void *result = t->fn(t->arg);
+    executor_future_t *f = t->future;
+
+    if (!f) {
+        safe_free(t);
+    } else {
+        f->result = result;
+
+        // The joiner may free f as soon as it sees DONE.
+        // Waking an address which has been freed is harmless.
+        if (atomic_exchange(&(f->state), EXECUTOR_FUTURE_DONE) == EXECUTOR_FUTURE_WAITED) {
+            futex_wake(&(f->state), INT_MAX);
+        }
+    }
+
+    executor_task_done(e);
+}
+
+// Pops a batch of tasks from the injection queue. The first is returned, the rest are
+// pushed onto w's deque, where other workers can steal them.
+static executor_task_t *executor_take_injected(executor_worker_t *w) {
+    executor_t *e = w->exec;
+
+    if (atomic_load_explicit(&(e->inject_len), memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(e->inject_mut));
+
+    executor_task_t *first = e->inject_head;
+    size_t taken = 0;
+
+    if (first) {
+        executor_task_t *iter = first->next;
+        taken = 1;
+
+        while (iter && taken < EXECUTOR_INJECT_BATCH) {
+            executor_task_t *next = iter->next;
+            deque_push(&(w->deque), iter);
+            iter = next;
+            taken++;
+        }
+
+        e->inject_head = iter;
+        if (!iter) {
+            e->inject_tail = NULL;
+        }
+
+        atomic_fetch_sub(&(e->inject_len), taken);
+    }
+
+    pthread_mutex_unlock(&(e->inject_mut));
+
+    return first;
+}
+
+static inline uint64_t executor_next_rand(executor_worker_t *w) {
+    // xorshift64
+    uint64_t x = w->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    w->rng = x;
+
+    return x;
+}
+
+static executor_task_t *executor_steal(executor_worker_t *w) {
+    executor_t *e = w->exec;
+
+    if (e->num_workers < 2) {
+        return NULL;
+    }
+
+    size_t start = (size_t)(executor_next_rand(w) % e->num_workers);
+
+    for (size_t i = 0; i < e->num_workers; i++) {
+        executor_worker_t *victim = &(e->workers[(start + i) % e->num_workers]);
+        if (victim == w) {
+            continue;
+        }
+
+        executor_task_t *t = deque_steal(&(victim->deque));
+        if (t) {
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+static executor_task_t *executor_find_task(executor_worker_t *w) {
+    executor_task_t *t = deque_pop(&(w->deque));
+
+    if (!t) {
+        t = executor_take_injected(w);
+    }
+
+    if (!t) {
+        t = executor_steal(w);
+    }
+
+    return t;
+}
+
+// Returns true if the worker should exit.
+static bool executor_park(executor_worker_t *w) {
+    executor_t *e = w->exec;
+
+    atomic_fetch_add(&(e->num_parked), 1);
+
+    // Submitters bump the epoch after publishing their task, then wake if anyone is
+    // parked. So, either the check below sees the new task, or the epoch has changed
+    // and the futex wait returns right away.
+    unsigned int epoch = atomic_load(&(e->epoch));
+
+    bool exit = false;
+    executor_task_t *t = executor_find_task(w);
+
+    if (t) {
+        atomic_fetch_sub(&(e->num_parked), 1);
+        executor_run(e, t);
+        return false;
+    }
+
+    if (atomic_load(&(e->stop)) && atomic_load(&(e->pending)) == 0) {
+        exit = true;
+    } else {
+        futex_wait(&(e->epoch), epoch);
+    }
+
+    atomic_fetch_sub(&(e->num_parked), 1);
+
+    return exit;
+}
+
+static void *executor_worker_main(void *arg) {
+    executor_worker_t *w = (executor_worker_t *)arg;
+    executor_self = w;
+
+    while (true) {
+        executor_task_t *t = NULL;
+
+        for (size_t i = 0; i < EXECUTOR_SPIN_ROUNDS && !t; i++) {
+            t = executor_find_task(w);
+            if (!t) {
+                cpu_relax();
+            }
+        }
+
+        if (t) {
+            executor_run(w->exec, t);
+        } else if (executor_park(w)) {
+            break;
+        }
+    }
+
+    executor_self = NULL;
+
+    return NULL;
+}
+
+executor_t *new_executor(size_t num_workers) {
+    if (num_workers == 0) {
+        num_workers = sys_allowed_cpus(NULL, 0);
+        if (num_workers == 0) {
+            num_workers = 1;
+        }
+    }
+
+    executor_t *e = (executor_t *)safe_malloc(sizeof(executor_t));
+
+    e->num_workers = num_workers;
+    e->workers = (executor_worker_t *)safe_malloc(sizeof(executor_worker_t) * num_workers);
+
+    safe_pthread_mutex_init(&(e->inject_mut), NULL);
+    e->inject_head = NULL;
+    e->inject_tail = NULL;
+    atomic_init(&(e->inject_len), 0);
+
+    atomic_init(&(e->epoch), 0);
+    atomic_init(&(e->num_parked), 0);
+    atomic_init(&(e->pending), 0);
+    atomic_init(&(e->stop), false);
+
+    // All deques must exist before any worker tries to steal.
+    for (size_t i = 0; i < num_workers; i++) {
+        executor_worker_t *w = &(e->workers[i]);
+
+        w->exec = e;
+        w->index = i;
+        w->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        init_deque(&(w->deque));
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "exec-w%zu", i);
+
+        sys_thread_placement_t placement = SYS_THREAD_PLACEMENT_DEFAULT;
+        placement.name = name;
+
+        safe_pthread_create_placed(&(e->workers[i].thread), &placement,
+                executor_worker_main, &(e->workers[i]));
+    }
+
+    return e;
+}
+
+void delete_executor(executor_t *e) {
+    if (executor_self) {
+        log_fatal("delete_executor called from within a task");
+    }
+
+    atomic_store(&(e->stop), true);
+    atomic_fetch_add(&(e->epoch), 1);
+    futex_wake(&(e->epoch), INT_MAX);
+
+    for (size_t i = 0; i < e->num_workers; i++) {
+        safe_pthread_join(e->workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < e->num_workers; i++) {
+        cleanup_deque(&(e->workers[i].deque));
+    }
+
+    safe_pthread_mutex_destroy(&(e->inject_mut));
+
+    safe_free(e->workers);
+    safe_free(e);
+}
+
+static void executor_push(executor_t *e, executor_task_t *t) {
+    atomic_fetch_add(&(e->pending), 1);
+
+    executor_worker_t *w = executor_self;
+
+    if (w && w->exec == e) {
+        deque_push(&(w->deque), t);
+    } else {
+        t->next = NULL;
+
+        pthread_mutex_lock(&(e->inject_mut));
+
+        if (e->inject_tail) {
+            e->inject_tail->next = t;
+        } else {
+            e->inject_head = t;
+        }
+        e->inject_tail = t;
+
+        atomic_fetch_add(&(e->inject_len), 1);
+
+        pthread_mutex_unlock(&(e->inject_mut));
+    }
+
+    atomic_fetch_add(&(e->epoch), 1);
+
+    if (atomic_load(&(e->num_parked)) > 0) {
+        futex_wake(&(e->epoch), 1);
+    }
+}
+
+void executor_spawn(executor_t *e, executor_task_ft fn, void *arg) {
+    executor_task_t *t = (executor_task_t *)safe_malloc(sizeof(executor_task_t));
+
+    t->fn = fn;
+    t->arg = arg;
+    t->future = NULL;
+    t->next = NULL;
+
+    executor_push(e, t);
+}
+
+executor_future_t *executor_submit(executor_t *e, executor_task_ft fn, void *arg) {
+    executor_future_t *f = (executor_future_t *)safe_malloc(sizeof(executor_future_t));
+
+    f->task.fn = fn;
+    f->task.arg = arg;
+    f->task.future = f;
+    f->task.next = NULL;
+
+    atomic_init(&(f->state), EXECUTOR_FUTURE_PENDING);
+    f->result = NULL;
+    f->exec = e;
+
+    executor_push(e, &(f->task));
+
+    return f;
+}
+
+void *executor_join(executor_future_t *f) {
+    executor_worker_t *w = executor_self;
+
+    if (w && w->exec == f->exec) {
+        // Parking a worker here could deadlock the pool, help out instead.
+        while (!executor_future_done(f)) {
+            executor_task_t *t = executor_find_task(w);
+
+            if (t) {
+                executor_run(w->exec, t);
+            } else {
+                // The task is running on another worker.
+                sched_yield();
+            }
+        }
+    } else {
+        unsigned int state = EXECUTOR_FUTURE_PENDING;
+        atomic_compare_exchange_strong(&(f->state), &state, EXECUTOR_FUTURE_WAITED);
+
+        while (atomic_load_explicit(&(f->state), memory_order_acquire) != EXECUTOR_FUTURE_DONE) {
+            futex_wait(&(f->state), EXECUTOR_FUTURE_WAITED);
+        }
+    }
+
+    void *result = f->result;
+    safe_free(f);
+
+    return result;
+}
+
+int executor_current_worker(void) {
+    return executor_self ? (int)executor_self->index : -1;
+}
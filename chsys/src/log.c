@@ -1,18 +1,22 @@
 
 #include "chsys/log.h"
+#include "chsys/log_bin.h"
 #include "chsys/sys.h"
+#include "chsys/time.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
-
-typedef struct _log_level_style_t {
-    const char *label;
-    const char *label_style;
-    const char *msg_style;
-} log_level_style_t;
+#include <sys/uio.h>
 
 static const log_level_style_t LOG_LEVEL_TO_STYLE[] = {
     {
@@ -32,6 +36,10 @@ static const log_level_style_t LOG_LEVEL_TO_STYLE[] = {
     },
 };
 
+const log_level_style_t *log_level_style(sys_log_level_t level) {
+    return &(LOG_LEVEL_TO_STYLE[level]);
+}
+
 // Call this when you have the system lock
 // AND you aren't in quiet mode!
 static void _log_any(sys_log_level_t level, const char *fmt, va_list args) {
@@ -50,9 +58,529 @@ static void _log_any(sys_log_level_t level, const char *fmt, va_list args) {
     printf(ANSI_RESET "\n");
 }
 
+// Module levels.
+//
+// Modules are kept in a list so that their levels can be set by name.
+// Per module levels are kept separately, as a module may be given a level
+// before it ever logs.
+//
+// NOTE: This uses its own lock rather than the system lock, since
+// modules can register while the system lock is held.
+
+log_module_t chsys_default_log_module = LOG_MODULE_INIT("default");
+
+typedef struct _log_module_level_t {
+    const char *name;
+    sys_log_level_t level;
+    struct _log_module_level_t *next;
+} log_module_level_t;
+
+static pthread_mutex_t modules_mut = PTHREAD_MUTEX_INITIALIZER;
+static log_module_t *modules = NULL;
+static log_module_level_t *module_levels = NULL;
+static sys_log_level_t default_level = SYS_INFO;
+
+// Must be called with the modules lock.
+static sys_log_level_t module_level(const char *name) {
+    for (log_module_level_t *iter = module_levels; iter; iter = iter->next) {
+        if (strcmp(iter->name, name) == 0) {
+            return iter->level;
+        }
+    }
+
+    return default_level;
+}
+
+void log_module_register(log_module_t *m) {
+    pthread_mutex_lock(&modules_mut);
+
+    // Another thread may have beat us here.
+    if (!atomic_load_explicit(&(m->registered), memory_order_relaxed)) {
+        atomic_store_explicit(&(m->level), (int)module_level(m->name), memory_order_relaxed);
+
+        m->next = modules;
+        modules = m;
+
+        atomic_store_explicit(&(m->registered), true, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&modules_mut);
+}
+
+void sys_log_set_level(sys_log_level_t level) {
+    pthread_mutex_lock(&modules_mut);
+
+    log_module_level_t *iter = module_levels;
+    while (iter) {
+        log_module_level_t *next = iter->next;
+        free(iter);
+        iter = next;
+    }
+
+    module_levels = NULL;
+    default_level = level;
+
+    for (log_module_t *m = modules; m; m = m->next) {
+        atomic_store_explicit(&(m->level), (int)level, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&modules_mut);
+}
+
+void sys_log_set_module_level(const char *name, sys_log_level_t level) {
+    pthread_mutex_lock(&modules_mut);
+
+    log_module_level_t *iter = module_levels;
+    while (iter && strcmp(iter->name, name) != 0) {
+        iter = iter->next;
+    }
+
+    if (!iter) {
+        // The name is copied into the same block.
+        size_t name_len = strlen(name);
+        iter = malloc(sizeof(log_module_level_t) + name_len + 1);
+        if (!iter) {
+            pthread_mutex_unlock(&modules_mut);
+            log_fatal("Failed to malloc module level");
+        }
+
+        char *name_copy = (char *)(iter + 1);
+        memcpy(name_copy, name, name_len + 1);
+
+        iter->name = name_copy;
+        iter->next = module_levels;
+        module_levels = iter;
+    }
+
+    iter->level = level;
+
+    for (log_module_t *m = modules; m; m = m->next) {
+        if (strcmp(m->name, name) == 0) {
+            atomic_store_explicit(&(m->level), (int)level, memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_unlock(&modules_mut);
+}
+
+// Rate limiting.
+
+bool log_rate_limit_pass(log_rate_limit_t *rl, size_t *suppressed) {
+    uint64_t now = sys_now_ns();
+
+    uint64_t tat = atomic_load_explicit(&(rl->tat), memory_order_relaxed);
+    uint64_t new_tat;
+
+    do {
+        new_tat = (tat > now ? tat : now) + rl->interval_ns;
+
+        // Too far ahead, the bucket is empty.
+        if (new_tat - now > rl->burst_ns) {
+            atomic_fetch_add_explicit(&(rl->suppressed), 1, memory_order_relaxed);
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&(rl->tat), &tat, new_tat, 
+                memory_order_relaxed, memory_order_relaxed));
+
+    *suppressed = atomic_exchange_explicit(&(rl->suppressed), 0, memory_order_relaxed);
+
+    return true;
+}
+
+// Async mode state.
+//
+// The ring is a bounded MPMC queue. (Dmitry Vyukov's design)
+// Every slot has a sequence number which tells producers and the consumer
+// whether the slot is free, or holds a published line for a given position.
+//
+// Producers claim positions with a CAS on head. There is only ever one consumer
+// at a time (Either the flusher or a thread calling sys_log_async_flush), which is
+// enforced by the consumer mutex, so tail is only written under that mutex.
+//
+// All memory here is raw malloc'd and not counted.
+
+#define LOG_ASYNC_MAX_BATCH 64
+
+typedef struct _log_slot_t {
+    atomic_size_t seq;
+    size_t len;
+    char line[SYS_LOG_ASYNC_LINE_SIZE];
+} log_slot_t;
+
+typedef struct _log_async_state_t {
+    int fd;
+    size_t cap;
+    unsigned long flush_interval_us;
+
+    log_slot_t *slots;
+
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+
+    atomic_size_t dropped;
+
+    // Only accessed by the consumer.
+    size_t dropped_reported;
+
+    pthread_mutex_t consumer_mut;
+    pthread_t flusher;
+    atomic_bool stop;
+} log_async_state_t;
+
+static atomic_bool las_enabled = false;
+static log_async_state_t las;
+
+static const char LINE_SUFFIX[] = ANSI_RESET "\n";
+
+// Formats a full log line (Same format as _log_any) into buf.
+// Always ends the line with the suffix, truncating the message if needed.
+// Returns the length of the line.
+static size_t format_line(char *buf, size_t buf_size, sys_log_level_t level, 
+        const char *fmt, va_list args) {
+    const log_level_style_t *style = &(LOG_LEVEL_TO_STYLE[level]);
+    const size_t suffix_len = sizeof(LINE_SUFFIX) - 1;
+
+    // Space we are allowed to fill before the suffix (not including the NULL terminator).
+    const size_t body_cap = buf_size - suffix_len - 1;
+
+    int n = snprintf(buf, body_cap + 1, 
+            ANSI_BOLD "(" ANSI_RESET ANSI_BRIGHT_CYAN_FG "%d" ANSI_RESET ANSI_BOLD ") " ANSI_RESET
+            "%s%s%s %s", 
+            getpid(), style->label_style, style->label, ANSI_RESET, style->msg_style);
+
+    size_t len = n < 0 ? 0 : (size_t)n;
+    if (len > body_cap) {
+        len = body_cap;
+    }
+
+    n = vsnprintf(buf + len, body_cap + 1 - len, fmt, args);
+    if (n > 0) {
+        len += (size_t)n;
+        if (len > body_cap) {
+            len = body_cap;
+        }
+    }
+
+    memcpy(buf + len, LINE_SUFFIX, sizeof(LINE_SUFFIX));
+    return len + suffix_len;
+}
+
+// Returns false if the ring was full and the line was dropped.
+static bool log_async_push(sys_log_level_t level, const char *fmt, va_list args) {
+    log_slot_t *slot;
+    size_t pos = atomic_load_explicit(&(las.head), memory_order_relaxed);
+
+    while (true) {
+        slot = &(las.slots[pos & (las.cap - 1)]);
+        size_t seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&(las.head), &pos, pos + 1, 
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+
+            // On failure pos is reloaded for us.
+        } else if (diff < 0) {
+            // This slot still holds a line from one lap ago, the ring is full.
+            atomic_fetch_add_explicit(&(las.dropped), 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&(las.head), memory_order_relaxed);
+        }
+    }
+
+    slot->len = format_line(slot->line, sizeof(slot->line), level, fmt, args);
+
+    // Publish.
+    atomic_store_explicit(&(slot->seq), pos + 1, memory_order_release);
+
+    return true;
+}
+
+// Writes all of iov, retrying on partial writes.
+// Errors are ignored, there is nowhere to report them.
+static void write_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t w = writev(fd, iov, iovcnt);
+
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        size_t written = (size_t)w;
+        while (iovcnt > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void log_async_report_dropped(void) {
+    size_t dropped = atomic_load_explicit(&(las.dropped), memory_order_relaxed);
+    if (dropped == las.dropped_reported) {
+        return;
+    }
+
+    char buf[SYS_LOG_ASYNC_LINE_SIZE];
+    size_t len = (size_t)snprintf(buf, sizeof(buf), 
+            "%s[%zu log entries dropped]" ANSI_RESET "\n", 
+            LOG_LEVEL_TO_STYLE[SYS_WARN].label_style, dropped - las.dropped_reported);
+
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    write_all(las.fd, &iov, 1);
+
+    las.dropped_reported = dropped;
+}
+
+// Writes out one batch of published lines.
+// Must be called with the consumer mutex.
+// Returns the number of lines written.
+static size_t log_async_drain_batch(void) {
+    struct iovec iov[LOG_ASYNC_MAX_BATCH];
+
+    size_t tail = atomic_load_explicit(&(las.tail), memory_order_relaxed);
+    size_t n = 0;
+
+    while (n < LOG_ASYNC_MAX_BATCH) {
+        log_slot_t *slot = &(las.slots[(tail + n) & (las.cap - 1)]);
+        size_t seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+
+        if (seq != tail + n + 1) {
+            // Not yet published.
+            break;
+        }
+
+        iov[n].iov_base = slot->line;
+        iov[n].iov_len = slot->len;
+        n++;
+    }
+
+    if (n > 0) {
+        write_all(las.fd, iov, (int)n);
+    }
+
+    // Lines are only dropped when the ring is full, so the report
+    // belongs after what was in the ring.
+    log_async_report_dropped();
+
+    if (n == 0) {
+        return 0;
+    }
+
+    // Hand the slots back to producers for the next lap.
+    for (size_t i = 0; i < n; i++) {
+        log_slot_t *slot = &(las.slots[(tail + i) & (las.cap - 1)]);
+        atomic_store_explicit(&(slot->seq), tail + i + las.cap, memory_order_release);
+    }
+
+    atomic_store_explicit(&(las.tail), tail + n, memory_order_relaxed);
+
+    return n;
+}
+
+static void *log_async_flusher(void *arg) {
+    (void)arg;
+
+    while (!atomic_load_explicit(&(las.stop), memory_order_acquire)) {
+        pthread_mutex_lock(&(las.consumer_mut));
+        size_t written = log_async_drain_batch();
+        pthread_mutex_unlock(&(las.consumer_mut));
+
+        if (written == 0) {
+            sys_sleep_us(las.flush_interval_us);
+        }
+    }
+
+    return NULL;
+}
+
+static void log_async_spawn_flusher(void) {
+    atomic_store(&(las.stop), false);
+
+    int s = pthread_create(&(las.flusher), NULL, log_async_flusher, NULL);
+    if (s) {
+        atomic_store(&las_enabled, false);
+        log_fatal("Failed to create log flusher thread. (%d)", s);
+    }
+}
+
+static void log_async_reset_ring(void) {
+    for (size_t i = 0; i < las.cap; i++) {
+        atomic_store_explicit(&(las.slots[i].seq), i, memory_order_relaxed);
+    }
+
+    atomic_store(&(las.head), 0);
+    atomic_store(&(las.tail), 0);
+}
+
+void sys_log_async_start(const sys_log_async_config_t *cfg) {
+    if (atomic_load(&las_enabled)) {
+        log_fatal("Async logging already started");
+    }
+
+    if (sys_log_binary_enabled()) {
+        log_fatal("Async logging cannot be used with binary logging");
+    }
+
+    sys_log_async_config_t c = {
+        .fd = -1,
+        .ring_cap = 0,
+        .flush_interval_us = 0,
+    };
+
+    if (cfg) {
+        c = *cfg;
+    }
+
+    if (c.ring_cap == 0) {
+        c.ring_cap = SYS_LOG_ASYNC_DEFAULT_CAP;
+    }
+
+    if ((c.ring_cap & (c.ring_cap - 1)) != 0) {
+        log_fatal("Async log ring capacity must be a power of 2. (%zu)", c.ring_cap);
+    }
+
+    las.fd = c.fd < 0 ? STDOUT_FILENO : c.fd;
+    las.cap = c.ring_cap;
+    las.flush_interval_us = c.flush_interval_us == 0 ? 1000 : c.flush_interval_us;
+
+    las.slots = malloc(sizeof(log_slot_t) * las.cap);
+    if (!las.slots) {
+        log_fatal("Failed to malloc async log ring");
+    }
+
+    log_async_reset_ring();
+
+    atomic_store(&(las.dropped), 0);
+    las.dropped_reported = 0;
+
+    pthread_mutex_init(&(las.consumer_mut), NULL);
+
+    // Anything logged synchronously before now should come first.
+    fflush(stdout);
+
+    atomic_store(&las_enabled, true);
+    log_async_spawn_flusher();
+}
+
+void sys_log_async_stop(void) {
+    if (!atomic_load(&las_enabled)) {
+        return;
+    }
+
+    atomic_store(&(las.stop), true);
+    pthread_join(las.flusher, NULL);
+
+    sys_log_async_flush();
+
+    atomic_store(&las_enabled, false);
+
+    pthread_mutex_destroy(&(las.consumer_mut));
+    free(las.slots);
+    las.slots = NULL;
+}
+
+bool sys_log_async_enabled(void) {
+    return atomic_load(&las_enabled);
+}
+
+void sys_log_async_flush(void) {
+    if (!atomic_load(&las_enabled)) {
+        return;
+    }
+
+    // Every line logged before this call has a position below target.
+    // Some of those positions may be claimed but not yet published,
+    // in which case we just wait for their producers to finish.
+    size_t target = atomic_load(&(las.head));
+
+    pthread_mutex_lock(&(las.consumer_mut));
+    while (atomic_load_explicit(&(las.tail), memory_order_relaxed) < target) {
+        if (log_async_drain_batch() == 0) {
+            sched_yield();
+        }
+    }
+
+    log_async_report_dropped();
+    pthread_mutex_unlock(&(las.consumer_mut));
+}
+
+size_t sys_log_async_dropped(void) {
+    return atomic_load(&(las.dropped));
+}
+
+void sys_log_async_after_fork(void) {
+    if (!atomic_load(&las_enabled)) {
+        return;
+    }
+
+    // The consumer mutex may have been held by a thread which no longer exists.
+    pthread_mutex_init(&(las.consumer_mut), NULL);
+
+    // Lines pending at the time of the fork are the parent's to write.
+    // Some slots could also have been mid-write by threads which don't exist here.
+    log_async_reset_ring();
+    las.dropped_reported = atomic_load(&(las.dropped));
+
+    log_async_spawn_flusher();
+}
+
 void log_any_p(bool acquire_lock, sys_log_level_t level, const char *fmt,...) {
+    // The quiet flag is atomic, no need for the lock.
+    bool quiet = sys_is_quiet_p(false);
+    if (quiet && level != SYS_FATAL) {
+        return;
+    }
+
+    if (sys_log_binary_enabled()) {
+        // Same story as async mode below.
+        if (!quiet) {
+            va_list args;
+            va_start(args, fmt);
+            log_binary_record(level, fmt, args);
+            va_end(args);
+        }
+
+        if (level == SYS_FATAL) {
+            sys_lock_p(acquire_lock);
+            safe_exit_p(false, 1);
+        }
+
+        return;
+    }
+
+    if (atomic_load_explicit(&las_enabled, memory_order_acquire)) {
+        // NOTE: No lock is taken here.
+        if (!quiet) {
+            va_list args;
+            va_start(args, fmt);
+            log_async_push(level, fmt, args);
+            va_end(args);
+        }
+
+        if (level == SYS_FATAL) {
+            // safe_exit flushes the ring for us.
+            sys_lock_p(acquire_lock);
+            safe_exit_p(false, 1);
+        }
+
+        return;
+    }
+
     sys_lock_p(acquire_lock);
-    if (!sys_is_quiet_p(false)) {
+    if (!quiet) {
         va_list args;
         va_start(args, fmt);
         _log_any(level, fmt, args); 
@@ -63,8 +591,3 @@ void log_any_p(bool acquire_lock, sys_log_level_t level, const char *fmt,...) {
     }
     sys_unlock_p(acquire_lock);
 }
-
-
-
-
-
@@ -0,0 +1,1082 @@
+
+#include "chsys/log_bin.h"
+#include "chsys/log.h"
+#include "chsys/sys.h"
+#include "chsys/time.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+
+// File layout (All integers are in native byte order)
+//
+// Header:
+//      char magic[8]       "CHLOGBIN"
+//      u32 version
+//      u8 abi[8]           Sizes of the argument types below, see lb_abi
+//      u64 start_ns        Monotonic clock at start
+//
+// Format record:
+//      u8 tag              LB_REC_FORMAT
+//      u64 id              High 32 bits are the pid of the registering process
+//      u32 len
+//      char fmt[len]
+//
+// Entry record:
+//      u8 tag              LB_REC_ENTRY
+//      u8 level
+//      u64 id
+//      u32 pid
+//      u64 ts_ns
+//      u32 payload_len
+//      u8 payload[payload_len]
+//
+// The payload holds each argument in order. Numbers are stored using their
+// native size. Strings are stored as a u16 length followed by their bytes.
+// (A length of LB_NULL_STR means the string pointer was NULL)
+
+#define LB_MAGIC "CHLOGBIN"
+#define LB_VERSION 1
+
+#define LB_REC_FORMAT 1
+#define LB_REC_ENTRY 2
+
+#define LB_NULL_STR 0xFFFF
+
+#define LB_HEADER_SIZE (8 + 4 + 8 + 8)
+#define LB_ENTRY_HEADER_SIZE (1 + 1 + 8 + 4 + 8 + 4)
+
+// Every argument other than a string takes at most 16 bytes.
+// Strings share whatever is left of the payload after that.
+#define LB_MAX_PAYLOAD 0x1000
+#define LB_MAX_STR_TOTAL (LB_MAX_PAYLOAD - (LOG_BIN_MAX_ARGS * (16 + 2)))
+#define LB_MAX_RECORD (LB_ENTRY_HEADER_SIZE + LB_MAX_PAYLOAD)
+
+#define LB_BUF_SIZE 0x10000
+
+#define LB_CACHE_SIZE 64
+
+typedef enum _lb_arg_type_t {
+    LB_ARG_NONE = 0, // Used for "%%"
+    LB_ARG_INT,
+    LB_ARG_LONG,
+    LB_ARG_LLONG,
+    LB_ARG_INTMAX,
+    LB_ARG_SIZE,
+    LB_ARG_PTRDIFF,
+    LB_ARG_DOUBLE,
+    LB_ARG_LDOUBLE,
+    LB_ARG_STR,
+    LB_ARG_PTR,
+} lb_arg_type_t;
+
+static const uint8_t lb_abi[8] = {
+    sizeof(long), sizeof(long long), sizeof(intmax_t), sizeof(size_t),
+    sizeof(ptrdiff_t), sizeof(long double), sizeof(void *), 0
+};
+
+// Conversion spec parsing. (Shared by the recorder and the decoder)
+
+typedef struct _lb_spec_t {
+    bool width_star;
+    bool prec_star;
+    lb_arg_type_t type;
+} lb_spec_t;
+
+// p should point just after a '%'.
+// Returns a pointer just after the conversion character, or NULL if the spec
+// is not supported.
+static const char *lb_parse_spec(const char *p, lb_spec_t *spec) {
+    spec->width_star = false;
+    spec->prec_star = false;
+    spec->type = LB_ARG_NONE;
+
+    if (*p == '%') {
+        return p + 1;
+    }
+
+    while (*p && strchr("-+ #0'", *p)) {
+        p++;
+    }
+
+    if (*p == '*') {
+        spec->width_star = true;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->prec_star = true;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+    }
+
+    // Length modifier.
+    lb_arg_type_t int_type = LB_ARG_INT;
+    bool long_double = false;
+    bool wide = false;
+
+    if (p[0] == 'h') {
+        p += p[1] == 'h' ? 2 : 1;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        int_type = LB_ARG_LLONG;
+        p += 2;
+    } else if (p[0] == 'l') {
+        int_type = LB_ARG_LONG;
+        wide = true;
+        p++;
+    } else if (p[0] == 'j') {
+        int_type = LB_ARG_INTMAX;
+        p++;
+    } else if (p[0] == 'z') {
+        int_type = LB_ARG_SIZE;
+        p++;
+    } else if (p[0] == 't') {
+        int_type = LB_ARG_PTRDIFF;
+        p++;
+    } else if (p[0] == 'L') {
+        long_double = true;
+        p++;
+    }
+
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        spec->type = int_type;
+        break;
+
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A':
+        spec->type = long_double ? LB_ARG_LDOUBLE : LB_ARG_DOUBLE;
+        break;
+
+    case 'c':
+        if (wide) {
+            return NULL;
+        }
+        spec->type = LB_ARG_INT;
+        break;
+
+    case 's':
+        if (wide) {
+            return NULL;
+        }
+        spec->type = LB_ARG_STR;
+        break;
+
+    case 'p':
+        spec->type = LB_ARG_PTR;
+        break;
+
+    default:
+        // %n, %ls, or garbage.
+        return NULL;
+    }
+
+    return p + 1;
+}
+
+// Writes the argument types of fmt into types.
+// Returns the number of arguments, or -1 if fmt is not supported.
+static int lb_parse_fmt(const char *fmt, uint8_t *types) {
+    int n = 0;
+    lb_spec_t spec;
+
+    const char *p = fmt;
+    while ((p = strchr(p, '%'))) {
+        p = lb_parse_spec(p + 1, &spec);
+        if (!p) {
+            return -1;
+        }
+
+        if (spec.type == LB_ARG_NONE) {
+            continue;
+        }
+
+        int needed = 1 + spec.width_star + spec.prec_star;
+        if (n + needed > LOG_BIN_MAX_ARGS) {
+            return -1;
+        }
+
+        if (spec.width_star) {
+            types[n++] = LB_ARG_INT;
+        }
+
+        if (spec.prec_star) {
+            types[n++] = LB_ARG_INT;
+        }
+
+        types[n++] = (uint8_t)spec.type;
+    }
+
+    return n;
+}
+
+// Recorder state.
+//
+// Everything here uses raw malloc and is not counted.
+
+typedef struct _lb_format_t {
+    const char *fmt;
+    uint64_t id;
+
+    // When false, records of this format have no payload.
+    bool supported;
+    uint8_t num_args;
+    uint8_t arg_types[LOG_BIN_MAX_ARGS];
+} lb_format_t;
+
+typedef struct _lb_buf_t {
+    // Held while a record is being written, or while the buffer is being flushed.
+    // Only ever contended by sys_log_binary_flush.
+    atomic_flag lock;
+
+    size_t len;
+
+    struct _lb_buf_t *prev;
+    struct _lb_buf_t *next;
+
+    uint8_t data[LB_BUF_SIZE];
+} lb_buf_t;
+
+typedef struct _lb_state_t {
+    int fd;
+
+    // Cached, so records don't make a syscall.
+    // Set on start, and refreshed in the child after a fork.
+    uint32_t pid;
+
+    // Protects writes to fd.
+    pthread_mutex_t file_mut;
+
+    // Protects the format registry.
+    // Open addressing on the format string address.
+    pthread_mutex_t reg_mut;
+    lb_format_t **table;
+    size_t table_cap;
+    size_t num_formats;
+
+    // Protects the list of thread buffers.
+    pthread_mutex_t bufs_mut;
+    lb_buf_t *bufs;
+} lb_state_t;
+
+static atomic_bool lb_enabled = false;
+static lb_state_t lb;
+
+// Incremented every start, so that thread caches from a previous
+// start are never used.
+static atomic_uint lb_generation = 0;
+
+typedef struct _lb_cache_entry_t {
+    const char *fmt;
+    unsigned int gen;
+    lb_format_t *f;
+} lb_cache_entry_t;
+
+static _Thread_local lb_cache_entry_t lb_cache[LB_CACHE_SIZE];
+static _Thread_local lb_buf_t *lb_tbuf = NULL;
+
+static pthread_once_t lb_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lb_key;
+
+// Errors are ignored, there is nowhere to report them.
+static void lb_write_all(const uint8_t *data, size_t len) {
+    pthread_mutex_lock(&(lb.file_mut));
+
+    while (len > 0) {
+        ssize_t w = write(lb.fd, data, len);
+
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        data += w;
+        len -= (size_t)w;
+    }
+
+    pthread_mutex_unlock(&(lb.file_mut));
+}
+
+static inline uint8_t *lb_put(uint8_t *dest, const void *src, size_t len) {
+    memcpy(dest, src, len);
+    return dest + len;
+}
+
+static inline size_t lb_hash_ptr(const void *p) {
+    uint64_t x = (uint64_t)(uintptr_t)p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+// Must be called with the registry lock.
+static void lb_table_insert(lb_format_t *f) {
+    size_t i = lb_hash_ptr(f->fmt) & (lb.table_cap - 1);
+    while (lb.table[i]) {
+        i = (i + 1) & (lb.table_cap - 1);
+    }
+    lb.table[i] = f;
+}
+
+// Must be called with the registry lock.
+static void lb_table_grow(void) {
+    lb_format_t **old = lb.table;
+    size_t old_cap = lb.table_cap;
+
+    lb.table_cap = old_cap ? old_cap * 2 : 64;
+    lb.table = calloc(lb.table_cap, sizeof(lb_format_t *));
+    if (!lb.table) {
+        log_fatal("Failed to grow binary log format table");
+    }
+
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            lb_table_insert(old[i]);
+        }
+    }
+
+    free(old);
+}
+
+static lb_format_t *lb_register(const char *fmt) {
+    pthread_mutex_lock(&(lb.reg_mut));
+
+    if (lb.table_cap > 0) {
+        size_t i = lb_hash_ptr(fmt) & (lb.table_cap - 1);
+        while (lb.table[i]) {
+            if (lb.table[i]->fmt == fmt) {
+                lb_format_t *f = lb.table[i];
+                pthread_mutex_unlock(&(lb.reg_mut));
+                return f;
+            }
+            i = (i + 1) & (lb.table_cap - 1);
+        }
+    }
+
+    // Not found, create a new format.
+    if ((lb.num_formats + 1) * 2 > lb.table_cap) {
+        lb_table_grow();
+    }
+
+    lb_format_t *f = malloc(sizeof(lb_format_t));
+    if (!f) {
+        log_fatal("Failed to malloc binary log format");
+    }
+
+    f->fmt = fmt;
+    f->id = ((uint64_t)lb.pid << 32) | (uint64_t)(uint32_t)lb.num_formats;
+
+    int n = lb_parse_fmt(fmt, f->arg_types);
+    f->supported = n >= 0;
+    f->num_args = n >= 0 ? (uint8_t)n : 0;
+
+    lb_table_insert(f);
+    lb.num_formats++;
+
+    // The format must be in the file before any thread buffer holding an
+    // entry which uses it, so it is written right away.
+    size_t fmt_len = strlen(fmt);
+    size_t rec_len = 1 + 8 + 4 + fmt_len;
+    uint8_t *rec = malloc(rec_len);
+    if (!rec) {
+        log_fatal("Failed to malloc binary log format record");
+    }
+
+    uint8_t tag = LB_REC_FORMAT;
+    uint32_t len32 = (uint32_t)fmt_len;
+
+    uint8_t *iter = rec;
+    iter = lb_put(iter, &tag, 1);
+    iter = lb_put(iter, &(f->id), 8);
+    iter = lb_put(iter, &len32, 4);
+    lb_put(iter, fmt, fmt_len);
+
+    lb_write_all(rec, rec_len);
+    free(rec);
+
+    pthread_mutex_unlock(&(lb.reg_mut));
+
+    return f;
+}
+
+static lb_format_t *lb_lookup(const char *fmt) {
+    unsigned int gen = atomic_load_explicit(&lb_generation, memory_order_relaxed);
+    lb_cache_entry_t *ce = &(lb_cache[lb_hash_ptr(fmt) & (LB_CACHE_SIZE - 1)]);
+
+    if (ce->fmt == fmt && ce->gen == gen) {
+        return ce->f;
+    }
+
+    lb_format_t *f = lb_register(fmt);
+
+    ce->fmt = fmt;
+    ce->gen = gen;
+    ce->f = f;
+
+    return f;
+}
+
+static inline void lb_buf_lock(lb_buf_t *b) {
+    while (atomic_flag_test_and_set_explicit(&(b->lock), memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+static inline void lb_buf_unlock(lb_buf_t *b) {
+    atomic_flag_clear_explicit(&(b->lock), memory_order_release);
+}
+
+// Must be called with the buffer lock.
+static void lb_buf_flush(lb_buf_t *b) {
+    if (b->len > 0) {
+        lb_write_all(b->data, b->len);
+        b->len = 0;
+    }
+}
+
+static void lb_delete_thread_buf(void *arg) {
+    lb_buf_t *b = (lb_buf_t *)arg;
+
+    pthread_mutex_lock(&(lb.bufs_mut));
+
+    if (b->prev) {
+        b->prev->next = b->next;
+    } else {
+        lb.bufs = b->next;
+    }
+
+    if (b->next) {
+        b->next->prev = b->prev;
+    }
+
+    // Only write if binary logging is still going.
+    lb_buf_lock(b);
+    if (atomic_load(&lb_enabled)) {
+        lb_buf_flush(b);
+    }
+    lb_buf_unlock(b);
+
+    pthread_mutex_unlock(&(lb.bufs_mut));
+
+    free(b);
+}
+
+static void lb_create_key(void) {
+    if (pthread_key_create(&lb_key, lb_delete_thread_buf)) {
+        log_fatal("Failed to create binary log buffer key");
+    }
+}
+
+static lb_buf_t *lb_thread_buf(void) {
+    if (lb_tbuf) {
+        return lb_tbuf;
+    }
+
+    pthread_once(&lb_key_once, lb_create_key);
+
+    lb_buf_t *b = malloc(sizeof(lb_buf_t));
+    if (!b) {
+        log_fatal("Failed to malloc binary log buffer");
+    }
+
+    atomic_flag_clear(&(b->lock));
+    b->len = 0;
+    b->prev = NULL;
+
+    pthread_mutex_lock(&(lb.bufs_mut));
+    b->next = lb.bufs;
+    if (lb.bufs) {
+        lb.bufs->prev = b;
+    }
+    lb.bufs = b;
+    pthread_mutex_unlock(&(lb.bufs_mut));
+
+    if (pthread_setspecific(lb_key, b)) {
+        log_fatal("Failed to register binary log buffer");
+    }
+
+    lb_tbuf = b;
+    return b;
+}
+
+void log_binary_record(sys_log_level_t level, const char *fmt, va_list args) {
+    lb_format_t *f = lb_lookup(fmt);
+    lb_buf_t *b = lb_thread_buf();
+
+    lb_buf_lock(b);
+
+    if (LB_BUF_SIZE - b->len < LB_MAX_RECORD) {
+        lb_buf_flush(b);
+    }
+
+    uint8_t *rec = b->data + b->len;
+
+    // Header fields are filled in below, after the payload length is known.
+    uint8_t *payload = rec + LB_ENTRY_HEADER_SIZE;
+    uint8_t *iter = payload;
+    size_t str_budget = LB_MAX_STR_TOTAL;
+
+    for (uint8_t i = 0; i < f->num_args; i++) {
+        switch ((lb_arg_type_t)f->arg_types[i]) {
+        case LB_ARG_INT: {
+            int v = va_arg(args, int);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_LONG: {
+            long v = va_arg(args, long);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_LLONG: {
+            long long v = va_arg(args, long long);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_INTMAX: {
+            intmax_t v = va_arg(args, intmax_t);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_SIZE: {
+            size_t v = va_arg(args, size_t);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_PTRDIFF: {
+            ptrdiff_t v = va_arg(args, ptrdiff_t);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_DOUBLE: {
+            double v = va_arg(args, double);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_LDOUBLE: {
+            long double v = va_arg(args, long double);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_PTR: {
+            void *v = va_arg(args, void *);
+            iter = lb_put(iter, &v, sizeof(v));
+            break;
+        }
+        case LB_ARG_STR: {
+            const char *v = va_arg(args, const char *);
+            uint16_t len16;
+
+            if (!v) {
+                len16 = LB_NULL_STR;
+                iter = lb_put(iter, &len16, 2);
+                break;
+            }
+
+            size_t cap = str_budget < LOG_BIN_MAX_STR ? str_budget : LOG_BIN_MAX_STR;
+            size_t len = strnlen(v, cap);
+            str_budget -= len;
+
+            len16 = (uint16_t)len;
+            iter = lb_put(iter, &len16, 2);
+            iter = lb_put(iter, v, len);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    uint8_t tag = LB_REC_ENTRY;
+    uint8_t lvl = (uint8_t)level;
+    uint64_t ts = sys_now_ns();
+    uint32_t payload_len = (uint32_t)(iter - payload);
+
+    uint8_t *hdr = rec;
+    hdr = lb_put(hdr, &tag, 1);
+    hdr = lb_put(hdr, &lvl, 1);
+    hdr = lb_put(hdr, &(f->id), 8);
+    hdr = lb_put(hdr, &(lb.pid), 4);
+    hdr = lb_put(hdr, &ts, 8);
+    lb_put(hdr, &payload_len, 4);
+
+    b->len += LB_ENTRY_HEADER_SIZE + payload_len;
+
+    lb_buf_unlock(b);
+}
+
+static void lb_clear_registry(void) {
+    for (size_t i = 0; i < lb.table_cap; i++) {
+        free(lb.table[i]);
+    }
+
+    free(lb.table);
+
+    lb.table = NULL;
+    lb.table_cap = 0;
+    lb.num_formats = 0;
+}
+
+void sys_log_binary_start(int fd) {
+    if (atomic_load(&lb_enabled)) {
+        log_fatal("Binary logging already started");
+    }
+
+    if (sys_log_async_enabled()) {
+        log_fatal("Binary logging cannot be used with async logging");
+    }
+
+    lb.fd = fd;
+    lb.pid = (uint32_t)getpid();
+
+    // The buffer list is left alone, as buffers from a previous start
+    // still belong to their threads.
+    static bool mutexes_init = false;
+    if (!mutexes_init) {
+        pthread_mutex_init(&(lb.file_mut), NULL);
+        pthread_mutex_init(&(lb.reg_mut), NULL);
+        pthread_mutex_init(&(lb.bufs_mut), NULL);
+        mutexes_init = true;
+    }
+
+    atomic_fetch_add(&lb_generation, 1);
+
+    uint8_t hdr[LB_HEADER_SIZE];
+    uint32_t version = LB_VERSION;
+    uint64_t start_ns = sys_now_ns();
+
+    uint8_t *iter = hdr;
+    iter = lb_put(iter, LB_MAGIC, 8);
+    iter = lb_put(iter, &version, 4);
+    iter = lb_put(iter, lb_abi, 8);
+    lb_put(iter, &start_ns, 8);
+
+    lb_write_all(hdr, sizeof(hdr));
+
+    atomic_store(&lb_enabled, true);
+}
+
+void sys_log_binary_stop(void) {
+    if (!atomic_load(&lb_enabled)) {
+        return;
+    }
+
+    sys_log_binary_flush();
+    atomic_store(&lb_enabled, false);
+
+    pthread_mutex_lock(&(lb.reg_mut));
+    lb_clear_registry();
+    pthread_mutex_unlock(&(lb.reg_mut));
+}
+
+bool sys_log_binary_enabled(void) {
+    return atomic_load_explicit(&lb_enabled, memory_order_acquire);
+}
+
+void sys_log_binary_flush(void) {
+    if (!atomic_load(&lb_enabled)) {
+        return;
+    }
+
+    pthread_mutex_lock(&(lb.bufs_mut));
+
+    for (lb_buf_t *b = lb.bufs; b; b = b->next) {
+        lb_buf_lock(b);
+        lb_buf_flush(b);
+        lb_buf_unlock(b);
+    }
+
+    pthread_mutex_unlock(&(lb.bufs_mut));
+}
+
+void sys_log_binary_after_fork(void) {
+    if (!atomic_load(&lb_enabled)) {
+        return;
+    }
+
+    lb.pid = (uint32_t)getpid();
+
+    // Any of these may have been held by a thread which no longer exists.
+    pthread_mutex_init(&(lb.file_mut), NULL);
+    pthread_mutex_init(&(lb.reg_mut), NULL);
+    pthread_mutex_init(&(lb.bufs_mut), NULL);
+
+    // Only this thread survives, so all other buffers can go.
+    lb_buf_t *iter = lb.bufs;
+    while (iter) {
+        lb_buf_t *next = iter->next;
+        if (iter != lb_tbuf) {
+            free(iter);
+        }
+        iter = next;
+    }
+
+    lb.bufs = lb_tbuf;
+
+    if (lb_tbuf) {
+        atomic_flag_clear(&(lb_tbuf->lock));
+        lb_tbuf->len = 0;
+        lb_tbuf->prev = NULL;
+        lb_tbuf->next = NULL;
+    }
+
+    // The registry is kept. Its formats were already written by the parent.
+}
+
+// Decoding.
+
+typedef struct _lb_decode_format_t {
+    uint64_t id;
+    char *fmt;
+} lb_decode_format_t;
+
+typedef struct _lb_decoder_t {
+    FILE *in;
+    FILE *out;
+    bool color;
+
+    uint64_t start_ns;
+
+    // Open addressing on id.
+    lb_decode_format_t *table;
+    size_t table_cap;
+    size_t num_formats;
+} lb_decoder_t;
+
+static bool lb_read(lb_decoder_t *d, void *dest, size_t len) {
+    return fread(dest, 1, len, d->in) == len;
+}
+
+static lb_decode_format_t *lb_decode_slot(lb_decode_format_t *table, size_t cap, uint64_t id) {
+    size_t i = lb_hash_ptr((const void *)(uintptr_t)id) & (cap - 1);
+    while (table[i].fmt && table[i].id != id) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &(table[i]);
+}
+
+static bool lb_decode_add_format(lb_decoder_t *d, uint64_t id, char *fmt) {
+    if ((d->num_formats + 1) * 2 > d->table_cap) {
+        size_t new_cap = d->table_cap ? d->table_cap * 2 : 64;
+        lb_decode_format_t *new_table = calloc(new_cap, sizeof(lb_decode_format_t));
+        if (!new_table) {
+            return false;
+        }
+
+        for (size_t i = 0; i < d->table_cap; i++) {
+            if (d->table[i].fmt) {
+                *lb_decode_slot(new_table, new_cap, d->table[i].id) = d->table[i];
+            }
+        }
+
+        free(d->table);
+        d->table = new_table;
+        d->table_cap = new_cap;
+    }
+
+    lb_decode_format_t *slot = lb_decode_slot(d->table, d->table_cap, id);
+    if (slot->fmt) {
+        // Redefinition, should never happen.
+        free(slot->fmt);
+    } else {
+        d->num_formats++;
+    }
+
+    slot->id = id;
+    slot->fmt = fmt;
+
+    return true;
+}
+
+static const char *lb_decode_lookup(lb_decoder_t *d, uint64_t id) {
+    if (d->table_cap == 0) {
+        return NULL;
+    }
+
+    return lb_decode_slot(d->table, d->table_cap, id)->fmt;
+}
+
+// Copies len bytes out of the payload.
+static bool lb_take(const uint8_t **iter, const uint8_t *end, void *dest, size_t len) {
+    if ((size_t)(end - *iter) < len) {
+        return false;
+    }
+
+    memcpy(dest, *iter, len);
+    *iter += len;
+    return true;
+}
+
+// Renders one conversion spec, spec_start points to the '%'.
+static bool lb_render_spec(lb_decoder_t *d, const char *spec_start, const char *spec_end,
+        const lb_spec_t *spec, const uint8_t **iter, const uint8_t *end) {
+    // Stars are replaced by the values they consumed, so the spec can be
+    // handed to fprintf with just one argument.
+    char spec_buf[128];
+    size_t len = 0;
+
+    for (const char *p = spec_start; p < spec_end; p++) {
+        if (*p == '*') {
+            int v;
+            if (!lb_take(iter, end, &v, sizeof(v))) {
+                return false;
+            }
+
+            int n = snprintf(spec_buf + len, sizeof(spec_buf) - len, "%d", v);
+            if (n < 0 || (size_t)n >= sizeof(spec_buf) - len) {
+                return false;
+            }
+            len += (size_t)n;
+        } else {
+            if (len + 1 >= sizeof(spec_buf)) {
+                return false;
+            }
+            spec_buf[len++] = *p;
+        }
+    }
+
+    spec_buf[len] = '\0';
+
+    switch (spec->type) {
+
+#define LB_RENDER_CASE(tag, type) \
+    case tag: { \
+        type v; \
+        if (!lb_take(iter, end, &v, sizeof(v))) { \
+            return false; \
+        } \
+        fprintf(d->out, spec_buf, v); \
+        return true; \
+    }
+
+    LB_RENDER_CASE(LB_ARG_INT, int)
+    LB_RENDER_CASE(LB_ARG_LONG, long)
+    LB_RENDER_CASE(LB_ARG_LLONG, long long)
+    LB_RENDER_CASE(LB_ARG_INTMAX, intmax_t)
+    LB_RENDER_CASE(LB_ARG_SIZE, size_t)
+    LB_RENDER_CASE(LB_ARG_PTRDIFF, ptrdiff_t)
+    LB_RENDER_CASE(LB_ARG_DOUBLE, double)
+    LB_RENDER_CASE(LB_ARG_LDOUBLE, long double)
+    LB_RENDER_CASE(LB_ARG_PTR, void *)
+
+#undef LB_RENDER_CASE
+
+    case LB_ARG_STR: {
+        uint16_t len16;
+        if (!lb_take(iter, end, &len16, 2)) {
+            return false;
+        }
+
+        if (len16 == LB_NULL_STR) {
+            fprintf(d->out, spec_buf, "(null)");
+            return true;
+        }
+
+        char str[LOG_BIN_MAX_STR + 1];
+        if (len16 > LOG_BIN_MAX_STR || !lb_take(iter, end, str, len16)) {
+            return false;
+        }
+        str[len16] = '\0';
+
+        fprintf(d->out, spec_buf, str);
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+static bool lb_render_entry(lb_decoder_t *d, const char *fmt, const uint8_t *payload, size_t payload_len) {
+    uint8_t types[LOG_BIN_MAX_ARGS];
+    if (lb_parse_fmt(fmt, types) < 0) {
+        // Recorded without arguments.
+        fputs(fmt, d->out);
+        return true;
+    }
+
+    const uint8_t *iter = payload;
+    const uint8_t *end = payload + payload_len;
+
+    const char *p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            fputc(*p, d->out);
+            p++;
+            continue;
+        }
+
+        lb_spec_t spec;
+        const char *spec_end = lb_parse_spec(p + 1, &spec);
+
+        if (spec.type == LB_ARG_NONE) {
+            fputc('%', d->out);
+        } else if (!lb_render_spec(d, p, spec_end, &spec, &iter, end)) {
+            return false;
+        }
+
+        p = spec_end;
+    }
+
+    return true;
+}
+
+static bool lb_decode_entry(lb_decoder_t *d) {
+    uint8_t lvl;
+    uint64_t id;
+    uint32_t pid;
+    uint64_t ts;
+    uint32_t payload_len;
+
+    if (!lb_read(d, &lvl, 1) || !lb_read(d, &id, 8) || !lb_read(d, &pid, 4) ||
+            !lb_read(d, &ts, 8) || !lb_read(d, &payload_len, 4)) {
+        return false;
+    }
+
+    if (lvl > SYS_FATAL || payload_len > LB_MAX_PAYLOAD) {
+        return false;
+    }
+
+    uint8_t payload[LB_MAX_PAYLOAD];
+    if (!lb_read(d, payload, payload_len)) {
+        return false;
+    }
+
+    const char *fmt = lb_decode_lookup(d, id);
+    if (!fmt) {
+        return false;
+    }
+
+    const log_level_style_t *style = log_level_style((sys_log_level_t)lvl);
+    double secs = (double)(int64_t)(ts - d->start_ns) / 1e9;
+
+    if (d->color) {
+        fprintf(d->out,
+                ANSI_BOLD "(" ANSI_RESET ANSI_BRIGHT_CYAN_FG "%u" ANSI_RESET ANSI_BOLD ") " ANSI_RESET
+                "%s%s%s " ANSI_BRIGHT_BLACK_FG "[%+.6f]" ANSI_RESET " %s",
+                pid, style->label_style, style->label, ANSI_RESET, secs, style->msg_style);
+    } else {
+        fprintf(d->out, "(%u) %s [%+.6f] ", pid, style->label, secs);
+    }
+
+    bool ok = lb_render_entry(d, fmt, payload, payload_len);
+
+    fputs(d->color ? ANSI_RESET "\n" : "\n", d->out);
+
+    return ok;
+}
+
+static bool lb_decode_format(lb_decoder_t *d) {
+    uint64_t id;
+    uint32_t len;
+
+    if (!lb_read(d, &id, 8) || !lb_read(d, &len, 4)) {
+        return false;
+    }
+
+    char *fmt = malloc((size_t)len + 1);
+    if (!fmt) {
+        return false;
+    }
+
+    if (!lb_read(d, fmt, len)) {
+        free(fmt);
+        return false;
+    }
+
+    fmt[len] = '\0';
+
+    if (!lb_decode_add_format(d, id, fmt)) {
+        free(fmt);
+        return false;
+    }
+
+    return true;
+}
+
+// A header is written on every start, so headers can show up between records.
+static bool lb_decode_header(lb_decoder_t *d) {
+    // The magic's first byte has already been read.
+    char magic[7];
+    uint32_t version;
+    uint8_t abi[8];
+
+    if (!lb_read(d, magic, 7) || memcmp(magic, LB_MAGIC + 1, 7) != 0) {
+        return false;
+    }
+
+    if (!lb_read(d, &version, 4) || version != LB_VERSION) {
+        return false;
+    }
+
+    if (!lb_read(d, abi, 8) || memcmp(abi, lb_abi, 8) != 0) {
+        return false;
+    }
+
+    return lb_read(d, &(d->start_ns), 8);
+}
+
+bool sys_log_binary_decode(FILE *in, FILE *out, bool color) {
+    lb_decoder_t d = {
+        .in = in,
+        .out = out,
+        .color = color,
+        .start_ns = 0,
+        .table = NULL,
+        .table_cap = 0,
+        .num_formats = 0,
+    };
+
+    // The file must start with a header.
+    int c = fgetc(in);
+    bool ok = c == LB_MAGIC[0] && lb_decode_header(&d);
+
+    while (ok && (c = fgetc(in)) != EOF) {
+        switch (c) {
+        case LB_REC_FORMAT:
+            ok = lb_decode_format(&d);
+            break;
+
+        case LB_REC_ENTRY:
+            ok = lb_decode_entry(&d);
+            break;
+
+        case 'C': // LB_MAGIC[0]
+            ok = lb_decode_header(&d);
+            break;
+
+        default:
+            ok = false;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < d.table_cap; i++) {
+        free(d.table[i].fmt);
+    }
+    free(d.table);
+
+    return ok;
+}
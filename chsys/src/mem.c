@@ -1,41 +1,416 @@
 
+// Needed for MAP_ANONYMOUS, MADV_HUGEPAGE and mremap.
+#define _GNU_SOURCE
 
 #include "chsys/mem.h"
 #include "chsys/log.h"
 #include "chsys/sys.h"
+
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Thread Caching.
+//
+// When enabled, small blocks freed by a thread are kept in that thread's cache
+// and reused by its later allocations, without touching the system allocator.
+//
+// Blocks are always real malloc'd blocks, so we don't need to remember their size class.
+// On free, the class is derived from the block's usable size. This also means a
+// block can be freed into any thread's cache, no matter which thread allocated it.
+// 
+// When a thread cache is full, a batch of blocks is moved to a shared depot.
+// (So memory freed on one thread isn't stuck there) 
+// When a thread cache is empty, it takes a batch from the depot before falling back to malloc.
+
+#define MEM_CACHE_CLASS_SIZE 16
+#define MEM_CACHE_NUM_CLASSES 32
+#define MEM_CACHE_MAX_SIZE (MEM_CACHE_CLASS_SIZE * MEM_CACHE_NUM_CLASSES)
+
+#define MEM_CACHE_CAP 32
+#define MEM_CACHE_BATCH_SIZE 16
+
+typedef struct _mem_cache_blk_t {
+    struct _mem_cache_blk_t *next;
+} mem_cache_blk_t;
+
+typedef struct _mem_cache_list_t {
+    size_t len;
+    mem_cache_blk_t *head;
+} mem_cache_list_t;
+
+typedef struct _mem_cache_t {
+    mem_cache_list_t lists[MEM_CACHE_NUM_CLASSES];
+} mem_cache_t;
+
+#ifdef CHSYS_MEM_CACHE
+static atomic_bool mem_caching = true;
+#else
+static atomic_bool mem_caching = false;
+#endif
+
+static pthread_mutex_t depot_mut = PTHREAD_MUTEX_INITIALIZER;
+static mem_cache_list_t depot[MEM_CACHE_NUM_CLASSES];
+
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+static _Thread_local mem_cache_t *thread_cache = NULL;
+
+// Set once this thread's cache has been destroyed.
+// Other thread exit destructors (e.g. a pool's) may still allocate and free after ours,
+// those calls must go straight to the system allocator.
+static _Thread_local bool thread_exiting = false;
+
+static inline void mcl_push(mem_cache_list_t *mcl, mem_cache_blk_t *blk) {
+    blk->next = mcl->head;
+    mcl->head = blk;
+    mcl->len++;
+}
+
+static inline mem_cache_blk_t *mcl_pop(mem_cache_list_t *mcl) {
+    mem_cache_blk_t *blk = mcl->head;
+
+    mcl->head = blk->next;
+    mcl->len--;
+
+    return blk;
+}
+
+static void mcl_move(mem_cache_list_t *dest, mem_cache_list_t *src, size_t n) {
+    while (n > 0 && src->len > 0) {
+        mcl_push(dest, mcl_pop(src));
+        n--;
+    }
+}
+
+// Called when a thread exits, all of its blocks go to the depot.
+static void mem_cache_destructor(void *arg) {
+    mem_cache_t *mc = (mem_cache_t *)arg;
+
+    pthread_mutex_lock(&depot_mut);
+    for (size_t c = 0; c < MEM_CACHE_NUM_CLASSES; c++) {
+        mcl_move(&(depot[c]), &(mc->lists[c]), SIZE_MAX);
+    }
+    pthread_mutex_unlock(&depot_mut);
+
+    thread_cache = NULL;
+    thread_exiting = true;
+
+    free(mc);
+}
+
+static void create_cache_key(void) {
+    if (pthread_key_create(&cache_key, mem_cache_destructor)) {
+        log_fatal("Failed to create memory cache key");
+    }
+}
+
+// Returns NULL if the cache couldn't be created.
+static mem_cache_t *get_thread_cache(void) {
+    if (thread_cache) {
+        return thread_cache;
+    }
+
+    if (thread_exiting) {
+        return NULL;
+    }
+
+    pthread_once(&cache_key_once, create_cache_key);
+
+    mem_cache_t *mc = (mem_cache_t *)calloc(1, sizeof(mem_cache_t));
+    if (!mc) {
+        return NULL;
+    }
+
+    if (pthread_setspecific(cache_key, mc)) {
+        free(mc);
+        return NULL;
+    }
+
+    thread_cache = mc;
+    return mc;
+}
+
+void sys_mem_cache_enable(void) {
+    atomic_store(&mem_caching, true);
+}
+
+bool sys_mem_cache_enabled(void) {
+    return atomic_load_explicit(&mem_caching, memory_order_relaxed);
+}
+
+// These raw calls are what actually talk to the system allocator.
+// They don't touch the malloc count.
+
+static void *mem_raw_malloc(size_t s) {
+    if (!sys_mem_cache_enabled() || s > MEM_CACHE_MAX_SIZE) {
+        return malloc(s);
+    }
 
+    mem_cache_t *mc = get_thread_cache();
+    if (!mc) {
+        return malloc(s);
+    }
+
+    // Round up to the nearest class.
+    size_t c = (s - 1) / MEM_CACHE_CLASS_SIZE;
+    mem_cache_list_t *mcl = &(mc->lists[c]);
 
-void *safe_malloc_p(bool acquire_lock, size_t s) {
+    if (mcl->len == 0) {
+        pthread_mutex_lock(&depot_mut);
+        mcl_move(mcl, &(depot[c]), MEM_CACHE_BATCH_SIZE);
+        pthread_mutex_unlock(&depot_mut);
+    }
+
+    if (mcl->len > 0) {
+        return mcl_pop(mcl);
+    }
+
+    // Always malloc the full class size, so the block can be reused by
+    // any request of this class.
+    return malloc((c + 1) * MEM_CACHE_CLASS_SIZE);
+}
+
+static void *mem_raw_realloc(void *mem, size_t s) {
+    return realloc(mem, s);
+}
+
+static void mem_raw_free(void *mem) {
+    if (!sys_mem_cache_enabled()) {
+        free(mem);
+        return;
+    }
+
+    size_t usable = malloc_usable_size(mem);
+    if (usable < MEM_CACHE_CLASS_SIZE || usable > MEM_CACHE_MAX_SIZE) {
+        free(mem);
+        return;
+    }
+
+    mem_cache_t *mc = get_thread_cache();
+    if (!mc) {
+        free(mem);
+        return;
+    }
+
+    // Round down, the block must be able to hold any request of its class.
+    size_t c = (usable / MEM_CACHE_CLASS_SIZE) - 1;
+    mem_cache_list_t *mcl = &(mc->lists[c]);
+
+    mcl_push(mcl, (mem_cache_blk_t *)mem);
+
+    if (mcl->len > MEM_CACHE_CAP) {
+        pthread_mutex_lock(&depot_mut);
+        mcl_move(&(depot[c]), mcl, MEM_CACHE_BATCH_SIZE);
+        pthread_mutex_unlock(&depot_mut);
+    }
+}
+
+// Profiling state.
+//
+// NOTE: Like the system state, nothing allocated for profiling is counted
+// by the malloc count.
+
+#define MEM_PROF_HIST_BUCKETS 32
+#define MEM_PROF_TABLE_SIZE 256
+
+typedef struct _mem_callsite_t {
+    const char *file;
+    int line;
+
+    // Only the owning thread ever inserts into its table, but any thread
+    // can free a block allocated at this callsite. So, all stats are atomic.
+    atomic_llong live_bytes;
+    atomic_llong peak_bytes;
+    atomic_ullong total_bytes;
+    atomic_ullong allocs;
+    atomic_ullong frees;
+
+    // Bucket i counts allocations of size [2^i, 2^(i+1)).
+    atomic_ullong hist[MEM_PROF_HIST_BUCKETS];
+
+    struct _mem_callsite_t *next;
+} mem_callsite_t;
+
+typedef struct _mem_prof_table_t {
+    _Atomic(mem_callsite_t *) buckets[MEM_PROF_TABLE_SIZE];
+    struct _mem_prof_table_t *next;
+} mem_prof_table_t;
+
+// Every profiled block starts with this header.
+// (16 bytes to keep the user's memory aligned)
+typedef struct _mem_prof_hdr_t {
+    mem_callsite_t *cs;
+    size_t size;
+} mem_prof_hdr_t;
+
+static atomic_bool mem_profiling = false;
+
+// All thread tables ever created. (Tables are never freed, as blocks
+// may outlive the thread which allocated them)
+static pthread_mutex_t tables_mut = PTHREAD_MUTEX_INITIALIZER;
+static mem_prof_table_t *tables = NULL;
+
+static _Thread_local mem_prof_table_t *thread_table = NULL;
+
+static mem_prof_table_t *get_thread_table(void) {
+    if (thread_table) {
+        return thread_table;
+    }
+
+    mem_prof_table_t *t = (mem_prof_table_t *)calloc(1, sizeof(mem_prof_table_t));
+    if (!t) {
+        log_fatal("Failed to malloc memory profile table");
+    }
+
+    pthread_mutex_lock(&tables_mut);
+    t->next = tables;
+    tables = t;
+    pthread_mutex_unlock(&tables_mut);
+
+    thread_table = t;
+    return t;
+}
+
+static mem_callsite_t *get_callsite(const char *file, int line) {
+    mem_prof_table_t *t = get_thread_table();
+
+    // File names are literals, so hashing the pointer is good enough here.
+    size_t b = (((uintptr_t)file >> 3) * 31 + (size_t)line) % MEM_PROF_TABLE_SIZE;
+
+    mem_callsite_t *head = atomic_load_explicit(&(t->buckets[b]), memory_order_acquire);
+    for (mem_callsite_t *iter = head; iter; iter = iter->next) {
+        if (iter->file == file && iter->line == line) {
+            return iter;
+        }
+    }
+
+    mem_callsite_t *cs = (mem_callsite_t *)calloc(1, sizeof(mem_callsite_t));
+    if (!cs) {
+        log_fatal("Failed to malloc memory profile callsite");
+    }
+
+    cs->file = file;
+    cs->line = line;
+    cs->next = head;
+
+    // Published so reports from other threads can see it.
+    atomic_store_explicit(&(t->buckets[b]), cs, memory_order_release);
+
+    return cs;
+}
+
+static inline size_t size_to_hist_bucket(size_t s) {
+    size_t b = 0;
+    while (s > 1 && b < MEM_PROF_HIST_BUCKETS - 1) {
+        s >>= 1;
+        b++;
+    }
+
+    return b;
+}
+
+static void callsite_record_alloc(mem_callsite_t *cs, size_t s) {
+    atomic_fetch_add_explicit(&(cs->allocs), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(cs->total_bytes), s, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(cs->hist[size_to_hist_bucket(s)]), 1, memory_order_relaxed);
+
+    long long live = atomic_fetch_add_explicit(&(cs->live_bytes), (long long)s, memory_order_relaxed) + (long long)s;
+    long long peak = atomic_load_explicit(&(cs->peak_bytes), memory_order_relaxed);
+
+    while (live > peak && 
+            !atomic_compare_exchange_weak_explicit(&(cs->peak_bytes), &peak, live, 
+                memory_order_relaxed, memory_order_relaxed));
+}
+
+static void callsite_record_free(mem_callsite_t *cs, size_t s) {
+    atomic_fetch_add_explicit(&(cs->frees), 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&(cs->live_bytes), (long long)s, memory_order_relaxed);
+}
+
+void sys_mem_profile_enable(void) {
+    if (sys_get_malloc_count() > 0) {
+        log_fatal("Memory profiling must be enabled before any allocations");
+    }
+
+    atomic_store(&mem_profiling, true);
+}
+
+bool sys_mem_profile_enabled(void) {
+    return atomic_load_explicit(&mem_profiling, memory_order_relaxed);
+}
+
+void *safe_malloc_at_p(bool acquire_lock, size_t s, const char *file, int line) {
     if (s == 0) {
         return NULL;
     }
 
-    void *mem = malloc(s);
-    if (!mem) {
+    if (!sys_mem_profile_enabled()) {
+        void *mem = mem_raw_malloc(s);
+        if (!mem) {
+            log_fatal_p(acquire_lock, "Failed to malloc");
+        }
+        sys_inc_malloc_count_p(acquire_lock);
+
+        return mem;
+    }
+
+    mem_prof_hdr_t *hdr = (mem_prof_hdr_t *)mem_raw_malloc(sizeof(mem_prof_hdr_t) + s);
+    if (!hdr) {
         log_fatal_p(acquire_lock, "Failed to malloc");
     }
     sys_inc_malloc_count_p(acquire_lock);
 
-    return mem;
+    hdr->cs = get_callsite(file, line);
+    hdr->size = s;
+    callsite_record_alloc(hdr->cs, s);
+
+    return hdr + 1;
 }
 
-void *safe_realloc_p(bool acquire_lock, void *mem, size_t s) {
+void *safe_realloc_at_p(bool acquire_lock, void *mem, size_t s, const char *file, int line) {
     if (s == 0) {
-        safe_free(mem);
+        safe_free_p(acquire_lock, mem);
         return NULL;
     }
 
     if (!mem) {
-        return safe_malloc_p(acquire_lock, s);
+        return safe_malloc_at_p(acquire_lock, s, file, line);
+    }
+
+    if (!sys_mem_profile_enabled()) {
+        void *new_mem = mem_raw_realloc(mem, s);
+        if (!new_mem) {
+            log_fatal_p(acquire_lock, "Failed to realloc");
+        }
+
+        return new_mem;
     }
 
-    void *new_mem = realloc(mem, s);
-    if (!new_mem) {
+    mem_prof_hdr_t *hdr = (mem_prof_hdr_t *)mem - 1;
+    mem_callsite_t *old_cs = hdr->cs;
+    size_t old_size = hdr->size;
+
+    hdr = (mem_prof_hdr_t *)mem_raw_realloc(hdr, sizeof(mem_prof_hdr_t) + s);
+    if (!hdr) {
         log_fatal_p(acquire_lock, "Failed to realloc");
     }
 
-    return new_mem;
+    // The block now belongs to the realloc callsite.
+    callsite_record_free(old_cs, old_size);
+
+    hdr->cs = get_callsite(file, line);
+    hdr->size = s;
+    callsite_record_alloc(hdr->cs, s);
+
+    return hdr + 1;
 }
 
 void safe_free_p(bool acquire_lock, void *mem) {
@@ -44,5 +419,400 @@ void safe_free_p(bool acquire_lock, void *mem) {
     }
 
     sys_dec_malloc_count_p(acquire_lock);
-    free(mem);
+
+    if (!sys_mem_profile_enabled()) {
+        mem_raw_free(mem);
+        return;
+    }
+
+    mem_prof_hdr_t *hdr = (mem_prof_hdr_t *)mem - 1;
+    callsite_record_free(hdr->cs, hdr->size);
+    mem_raw_free(hdr);
+}
+
+// Reporting.
+
+// Plain (non-atomic) snapshot of one or more merged callsites.
+typedef struct _mem_callsite_stats_t {
+    const char *file;
+    int line;
+
+    long long live_bytes;
+    long long peak_bytes;
+    unsigned long long total_bytes;
+    unsigned long long allocs;
+    unsigned long long frees;
+    unsigned long long hist[MEM_PROF_HIST_BUCKETS];
+} mem_callsite_stats_t;
+
+static bool callsite_matches(const mem_callsite_stats_t *st, const mem_callsite_t *cs) {
+    if (st->line != cs->line) {
+        return false;
+    }
+
+    if (!(st->file) || !(cs->file)) {
+        return st->file == cs->file;
+    }
+
+    return strcmp(st->file, cs->file) == 0;
+}
+
+static void callsite_merge(mem_callsite_stats_t *st, const mem_callsite_t *cs) {
+    st->live_bytes += atomic_load_explicit(&(cs->live_bytes), memory_order_relaxed);
+    st->peak_bytes += atomic_load_explicit(&(cs->peak_bytes), memory_order_relaxed);
+    st->total_bytes += atomic_load_explicit(&(cs->total_bytes), memory_order_relaxed);
+    st->allocs += atomic_load_explicit(&(cs->allocs), memory_order_relaxed);
+    st->frees += atomic_load_explicit(&(cs->frees), memory_order_relaxed);
+
+    for (size_t i = 0; i < MEM_PROF_HIST_BUCKETS; i++) {
+        st->hist[i] += atomic_load_explicit(&(cs->hist[i]), memory_order_relaxed);
+    }
+}
+
+static int callsite_stats_cmp(const void *a, const void *b) {
+    const mem_callsite_stats_t *st_a = (const mem_callsite_stats_t *)a;
+    const mem_callsite_stats_t *st_b = (const mem_callsite_stats_t *)b;
+
+    if (st_a->live_bytes != st_b->live_bytes) {
+        return st_a->live_bytes < st_b->live_bytes ? 1 : -1;
+    }
+
+    if (st_a->total_bytes != st_b->total_bytes) {
+        return st_a->total_bytes < st_b->total_bytes ? 1 : -1;
+    }
+
+    return 0;
+}
+
+// Writes a newly malloc'd array of merged stats to stats.
+// Returns the number of entries.
+static size_t collect_callsite_stats(mem_callsite_stats_t **stats) {
+    size_t len = 0;
+    size_t cap = 16;
+    mem_callsite_stats_t *arr = (mem_callsite_stats_t *)malloc(sizeof(mem_callsite_stats_t) * cap);
+    if (!arr) {
+        log_fatal("Failed to malloc memory profile report");
+    }
+
+    pthread_mutex_lock(&tables_mut);
+
+    for (mem_prof_table_t *t = tables; t; t = t->next) {
+        for (size_t b = 0; b < MEM_PROF_TABLE_SIZE; b++) {
+            mem_callsite_t *cs = atomic_load_explicit(&(t->buckets[b]), memory_order_acquire);
+
+            for (; cs; cs = cs->next) {
+                // The same callsite can show up in many thread tables.
+                size_t i = 0;
+                while (i < len && !callsite_matches(&(arr[i]), cs)) {
+                    i++;
+                }
+
+                if (i == len) {
+                    if (len == cap) {
+                        cap *= 2;
+                        arr = (mem_callsite_stats_t *)realloc(arr, sizeof(mem_callsite_stats_t) * cap);
+                        if (!arr) {
+                            log_fatal("Failed to realloc memory profile report");
+                        }
+                    }
+
+                    memset(&(arr[len]), 0, sizeof(mem_callsite_stats_t));
+                    arr[len].file = cs->file;
+                    arr[len].line = cs->line;
+                    len++;
+                }
+
+                callsite_merge(&(arr[i]), cs);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&tables_mut);
+
+    qsort(arr, len, sizeof(mem_callsite_stats_t), callsite_stats_cmp);
+
+    *stats = arr;
+    return len;
+}
+
+static void fprint_json_str(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (const char *iter = str; *iter; iter++) {
+        if (*iter == '"' || *iter == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*iter, fp);
+    }
+    fputc('"', fp);
+}
+
+void sys_mem_profile_report(FILE *fp, bool json) {
+    mem_callsite_stats_t *stats;
+    size_t len = collect_callsite_stats(&stats);
+
+    if (json) {
+        fprintf(fp, "[");
+    } else {
+        fprintf(fp, "%14s %14s %10s %10s %14s  %s\n", 
+                "live_bytes", "peak_bytes", "allocs", "frees", "total_bytes", "callsite");
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        mem_callsite_stats_t *st = &(stats[i]);
+        const char *file = st->file ? st->file : "<unknown>";
+
+        if (!json) {
+            fprintf(fp, "%14lld %14lld %10llu %10llu %14llu  %s:%d\n", 
+                    st->live_bytes, st->peak_bytes, st->allocs, st->frees, st->total_bytes, 
+                    file, st->line);
+            continue;
+        }
+
+        fprintf(fp, "%s\n  {\"file\": ", i == 0 ? "" : ",");
+        fprint_json_str(fp, file);
+        fprintf(fp, ", \"line\": %d, \"live_bytes\": %lld, \"peak_bytes\": %lld, "
+                "\"allocs\": %llu, \"frees\": %llu, \"total_bytes\": %llu, \"histogram\": {",
+                st->line, st->live_bytes, st->peak_bytes, st->allocs, st->frees, st->total_bytes);
+
+        bool first = true;
+        for (size_t b = 0; b < MEM_PROF_HIST_BUCKETS; b++) {
+            if (st->hist[b] == 0) {
+                continue;
+            }
+
+            fprintf(fp, "%s\"%llu\": %llu", first ? "" : ", ", 1ULL << b, st->hist[b]);
+            first = false;
+        }
+
+        fprintf(fp, "}}");
+    }
+
+    if (json) {
+        fprintf(fp, "\n]\n");
+    }
+
+    fflush(fp);
+    free(stats);
+}
+
+// Large Buffers.
+
+#define MEM_HUGE_PAGE_SIZE 0x200000
+
+// Every large buffer starts with this header.
+// (16 bytes to keep the user's memory aligned)
+typedef struct _mem_large_hdr_t {
+    // Length of the underlying mapping, 0 if the buffer lives on the heap.
+    size_t map_len;
+    size_t size;
+} mem_large_hdr_t;
+
+static inline size_t round_up(size_t s, size_t align) {
+    return (s + (align - 1)) & ~(align - 1);
+}
+
+// Maps len bytes (a multiple of MEM_HUGE_PAGE_SIZE) at a huge page aligned address.
+// Returns NULL on failure.
+static uint8_t *mem_map_huge_aligned(size_t len) {
+    // Huge pages can only back huge page aligned regions.
+    // Map a little extra, then trim off the unaligned ends.
+    uint8_t *raw = mmap(NULL, len + MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint8_t *map = (uint8_t *)round_up((uintptr_t)raw, MEM_HUGE_PAGE_SIZE);
+
+    size_t head = map - raw;
+    size_t tail = MEM_HUGE_PAGE_SIZE - head;
+
+    if (head > 0) {
+        munmap(raw, head);
+    }
+
+    if (tail > 0) {
+        munmap(map + len, tail);
+    }
+
+    return map;
+}
+
+static inline bool is_huge_aligned(const void *p) {
+    return ((uintptr_t)p & (MEM_HUGE_PAGE_SIZE - 1)) == 0;
+}
+
+// Returns NULL on failure.
+static mem_large_hdr_t *mem_map_large(size_t s, bool prefault) {
+    size_t map_len = round_up(sizeof(mem_large_hdr_t) + s, (size_t)sysconf(_SC_PAGESIZE));
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (prefault) {
+        flags |= MAP_POPULATE;
+    }
+
+    uint8_t *map;
+
+    if (map_len < MEM_HUGE_PAGE_SIZE) {
+        map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+    } else {
+        map_len = round_up(map_len, MEM_HUGE_PAGE_SIZE);
+
+        // NOTE: We never populate the extra region.
+        map = mem_map_huge_aligned(map_len);
+        if (!map) {
+            return NULL;
+        }
+
+        // Failure here is fine, we'll just use normal pages.
+        madvise(map, map_len, MADV_HUGEPAGE);
+
+        if (prefault) {
+            madvise(map, map_len, MADV_WILLNEED);
+
+            // Touch every page so faults happen now, not on the hot path.
+            long page_size = sysconf(_SC_PAGESIZE);
+            for (size_t offset = 0; offset < map_len; offset += page_size) {
+                ((volatile uint8_t *)map)[offset] = 0;
+            }
+        }
+    }
+
+    mem_large_hdr_t *hdr = (mem_large_hdr_t *)map;
+    hdr->map_len = map_len;
+    hdr->size = s;
+
+    return hdr;
+}
+
+void *safe_malloc_large_p(bool acquire_lock, size_t s, bool prefault) {
+    if (s == 0) {
+        return NULL;
+    }
+
+    mem_large_hdr_t *hdr;
+
+    if (s < SAFE_LARGE_THRESHOLD) {
+        hdr = (mem_large_hdr_t *)safe_malloc_p(acquire_lock, sizeof(mem_large_hdr_t) + s);
+        hdr->map_len = 0;
+        hdr->size = s;
+
+        return hdr + 1;
+    }
+
+    hdr = mem_map_large(s, prefault);
+
+    // Fall back to the heap if mmap fails for whatever reason.
+    if (!hdr) {
+        hdr = (mem_large_hdr_t *)safe_malloc_p(acquire_lock, sizeof(mem_large_hdr_t) + s);
+        hdr->map_len = 0;
+        hdr->size = s;
+
+        return hdr + 1;
+    }
+
+    sys_inc_malloc_count_p(acquire_lock);
+
+    return hdr + 1;
+}
+
+void *safe_realloc_large_p(bool acquire_lock, void *mem, size_t s) {
+    if (s == 0) {
+        safe_free_large_p(acquire_lock, mem);
+        return NULL;
+    }
+
+    if (!mem) {
+        return safe_malloc_large_p(acquire_lock, s, false);
+    }
+
+    mem_large_hdr_t *hdr = (mem_large_hdr_t *)mem - 1;
+
+    // Heap buffers stay on the heap until they cross the threshold.
+    if (hdr->map_len == 0 && s < SAFE_LARGE_THRESHOLD) {
+        hdr = (mem_large_hdr_t *)safe_realloc_p(acquire_lock, hdr, sizeof(mem_large_hdr_t) + s);
+        hdr->size = s;
+
+        return hdr + 1;
+    }
+
+    // Mapped buffers which still fit in their mapping don't need to move.
+    if (hdr->map_len > 0 && sizeof(mem_large_hdr_t) + s <= hdr->map_len) {
+        hdr->size = s;
+        return mem;
+    }
+
+    // Grow mappings with mremap if possible, this avoids a copy.
+    if (hdr->map_len > 0) {
+        size_t new_map_len = round_up(sizeof(mem_large_hdr_t) + s, (size_t)sysconf(_SC_PAGESIZE));
+        void *new_map = MAP_FAILED;
+
+        if (new_map_len < MEM_HUGE_PAGE_SIZE) {
+            // The kernel may still move the mapping.
+            new_map = mremap(hdr, hdr->map_len, new_map_len, MREMAP_MAYMOVE);
+        } else {
+            new_map_len = round_up(new_map_len, MEM_HUGE_PAGE_SIZE);
+
+            // Growing in place keeps an aligned mapping aligned.
+            if (is_huge_aligned(hdr)) {
+                new_map = mremap(hdr, hdr->map_len, new_map_len, 0);
+            }
+
+            // Otherwise, the pages are moved (not copied) to an aligned spot, as a
+            // mapping moved wherever the kernel likes would lose its huge pages.
+            if (new_map == MAP_FAILED) {
+                uint8_t *target = mem_map_huge_aligned(new_map_len);
+                if (target) {
+                    new_map = mremap(hdr, hdr->map_len, new_map_len,
+                            MREMAP_MAYMOVE | MREMAP_FIXED, target);
+                    if (new_map == MAP_FAILED) {
+                        munmap(target, new_map_len);
+                    }
+                }
+            }
+        }
+
+        if (new_map != MAP_FAILED) {
+            hdr = (mem_large_hdr_t *)new_map;
+            hdr->map_len = new_map_len;
+            hdr->size = s;
+
+            if (new_map_len >= MEM_HUGE_PAGE_SIZE) {
+                madvise(hdr, new_map_len, MADV_HUGEPAGE);
+            }
+
+            return hdr + 1;
+        }
+    }
+
+    // Otherwise, a new buffer is needed.
+    size_t old_size = hdr->size;
+    void *new_mem = safe_malloc_large_p(acquire_lock, s, false);
+
+    memcpy(new_mem, mem, old_size < s ? old_size : s);
+    safe_free_large_p(acquire_lock, mem);
+
+    return new_mem;
+}
+
+void safe_free_large_p(bool acquire_lock, void *mem) {
+    if (!mem) {
+        return;
+    }
+
+    mem_large_hdr_t *hdr = (mem_large_hdr_t *)mem - 1;
+
+    if (hdr->map_len == 0) {
+        safe_free_p(acquire_lock, hdr);
+        return;
+    }
+
+    sys_dec_malloc_count_p(acquire_lock);
+    
+    if (munmap(hdr, hdr->map_len)) {
+        log_fatal_p(acquire_lock, "Failed to unmap large buffer");
+    }
 }
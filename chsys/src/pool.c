@@ -0,0 +1,224 @@
+
+#include "chsys/pool.h"
+#include "chsys/mem.h"
+#include "chsys/log.h"
+#include "chsys/wrappers.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// All slabs start with a pointer to the next slab, objects come after.
+// (Padded to keep objects aligned)
+#define POOL_SLAB_HDR_SIZE 16
+
+static inline size_t pool_class_size(size_t c) {
+    return (size_t)POOL_MIN_OBJ_SIZE << c;
+}
+
+// Assumes 0 < s <= POOL_MAX_OBJ_SIZE.
+static inline size_t pool_size_to_class(size_t s) {
+    size_t c = 0;
+    while (pool_class_size(c) < s) {
+        c++;
+    }
+
+    return c;
+}
+
+static inline void pfl_push(pool_free_list_t *pfl, pool_obj_t *obj) {
+    obj->next = pfl->head;
+    pfl->head = obj;
+    pfl->len++;
+}
+
+static inline pool_obj_t *pfl_pop(pool_free_list_t *pfl) {
+    pool_obj_t *obj = pfl->head;
+
+    pfl->head = obj->next;
+    pfl->len--;
+
+    return obj;
+}
+
+// Move at most n objects from src to dest.
+static void pfl_move(pool_free_list_t *dest, pool_free_list_t *src, size_t n) {
+    while (n > 0 && src->len > 0) {
+        pfl_push(dest, pfl_pop(src));
+        n--;
+    }
+}
+
+// Assumes we have the pool lock.
+// Allocates a new slab and places all of its objects in the depot.
+static void pool_grow(pool_t *p, size_t c) {
+    uint8_t *slab = (uint8_t *)safe_malloc(POOL_SLAB_SIZE);
+
+    *(void **)slab = p->slabs;
+    p->slabs = slab;
+
+    const size_t obj_size = pool_class_size(c);
+    pool_free_list_t *pfl = &(p->depot[c]);
+
+    for (size_t offset = POOL_SLAB_HDR_SIZE; offset + obj_size <= POOL_SLAB_SIZE; offset += obj_size) {
+        pfl_push(pfl, (pool_obj_t *)(slab + offset));
+    }
+}
+
+// This is called when a thread which has used the pool exits.
+// All of its cached objects are given back to the depot.
+static void pool_cache_destructor(void *arg) {
+    pool_cache_t *pc = (pool_cache_t *)arg;
+    pool_t *p = pc->pool;
+
+    safe_pthread_mutex_lock(&(p->mut));
+
+    for (size_t c = 0; c < POOL_NUM_CLASSES; c++) {
+        pfl_move(&(p->depot[c]), &(pc->lists[c]), SIZE_MAX);
+    }
+
+    if (pc->prev) {
+        pc->prev->next = pc->next;
+    } else {
+        p->caches = pc->next;
+    }
+
+    if (pc->next) {
+        pc->next->prev = pc->prev;
+    }
+
+    safe_pthread_mutex_unlock(&(p->mut));
+
+    safe_free(pc);
+}
+
+static pool_cache_t *pool_get_cache(pool_t *p) {
+    pool_cache_t *pc = (pool_cache_t *)pthread_getspecific(p->cache_key);
+    if (pc) {
+        return pc;
+    }
+
+    pc = (pool_cache_t *)safe_malloc(sizeof(pool_cache_t));
+    pc->pool = p;
+    pc->prev = NULL;
+
+    for (size_t c = 0; c < POOL_NUM_CLASSES; c++) {
+        pc->lists[c].len = 0;
+        pc->lists[c].head = NULL;
+    }
+
+    safe_pthread_mutex_lock(&(p->mut));
+
+    pc->next = p->caches;
+    if (p->caches) {
+        p->caches->prev = pc;
+    }
+    p->caches = pc;
+
+    safe_pthread_mutex_unlock(&(p->mut));
+
+    if (pthread_setspecific(p->cache_key, pc)) {
+        log_fatal("Failed to register pool cache");
+    }
+
+    return pc;
+}
+
+pool_t *new_pool(void) {
+    pool_t *p = (pool_t *)safe_malloc(sizeof(pool_t));
+
+    if (pthread_key_create(&(p->cache_key), pool_cache_destructor)) {
+        log_fatal("Failed to create pool cache key");
+    }
+
+    safe_pthread_mutex_init(&(p->mut), NULL);
+
+    for (size_t c = 0; c < POOL_NUM_CLASSES; c++) {
+        p->depot[c].len = 0;
+        p->depot[c].head = NULL;
+    }
+
+    p->slabs = NULL;
+    p->caches = NULL;
+
+    return p;
+}
+
+void delete_pool(pool_t *p) {
+    // After the key is deleted, cache destructors will no longer be called.
+    pthread_key_delete(p->cache_key);
+
+    pool_cache_t *pc = p->caches;
+    pool_cache_t *next_pc;
+
+    while (pc) {
+        next_pc = pc->next;
+        safe_free(pc);
+        pc = next_pc;
+    }
+
+    void *slab = p->slabs;
+    void *next_slab;
+
+    while (slab) {
+        next_slab = *(void **)slab;
+        safe_free(slab);
+        slab = next_slab;
+    }
+
+    safe_pthread_mutex_destroy(&(p->mut));
+    safe_free(p);
+}
+
+void *pool_alloc(pool_t *p, size_t s) {
+    if (s == 0) {
+        return NULL;
+    }
+
+    if (s > POOL_MAX_OBJ_SIZE) {
+        return safe_malloc(s);
+    }
+
+    size_t c = pool_size_to_class(s);
+    pool_cache_t *pc = pool_get_cache(p);
+    pool_free_list_t *pfl = &(pc->lists[c]);
+
+    if (pfl->len == 0) {
+        // Refill from the depot.
+        safe_pthread_mutex_lock(&(p->mut));
+
+        if (p->depot[c].len == 0) {
+            pool_grow(p, c);
+        }
+
+        pfl_move(pfl, &(p->depot[c]), POOL_BATCH_SIZE);
+
+        safe_pthread_mutex_unlock(&(p->mut));
+    }
+
+    return pfl_pop(pfl);
+}
+
+void pool_free(pool_t *p, void *mem, size_t s) {
+    if (!mem) {
+        return;
+    }
+
+    if (s > POOL_MAX_OBJ_SIZE) {
+        safe_free(mem);
+        return;
+    }
+
+    size_t c = pool_size_to_class(s);
+    pool_cache_t *pc = pool_get_cache(p);
+    pool_free_list_t *pfl = &(pc->lists[c]);
+
+    pfl_push(pfl, (pool_obj_t *)mem);
+
+    if (pfl->len > POOL_CACHE_CAP) {
+        // Give a batch back to the depot.
+        safe_pthread_mutex_lock(&(p->mut));
+        pfl_move(&(p->depot[c]), pfl, POOL_BATCH_SIZE);
+        safe_pthread_mutex_unlock(&(p->mut));
+    }
+}
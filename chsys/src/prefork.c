@@ -0,0 +1,199 @@
+
+#include "chsys/prefork.h"
+#include "chsys/log.h"
+#include "chsys/mem.h"
+#include "chsys/sock.h"
+#include "chsys/sys.h"
+#include "chsys/time.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Forks the worker for the given slot.
+static void prefork_spawn(sys_prefork_pool_t *pool, size_t i) {
+    pid_t pid = safe_fork();
+
+    if (pid == 0) {
+        // Worker process.
+        sys_prefork_worker_ft worker = pool->worker;
+        void *arg = pool->arg;
+        int listen_fd = pool->listen_fd;
+
+        int port = pool->attrs.port;
+        int pending_conns = pool->attrs.pending_conns;
+        bool reuse_port = pool->attrs.reuse_port;
+
+        // The pool is the supervisor's, the worker has no use for its copy.
+        safe_free(pool->pids);
+        safe_free(pool);
+
+        if (port >= 0 && reuse_port) {
+            listen_fd = create_reuseport_server(port, pending_conns);
+            if (listen_fd < 0) {
+                log_fatal("Worker %zu failed to create listening socket on port %d", i, port);
+            }
+        }
+
+        worker(i, listen_fd, arg);
+
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+
+        safe_exit(0);
+    }
+
+    pool->pids[i] = pid;
+    pool->num_live++;
+}
+
+sys_prefork_pool_t *new_sys_prefork_pool(const sys_prefork_pool_attrs_t *attrs,
+        sys_prefork_worker_ft worker, void *arg) {
+    if (attrs->num_workers == 0) {
+        log_fatal("Prefork pool must have at least one worker");
+    }
+
+    sys_prefork_pool_t *pool = (sys_prefork_pool_t *)safe_malloc(sizeof(sys_prefork_pool_t));
+
+    pool->attrs = *attrs;
+    pool->worker = worker;
+    pool->arg = arg;
+    pool->listen_fd = -1;
+    pool->restarts = 0;
+    pool->num_live = 0;
+
+    pool->pids = (pid_t *)safe_malloc(sizeof(pid_t) * attrs->num_workers);
+    memset(pool->pids, 0, sizeof(pid_t) * attrs->num_workers);
+
+    if (attrs->port >= 0) {
+        if (attrs->reuse_port) {
+            // Make sure the port is usable before forking.
+            // This socket can't be kept, or it would be handed connections
+            // which no one accepts.
+            int fd = create_reuseport_server(attrs->port, attrs->pending_conns);
+            if (fd < 0) {
+                log_fatal("Failed to create listening socket on port %d", attrs->port);
+            }
+            close(fd);
+        } else {
+            pool->listen_fd = create_server(attrs->port, attrs->pending_conns);
+            if (pool->listen_fd < 0) {
+                log_fatal("Failed to create listening socket on port %d", attrs->port);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < attrs->num_workers; i++) {
+        prefork_spawn(pool, i);
+    }
+
+    return pool;
+}
+
+// Reaps one exited worker if there is one.
+// Returns its slot, or num_workers if no worker was reaped.
+static size_t prefork_reap(sys_prefork_pool_t *pool, int options, int *wstatus) {
+    if (pool->num_live == 0) {
+        return pool->attrs.num_workers;
+    }
+
+    // NOTE: Only pool workers are waited on, other children of this process are left alone.
+    for (size_t i = 0; i < pool->attrs.num_workers; i++) {
+        if (pool->pids[i] == 0) {
+            continue;
+        }
+
+        if (safe_waitpid(pool->pids[i], wstatus, options | WNOHANG) > 0) {
+            pool->pids[i] = 0;
+            pool->num_live--;
+            return i;
+        }
+    }
+
+    if (!(options & WNOHANG)) {
+        // Blocking wait on any worker.
+        for (size_t i = 0; i < pool->attrs.num_workers; i++) {
+            if (pool->pids[i] != 0) {
+                safe_waitpid(pool->pids[i], wstatus, 0);
+                pool->pids[i] = 0;
+                pool->num_live--;
+                return i;
+            }
+        }
+    }
+
+    return pool->attrs.num_workers;
+}
+
+void sys_prefork_pool_supervise(sys_prefork_pool_t *pool) {
+    const uint32_t interval = pool->attrs.poll_interval_ms ? pool->attrs.poll_interval_ms : 100;
+
+    while (!sys_sig_exit_requested() && pool->num_live > 0) {
+        int wstatus;
+        size_t i = prefork_reap(pool, WNOHANG, &wstatus);
+
+        if (i == pool->attrs.num_workers) {
+            sys_sleep_ms(interval);
+            continue;
+        }
+
+        if (WIFEXITED(wstatus)) {
+            log_warn("Prefork worker %zu exited with status %d", i, WEXITSTATUS(wstatus));
+        } else if (WIFSIGNALED(wstatus)) {
+            log_warn("Prefork worker %zu killed by signal %d", i, WTERMSIG(wstatus));
+        }
+
+        if (!pool->attrs.restart_workers) {
+            continue;
+        }
+
+        if (pool->attrs.max_restarts > 0 && pool->restarts >= pool->attrs.max_restarts) {
+            log_warn("Prefork pool out of restarts, worker %zu will not be restarted", i);
+            continue;
+        }
+
+        pool->restarts++;
+        log_info("Restarting prefork worker %zu", i);
+        prefork_spawn(pool, i);
+    }
+}
+
+void delete_sys_prefork_pool(sys_prefork_pool_t *pool) {
+    for (size_t i = 0; i < pool->attrs.num_workers; i++) {
+        if (pool->pids[i] != 0) {
+            kill(pool->pids[i], SIGINT);
+        }
+    }
+
+    const sys_deadline_t deadline = sys_deadline_in_ms(pool->attrs.shutdown_timeout_ms);
+
+    while (pool->num_live > 0 && !sys_deadline_passed(deadline)) {
+        if (prefork_reap(pool, WNOHANG, NULL) == pool->attrs.num_workers) {
+            sys_sleep_ms(10);
+        }
+    }
+
+    if (pool->num_live > 0) {
+        log_warn("%zu prefork workers did not exit in time, killing", pool->num_live);
+
+        for (size_t i = 0; i < pool->attrs.num_workers; i++) {
+            if (pool->pids[i] != 0) {
+                kill(pool->pids[i], SIGKILL);
+            }
+        }
+
+        while (pool->num_live > 0) {
+            prefork_reap(pool, 0, NULL);
+        }
+    }
+
+    if (pool->listen_fd >= 0) {
+        close(pool->listen_fd);
+    }
+
+    safe_free(pool->pids);
+    safe_free(pool);
+}
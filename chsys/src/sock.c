@@ -1,15 +1,103 @@
 
+// Needed for SO_REUSEPORT, SO_BUSY_POLL and TCP_QUICKACK.
+#define _GNU_SOURCE
+
 #include "chsys/sock.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
+static const sock_opts_t default_opts = SOCK_OPTS_DEFAULT;
+
+int sock_set_nonblocking(int fd, bool nonblocking) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+
+    return fcntl(fd, F_SETFL, flags) == -1 ? -1 : 0;
+}
+
+static int set_int_opt(int sockfd, int level, int name, int val) {
+    return setsockopt(sockfd, level, name, &val, sizeof(val));
+}
+
+// Options which must be set before bind.
+static int apply_bind_opts(int sockfd, const sock_opts_t *opts) {
+    if (opts->reuse_addr && set_int_opt(sockfd, SOL_SOCKET, SO_REUSEADDR, 1)) {
+        return -1;
+    }
+
+    if (opts->reuse_port && set_int_opt(sockfd, SOL_SOCKET, SO_REUSEPORT, 1)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int apply_opts_p(int sockfd, const sock_opts_t *opts, bool tcp) {
+    if (opts->sndbuf > 0 && set_int_opt(sockfd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf)) {
+        return -1;
+    }
+
+    if (opts->rcvbuf > 0 && set_int_opt(sockfd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf)) {
+        return -1;
+    }
+
+    if (opts->busy_poll_us > 0) {
+        // Best effort, see sock.h.
+        (void)set_int_opt(sockfd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll_us);
+    }
+
+    if (tcp) {
+        if (opts->tcp_nodelay && set_int_opt(sockfd, IPPROTO_TCP, TCP_NODELAY, 1)) {
+            return -1;
+        }
+
+        if (opts->tcp_quickack && set_int_opt(sockfd, IPPROTO_TCP, TCP_QUICKACK, 1)) {
+            return -1;
+        }
+    }
+
+    if (opts->nonblocking && sock_set_nonblocking(sockfd, true)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int sock_apply_opts(int sockfd, const sock_opts_t *opts) {
+    int domain;
+    socklen_t len = sizeof(domain);
+
+    if (getsockopt(sockfd, SOL_SOCKET, SO_DOMAIN, &domain, &len)) {
+        return -1;
+    }
+
+    return apply_opts_p(sockfd, opts, domain == AF_INET || domain == AF_INET6);
+}
+
 int client_connect(const char *ipaddr, int port) {
+    return client_connect_opts(ipaddr, port, NULL);
+}
+
+int client_connect_opts(const char *ipaddr, int port, const sock_opts_t *opts) {
     // Basically took this from chatgpt tbh...
 
+    if (!opts) {
+        opts = &default_opts;
+    }
+
     int sockfd;
     struct sockaddr_in server_addr;
 
@@ -35,12 +123,21 @@ int client_connect(const char *ipaddr, int port) {
         close(sockfd);
         return -1;
     }
+
+    if (apply_opts_p(sockfd, opts, true)) {
+        close(sockfd);
+        return -1;
+    }
     
     return sockfd;
 }
 
-int create_server(int port, int pending_conns) {
-    if (pending_conns <= 0) {
+int create_server_opts(int port, const sock_opts_t *opts) {
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    if (opts->backlog <= 0) {
         return -1;
     }
 
@@ -54,16 +151,7 @@ int create_server(int port, int pending_conns) {
         return -1;
     }
 
-    int flags;
-
-    flags = fcntl(sockfd, F_GETFL, 0);
-    if (flags == -1) {
-        close(sockfd);
-        return -1;
-    }
-
-    status = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-    if (status == -1) {
+    if (apply_bind_opts(sockfd, opts) || apply_opts_p(sockfd, opts, true)) {
         close(sockfd);
         return -1;
     }
@@ -82,7 +170,7 @@ int create_server(int port, int pending_conns) {
     }
 
     // 3. Listen for incoming connections
-    status = listen(sockfd, pending_conns);
+    status = listen(sockfd, opts->backlog);
     if (status) { 
         close(sockfd);
         return -1;
@@ -90,3 +178,151 @@ int create_server(int port, int pending_conns) {
 
     return sockfd;
 }
+
+int create_server(int port, int pending_conns) {
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.backlog = pending_conns;
+    opts.nonblocking = true;
+
+    return create_server_opts(port, &opts);
+}
+
+int create_reuseport_server(int port, int pending_conns) {
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.backlog = pending_conns;
+    opts.nonblocking = true;
+
+    // SO_REUSEADDR as well, so that a restarted process can rebind while 
+    // old connections are in TIME_WAIT.
+    opts.reuse_addr = true;
+    opts.reuse_port = true;
+
+    return create_server_opts(port, &opts);
+}
+
+// Fills in addr from path. Returns the length of the address to use, 0 on failure.
+static socklen_t unix_addr_from_path(const char *path, struct sockaddr_un *addr) {
+    size_t path_len = strlen(path);
+
+    // Room is left for the NUL terminator, even for abstract names.
+    if (path_len == 0 || path_len >= sizeof(addr->sun_path)) {
+        return 0;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, path_len);
+
+    if (path[0] == '@') {
+        // Abstract names start with a NUL byte, and are NOT NUL terminated.
+        addr->sun_path[0] = '\0';
+        return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+    }
+
+    return (socklen_t)sizeof(*addr);
+}
+
+static bool valid_unix_type(int type) {
+    return type == SOCK_STREAM || type == SOCK_SEQPACKET;
+}
+
+int create_unix_server(const char *path, int type, const sock_opts_t *opts) {
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    if (!valid_unix_type(type) || opts->backlog <= 0) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = unix_addr_from_path(path, &addr);
+    if (addr_len == 0) {
+        return -1;
+    }
+
+    // A socket left over from an old server would make bind fail, so it's unlinked.
+    // Anything else at path is left alone.
+    bool stale_sock = false;
+    if (path[0] != '@') {
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                return -1;
+            }
+
+            stale_sock = true;
+        }
+    }
+
+    int sockfd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    if (apply_opts_p(sockfd, opts, false)) {
+        close(sockfd);
+        return -1;
+    }
+
+    if (stale_sock) {
+        unlink(path);
+    }
+
+    if (bind(sockfd, (struct sockaddr *)&addr, addr_len) || listen(sockfd, opts->backlog)) {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int unix_connect(const char *path, int type, const sock_opts_t *opts) {
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    if (!valid_unix_type(type)) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = unix_addr_from_path(path, &addr);
+    if (addr_len == 0) {
+        return -1;
+    }
+
+    int sockfd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    if (connect(sockfd, (struct sockaddr *)&addr, addr_len) || apply_opts_p(sockfd, opts, false)) {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int create_socketpair(int type, const sock_opts_t *opts, int fds[2]) {
+    if (!opts) {
+        opts = &default_opts;
+    }
+
+    if (!valid_unix_type(type) && type != SOCK_DGRAM) {
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds)) {
+        return -1;
+    }
+
+    if (apply_opts_p(fds[0], opts, false) || apply_opts_p(fds[1], opts, false)) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    return 0;
+}
@@ -10,8 +10,11 @@
 #include <stdbool.h>
 
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "chsys/log.h"
+#include "chsys/log_bin.h"
+#include "chsys/mem.h"
 
 // mean to only be used during setup.
 #define ERROR_OUT(...) \
@@ -27,23 +30,51 @@ typedef struct _child_node_t {
 } child_node_t;
 
 typedef struct _sys_state_t {
-    bool quiet;
-    
     bool signal_exit_flag;
     bool signal_exit_requested;
 
     void *signal_exit_routine_arg;
     void (*signal_exit_routine)(void *);
 
-    // NOTE: this counter will keep track of user mallocs only.
-    // All mallocs within this file are not counted!
-    size_t malloc_count;
     child_node_t *child_list;
 } sys_state_t;
 
 static pthread_mutex_t sys_mut;
 static sys_state_t *ss = NULL;
 
+// NOTE: The quiet flag also lives outside of the system state, so that
+// it can be checked by log calls before acquiring the system lock.
+static atomic_bool sys_quiet = false;
+
+// NOTE: The malloc count lives outside of the system state and is NOT
+// protected by the system lock.
+//
+// It is split into shards, each on its own cache line. Every thread is
+// assigned a shard the first time it allocates, and only ever touches that shard.
+// A shard on its own can go negative (Memory malloc'd on one thread and freed on another),
+// only the sum of all shards is meaningful.
+//
+// This counter will keep track of user mallocs only.
+// All mallocs within this file are not counted!
+#define SYS_MALLOC_SHARDS 64
+
+typedef struct _malloc_shard_t {
+    _Alignas(64) atomic_llong count;
+} malloc_shard_t;
+
+static malloc_shard_t malloc_shards[SYS_MALLOC_SHARDS];
+static atomic_uint next_malloc_shard = 0;
+static _Thread_local malloc_shard_t *thread_malloc_shard = NULL;
+
+static inline malloc_shard_t *get_thread_malloc_shard(void) {
+    if (!thread_malloc_shard) {
+        unsigned int i = atomic_fetch_add_explicit(&next_malloc_shard, 1, memory_order_relaxed);
+        thread_malloc_shard = &(malloc_shards[i % SYS_MALLOC_SHARDS]);
+    }
+
+    return thread_malloc_shard;
+}
+
 static void *sig_thread(void *arg) {
     (void)arg;
 
@@ -115,14 +146,17 @@ void sys_init(void) {
         ERROR_OUT("Could not malloc system state\n");
     }
 
-    ss->quiet = 0;
+    atomic_store(&sys_quiet, false);
     ss->signal_exit_flag = true;
     ss->signal_exit_requested = false;
     ss->signal_exit_routine_arg = NULL;
     ss->signal_exit_routine = NULL;
-    ss->malloc_count = 0;
     ss->child_list = NULL;
 
+    for (size_t i = 0; i < SYS_MALLOC_SHARDS; i++) {
+        atomic_init(&(malloc_shards[i].count), 0);
+    }
+
     // We've initialized our system state!
     // Now we can call log!
 
@@ -178,54 +212,77 @@ void sys_unlock_p(bool acquire_lock) {
     }
 }
 
+// acquire_lock is ignored for the quiet flag, it is atomic.
+
 void sys_set_quiet_p(bool acquire_lock, bool q) {
-    sys_lock_p(acquire_lock);
-    ss->quiet = q;
-    sys_unlock_p(acquire_lock);
+    (void)acquire_lock;
+    atomic_store_explicit(&sys_quiet, q, memory_order_relaxed);
 }
 
 bool sys_is_quiet_p(bool acquire_lock) {
-    bool res;
-
-    sys_lock_p(acquire_lock);
-    res = ss->quiet;
-    sys_unlock_p(acquire_lock);
-
-    return res;
+    (void)acquire_lock;
+    return atomic_load_explicit(&sys_quiet, memory_order_relaxed);
 }
 
+// NOTE: None of the malloc count functions below need the system lock.
+// acquire_lock is kept so the call signatures match the rest of the system.
+
 void sys_inc_malloc_count_p(bool acquire_lock) {
-    sys_lock_p(acquire_lock);
-    if (ss->malloc_count == SIZE_MAX) {
-        log_fatal_p(false, "Malloc overflow");
-    }
-    ss->malloc_count++;
-    sys_unlock_p(acquire_lock);
+    (void)acquire_lock;
+    atomic_fetch_add_explicit(&(get_thread_malloc_shard()->count), 1, memory_order_relaxed);
 }
 
 void sys_dec_malloc_count_p(bool acquire_lock) {
-    sys_lock_p(acquire_lock);
-    if (ss->malloc_count == 0) {
-        log_fatal_p(false, "Malloc underflow");
+    (void)acquire_lock;
+
+    // Since a single shard can legally go negative, underflow can only be
+    // detected when the shards are summed. (See sys_get_malloc_count_p)
+    atomic_fetch_sub_explicit(&(get_thread_malloc_shard()->count), 1, memory_order_relaxed);
+}
+
+// Returns the true sum of all shards, this can be negative if there
+// have been more frees than mallocs.
+static long long sum_malloc_shards(void) {
+    long long sum = 0;
+
+    for (size_t i = 0; i < SYS_MALLOC_SHARDS; i++) {
+        sum += atomic_load_explicit(&(malloc_shards[i].count), memory_order_relaxed);
     }
-    ss->malloc_count--;
-    sys_unlock_p(acquire_lock);
+
+    return sum;
 }
 
 size_t sys_get_malloc_count_p(bool acquire_lock) {
-    size_t mc;
+    long long sum = sum_malloc_shards();
 
-    sys_lock_p(acquire_lock);
-    mc = ss->malloc_count;
-    sys_unlock_p(acquire_lock);
+    // While other threads are running, a malloc and its free (on another thread)
+    // can be summed out of order, so a negative sum doesn't prove a real underflow.
+    // (safe_exit does the final check, once all threads are done)
+    if (sum < 0) {
+        log_warn_rl_p(acquire_lock, 1, 1, "Malloc count read as negative (%lld)", sum);
+        return 0;
+    }
+
+    return (size_t)sum;
+}
+
+size_t sys_get_malloc_count_exact_p(bool acquire_lock) {
+    long long sum = sum_malloc_shards();
 
-    return mc;
+    // No other thread is allocating, so this is a real underflow.
+    if (sum < 0) {
+        log_fatal_p(acquire_lock, "Malloc underflow (%lld)", sum);
+    }
+
+    return (size_t)sum;
 }
 
 void sys_reset_malloc_count_p(bool acquire_lock) {
-    sys_lock_p(acquire_lock);
-    ss->malloc_count = 0;
-    sys_unlock_p(acquire_lock);
+    (void)acquire_lock;
+
+    for (size_t i = 0; i < SYS_MALLOC_SHARDS; i++) {
+        atomic_store_explicit(&(malloc_shards[i].count), 0, memory_order_relaxed);
+    }
 }
 
 // This should be called after a fork within the child process.
@@ -251,6 +308,10 @@ static int prepare_from_child(void) {
     // Spawn our signal thread.
     spawn_sig_thread_p(true);
 
+    // Same goes for the async log flusher (If there is one).
+    sys_log_async_after_fork();
+    sys_log_binary_after_fork();
+
     return 0;
 }
 
@@ -258,6 +319,10 @@ pid_t safe_fork(void) {
     // Acquire the system lock before forking!
     sys_lock_p(true);
 
+    // Otherwise, anything sitting in the stdout buffer would be
+    // printed by both processes.
+    fflush(stdout);
+
     pid_t pid = fork();
     
     if (pid < 0) {
@@ -336,8 +401,20 @@ void safe_exit_p(bool acquire_lock, int status) {
     // NOTE: Log fatal calls this function, so we cannot call log fatal within exit.
 
     // Check malloc count.
-    if (ss->malloc_count > 0) {
-        log_warn_p(false, "Process exiting with memory leak. (%zu)", ss->malloc_count);
+    long long malloc_count = sum_malloc_shards();
+    if (malloc_count > 0) {
+        log_warn_p(false, "Process exiting with memory leak. (%lld)", malloc_count);
+    } else if (malloc_count < 0) {
+        // Can't be fatal here, so the exit fails instead.
+        log_warn_p(false, "Process exiting with malloc underflow. (%lld)", malloc_count);
+        if (status == 0) {
+            status = 1;
+        }
+    }
+
+    if (sys_mem_profile_enabled()) {
+        log_info_p(false, "Memory profile:");
+        sys_mem_profile_report(stdout, false);
     }
 
     // kill all children. 
@@ -358,6 +435,10 @@ void safe_exit_p(bool acquire_lock, int status) {
     }
 
     free(ss); 
+
+    // Write out anything still sitting in the async log ring or binary log buffers.
+    sys_log_async_flush();
+    sys_log_binary_flush();
     
     // NOTE: We exit while holding our lock!
     exit(status);
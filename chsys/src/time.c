@@ -0,0 +1,48 @@
+
+#include "chsys/time.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+void sys_sleep_ns(uint64_t ns) {
+    struct timespec req = {
+        .tv_sec = (time_t)(ns / SYS_NS_PER_S),
+        .tv_nsec = (long)(ns % SYS_NS_PER_S),
+    };
+    struct timespec rem;
+
+    while (nanosleep(&req, &rem) && errno == EINTR) {
+        req = rem;
+    }
+}
+
+#define CYCLES_CALIBRATION_NS (10 * SYS_NS_PER_MS)
+
+static pthread_once_t cycles_once = PTHREAD_ONCE_INIT;
+static double cycles_per_ns = 1.0;
+
+static void calibrate_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    uint64_t start_ns = sys_now_ns();
+    uint64_t start_cycles = sys_cycles();
+
+    // Busy wait rather than sleep, so the core doesn't go idle mid calibration.
+    uint64_t end_ns;
+    do {
+        end_ns = sys_now_ns();
+    } while (end_ns - start_ns < CYCLES_CALIBRATION_NS);
+
+    uint64_t end_cycles = sys_cycles();
+
+    cycles_per_ns = (double)(end_cycles - start_cycles) / (double)(end_ns - start_ns);
+#else
+    // sys_cycles is already in nanoseconds.
+    cycles_per_ns = 1.0;
+#endif
+}
+
+double sys_cycles_per_ns(void) {
+    pthread_once(&cycles_once, calibrate_cycles);
+    return cycles_per_ns;
+}
@@ -0,0 +1,231 @@
+
+// Needed for syscall.
+#define _GNU_SOURCE
+
+#include "chsys/uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool sys_uring_init(sys_uring_t *u, unsigned int entries, unsigned int cq_entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    if (cq_entries > 0) {
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+
+    int fd = uring_setup(entries, &p);
+    if (fd < 0) {
+        return false;
+    }
+
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+    u->sq_entries = p.sq_entries;
+    u->cq_entries = p.cq_entries;
+
+    u->sq_ring_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+    u->cq_ring_size = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && u->cq_ring_size > u->sq_ring_size) {
+        u->sq_ring_size = u->cq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (single_mmap) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            munmap(u->sq_ring, u->sq_ring_size);
+            close(fd);
+            return false;
+        }
+    }
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        if (!single_mmap) {
+            munmap(u->cq_ring, u->cq_ring_size);
+        }
+        munmap(u->sq_ring, u->sq_ring_size);
+        close(fd);
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *)u->sq_ring;
+    u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned int *)(sq + p.sq_off.flags);
+
+    // SQ slot i always holds SQE i, so the index array never has to change again.
+    unsigned int *sq_array = (unsigned int *)(sq + p.sq_off.array);
+    for (unsigned int i = 0; i < p.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    uint8_t *cq = (uint8_t *)u->cq_ring;
+    u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    u->sqe_head = *(u->sq_tail);
+    u->sqe_tail = u->sqe_head;
+
+    return true;
+}
+
+void sys_uring_cleanup(sys_uring_t *u) {
+    munmap(u->sqes, u->sqes_size);
+
+    if (u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_size);
+    }
+    munmap(u->sq_ring, u->sq_ring_size);
+
+    close(u->fd);
+}
+
+struct io_uring_sqe *sys_uring_get_sqe(sys_uring_t *u) {
+    unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    if (u->sqe_tail - head >= u->sq_entries) {
+        return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &(u->sqes[u->sqe_tail & *(u->sq_mask)]);
+    u->sqe_tail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+int sys_uring_submit(sys_uring_t *u, unsigned int wait_nr) {
+    unsigned int to_submit = u->sqe_tail - u->sqe_head;
+    bool overflow = __atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW;
+
+    if (to_submit == 0 && wait_nr == 0 && !overflow) {
+        return 0;
+    }
+
+    // Publish the new SQEs.
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+
+    // When the CQ has overflowed, GETEVENTS has the kernel move overflowed
+    // completions back into the ring.
+    unsigned int flags = (wait_nr > 0 || overflow) ? IORING_ENTER_GETEVENTS : 0;
+
+    int submitted;
+    do {
+        submitted = uring_enter(u->fd, to_submit, wait_nr, flags);
+    } while (submitted < 0 && errno == EINTR);
+
+    if (submitted < 0) {
+        return -errno;
+    }
+
+    u->sqe_head += (unsigned int)submitted;
+
+    return submitted;
+}
+
+bool sys_uring_buf_ring_init(sys_uring_t *u, sys_uring_buf_ring_t *br, uint16_t bgid,
+        unsigned int entries, size_t buf_size) {
+    if (entries == 0 || (entries & (entries - 1)) || entries > 32768) {
+        return false;
+    }
+
+    memset(br, 0, sizeof(*br));
+
+    // The ring must be page aligned, so it gets its own mapping.
+    br->br_size = entries * sizeof(struct io_uring_buf);
+    br->br = (struct io_uring_buf_ring *)mmap(NULL, br->br_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br->br == MAP_FAILED) {
+        return false;
+    }
+
+    br->bufs = (uint8_t *)mmap(NULL, entries * buf_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br->bufs == MAP_FAILED) {
+        munmap(br->br, br->br_size);
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+
+    if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        munmap(br->bufs, entries * buf_size);
+        munmap(br->br, br->br_size);
+        return false;
+    }
+
+    br->bgid = bgid;
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->tail = 0;
+
+    for (unsigned int i = 0; i < entries; i++) {
+        sys_uring_buf_ring_recycle(br, (uint16_t)i);
+    }
+
+    return true;
+}
+
+void sys_uring_buf_ring_cleanup(sys_uring_t *u, sys_uring_buf_ring_t *br) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+
+    uring_register(u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    munmap(br->bufs, br->entries * br->buf_size);
+    munmap(br->br, br->br_size);
+}
+
+void sys_uring_buf_ring_recycle(sys_uring_buf_ring_t *br, uint16_t bid) {
+    struct io_uring_buf *buf = &(br->br->bufs[br->tail & (br->entries - 1)]);
+
+    buf->addr = (uint64_t)(uintptr_t)sys_uring_buf_ring_buf(br, bid);
+    buf->len = (uint32_t)br->buf_size;
+    buf->bid = bid;
+
+    br->tail++;
+
+    // The kernel only looks at the tail, so it must be published after the entry.
+    __atomic_store_n(&(br->br->tail), br->tail, __ATOMIC_RELEASE);
+}
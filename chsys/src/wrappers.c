@@ -1,8 +1,15 @@
 
+// Needed for CPU sets, pthread_attr_setaffinity_np and pthread_setname_np.
+#define _GNU_SOURCE
+
 #include "chsys/wrappers.h"
 #include "chsys/log.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 void safe_pthread_create(pthread_t *t, const pthread_attr_t *attr, 
         void *(*start_routine)(void *), void *arg) {
@@ -17,6 +24,171 @@ void safe_pthread_join(pthread_t t, void **ret_val) {
     }
 }
 
+// Parses a sysfs cpulist. (e.g. "0-3,8,10-11")
+// Adds every listed CPU to set.
+// Returns false if the list couldn't be read.
+static bool read_cpulist(const char *path, cpu_set_t *set) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+
+    CPU_ZERO(set);
+
+    int lo, hi;
+
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1) {
+                break;
+            }
+            c = fgetc(f);
+        }
+
+        for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+
+        if (c != ',') {
+            break;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+static bool numa_node_cpu_set(int node, cpu_set_t *set) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return read_cpulist(path, set);
+}
+
+static size_t cpu_set_to_array(const cpu_set_t *set, int *cpus, size_t cap) {
+    size_t n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set)) {
+            if (n < cap) {
+                cpus[n] = cpu;
+            }
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static void allowed_cpu_set(cpu_set_t *set) {
+    if (sched_getaffinity(0, sizeof(cpu_set_t), set)) {
+        log_fatal("Failed to get CPU affinity");
+    }
+}
+
+size_t sys_allowed_cpus(int *cpus, size_t cap) {
+    cpu_set_t set;
+    allowed_cpu_set(&set);
+
+    return cpu_set_to_array(&set, cpus, cap);
+}
+
+size_t sys_numa_node_cpus(int node, int *cpus, size_t cap) {
+    cpu_set_t set;
+    if (node < 0 || !numa_node_cpu_set(node, &set)) {
+        return 0;
+    }
+
+    // Under taskset or a cpuset cgroup, some of the node's CPUs may be off limits.
+    cpu_set_t allowed;
+    allowed_cpu_set(&allowed);
+    CPU_AND(&set, &set, &allowed);
+
+    return cpu_set_to_array(&set, cpus, cap);
+}
+
+size_t sys_num_numa_nodes(void) {
+    cpu_set_t set;
+    if (!read_cpulist("/sys/devices/system/node/online", &set)) {
+        return 1;
+    }
+
+    // Here the "CPU" set actually holds node indeces.
+    size_t n = (size_t)CPU_COUNT(&set);
+    return n > 0 ? n : 1;
+}
+
+void safe_pthread_create_placed(pthread_t *t, const sys_thread_placement_t *placement,
+        void *(*start_routine)(void *), void *arg) {
+    if (!placement) {
+        safe_pthread_create(t, NULL, start_routine, arg);
+        return;
+    }
+
+    bool restrict_cpus = placement->num_cpus > 0 || placement->numa_node >= 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (placement->num_cpus > 0) {
+        for (size_t i = 0; i < placement->num_cpus; i++) {
+            if (placement->cpus[i] >= 0 && placement->cpus[i] < CPU_SETSIZE) {
+                CPU_SET(placement->cpus[i], &set);
+            }
+        }
+    }
+
+    if (placement->numa_node >= 0) {
+        cpu_set_t node_set;
+        if (!numa_node_cpu_set(placement->numa_node, &node_set)) {
+            CPU_ZERO(&node_set);
+        }
+
+        if (placement->num_cpus > 0) {
+            CPU_AND(&set, &set, &node_set);
+        } else {
+            set = node_set;
+        }
+    }
+
+    if (restrict_cpus) {
+        // CPUs this process can't use (or which don't exist) would make pthread_create fail.
+        cpu_set_t allowed;
+        allowed_cpu_set(&allowed);
+
+        CPU_AND(&set, &set, &allowed);
+    }
+
+    if (restrict_cpus && CPU_COUNT(&set) == 0) {
+        log_warn("Thread placement has no CPUs, spawning without affinity");
+        restrict_cpus = false;
+    }
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr)) {
+        log_fatal("Failed to init thread attributes");
+    }
+
+    // Setting the affinity in the attributes (Rather than after the fact) means
+    // the thread never runs anywhere else, not even briefly.
+    if (restrict_cpus && pthread_attr_setaffinity_np(&attr, sizeof(set), &set)) {
+        log_fatal("Failed to set thread affinity");
+    }
+
+    safe_pthread_create(t, &attr, start_routine, arg);
+    pthread_attr_destroy(&attr);
+
+    if (placement->name) {
+        char name[16];
+        strncpy(name, placement->name, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+
+        // Only cosmetic, failure is ignored.
+        pthread_setname_np(*t, name);
+    }
+}
+
 void safe_pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr) {
     if (pthread_mutex_init(m, attr)) {
         log_fatal("Failed to init mutex");
@@ -0,0 +1,81 @@
+
+#include "./arena.h"
+#include "chsys/arena.h"
+#include "chsys/log.h"
+#include "chsys/sys.h"
+#include "chsys/wrappers.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+static void test_arena_alloc_and_reset(void) {
+    sys_init();
+
+    arena_t *a = new_arena(0x100);
+
+    // Mix small allocations with some which are larger than the block size.
+    for (size_t round = 0; round < 3; round++) {
+        for (size_t i = 1; i < 200; i++) {
+            uint8_t *mem = arena_alloc(a, i * 3);
+            memset(mem, (int)i, i * 3);
+
+            if ((uintptr_t)mem % ARENA_ALIGNMENT != 0) {
+                log_fatal("Unaligned arena memory");
+            }
+        }
+
+        log_info("Round %zu used %zu bytes", round, arena_used(a));
+        arena_reset(a);
+    }
+
+    delete_arena(a);
+
+    // Expect no leak on exit.
+    safe_exit(0);
+}
+
+static void test_arena_leak(void) {
+    sys_init();
+    arena_t *a = new_arena(0);
+    arena_alloc(a, 10);
+
+    // Expect a leak of 2 on exit. (The arena and its block)
+    safe_exit(0);
+}
+
+static void *scratch_routine(void *arg) {
+    (void)arg;
+
+    for (size_t i = 0; i < 1000; i++) {
+        scratch_alloc(64);
+        if (i % 100 == 0) {
+            sys_scratch_reset();
+        }
+    }
+
+    // Scratch arena is cleaned up when this thread exits.
+    return NULL;
+}
+
+static void test_scratch_arena(void) {
+    sys_init();
+
+    pthread_t t;
+    safe_pthread_create(&t, NULL, scratch_routine, NULL);
+    scratch_routine(NULL);
+    safe_pthread_join(t, NULL);
+
+    // The scratch arena is not counted, expect no leak on exit.
+    safe_exit(0);
+}
+
+void run_arena_tests(void) {
+    (void)test_arena_alloc_and_reset;
+    //test_arena_alloc_and_reset();
+
+    (void)test_arena_leak;
+    //test_arena_leak();
+
+    (void)test_scratch_arena;
+    //test_scratch_arena();
+}
@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_ARENA_H
+#define TEST_CHSYS_ARENA_H
+
+void run_arena_tests(void);
+
+#endif
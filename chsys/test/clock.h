@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_CLOCK_H
+#define TEST_CHSYS_CLOCK_H
+
+void run_clock_tests(void);
+
+#endif
@@ -0,0 +1,200 @@
+
+#include "./event.h"
+#include "chsys/event.h"
+#include "chsys/log.h"
+#include "chsys/sock.h"
+#include "chsys/sys.h"
+#include "chsys/time.h"
+#include "chsys/wrappers.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void count_ticks_cb(sys_event_loop_t *loop, sys_event_source_t *src, 
+        uint32_t events, void *arg) {
+    (void)events;
+
+    uint64_t *ticks = (uint64_t *)arg;
+    *ticks += src->count;
+
+    if (*ticks >= 10) {
+        sys_event_loop_stop(loop);
+    }
+}
+
+static void test_event_timer(void) {
+    sys_init();
+
+    sys_event_loop_t *loop = new_sys_event_loop(0);
+
+    uint64_t ticks = 0;
+    sys_event_add_timer(loop, 10 * SYS_NS_PER_MS, 10 * SYS_NS_PER_MS, count_ticks_cb, &ticks);
+
+    uint64_t start = sys_now_ns();
+    sys_event_loop_run(loop);
+    uint64_t elapsed = sys_now_ns() - start;
+
+    log_info("%lu ticks in %lu ms", (unsigned long)ticks, (unsigned long)(elapsed / SYS_NS_PER_MS));
+
+    if (elapsed < 100 * SYS_NS_PER_MS) {
+        log_fatal("Timer fired too early");
+    }
+
+    delete_sys_event_loop(loop);
+
+    safe_exit(0);
+}
+
+static void *notify_thread(void *arg) {
+    sys_event_source_t *notifier = (sys_event_source_t *)arg;
+
+    for (int i = 0; i < 10; i++) {
+        sys_event_notify(notifier);
+        sys_sleep_ms(5);
+    }
+
+    return NULL;
+}
+
+static void test_event_notifier(void) {
+    sys_init();
+
+    sys_event_loop_t *loop = new_sys_event_loop(0);
+
+    uint64_t ticks = 0;
+    sys_event_source_t *notifier = sys_event_add_notifier(loop, count_ticks_cb, &ticks);
+
+    pthread_t t;
+    safe_pthread_create(&t, NULL, notify_thread, notifier);
+
+    sys_event_loop_run(loop);
+    safe_pthread_join(t, NULL);
+
+    log_info("Received %lu notifications", (unsigned long)ticks);
+
+    delete_sys_event_loop(loop);
+
+    safe_exit(0);
+}
+
+#define EVENT_TEST_PORT 8091
+#define EVENT_TEST_CLIENTS 50
+
+typedef struct _echo_state_t {
+    size_t accepted;
+    size_t closed;
+} echo_state_t;
+
+static void echo_cb(sys_event_loop_t *loop, sys_event_source_t *src, 
+        uint32_t events, void *arg) {
+    echo_state_t *es = (echo_state_t *)arg;
+
+    char buf[256];
+    ssize_t readden;
+
+    while ((readden = read(src->fd, buf, sizeof(buf))) > 0) {
+        if (write(src->fd, buf, (size_t)readden) != readden) {
+            log_fatal("Failed to echo");
+        }
+    }
+
+    if (readden == 0 || (events & SYS_EV_ERR)) {
+        int fd = src->fd;
+        sys_event_remove(loop, src);
+        close(fd);
+
+        if (++(es->closed) == EVENT_TEST_CLIENTS) {
+            sys_event_loop_stop(loop);
+        }
+    }
+}
+
+static void accept_cb(sys_event_loop_t *loop, sys_event_source_t *src, 
+        uint32_t events, void *arg) {
+    (void)events;
+
+    echo_state_t *es = (echo_state_t *)arg;
+
+    int fd;
+    while ((fd = accept(src->fd, NULL, NULL)) >= 0) {
+        // Accepted sockets don't inherit O_NONBLOCK.
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        if (!sys_event_add_fd(loop, fd, SYS_EV_READ, echo_cb, es)) {
+            log_fatal("Failed to watch client");
+        }
+
+        es->accepted++;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_fatal("Failed to accept");
+    }
+}
+
+static void *echo_clients_thread(void *arg) {
+    (void)arg;
+
+    for (int i = 0; i < EVENT_TEST_CLIENTS; i++) {
+        int fd = client_connect("127.0.0.1", EVENT_TEST_PORT);
+        if (fd < 0) {
+            log_fatal("Failed to connect to echo server");
+        }
+
+        const char msg[] = "hello";
+        char buf[sizeof(msg)];
+
+        if (write(fd, msg, sizeof(msg)) != sizeof(msg) || read(fd, buf, sizeof(buf)) != sizeof(msg)) {
+            log_fatal("Bad echo");
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static void test_event_echo_server(void) {
+    sys_init();
+
+    int server_fd = create_server(EVENT_TEST_PORT, 16);
+    if (server_fd < 0) {
+        log_fatal("Failed to create server");
+    }
+
+    sys_event_loop_t *loop = new_sys_event_loop(0);
+
+    echo_state_t es = {0};
+    sys_event_add_fd(loop, server_fd, SYS_EV_READ, accept_cb, &es);
+
+    pthread_t t;
+    safe_pthread_create(&t, NULL, echo_clients_thread, NULL);
+
+    uint64_t start = sys_now_ns();
+    sys_event_loop_run(loop);
+    uint64_t elapsed = sys_now_ns() - start;
+
+    safe_pthread_join(t, NULL);
+
+    log_info("Accepted and echoed %zu clients in %lu us", es.accepted, 
+            (unsigned long)(elapsed / SYS_NS_PER_US));
+
+    delete_sys_event_loop(loop);
+    close(server_fd);
+
+    safe_exit(0);
+}
+
+void run_event_tests(void) {
+    (void)test_event_timer;
+    //test_event_timer();
+
+    (void)test_event_notifier;
+    //test_event_notifier();
+
+    (void)test_event_echo_server;
+    //test_event_echo_server();
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_CHSYS_EVENT_H
+#define TEST_CHSYS_EVENT_H
+
+void run_event_tests(void);
+
+#endif
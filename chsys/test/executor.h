@@ -0,0 +1,6 @@
+#ifndef TEST_CHSYS_EXECUTOR_H
+#define TEST_CHSYS_EXECUTOR_H
+
+void run_executor_tests(void);
+
+#endif
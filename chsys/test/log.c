@@ -0,0 +1,196 @@
+
+#include "./log.h"
+#include "chsys/log.h"
+#include "chsys/log_bin.h"
+#include "chsys/sys.h"
+#include "chsys/wrappers.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOG_TEST_THREADS 4
+
+static void *log_routine(void *arg) {
+    size_t id = (size_t)(uintptr_t)arg;
+
+    for (size_t i = 0; i < 100; i++) {
+        log_info("Thread %zu line %zu", id, i);
+    }
+
+    return NULL;
+}
+
+static void test_async_log(void) {
+    sys_init();
+    sys_log_async_start(NULL);
+
+    pthread_t threads[LOG_TEST_THREADS];
+    for (size_t i = 0; i < LOG_TEST_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, log_routine, (void *)(uintptr_t)i);
+    }
+
+    for (size_t i = 0; i < LOG_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    sys_log_async_flush();
+    log_info("Dropped %zu lines", sys_log_async_dropped());
+
+    sys_log_async_stop();
+    log_info("Back to synchronous logging");
+
+    safe_exit(0);
+}
+
+static void test_async_log_dropped(void) {
+    sys_init();
+
+    // With such a small ring, many of these lines should be dropped.
+    // The flusher should report how many.
+    sys_log_async_config_t cfg = {
+        .fd = -1,
+        .ring_cap = 8,
+        .flush_interval_us = 100000,
+    };
+    sys_log_async_start(&cfg);
+
+    for (size_t i = 0; i < 100; i++) {
+        log_warn("Line %zu", i);
+    }
+
+    safe_exit(0);
+}
+
+static void test_async_log_fork(void) {
+    sys_init();
+    sys_log_async_start(NULL);
+
+    log_info("Logged before fork");
+
+    pid_t pid = safe_fork();
+    if (pid == 0) {
+        log_info("Hello from the child");
+        safe_exit(0);
+    }
+
+    safe_waitpid(pid, NULL, 0);
+
+    // Expect a fatal line to still be written.
+    log_fatal("Parent exiting via fatal");
+}
+
+static void *binary_log_routine(void *arg) {
+    size_t id = (size_t)(uintptr_t)arg;
+
+    for (size_t i = 0; i < 100; i++) {
+        log_info("Thread %zu: %d %5.2f %s %c %*d%%", id, (int)i, i / 3.0, 
+                i % 2 ? "odd" : "even", 'a' + (char)(i % 26), 4, (int)i);
+    }
+
+    return NULL;
+}
+
+static void test_binary_log(void) {
+    sys_init();
+
+    const char *path = "/tmp/chsys_test_binary.log";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_fatal("Failed to open %s", path);
+    }
+
+    sys_log_binary_start(fd);
+
+    pthread_t threads[LOG_TEST_THREADS];
+    for (size_t i = 0; i < LOG_TEST_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, binary_log_routine, (void *)(uintptr_t)i);
+    }
+
+    for (size_t i = 0; i < LOG_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    log_warn("A NULL string %s, a long %ld, and a pointer %p", (char *)NULL, -5L, (void *)path);
+    log_info("Unsupported format %n");
+
+    sys_log_binary_stop();
+    close(fd);
+
+    // Now render what was written.
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        log_fatal("Failed to reopen %s", path);
+    }
+
+    if (!sys_log_binary_decode(in, stdout, true)) {
+        log_fatal("Failed to decode binary log");
+    }
+
+    fclose(in);
+
+    safe_exit(0);
+}
+
+static void test_log_levels(void) {
+    sys_init();
+
+    log_info("This line should print");
+
+    sys_log_set_module_level("default", SYS_WARN);
+    log_info("This line should NOT print");
+    log_warn("This warning should print");
+
+    sys_log_set_level(SYS_INFO);
+    log_info("This line should print again");
+
+    sys_set_quiet(true);
+    log_warn("This warning should NOT print");
+    sys_set_quiet(false);
+
+    safe_exit(0);
+}
+
+static void rate_limited_warn(size_t i) {
+    log_warn_rl(1, 3, "Rate limited line %zu", i);
+}
+
+static void test_log_rate_limit(void) {
+    sys_init();
+
+    // Only the first 3 lines should print.
+    for (size_t i = 0; i < 1000; i++) {
+        rate_limited_warn(i);
+    }
+
+    // After a second, one more line should make it through, 
+    // followed by a count of the suppressed lines. (997)
+    sleep(1);
+
+    for (size_t i = 1000; i < 1010; i++) {
+        rate_limited_warn(i);
+    }
+
+    safe_exit(0);
+}
+
+void run_log_tests(void) {
+    (void)test_async_log;
+    //test_async_log();
+
+    (void)test_async_log_dropped;
+    //test_async_log_dropped();
+
+    (void)test_async_log_fork;
+    //test_async_log_fork();
+
+    (void)test_binary_log;
+    //test_binary_log();
+
+    (void)test_log_levels;
+    //test_log_levels();
+
+    (void)test_log_rate_limit;
+    //test_log_rate_limit();
+}
@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_LOG_H
+#define TEST_CHSYS_LOG_H
+
+void run_log_tests(void);
+
+#endif
@@ -3,6 +3,14 @@
 #include "chsys/sys.h"
 #include "sys.h"
 #include "sock.h"
+#include "arena.h"
+#include "pool.h"
+#include "mem.h"
+#include "log.h"
+#include "prefork.h"
+#include "clock.h"
+#include "executor.h"
+#include "event.h"
 #include "chsys/wrappers.h"
 
 // We won't have UNITY tests here.
@@ -12,4 +20,12 @@
 int main(void) {
     run_sys_tests();
     run_sock_tests();
+    run_arena_tests();
+    run_pool_tests();
+    run_mem_tests();
+    run_log_tests();
+    run_prefork_tests();
+    run_clock_tests();
+    run_executor_tests();
+    run_event_tests();
 }
@@ -0,0 +1,200 @@
+// Needed for MAP_ANONYMOUS.
+#define _GNU_SOURCE
+
+// Profile the allocations made in this file.
+#define CHSYS_MEM_PROFILE
+
+#include "./mem.h"
+#include "chsys/mem.h"
+#include "chsys/log.h"
+#include "chsys/sys.h"
+#include "chsys/pool.h"
+#include "chsys/wrappers.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+static void *profile_routine(void *arg) {
+    (void)arg;
+
+    for (size_t i = 0; i < 1000; i++) {
+        void *mem = safe_malloc(i + 1);
+        mem = safe_realloc(mem, 2 * (i + 1));
+        safe_free(mem);
+    }
+
+    return NULL;
+}
+
+static void test_mem_profile(void) {
+    sys_init();
+    sys_mem_profile_enable();
+
+    pthread_t t;
+    safe_pthread_create(&t, NULL, profile_routine, NULL);
+    profile_routine(NULL);
+    safe_pthread_join(t, NULL);
+
+    // Leak a little so there is something to find.
+    for (size_t i = 0; i < 10; i++) {
+        safe_malloc(100);
+    }
+
+    sys_mem_profile_report(stdout, true);
+
+    // Expect the text report to show the 1000 leaked bytes first.
+    safe_exit(0);
+}
+
+#define CACHE_TEST_THREADS 4
+#define CACHE_TEST_BLOCKS 10000
+
+static void *cache_alloc_routine(void *arg) {
+    void **blocks = (void **)arg;
+
+    for (size_t round = 0; round < 10; round++) {
+        for (size_t i = 0; i < CACHE_TEST_BLOCKS; i++) {
+            safe_free(safe_malloc(1 + (i % 600)));
+        }
+    }
+
+    // These will be freed by another thread.
+    for (size_t i = 0; i < CACHE_TEST_BLOCKS; i++) {
+        blocks[i] = safe_malloc(1 + (i % 600));
+    }
+
+    return NULL;
+}
+
+static void *cache_free_routine(void *arg) {
+    void **blocks = (void **)arg;
+
+    for (size_t i = 0; i < CACHE_TEST_BLOCKS; i++) {
+        safe_free(blocks[i]);
+    }
+
+    return NULL;
+}
+
+static void test_mem_cache(void) {
+    sys_init();
+    sys_mem_cache_enable();
+
+    pthread_t threads[CACHE_TEST_THREADS];
+    void **blocks[CACHE_TEST_THREADS];
+
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        blocks[i] = (void **)safe_malloc(sizeof(void *) * CACHE_TEST_BLOCKS);
+        safe_pthread_create(&(threads[i]), NULL, cache_alloc_routine, blocks[i]);
+    }
+
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, cache_free_routine, blocks[(i + 1) % CACHE_TEST_THREADS]);
+    }
+
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+        safe_free(blocks[i]);
+    }
+
+    // Expect no leak on exit.
+    safe_exit(0);
+}
+
+static void *cache_pool_routine(void *arg) {
+    pool_t *p = (pool_t *)arg;
+
+    for (size_t i = 0; i < 1000; i++) {
+        pool_free(p, pool_alloc(p, 1 + (i % 200)), 1 + (i % 200));
+    }
+
+    // On exit, the pool's cache destructor frees with safe_free, which may run
+    // after the memory cache's own destructor.
+    return NULL;
+}
+
+static void test_mem_cache_thread_exit(void) {
+    sys_init();
+    sys_mem_cache_enable();
+
+    pool_t *p = new_pool();
+
+    pthread_t threads[CACHE_TEST_THREADS];
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, cache_pool_routine, p);
+    }
+
+    for (size_t i = 0; i < CACHE_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    delete_pool(p);
+
+    // Expect no leak on exit. (And no use after free when run with ASan)
+    safe_exit(0);
+}
+
+#define HUGE_PAGE_SIZE 0x200000
+
+static void test_large_realloc(void) {
+    sys_init();
+
+    size_t size = SAFE_LARGE_THRESHOLD;
+    uint8_t *buf = (uint8_t *)safe_malloc_large(size);
+
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)i;
+    }
+
+    // Grow well past a huge page, with something mapped right after the buffer
+    // each time, so it can't just grow in place.
+    for (int round = 0; round < 4; round++) {
+        void *blocker = mmap(buf + size, 0x1000, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        size_t new_size = size * 4;
+        buf = (uint8_t *)safe_realloc_large(buf, new_size);
+
+        for (size_t i = 0; i < size; i++) {
+            if (buf[i] != (uint8_t)i) {
+                log_fatal("Large buffer lost its contents at %zu", i);
+            }
+        }
+
+        for (size_t i = size; i < new_size; i++) {
+            buf[i] = (uint8_t)i;
+        }
+
+        // The buffer's header (16 bytes) starts the mapping.
+        uintptr_t map = (uintptr_t)buf - 16;
+        log_info("Large buffer of %zu bytes, mapping %s huge page aligned", new_size,
+                new_size >= HUGE_PAGE_SIZE && (map & (HUGE_PAGE_SIZE - 1)) ? "NOT" : "is");
+
+        if (blocker != MAP_FAILED) {
+            munmap(blocker, 0x1000);
+        }
+
+        size = new_size;
+    }
+
+    safe_free_large(buf);
+    safe_exit(0);
+}
+
+void run_mem_tests(void) {
+    (void)test_large_realloc;
+    //test_large_realloc();
+
+    (void)test_mem_cache;
+    //test_mem_cache();
+
+    (void)test_mem_cache_thread_exit;
+    //test_mem_cache_thread_exit();
+
+    (void)test_mem_profile;
+    //test_mem_profile();
+}
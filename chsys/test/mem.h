@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_MEM_H
+#define TEST_CHSYS_MEM_H
+
+void run_mem_tests(void);
+
+#endif
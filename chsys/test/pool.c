@@ -0,0 +1,80 @@
+
+#include "./pool.h"
+#include "chsys/pool.h"
+#include "chsys/log.h"
+#include "chsys/sys.h"
+#include "chsys/wrappers.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#define POOL_TEST_THREADS 4
+#define POOL_TEST_OBJS 10000
+
+typedef struct _pool_test_arg_t {
+    pool_t *pool;
+
+    // Objects allocated by one thread, to be freed by another.
+    void **objs;
+} pool_test_arg_t;
+
+static void *pool_alloc_routine(void *arg) {
+    pool_test_arg_t *pta = (pool_test_arg_t *)arg;
+
+    for (size_t i = 0; i < POOL_TEST_OBJS; i++) {
+        size_t s = 8 + (i % 100);
+        pta->objs[i] = pool_alloc(pta->pool, s);
+        memset(pta->objs[i], 0xAB, s);
+    }
+
+    return NULL;
+}
+
+static void *pool_free_routine(void *arg) {
+    pool_test_arg_t *pta = (pool_test_arg_t *)arg;
+
+    for (size_t i = 0; i < POOL_TEST_OBJS; i++) {
+        pool_free(pta->pool, pta->objs[i], 8 + (i % 100));
+    }
+
+    return NULL;
+}
+
+static void test_pool_cross_thread(void) {
+    sys_init();
+
+    pool_t *pool = new_pool();
+
+    pthread_t threads[POOL_TEST_THREADS];
+    pool_test_arg_t args[POOL_TEST_THREADS];
+
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) {
+        args[i].pool = pool;
+        args[i].objs = (void **)malloc(sizeof(void *) * POOL_TEST_OBJS);
+        safe_pthread_create(&(threads[i]), NULL, pool_alloc_routine, &(args[i]));
+    }
+
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    // Now free everything on different threads.
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, pool_free_routine, &(args[(i + 1) % POOL_TEST_THREADS]));
+    }
+
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+        free(args[i].objs);
+    }
+
+    delete_pool(pool);
+
+    // Expect no leak on exit.
+    safe_exit(0);
+}
+
+void run_pool_tests(void) {
+    (void)test_pool_cross_thread;
+    //test_pool_cross_thread();
+}
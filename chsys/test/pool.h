@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_POOL_H
+#define TEST_CHSYS_POOL_H
+
+void run_pool_tests(void);
+
+#endif
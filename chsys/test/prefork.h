@@ -0,0 +1,7 @@
+
+#ifndef TEST_CHSYS_PREFORK_H
+#define TEST_CHSYS_PREFORK_H
+
+void run_prefork_tests(void);
+
+#endif
@@ -5,8 +5,10 @@
 #include "chsys/sys.h"
 #include "chsys/wrappers.h"
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -71,6 +73,197 @@ static void test_echo_socket(void) {
     safe_exit(0);
 }
 
+#define UNIX_TEST_PATH "/tmp/chsys_sock_test"
+
+static void *unix_echo_routine(void *arg) {
+    int serverfd = *(int *)arg;
+
+    int clientfd = accept(serverfd, NULL, NULL);
+    if (clientfd < 0) {
+        log_fatal("Failed to accept unix client");
+    }
+
+    char buf[ECHO_ROUTINE_BUF_SIZE];
+    ssize_t readden;
+
+    // With SEQPACKET, each read returns exactly one message.
+    while ((readden = read(clientfd, buf, sizeof(buf))) > 0) {
+        if (write(clientfd, buf, readden) != readden) {
+            log_fatal("Failed to echo to unix client");
+        }
+    }
+
+    close(clientfd);
+
+    return NULL;
+}
+
+static void test_unix_socket(int type, const char *path) {
+    sys_init();
+
+    int serverfd = create_unix_server(path, type, NULL);
+    if (serverfd < 0) {
+        log_fatal("Failed to create unix server at %s", path);
+    }
+
+    pthread_t server;
+    safe_pthread_create(&server, NULL, unix_echo_routine, &serverfd);
+
+    int clientfd = unix_connect(path, type, NULL);
+    if (clientfd < 0) {
+        log_fatal("Failed to connect to %s", path);
+    }
+
+    const char *msgs[] = {"Hello", "from", "a unix socket"};
+
+    for (size_t i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++) {
+        size_t len = strlen(msgs[i]) + 1;
+        if (write(clientfd, msgs[i], len) != (ssize_t)len) {
+            log_fatal("Failed to write to unix server");
+        }
+
+        char buf[ECHO_ROUTINE_BUF_SIZE];
+        ssize_t readden = read(clientfd, buf, sizeof(buf));
+
+        if (readden != (ssize_t)len || strcmp(buf, msgs[i])) {
+            log_fatal("Bad echo from unix server");
+        }
+
+        log_info("Echoed \"%s\"", buf);
+    }
+
+    close(clientfd);
+    safe_pthread_join(server, NULL);
+    close(serverfd);
+
+    safe_exit(0);
+}
+
+static void test_unix_stream_socket(void) {
+    test_unix_socket(SOCK_STREAM, UNIX_TEST_PATH);
+}
+
+static void test_unix_seqpacket_socket(void) {
+    test_unix_socket(SOCK_SEQPACKET, "@chsys_sock_test");
+}
+
+static void test_unix_server_path(void) {
+    sys_init();
+
+    unlink(UNIX_TEST_PATH);
+
+    // A regular file is never replaced.
+    FILE *f = fopen(UNIX_TEST_PATH, "w");
+    if (!f) {
+        log_fatal("Failed to create %s", UNIX_TEST_PATH);
+    }
+    fclose(f);
+
+    if (create_unix_server(UNIX_TEST_PATH, SOCK_STREAM, NULL) >= 0) {
+        log_fatal("Created a unix server over a regular file");
+    }
+
+    if (access(UNIX_TEST_PATH, F_OK)) {
+        log_fatal("Regular file was deleted");
+    }
+
+    unlink(UNIX_TEST_PATH);
+
+    // The socket file left by a closed server is replaced.
+    for (int i = 0; i < 2; i++) {
+        int serverfd = create_unix_server(UNIX_TEST_PATH, SOCK_STREAM, NULL);
+        if (serverfd < 0) {
+            log_fatal("Failed to create unix server (%d)", i);
+        }
+
+        close(serverfd);
+    }
+
+    unlink(UNIX_TEST_PATH);
+    log_info("Unix server path handling works");
+
+    safe_exit(0);
+}
+
+static void test_socketpair(void) {
+    sys_init();
+
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.nonblocking = true;
+    opts.sndbuf = 0x10000;
+
+    int fds[2];
+    if (create_socketpair(SOCK_SEQPACKET, &opts, fds)) {
+        log_fatal("Failed to create socketpair");
+    }
+
+    char buf[16];
+    if (read(fds[1], buf, sizeof(buf)) != -1) {
+        log_fatal("Expected a non-blocking read");
+    }
+
+    if (write(fds[0], "ping", 5) != 5 || read(fds[1], buf, sizeof(buf)) != 5) {
+        log_fatal("Failed to send over socketpair");
+    }
+
+    log_info("Received %s over socketpair", buf);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    safe_exit(0);
+}
+
+static void test_tcp_opts(void) {
+    sys_init();
+
+    sock_opts_t opts = SOCK_OPTS_DEFAULT;
+    opts.backlog = 64;
+    opts.nonblocking = true;
+    opts.reuse_addr = true;
+    opts.tcp_nodelay = true;
+    opts.rcvbuf = 0x20000;
+
+    int serverfd = create_server_opts(ECHO_ROUTINE_PORT, &opts);
+    if (serverfd < 0) {
+        log_fatal("Failed to create server");
+    }
+
+    sock_opts_t client_opts = SOCK_OPTS_DEFAULT;
+    client_opts.tcp_nodelay = true;
+    client_opts.tcp_quickack = true;
+    client_opts.busy_poll_us = 50;
+
+    int clientfd = client_connect_opts("127.0.0.1", ECHO_ROUTINE_PORT, &client_opts);
+    if (clientfd < 0) {
+        log_fatal("Failed to connect");
+    }
+
+    // The connection is already established, so this shouldn't need to wait.
+    int acceptedfd = accept(serverfd, NULL, NULL);
+    if (acceptedfd < 0) {
+        log_fatal("Failed to accept");
+    }
+
+    int val;
+    socklen_t len = sizeof(val);
+
+    getsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &val, &len);
+    log_info("Client TCP_NODELAY: %d", val);
+
+    getsockopt(acceptedfd, IPPROTO_TCP, TCP_NODELAY, &val, &len);
+    log_info("Accepted TCP_NODELAY: %d", val);
+
+    getsockopt(serverfd, SOL_SOCKET, SO_RCVBUF, &val, &len);
+    log_info("Server SO_RCVBUF: %d", val);
+
+    close(acceptedfd);
+    close(clientfd);
+    close(serverfd);
+
+    safe_exit(0);
+}
+
 void run_sock_tests(void) {
     (void)test_echo_socket;
     /*
@@ -78,4 +271,19 @@ void run_sock_tests(void) {
     test_echo_socket();
     safe_exit(0);
     */
+
+    (void)test_unix_stream_socket;
+    //test_unix_stream_socket();
+
+    (void)test_unix_seqpacket_socket;
+    //test_unix_seqpacket_socket();
+
+    (void)test_unix_server_path;
+    //test_unix_server_path();
+
+    (void)test_socketpair;
+    //test_socketpair();
+
+    (void)test_tcp_opts;
+    //test_tcp_opts();
 }
@@ -2,7 +2,9 @@
 #include "chsys/sys.h"
 #include "chsys/log.h"
 #include "chsys/mem.h"
+#include "chsys/wrappers.h"
 #include "sys.h"
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -25,6 +27,57 @@ static void test_no_mem_leak(void) {
     safe_exit_p(true, 0);
 }
 
+static void test_mem_underflow(void) {
+    sys_init();
+
+    // One free too many, should be fatal.
+    sys_dec_malloc_count();
+    log_info("Malloc count: %zu", sys_get_malloc_count_exact());
+
+    safe_exit_p(true, 0);
+}
+
+#define MALLOC_COUNT_THREADS 8
+#define MALLOC_COUNT_ITERS 100000
+
+static void *malloc_count_routine(void *arg) {
+    void **mems = (void **)arg;
+
+    for (size_t i = 0; i < MALLOC_COUNT_ITERS; i++) {
+        safe_free(safe_malloc(16));
+    }
+
+    // Leave one allocation behind, it'll be freed by a different thread.
+    *mems = safe_malloc(16);
+
+    return NULL;
+}
+
+static void test_threaded_malloc_count(void) {
+    sys_init();
+
+    pthread_t threads[MALLOC_COUNT_THREADS];
+    void *mems[MALLOC_COUNT_THREADS];
+
+    for (size_t i = 0; i < MALLOC_COUNT_THREADS; i++) {
+        safe_pthread_create(&(threads[i]), NULL, malloc_count_routine, &(mems[i]));
+    }
+
+    for (size_t i = 0; i < MALLOC_COUNT_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    // Expect MALLOC_COUNT_THREADS.
+    log_info("Malloc count after threads: %zu", sys_get_malloc_count());
+
+    for (size_t i = 0; i < MALLOC_COUNT_THREADS; i++) {
+        safe_free(mems[i]);
+    }
+
+    // Expect no leak on exit.
+    safe_exit_p(true, 0);
+}
+
 static void test_sigint_catch(void) {
     sys_init();
 
@@ -132,6 +185,12 @@ void run_sys_tests(void) {
     (void)test_no_mem_leak;
     //test_no_mem_leak();
     
+    (void)test_mem_underflow;
+    //test_mem_underflow();
+
+    (void)test_threaded_malloc_count;
+    //test_threaded_malloc_count();
+
     (void)test_sigint_catch;
     //test_sigint_catch();
 
@@ -0,0 +1,55 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chsys/log_bin.h"
+
+// chlog-decode renders a binary log written by sys_log_binary_start.
+//
+// Usage: chlog-decode [-n] [FILE]
+//
+// When no FILE (or "-") is given, the log is read from stdin.
+// Output is colored when stdout is a terminal, unless -n is given.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n] [FILE]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    bool color = isatty(STDOUT_FILENO);
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            color = false;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *in = stdin;
+    if (path && strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (!in) {
+            fprintf(stderr, "Failed to open %s\n", path);
+            return 1;
+        }
+    }
+
+    bool ok = sys_log_binary_decode(in, stdout, color);
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Malformed or incompatible binary log\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#ifndef CHUTIL_BTREE_H
+#define CHUTIL_BTREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An ordered map, as a B+ tree.
+//
+// Like hash_map_t, keys and values are fixed size and copied into the tree.
+// Instead of hash and equality functions, keys are ordered by a comparison function.
+//
+// All pairs live in the leaves, which are linked in key order, so iterating over
+// any range of keys just walks leaves left to right.
+//
+// Nodes are wide, about BT_NODE_SIZE bytes (a few cache lines), with keys stored inline
+// and back to back. So, the tree stays very shallow, and a search within a node
+// reads contiguous memory.
+//
+// NOTE: Puts and removes MOVE pairs within and between leaves. Any pointer returned by
+// bt_get or bt_cursor_next is only valid until the next bt_put or bt_remove.
+
+// Returns < 0 if k1 comes before k2, 0 if they are equal, > 0 otherwise.
+typedef int (*btree_key_cmp_ft)(const void *k1, const void *k2);
+
+// Target size of a node in bytes. (8 cache lines)
+#define BT_NODE_SIZE 512
+
+// Nodes always hold at least this many keys, even when keys/values are big.
+// (In that case, nodes are larger than BT_NODE_SIZE)
+#define BT_MIN_FANOUT 4
+
+// Every node starts with this header.
+//
+// A leaf is followed by its keys then its values.
+// An internal node is followed by its (num_keys + 1) children then its keys.
+// Child i holds keys k where keys[i - 1] <= k < keys[i].
+typedef struct _bt_node_t {
+    bool leaf;
+    uint32_t num_keys;
+
+    // Leaves only, the next leaf in key order. (NULL for the last leaf)
+    struct _bt_node_t *next;
+} bt_node_t;
+
+typedef struct _btree_t {
+    size_t key_size;
+    size_t value_size;
+
+    btree_key_cmp_ft cmp_func;
+
+    // Max number of keys in each type of node.
+    size_t leaf_cap;
+    size_t internal_cap;
+
+    // Allocation size of each type of node.
+    size_t leaf_size;
+    size_t internal_size;
+
+    // Offsets from the end of the node header.
+    size_t leaf_vals_offset;
+    size_t internal_keys_offset;
+
+    size_t num_keys;
+
+    // 1 when the root is a leaf.
+    size_t height;
+    bt_node_t *root;
+
+    // Used to carry keys up the tree while splitting. (2 keys)
+    uint8_t *key_buf;
+} btree_t;
+
+// NOTE: value size CAN be 0 (an ordered set), then values can always be given as NULL.
+btree_t *new_btree(size_t ks, size_t vs, btree_key_cmp_ft cmp);
+
+// Builds a tree from n pairs, keys holds n keys back to back, values holds n values back to back.
+// Keys must be in strictly increasing order, otherwise NULL is returned.
+//
+// Much faster than n puts, as leaves are filled one after the other, and every
+// node is written just once.
+btree_t *new_btree_from_sorted(size_t ks, size_t vs, btree_key_cmp_ft cmp,
+        const void *keys, const void *values, size_t n);
+
+void delete_btree(btree_t *bt);
+
+static inline size_t bt_num_keys(btree_t *bt) {
+    return bt->num_keys;
+}
+
+void bt_put(btree_t *bt, const void *key, const void *value);
+void *bt_get(btree_t *bt, const void *key);
+bool bt_remove(btree_t *bt, const void *key);
+
+static inline bool bt_get_copy(btree_t *bt, const void *key, void *dest) {
+    void *val = bt_get(bt, key);
+    if (!val) {
+        return false;
+    }
+
+    memcpy(dest, val, bt->value_size);
+    return true;
+}
+
+static inline bool bt_contains(btree_t *bt, const void *key) {
+    return bt_get(bt, key) != NULL;
+}
+
+// Iterates over pairs in key order.
+// Like hash_map_cursor_t, any number of cursors can walk a tree at once, but a cursor
+// must not be used after the tree is modified.
+typedef struct _btree_cursor_t {
+    bt_node_t *leaf;    // NULL means done.
+    size_t ind;
+
+    // Iteration stops at the first key >= end. (NULL means no end)
+    // NOT COPIED, must outlive the cursor.
+    const void *end;
+} btree_cursor_t;
+
+// Sets cur to the smallest key of the tree.
+void bt_cursor_init(btree_t *bt, btree_cursor_t *cur);
+
+// Sets cur to iterate over the keys k where lo <= k < hi.
+// lo and/or hi can be NULL for no lower and/or upper bound.
+void bt_cursor_init_range(btree_t *bt, btree_cursor_t *cur, const void *lo, const void *hi);
+
+// Writes the next pair to key and val (either can be NULL), and returns true.
+// Returns false once done.
+bool bt_cursor_next(btree_t *bt, btree_cursor_t *cur, const void **key, void **val);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef CHUTIL_CONCURRENT_MAP_H
+#define CHUTIL_CONCURRENT_MAP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "chutil/map.h"
+
+// A thread safe hash map.
+//
+// Keys are spread across many stripes, each being a hash_map_t behind its own rwlock.
+// So, calls on keys of different stripes never wait on each other, and lookups
+// only ever wait on writers of the same stripe.
+//
+// Values are always copied in and out, never handed out by pointer, since another
+// thread could remove them at any time. To change a value in place, use chm_update.
+//
+// Each stripe's map resizes incrementally. (See hm_set_incremental_resize)
+
+// Used when num_stripes is 0.
+#define CHM_DEFAULT_STRIPES 64
+
+// Each stripe gets its own cache lines. (128 bytes, as adjacent lines are often
+// prefetched together) The stripes array is aligned to this size.
+#define CHM_STRIPE_SIZE 128
+
+typedef union _chm_stripe_t {
+    struct {
+        pthread_rwlock_t lock;
+        hash_map_t *hm;
+    };
+
+    uint8_t pad[CHM_STRIPE_SIZE];
+} chm_stripe_t;
+
+typedef struct _concurrent_hash_map_t {
+    size_t key_size;
+    size_t value_size;
+
+    hash_map_hash_ft hash_func;
+    hash_map_key_eq_ft eq_func;
+
+    // Always a power of 2.
+    size_t num_stripes;
+    chm_stripe_t *stripes;
+
+    // What was allocated, stripes is aligned within it.
+    void *stripes_mem;
+
+    atomic_size_t num_keys;
+} concurrent_hash_map_t;
+
+// num_stripes is rounded up to a power of 2. (0 for CHM_DEFAULT_STRIPES)
+// A few times the number of threads using the map is a good choice.
+concurrent_hash_map_t *new_concurrent_hash_map(size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, size_t num_stripes);
+
+// NOT thread safe, no other thread may be using the map.
+void delete_concurrent_hash_map(concurrent_hash_map_t *chm);
+
+// With writers running, this is only a rough count.
+static inline size_t chm_num_keys(concurrent_hash_map_t *chm) {
+    return atomic_load(&(chm->num_keys));
+}
+
+void chm_put(concurrent_hash_map_t *chm, const void *key, const void *value);
+
+// Returns true if key was not in the map, and value was put.
+// Returns false (leaving the map as is) if key was already in the map.
+bool chm_put_if_absent(concurrent_hash_map_t *chm, const void *key, const void *value);
+
+// Copies key's value into dest. Returns false if key is not in the map.
+// (dest can be NULL, to just check if key exists)
+bool chm_get_copy(concurrent_hash_map_t *chm, const void *key, void *dest);
+
+static inline bool chm_contains(concurrent_hash_map_t *chm, const void *key) {
+    return chm_get_copy(chm, key, NULL);
+}
+
+// When old_value is non-NULL, the removed value is copied into it.
+// (So that the caller can clean it up)
+// Returns false if key is not in the map.
+bool chm_remove(concurrent_hash_map_t *chm, const void *key, void *old_value);
+
+// Called with the stripe's write lock held, val can be changed in place.
+// The map must NOT be used from within this function.
+typedef void (*chm_update_ft)(const void *key, void *val, void *arg);
+
+// Runs f on key's value. Returns false if key is not in the map.
+bool chm_update(concurrent_hash_map_t *chm, const void *key, chm_update_ft f, void *arg);
+
+// Called on every pair of chm_for_each, with the pair's stripe read locked.
+// The map must NOT be used from within this function.
+typedef void (*chm_visit_ft)(const void *key, const void *val, void *arg);
+
+// Visits every pair, one stripe at a time.
+// Pairs put or removed during the call may or may not be visited.
+void chm_for_each(concurrent_hash_map_t *chm, chm_visit_ft f, void *arg);
+
+// Returns a new hash_map_t holding a copy of every pair.
+// All stripes are read locked at once while copying, so the snapshot is exactly the
+// map's contents at a single point in time.
+//
+// The returned map is owned by the caller, and uses the same hash and equality functions.
+hash_map_t *chm_snapshot(concurrent_hash_map_t *chm);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef CHUTIL_FLAT_MAP_H
+#define CHUTIL_FLAT_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chutil/map.h"
+
+// An open addressing hash map, an alternative to hash_map_t.
+//
+// Keys and values are stored inline in one table, so puts never allocate (except to grow),
+// and a lookup usually touches just two cache lines.
+//
+// Each slot has a 1-byte control byte, either EMPTY or 7 bits of the key's hash.
+// Lookups compare 16 control bytes at once (With SSE2, when available), and only
+// call the equality function on slots whose 7 bits match.
+//
+// Collisions are resolved with linear probing. On remove, the following entries
+// of the probe run are shifted back, so there are never any tombstones, and lookups
+// never slow down after many removes.
+//
+// Differences from hash_map_t:
+// NOTE: Puts and removes MOVE entries. Any pointer returned by fhm_get or fhm_next_kvp
+// is only valid until the next fhm_put or fhm_remove.
+// NOTE: The hash function is given the same hash_map_hash_ft type, but its value is mixed
+// before use, so weak hash functions are fine.
+
+// Number of control bytes compared at once.
+#define FHM_GROUP_WIDTH 16
+
+typedef struct _flat_hash_map_t {
+    size_t key_size;
+    size_t value_size;
+
+    // Key followed by value, padded for alignment.
+    size_t slot_size;
+
+    hash_map_hash_ft hash_func;
+    hash_map_key_eq_ft eq_func;
+
+    size_t num_keys;
+
+    // Always a power of 2.
+    size_t cap;
+
+    // The table is a single buffer, holding all 3 arrays below.
+    void *table;
+    size_t table_size;
+
+    uint8_t *slots;
+
+    // Mixed hash of each full slot. (Used when growing and shifting, so keys
+    // are never rehashed)
+    uint32_t *hashes;
+
+    // cap control bytes, followed by copies of the first FHM_GROUP_WIDTH - 1.
+    // (So a group can be loaded from any position without wrapping)
+    uint8_t *ctrl;
+
+    size_t iter_ind;
+} flat_hash_map_t;
+
+flat_hash_map_t *new_flat_hash_map(size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef);
+void delete_flat_hash_map(flat_hash_map_t *fhm);
+
+static inline const void *fhm_kvp_key(flat_hash_map_t *fhm, key_val_pair_t kvp) {
+    (void)fhm;
+    return kvp;
+}
+
+static inline void *fhm_kvp_val(flat_hash_map_t *fhm, key_val_pair_t kvp) {
+    return (uint8_t *)kvp + fhm->key_size;
+}
+
+static inline size_t fhm_num_keys(flat_hash_map_t *fhm) {
+    return fhm->num_keys;
+}
+
+// Same rules as hm_reset_iterator and hm_next_kvp.
+void fhm_reset_iterator(flat_hash_map_t *fhm);
+key_val_pair_t fhm_next_kvp(flat_hash_map_t *fhm);
+
+void fhm_put(flat_hash_map_t *fhm, const void *key, const void *value);
+void *fhm_get(flat_hash_map_t *fhm, const void *key);
+bool fhm_remove(flat_hash_map_t *fhm, const void *key);
+
+static inline bool fhm_get_copy(flat_hash_map_t *fhm, const void *key, void *dest) {
+    void *val = fhm_get(fhm, key);
+    if (!val) {
+        return false;
+    }
+
+    memcpy(dest, val, fhm->value_size);
+    return true;
+}
+
+static inline bool fhm_contains(flat_hash_map_t *fhm, const void *key) {
+    return fhm_get(fhm, key) != NULL;
+}
+
+bool fhm_equals(flat_hash_map_t *fhm1, flat_hash_map_t *fhm2, hash_map_val_eq_ft val_eq);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CHUTIL_HASH_H
+#define CHUTIL_HASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Fast non-cryptographic hashing.
+//
+// hash_bytes is in the style of wyhash. Long inputs are consumed 48 bytes per step
+// over 3 independent lanes, each step being a few 64x64 => 128 bit multiplies.
+// Short inputs (<= 16 bytes) take a single multiply.
+//
+// NOTE: These are NOT safe against collision attacks by someone who knows the seed.
+// NOTE: Results depend on the machine's byte order, so they should not be persisted
+// or sent to other machines.
+
+#define HASH_DEFAULT_SEED 0x9E3779B97F4A7C15ULL
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+// Integer Mixers
+//
+// Both are bijections, and every input bit affects every output bit.
+// Use these to hash integer keys, or to clean up a weak hash.
+
+// (The splitmix64 finalizer)
+static inline uint64_t hash_mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// (MurmurHash3's finalizer)
+static inline uint32_t hash_mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6BU;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35U;
+    x ^= x >> 16;
+    return x;
+}
+
+// Folds a 64-bit hash into the 32 bits expected by hash_map_hash_ft.
+static inline uint32_t hash_fold32(uint64_t h) {
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Ready made hash_map_hash_ft style helpers.
+
+static inline uint32_t hash_u64_key(const void *key) {
+    return hash_fold32(hash_mix64(*(const uint64_t *)key));
+}
+
+static inline uint32_t hash_u32_key(const void *key) {
+    return hash_mix32(*(const uint32_t *)key);
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "chsys/pool.h"
+
 // Abstract List Types. (Really just reinventing C++ here.)
 
 typedef void *(*list_constructor_ft)(size_t);
@@ -161,6 +163,10 @@ typedef struct _linked_list_t {
     size_t cell_size;
     size_t len;
 
+    // When non-NULL, nodes are allocated from this pool
+    // instead of with safe_malloc. (NOT OWNED by the list)
+    pool_t *pool;
+
     linked_list_node_hdr_t *first;
     linked_list_node_hdr_t *last;
 
@@ -168,6 +174,10 @@ typedef struct _linked_list_t {
 } linked_list_t;
 
 linked_list_t *new_linked_list(size_t cs);
+
+// Same as new_linked_list, but all nodes will be allocated from the given pool.
+// The pool must outlive the list.
+linked_list_t *new_linked_list_with_pool(size_t cs, pool_t *pool);
 void delete_linked_list(linked_list_t *ll);
 void *delete_and_move_linked_list(linked_list_t *ll);
 
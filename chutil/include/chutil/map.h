@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "chsys/pool.h"
+
 // Only hashmap implementation for now!
 
 typedef bool (*hash_map_key_eq_ft)(const void *, const void *);
@@ -22,6 +24,21 @@ typedef struct _key_val_header_t {
     uint32_t hash_val;
 } key_val_header_t;
 
+// An iterator kept outside of the map, usually on the stack.
+//
+// Any number of cursors can walk the same map at once, as none of them
+// change the map. (e.g. many threads holding a read lock)
+// Like the map's own iterator, a cursor must not be used after the map is modified.
+typedef struct _hash_map_cursor_t {
+    // While resizing, iteration visits chains, then old_chains.
+    // (So chain_ind may run past chains_cap)
+    size_t chain_ind;
+    size_t end_chain_ind;   // Exclusive.
+
+    key_val_header_t *iter; // header of next pair to return.
+                            // NULL means done.
+} hash_map_cursor_t;
+
 typedef struct _hash_map_t {
     size_t key_size;
     size_t value_size;
@@ -31,19 +48,53 @@ typedef struct _hash_map_t {
 
     size_t num_keys;
 
+    // When non-NULL, key value pairs are allocated from this pool
+    // instead of with safe_malloc. (NOT OWNED by the map)
+    pool_t *pool;
+
     size_t chains_cap;
     key_val_header_t **chains;
 
-    size_t iter_chain_ind;
-    key_val_header_t *iter; // header of next pair to return from next_kvp.
-                            // NULL means empty.
+    // Incremental Resizing (Off by default, see hm_set_incremental_resize)
+    //
+    // While a resize is in progress, old_chains is the previous table.
+    // Chains of old_chains before migrate_ind have already been moved into chains.
+    // (And are NULL) When old_chains is NULL, no resize is in progress.
+    bool incremental;
+    size_t old_chains_cap;
+    key_val_header_t **old_chains;
+    size_t migrate_ind;
+
+    // Cursor used by hm_reset_iterator and hm_next_kvp.
+    hash_map_cursor_t iter;
 } hash_map_t;
 
 hash_map_t *new_hash_map(size_t ks, size_t vs, 
         hash_map_hash_ft hf, hash_map_key_eq_ft ef);
 
+// Same as new_hash_map, but all key value pairs will be allocated from the given pool.
+// The pool must outlive the map.
+hash_map_t *new_hash_map_with_pool(size_t ks, size_t vs, 
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, pool_t *pool);
+
 void delete_hash_map(hash_map_t *hm);
 
+// By default, when a put makes the map too full, every pair is moved into a
+// larger table right away. For a big map, that one put can take a long time.
+//
+// In incremental mode, the larger table is allocated, but pairs are moved over
+// a few chains at a time by each following put and remove. Lookups check both tables
+// until the move is done. So, no single call ever does more than a bounded amount of work.
+// (Other than allocating the new table)
+//
+// NOTE: Lookups NEVER move pairs, so concurrent hm_get calls (e.g. under a read lock)
+// are safe in both modes.
+void hm_set_incremental_resize(hash_map_t *hm, bool incremental);
+
+// Grows the map (right away, even in incremental mode) so that n keys
+// fit without any further resizing.
+void hm_reserve(hash_map_t *hm, size_t n);
+
 // There is no key_mut since keys should never change!
 static inline const void *kvp_key(hash_map_t *hm, key_val_pair_t kvp) {
     (void)hm;
@@ -54,6 +105,12 @@ static inline void *kvp_val(hash_map_t *hm, key_val_pair_t kvp) {
     return (uint8_t *)kvp + hm->key_size;   // Skip over key.
 }
 
+// The hash of kvp's key, as stored when it was put. (No call to the hash function)
+static inline uint32_t kvp_hash(hash_map_t *hm, key_val_pair_t kvp) {
+    (void)hm;
+    return ((key_val_header_t *)((uint8_t *)kvp - sizeof(key_val_header_t)))->hash_val;
+}
+
 static inline size_t hm_num_keys(hash_map_t *hm) {
     return hm->num_keys;
 }
@@ -69,10 +126,68 @@ void hm_reset_iterator(hash_map_t *hm);
 // This will return HASH_MAP_EXHAUSTED when done.
 key_val_pair_t hm_next_kvp(hash_map_t *hm);
 
+// Sets cur to the start of the map.
+void hm_cursor_init(hash_map_t *hm, hash_map_cursor_t *cur);
+
+// Splits the map's chains into num_parts ranges of (nearly) equal size, and sets cur
+// to the start of range part.
+//
+// part must be < num_parts, otherwise (including when num_parts is 0) cur is
+// left with an empty range, and hm_cursor_next returns HASH_MAP_EXHAUSTED right away.
+//
+// Every pair is in exactly one range, so num_parts threads can each walk their own part.
+// NOTE: Ranges are by chain, not pair, so with a small map some ranges may be empty.
+void hm_cursor_init_partition(hash_map_t *hm, hash_map_cursor_t *cur, size_t part, size_t num_parts);
+
+// Returns HASH_MAP_EXHAUSTED once cur's range is done.
+key_val_pair_t hm_cursor_next(hash_map_t *hm, hash_map_cursor_t *cur);
+
 void hm_put(hash_map_t *hm, const void *key, const void *value);
 void *hm_get(hash_map_t *hm, const void *key);
 bool hm_remove(hash_map_t *hm, const void *key);
 
+// If key is in the map, returns a pointer to its value.
+// Otherwise, key is put with a copy of init_val (or a zeroed value when init_val is NULL),
+// and a pointer to the new value is returned.
+//
+// When inserted is non-NULL, it is set to whether key was newly put.
+// Only hashes and searches once, unlike an hm_get followed by an hm_put.
+void *hm_get_or_insert(hash_map_t *hm, const void *key, const void *init_val, bool *inserted);
+
+// Same as hm_put, but returns true if key was newly put, false if its value was overwritten.
+bool hm_upsert(hash_map_t *hm, const void *key, const void *value);
+
+// Precomputed Hash Variants
+//
+// hash_val MUST be hm_hash(hm, key). Useful when the same key is used for more than
+// one call, or its hash is already known (e.g. stored alongside the key elsewhere).
+
+static inline uint32_t hm_hash(hash_map_t *hm, const void *key) {
+    return hm->hash_func(key);
+}
+
+void hm_put_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, const void *value);
+void *hm_get_hashed(hash_map_t *hm, const void *key, uint32_t hash_val);
+bool hm_remove_hashed(hash_map_t *hm, const void *key, uint32_t hash_val);
+void *hm_get_or_insert_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, 
+        const void *init_val, bool *inserted);
+bool hm_upsert_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, const void *value);
+
+// Batched Calls
+//
+// On a map much larger than the cache, nearly every lookup waits on a miss for the
+// chain slot, then again for the first pair. These calls hash a group of keys up front
+// and prefetch their chains, so the misses of the whole group overlap.
+//
+// keys holds n keys back to back. (i.e. key i is at keys + (i * key_size))
+
+// vals[i] is set to hm_get(hm, key i).
+void hm_get_batch(hash_map_t *hm, const void *keys, size_t n, void **vals);
+
+// Puts key i with value i for every i < n. values holds n values back to back.
+// Keys are put in order, so a repeated key ends with its last value.
+void hm_put_batch(hash_map_t *hm, const void *keys, const void *values, size_t n);
+
 static inline bool hm_get_copy(hash_map_t *hm, const void *key, void *dest) {
     void *val = hm_get(hm, key);
     if (!val) {
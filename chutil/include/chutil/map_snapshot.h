@@ -0,0 +1,141 @@
+#ifndef CHUTIL_MAP_SNAPSHOT_H
+#define CHUTIL_MAP_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chutil/map.h"
+
+// Read-only hash map snapshots.
+//
+// hm_write_snapshot writes a hash_map_t to a flat file, which new_hm_snapshot maps
+// back into memory with mmap. Lookups run directly on the mapped file, so opening
+// a snapshot does no per-key work, and every process opening the same file shares
+// the same pages of the page cache.
+//
+// The file holds no pointers, just offsets computed from the sizes in the header:
+//
+// header           (hm_snapshot_header_t, padded to HM_SNAPSHOT_HEADER_SIZE)
+// bucket_starts    (num_buckets + 1) x uint64_t
+//                  bucket b's pairs are slots [bucket_starts[b], bucket_starts[b + 1])
+// hashes           num_keys x uint32_t, the user hash of each slot's key
+//                  (padded to 8 bytes)
+// slots            num_keys x slot_size, key followed by value
+//
+// NOTE: Keys and values are copied byte for byte, so they must not hold pointers.
+// NOTE: The file uses the writer's byte order, and the stored hashes are only meaningful
+// for the hash function used to write it. The same hash and equality functions must be
+// given when opening.
+
+#define HM_SNAPSHOT_MAGIC "CHHMSNAP"
+#define HM_SNAPSHOT_VERSION 1
+#define HM_SNAPSHOT_HEADER_SIZE 64
+
+typedef struct _hm_snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t key_size;
+    uint64_t value_size;
+
+    uint64_t num_keys;
+
+    // Always a power of 2.
+    uint64_t num_buckets;
+
+    // Size of the whole file, header included.
+    uint64_t file_size;
+
+    // hash_bytes of everything after the header. (See chutil/hash.h)
+    uint64_t checksum;
+} hm_snapshot_header_t;
+
+typedef enum _hm_snapshot_status_t {
+    HM_SNAPSHOT_SUCCESS = 0,
+
+    // A system call failed, errno is left as is.
+    HM_SNAPSHOT_IO_ERROR,
+
+    // Not a snapshot file, a different version, or its sizes don't add up.
+    HM_SNAPSHOT_BAD_FORMAT,
+
+    // The file's key or value size differs from the one given.
+    HM_SNAPSHOT_SIZE_MISMATCH,
+
+    HM_SNAPSHOT_BAD_CHECKSUM,
+} hm_snapshot_status_t;
+
+// Writes hm to the file at path.
+//
+// The file is built under a unique temporary name (path + ".XXXXXX", see mkstemp)
+// and then renamed, so processes opening path never see a half written snapshot, and
+// concurrent writers never touch each other's files. (The last rename wins)
+//
+// Returns HM_SNAPSHOT_IO_ERROR if there isn't enough space for the file.
+hm_snapshot_status_t hm_write_snapshot(hash_map_t *hm, const char *path);
+
+typedef struct _hm_snapshot_t {
+    size_t key_size;
+    size_t value_size;
+    size_t slot_size;
+
+    hash_map_hash_ft hash_func;
+    hash_map_key_eq_ft eq_func;
+
+    size_t num_keys;
+    size_t num_buckets;
+
+    // The read-only mapping of the whole file.
+    const uint8_t *image;
+    size_t image_size;
+
+    // Point into image.
+    const uint64_t *bucket_starts;
+    const uint32_t *hashes;
+    const uint8_t *slots;
+} hm_snapshot_t;
+
+// Maps the snapshot at path. ks and vs must match the sizes it was written with.
+//
+// When verify is true, the checksum is checked, which reads the whole file.
+// Otherwise, only the header is checked, and opening takes the same time for any size of file.
+hm_snapshot_status_t new_hm_snapshot(hm_snapshot_t **snap, const char *path, size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, bool verify);
+
+void delete_hm_snapshot(hm_snapshot_t *snap);
+
+static inline size_t hms_num_keys(hm_snapshot_t *snap) {
+    return snap->num_keys;
+}
+
+// Returned values are read-only, they live in the mapped file.
+const void *hms_get(hm_snapshot_t *snap, const void *key);
+
+static inline bool hms_get_copy(hm_snapshot_t *snap, const void *key, void *dest) {
+    const void *val = hms_get(snap, key);
+    if (!val) {
+        return false;
+    }
+
+    memcpy(dest, val, snap->value_size);
+    return true;
+}
+
+static inline bool hms_contains(hm_snapshot_t *snap, const void *key) {
+    return hms_get(snap, key) != NULL;
+}
+
+// Slots can be iterated by index, i < hms_num_keys(snap).
+
+static inline const void *hms_key(hm_snapshot_t *snap, size_t i) {
+    return snap->slots + (i * snap->slot_size);
+}
+
+static inline const void *hms_val(hm_snapshot_t *snap, size_t i) {
+    return snap->slots + (i * snap->slot_size) + snap->key_size;
+}
+
+#endif
@@ -0,0 +1,744 @@
+#include "chutil/btree.h"
+#include "chsys/mem.h"
+#include <string.h>
+
+// With at least BT_MIN_FANOUT (>= 2) keys per node, no tree of addressable size is taller.
+#define BT_MAX_HEIGHT 64
+
+static inline size_t bt_round8(size_t s) {
+    return (s + 7) & ~((size_t)7);
+}
+
+static inline uint8_t *bt_data(bt_node_t *node) {
+    return (uint8_t *)node + sizeof(bt_node_t);
+}
+
+// Node Field Access
+
+static inline uint8_t *bt_leaf_key(btree_t *bt, bt_node_t *leaf, size_t i) {
+    return bt_data(leaf) + (i * bt->key_size);
+}
+
+static inline uint8_t *bt_leaf_val(btree_t *bt, bt_node_t *leaf, size_t i) {
+    return bt_data(leaf) + bt->leaf_vals_offset + (i * bt->value_size);
+}
+
+static inline bt_node_t **bt_children(bt_node_t *node) {
+    return (bt_node_t **)bt_data(node);
+}
+
+static inline uint8_t *bt_internal_key(btree_t *bt, bt_node_t *node, size_t i) {
+    return bt_data(node) + bt->internal_keys_offset + (i * bt->key_size);
+}
+
+// Leaves can't drop below half full, except for the root.
+static inline size_t bt_leaf_min(btree_t *bt) {
+    return bt->leaf_cap / 2;
+}
+
+// A split internal node gives floor(cap / 2) keys to its right half, and one key
+// goes up. So, this min always leaves room to merge two siblings and their separator.
+static inline size_t bt_internal_min(btree_t *bt) {
+    return (bt->internal_cap - 1) / 2;
+}
+
+// Copies n values from src (which can be NULL in an ordered set).
+static inline void bt_copy_vals(btree_t *bt, void *dest, const void *src, size_t n) {
+    if (bt->value_size > 0) {
+        memcpy(dest, src, n * bt->value_size);
+    }
+}
+
+static bt_node_t *bt_new_node(btree_t *bt, bool leaf) {
+    bt_node_t *node = (bt_node_t *)safe_malloc(leaf ? bt->leaf_size : bt->internal_size);
+
+    node->leaf = leaf;
+    node->num_keys = 0;
+    node->next = NULL;
+
+    return node;
+}
+
+static void bt_free_node(bt_node_t *node) {
+    safe_free(node);
+}
+
+// Binary Search
+//
+// Keys are compared with a user function, so SIMD comparisons aren't an option.
+// Keys are contiguous though, so the last few steps of a search stay within a cache line.
+
+// Returns the first index whose key is >= key. (n if there is none)
+static size_t bt_lower_bound(btree_t *bt, const uint8_t *keys, size_t n, const void *key) {
+    size_t lo = 0;
+    size_t hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) / 2);
+
+        if (bt->cmp_func(keys + (mid * bt->key_size), key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Returns the first index whose key is > key. (n if there is none)
+static size_t bt_upper_bound(btree_t *bt, const uint8_t *keys, size_t n, const void *key) {
+    size_t lo = 0;
+    size_t hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) / 2);
+
+        if (bt->cmp_func(keys + (mid * bt->key_size), key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Index of the child of an internal node which may hold key.
+static inline size_t bt_child_ind(btree_t *bt, bt_node_t *node, const void *key) {
+    return bt_upper_bound(bt, bt_internal_key(bt, node, 0), node->num_keys, key);
+}
+
+// Construction
+
+// Returns the largest capacity whose node fits within BT_NODE_SIZE, but no less than BT_MIN_FANOUT.
+static size_t bt_pick_cap(size_t (*node_size)(size_t ks, size_t vs, size_t cap), size_t ks, size_t vs) {
+    size_t cap = BT_MIN_FANOUT;
+
+    while (node_size(ks, vs, cap + 1) <= BT_NODE_SIZE) {
+        cap++;
+    }
+
+    return cap;
+}
+
+static size_t bt_leaf_size(size_t ks, size_t vs, size_t cap) {
+    return sizeof(bt_node_t) + bt_round8(cap * ks) + (cap * vs);
+}
+
+static size_t bt_internal_size(size_t ks, size_t vs, size_t cap) {
+    (void)vs;
+    return sizeof(bt_node_t) + ((cap + 1) * sizeof(bt_node_t *)) + (cap * ks);
+}
+
+// Sets up everything but the root.
+static btree_t *bt_new_empty(size_t ks, size_t vs, btree_key_cmp_ft cmp) {
+    btree_t *bt = (btree_t *)safe_malloc(sizeof(btree_t));
+
+    bt->key_size = ks;
+    bt->value_size = vs;
+    bt->cmp_func = cmp;
+
+    bt->leaf_cap = bt_pick_cap(bt_leaf_size, ks, vs);
+    bt->internal_cap = bt_pick_cap(bt_internal_size, ks, vs);
+
+    bt->leaf_size = bt_leaf_size(ks, vs, bt->leaf_cap);
+    bt->internal_size = bt_internal_size(ks, vs, bt->internal_cap);
+
+    // Values are 8-byte aligned, when the value size allows.
+    bt->leaf_vals_offset = bt_round8(bt->leaf_cap * ks);
+    bt->internal_keys_offset = (bt->internal_cap + 1) * sizeof(bt_node_t *);
+
+    bt->num_keys = 0;
+    bt->height = 0;
+    bt->root = NULL;
+
+    bt->key_buf = (uint8_t *)safe_malloc(2 * ks);
+
+    return bt;
+}
+
+btree_t *new_btree(size_t ks, size_t vs, btree_key_cmp_ft cmp) {
+    if (ks == 0 || cmp == NULL) {
+        return NULL;
+    }
+
+    // NOTE: value size CAN be 0 (ordered set)
+
+    btree_t *bt = bt_new_empty(ks, vs, cmp);
+
+    bt->height = 1;
+    bt->root = bt_new_node(bt, true);
+
+    return bt;
+}
+
+// Splits count items into num_groups groups as evenly as possible.
+// Returns the size of group i.
+static inline size_t bt_group_size(size_t count, size_t num_groups, size_t i) {
+    return (count / num_groups) + (i < count % num_groups ? 1 : 0);
+}
+
+btree_t *new_btree_from_sorted(size_t ks, size_t vs, btree_key_cmp_ft cmp,
+        const void *keys, const void *values, size_t n) {
+    if (ks == 0 || cmp == NULL) {
+        return NULL;
+    }
+
+    const uint8_t *key_iter = (const uint8_t *)keys;
+    const uint8_t *val_iter = (const uint8_t *)values;
+
+    for (size_t i = 1; i < n; i++) {
+        if (cmp(key_iter + ((i - 1) * ks), key_iter + (i * ks)) >= 0) {
+            return NULL;
+        }
+    }
+
+    if (n == 0) {
+        return new_btree(ks, vs, cmp);
+    }
+
+    btree_t *bt = bt_new_empty(ks, vs, cmp);
+    bt->num_keys = n;
+
+    // Leaves are filled evenly, when there is more than one, each is at least half full.
+    size_t level_len = (n + bt->leaf_cap - 1) / bt->leaf_cap;
+
+    bt_node_t **level = (bt_node_t **)safe_malloc(sizeof(bt_node_t *) * level_len);
+
+    // The smallest key under each node of the level. (Points into the leaves)
+    const uint8_t **mins = (const uint8_t **)safe_malloc(sizeof(const uint8_t *) * level_len);
+
+    bt_node_t *prev = NULL;
+    for (size_t i = 0; i < level_len; i++) {
+        bt_node_t *leaf = bt_new_node(bt, true);
+        leaf->num_keys = (uint32_t)bt_group_size(n, level_len, i);
+
+        memcpy(bt_leaf_key(bt, leaf, 0), key_iter, leaf->num_keys * ks);
+        bt_copy_vals(bt, bt_leaf_val(bt, leaf, 0), val_iter, leaf->num_keys);
+
+        key_iter += leaf->num_keys * ks;
+        if (val_iter) {
+            val_iter += leaf->num_keys * vs;
+        }
+
+        if (prev) {
+            prev->next = leaf;
+        }
+        prev = leaf;
+
+        level[i] = leaf;
+        mins[i] = bt_leaf_key(bt, leaf, 0);
+    }
+
+    bt->height = 1;
+
+    // Build each level of internal nodes over the one below, until one node is left.
+    while (level_len > 1) {
+        size_t max_children = bt->internal_cap + 1;
+        size_t next_len = (level_len + max_children - 1) / max_children;
+
+        size_t child_ind = 0;
+        for (size_t i = 0; i < next_len; i++) {
+            size_t num_children = bt_group_size(level_len, next_len, i);
+
+            bt_node_t *node = bt_new_node(bt, false);
+            node->num_keys = (uint32_t)(num_children - 1);
+
+            const uint8_t *node_min = mins[child_ind];
+
+            for (size_t c = 0; c < num_children; c++) {
+                bt_children(node)[c] = level[child_ind + c];
+
+                if (c > 0) {
+                    memcpy(bt_internal_key(bt, node, c - 1), mins[child_ind + c], ks);
+                }
+            }
+
+            child_ind += num_children;
+
+            // Safe to write over, only entries before child_ind are overwritten.
+            level[i] = node;
+            mins[i] = node_min;
+        }
+
+        level_len = next_len;
+        bt->height++;
+    }
+
+    bt->root = level[0];
+
+    safe_free(level);
+    safe_free(mins);
+
+    return bt;
+}
+
+static void bt_free_subtree(bt_node_t *node) {
+    if (!(node->leaf)) {
+        for (size_t i = 0; i <= node->num_keys; i++) {
+            bt_free_subtree(bt_children(node)[i]);
+        }
+    }
+
+    bt_free_node(node);
+}
+
+void delete_btree(btree_t *bt) {
+    bt_free_subtree(bt->root);
+
+    safe_free(bt->key_buf);
+    safe_free(bt);
+}
+
+// Lookups
+
+// Returns the leaf which may hold key.
+// When path/path_inds are non-NULL, the internal nodes passed through and the
+// child index taken at each are written to them. (height - 1 entries)
+static bt_node_t *bt_descend(btree_t *bt, const void *key, bt_node_t **path, size_t *path_inds) {
+    bt_node_t *node = bt->root;
+    size_t depth = 0;
+
+    while (!(node->leaf)) {
+        size_t ci = bt_child_ind(bt, node, key);
+
+        if (path) {
+            path[depth] = node;
+            path_inds[depth] = ci;
+        }
+
+        depth++;
+        node = bt_children(node)[ci];
+    }
+
+    return node;
+}
+
+void *bt_get(btree_t *bt, const void *key) {
+    bt_node_t *leaf = bt_descend(bt, key, NULL, NULL);
+
+    size_t i = bt_lower_bound(bt, bt_leaf_key(bt, leaf, 0), leaf->num_keys, key);
+    if (i < leaf->num_keys && bt->cmp_func(bt_leaf_key(bt, leaf, i), key) == 0) {
+        return bt_leaf_val(bt, leaf, i);
+    }
+
+    return NULL;
+}
+
+// Insertion
+
+// Moves entries [from, from + n) of an array of elements of size s to start at index to.
+static inline void bt_move(uint8_t *arr, size_t s, size_t from, size_t to, size_t n) {
+    memmove(arr + (to * s), arr + (from * s), n * s);
+}
+
+static void bt_leaf_insert_at(btree_t *bt, bt_node_t *leaf, size_t i, const void *key, const void *value) {
+    size_t tail = leaf->num_keys - i;
+
+    bt_move(bt_leaf_key(bt, leaf, 0), bt->key_size, i, i + 1, tail);
+    bt_move(bt_leaf_val(bt, leaf, 0), bt->value_size, i, i + 1, tail);
+
+    memcpy(bt_leaf_key(bt, leaf, i), key, bt->key_size);
+    bt_copy_vals(bt, bt_leaf_val(bt, leaf, i), value, 1);
+
+    leaf->num_keys++;
+}
+
+// Inserts key at i and child at i + 1.
+static void bt_internal_insert_at(btree_t *bt, bt_node_t *node, size_t i, const void *key, bt_node_t *child) {
+    size_t tail = node->num_keys - i;
+
+    bt_move(bt_internal_key(bt, node, 0), bt->key_size, i, i + 1, tail);
+    memmove(&(bt_children(node)[i + 2]), &(bt_children(node)[i + 1]), tail * sizeof(bt_node_t *));
+
+    memcpy(bt_internal_key(bt, node, i), key, bt->key_size);
+    bt_children(node)[i + 1] = child;
+
+    node->num_keys++;
+}
+
+// Splits a full leaf while inserting the pair at i. Returns the new right leaf.
+static bt_node_t *bt_leaf_split_insert(btree_t *bt, bt_node_t *leaf, size_t i,
+        const void *key, const void *value) {
+    bt_node_t *right = bt_new_node(bt, true);
+
+    size_t n = leaf->num_keys;
+
+    // Number of pairs left in the left leaf once the new pair is in.
+    size_t mid = (n + 1) / 2;
+
+    // If the new pair goes left, one more pair must move right.
+    size_t move_from = i < mid ? mid - 1 : mid;
+    size_t num_moved = n - move_from;
+
+    memcpy(bt_leaf_key(bt, right, 0), bt_leaf_key(bt, leaf, move_from), num_moved * bt->key_size);
+    memcpy(bt_leaf_val(bt, right, 0), bt_leaf_val(bt, leaf, move_from), num_moved * bt->value_size);
+
+    right->num_keys = (uint32_t)num_moved;
+    leaf->num_keys = (uint32_t)move_from;
+
+    if (i < mid) {
+        bt_leaf_insert_at(bt, leaf, i, key, value);
+    } else {
+        bt_leaf_insert_at(bt, right, i - mid, key, value);
+    }
+
+    right->next = leaf->next;
+    leaf->next = right;
+
+    return right;
+}
+
+// Splits a full internal node while inserting key at i (and child at i + 1).
+// Returns the new right node, the key which must go up is written to up_key.
+static bt_node_t *bt_internal_split_insert(btree_t *bt, bt_node_t *node, size_t i,
+        const void *key, bt_node_t *child, uint8_t *up_key) {
+    bt_node_t *right = bt_new_node(bt, false);
+
+    size_t ks = bt->key_size;
+    size_t n = node->num_keys;
+
+    // Once key is in, there are n + 1 keys. The key at mid goes up, keys before
+    // it stay, keys after it go right.
+    size_t mid = (n + 1) / 2;
+
+    bt_node_t **children = bt_children(node);
+    bt_node_t **right_children = bt_children(right);
+
+    if (i < mid) {
+        memcpy(up_key, bt_internal_key(bt, node, mid - 1), ks);
+
+        right->num_keys = (uint32_t)(n - mid);
+        memcpy(bt_internal_key(bt, right, 0), bt_internal_key(bt, node, mid), right->num_keys * ks);
+        memcpy(right_children, &(children[mid]), (right->num_keys + 1) * sizeof(bt_node_t *));
+
+        node->num_keys = (uint32_t)(mid - 1);
+        bt_internal_insert_at(bt, node, i, key, child);
+    } else if (i == mid) {
+        memcpy(up_key, key, ks);
+
+        right->num_keys = (uint32_t)(n - mid);
+        memcpy(bt_internal_key(bt, right, 0), bt_internal_key(bt, node, mid), right->num_keys * ks);
+        right_children[0] = child;
+        memcpy(&(right_children[1]), &(children[mid + 1]), right->num_keys * sizeof(bt_node_t *));
+
+        node->num_keys = (uint32_t)mid;
+    } else {
+        memcpy(up_key, bt_internal_key(bt, node, mid), ks);
+
+        right->num_keys = (uint32_t)(n - mid - 1);
+        memcpy(bt_internal_key(bt, right, 0), bt_internal_key(bt, node, mid + 1), right->num_keys * ks);
+        memcpy(right_children, &(children[mid + 1]), (right->num_keys + 1) * sizeof(bt_node_t *));
+
+        node->num_keys = (uint32_t)mid;
+        bt_internal_insert_at(bt, right, i - mid - 1, key, child);
+    }
+
+    return right;
+}
+
+void bt_put(btree_t *bt, const void *key, const void *value) {
+    bt_node_t *path[BT_MAX_HEIGHT];
+    size_t path_inds[BT_MAX_HEIGHT];
+
+    bt_node_t *leaf = bt_descend(bt, key, path, path_inds);
+
+    size_t i = bt_lower_bound(bt, bt_leaf_key(bt, leaf, 0), leaf->num_keys, key);
+    if (i < leaf->num_keys && bt->cmp_func(bt_leaf_key(bt, leaf, i), key) == 0) {
+        bt_copy_vals(bt, bt_leaf_val(bt, leaf, i), value, 1);
+        return; // We can just exit after an update.
+    }
+
+    bt->num_keys++;
+
+    if (leaf->num_keys < bt->leaf_cap) {
+        bt_leaf_insert_at(bt, leaf, i, key, value);
+        return;
+    }
+
+    bt_node_t *right = bt_leaf_split_insert(bt, leaf, i, key, value);
+
+    // The separator and new node to insert into the level above.
+    // up_key alternates between the 2 key buffers, so that splitting a node never
+    // writes over the key being inserted into it.
+    uint8_t *up_key = bt->key_buf;
+    memcpy(up_key, bt_leaf_key(bt, right, 0), bt->key_size);
+
+    size_t depth = bt->height - 1;
+    while (depth > 0) {
+        depth--;
+
+        bt_node_t *node = path[depth];
+        size_t ci = path_inds[depth];
+
+        if (node->num_keys < bt->internal_cap) {
+            bt_internal_insert_at(bt, node, ci, up_key, right);
+            return;
+        }
+
+        uint8_t *next_up_key = up_key == bt->key_buf ? bt->key_buf + bt->key_size : bt->key_buf;
+        right = bt_internal_split_insert(bt, node, ci, up_key, right, next_up_key);
+        up_key = next_up_key;
+    }
+
+    // The root was split, the tree grows by one level.
+    bt_node_t *new_root = bt_new_node(bt, false);
+
+    new_root->num_keys = 1;
+    memcpy(bt_internal_key(bt, new_root, 0), up_key, bt->key_size);
+    bt_children(new_root)[0] = bt->root;
+    bt_children(new_root)[1] = right;
+
+    bt->root = new_root;
+    bt->height++;
+}
+
+// Removal
+
+static void bt_leaf_remove_at(btree_t *bt, bt_node_t *leaf, size_t i) {
+    size_t tail = leaf->num_keys - i - 1;
+
+    bt_move(bt_leaf_key(bt, leaf, 0), bt->key_size, i + 1, i, tail);
+    bt_move(bt_leaf_val(bt, leaf, 0), bt->value_size, i + 1, i, tail);
+
+    leaf->num_keys--;
+}
+
+// Removes key i and child i + 1.
+static void bt_internal_remove_at(btree_t *bt, bt_node_t *node, size_t i) {
+    size_t tail = node->num_keys - i - 1;
+
+    bt_move(bt_internal_key(bt, node, 0), bt->key_size, i + 1, i, tail);
+    memmove(&(bt_children(node)[i + 1]), &(bt_children(node)[i + 2]), tail * sizeof(bt_node_t *));
+
+    node->num_keys--;
+}
+
+// Appends all of right's pairs to left.
+static void bt_leaf_merge(btree_t *bt, bt_node_t *left, bt_node_t *right) {
+    memcpy(bt_leaf_key(bt, left, left->num_keys), bt_leaf_key(bt, right, 0), right->num_keys * bt->key_size);
+    memcpy(bt_leaf_val(bt, left, left->num_keys), bt_leaf_val(bt, right, 0), right->num_keys * bt->value_size);
+
+    left->num_keys += right->num_keys;
+    left->next = right->next;
+}
+
+// Appends sep, then all of right's keys and children to left.
+static void bt_internal_merge(btree_t *bt, bt_node_t *left, const void *sep, bt_node_t *right) {
+    size_t n = left->num_keys;
+
+    memcpy(bt_internal_key(bt, left, n), sep, bt->key_size);
+    memcpy(bt_internal_key(bt, left, n + 1), bt_internal_key(bt, right, 0), right->num_keys * bt->key_size);
+    memcpy(&(bt_children(left)[n + 1]), bt_children(right), (right->num_keys + 1) * sizeof(bt_node_t *));
+
+    left->num_keys += right->num_keys + 1;
+}
+
+// Refills leaf (child ci of parent), which has dropped below the min.
+// Returns true if a pair was borrowed from a sibling, false if leaf was merged with one.
+// (In which case parent has lost a key)
+static bool bt_fix_leaf(btree_t *bt, bt_node_t *parent, size_t ci, bt_node_t *leaf) {
+    bt_node_t *left = ci > 0 ? bt_children(parent)[ci - 1] : NULL;
+    bt_node_t *right = ci < parent->num_keys ? bt_children(parent)[ci + 1] : NULL;
+
+    size_t min = bt_leaf_min(bt);
+
+    if (left && left->num_keys > min) {
+        size_t last = left->num_keys - 1;
+        bt_leaf_insert_at(bt, leaf, 0, bt_leaf_key(bt, left, last), bt_leaf_val(bt, left, last));
+        left->num_keys--;
+
+        memcpy(bt_internal_key(bt, parent, ci - 1), bt_leaf_key(bt, leaf, 0), bt->key_size);
+        return true;
+    }
+
+    if (right && right->num_keys > min) {
+        bt_leaf_insert_at(bt, leaf, leaf->num_keys, bt_leaf_key(bt, right, 0), bt_leaf_val(bt, right, 0));
+        bt_leaf_remove_at(bt, right, 0);
+
+        memcpy(bt_internal_key(bt, parent, ci), bt_leaf_key(bt, right, 0), bt->key_size);
+        return true;
+    }
+
+    if (left) {
+        bt_leaf_merge(bt, left, leaf);
+        bt_internal_remove_at(bt, parent, ci - 1);
+        bt_free_node(leaf);
+    } else {
+        bt_leaf_merge(bt, leaf, right);
+        bt_internal_remove_at(bt, parent, ci);
+        bt_free_node(right);
+    }
+
+    return false;
+}
+
+// Same as bt_fix_leaf, but for an internal node.
+// Keys are rotated through the parent, as internal keys are only separators.
+static bool bt_fix_internal(btree_t *bt, bt_node_t *parent, size_t ci, bt_node_t *node) {
+    bt_node_t *left = ci > 0 ? bt_children(parent)[ci - 1] : NULL;
+    bt_node_t *right = ci < parent->num_keys ? bt_children(parent)[ci + 1] : NULL;
+
+    size_t ks = bt->key_size;
+    size_t min = bt_internal_min(bt);
+
+    if (left && left->num_keys > min) {
+        size_t n = node->num_keys;
+
+        bt_move(bt_internal_key(bt, node, 0), ks, 0, 1, n);
+        memmove(&(bt_children(node)[1]), bt_children(node), (n + 1) * sizeof(bt_node_t *));
+
+        memcpy(bt_internal_key(bt, node, 0), bt_internal_key(bt, parent, ci - 1), ks);
+        bt_children(node)[0] = bt_children(left)[left->num_keys];
+        node->num_keys++;
+
+        memcpy(bt_internal_key(bt, parent, ci - 1), bt_internal_key(bt, left, left->num_keys - 1), ks);
+        left->num_keys--;
+
+        return true;
+    }
+
+    if (right && right->num_keys > min) {
+        size_t n = node->num_keys;
+
+        memcpy(bt_internal_key(bt, node, n), bt_internal_key(bt, parent, ci), ks);
+        bt_children(node)[n + 1] = bt_children(right)[0];
+        node->num_keys++;
+
+        memcpy(bt_internal_key(bt, parent, ci), bt_internal_key(bt, right, 0), ks);
+
+        bt_move(bt_internal_key(bt, right, 0), ks, 1, 0, right->num_keys - 1);
+        memmove(bt_children(right), &(bt_children(right)[1]), right->num_keys * sizeof(bt_node_t *));
+        right->num_keys--;
+
+        return true;
+    }
+
+    if (left) {
+        bt_internal_merge(bt, left, bt_internal_key(bt, parent, ci - 1), node);
+        bt_internal_remove_at(bt, parent, ci - 1);
+        bt_free_node(node);
+    } else {
+        bt_internal_merge(bt, node, bt_internal_key(bt, parent, ci), right);
+        bt_internal_remove_at(bt, parent, ci);
+        bt_free_node(right);
+    }
+
+    return false;
+}
+
+bool bt_remove(btree_t *bt, const void *key) {
+    bt_node_t *path[BT_MAX_HEIGHT];
+    size_t path_inds[BT_MAX_HEIGHT];
+
+    bt_node_t *leaf = bt_descend(bt, key, path, path_inds);
+
+    size_t i = bt_lower_bound(bt, bt_leaf_key(bt, leaf, 0), leaf->num_keys, key);
+    if (i == leaf->num_keys || bt->cmp_func(bt_leaf_key(bt, leaf, i), key) != 0) {
+        return false; // No match.
+    }
+
+    bt_leaf_remove_at(bt, leaf, i);
+    bt->num_keys--;
+
+    // NOTE: Separators above may still hold the removed key. That's fine, a separator
+    // only needs to be between the keys of its two children.
+
+    if (bt->height == 1 || leaf->num_keys >= bt_leaf_min(bt)) {
+        return true;
+    }
+
+    size_t depth = bt->height - 2;
+
+    if (bt_fix_leaf(bt, path[depth], path_inds[depth], leaf)) {
+        return true;
+    }
+
+    // A merge took a key from the parent, which may now need fixing as well.
+    while (depth > 0) {
+        bt_node_t *node = path[depth];
+
+        if (node->num_keys >= bt_internal_min(bt)) {
+            return true;
+        }
+
+        depth--;
+
+        if (bt_fix_internal(bt, path[depth], path_inds[depth], node)) {
+            return true;
+        }
+    }
+
+    // The root has no min, but once it has no keys, its only child becomes the root.
+    bt_node_t *root = bt->root;
+    if (root->num_keys == 0) {
+        bt->root = bt_children(root)[0];
+        bt->height--;
+
+        bt_free_node(root);
+    }
+
+    return true;
+}
+
+// Iteration
+
+void bt_cursor_init(btree_t *bt, btree_cursor_t *cur) {
+    bt_cursor_init_range(bt, cur, NULL, NULL);
+}
+
+void bt_cursor_init_range(btree_t *bt, btree_cursor_t *cur, const void *lo, const void *hi) {
+    cur->end = hi;
+
+    bt_node_t *leaf;
+
+    if (lo) {
+        leaf = bt_descend(bt, lo, NULL, NULL);
+        cur->ind = bt_lower_bound(bt, bt_leaf_key(bt, leaf, 0), leaf->num_keys, lo);
+    } else {
+        leaf = bt->root;
+        while (!(leaf->leaf)) {
+            leaf = bt_children(leaf)[0];
+        }
+        cur->ind = 0;
+    }
+
+    // All of lo's leaf may be less than lo, in which case, the range starts
+    // at the next leaf. (Only the root can be an empty leaf)
+    if (cur->ind == leaf->num_keys) {
+        leaf = leaf->next;
+        cur->ind = 0;
+    }
+
+    cur->leaf = leaf;
+}
+
+bool bt_cursor_next(btree_t *bt, btree_cursor_t *cur, const void **key, void **val) {
+    if (!(cur->leaf)) {
+        return false;
+    }
+
+    const uint8_t *k = bt_leaf_key(bt, cur->leaf, cur->ind);
+
+    if (cur->end && bt->cmp_func(k, cur->end) >= 0) {
+        cur->leaf = NULL;
+        return false;
+    }
+
+    if (key) {
+        *key = k;
+    }
+
+    if (val) {
+        *val = bt_leaf_val(bt, cur->leaf, cur->ind);
+    }
+
+    cur->ind++;
+    if (cur->ind == cur->leaf->num_keys) {
+        cur->leaf = cur->leaf->next;
+        cur->ind = 0;
+    }
+
+    return true;
+}
@@ -0,0 +1,227 @@
+#include "chutil/concurrent_map.h"
+#include "chutil/hash.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+#include "chsys/wrappers.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(chm_stripe_t) == CHM_STRIPE_SIZE, "Stripe data must fit within CHM_STRIPE_SIZE");
+
+// The user's hash picks the chain within a stripe by its low bits,
+// so the stripe is picked from the high bits of the mixed hash.
+static inline chm_stripe_t *chm_stripe(concurrent_hash_map_t *chm, uint32_t hash_val) {
+    uint32_t h = hash_mix32(hash_val);
+    return &(chm->stripes[(h >> 16) & (chm->num_stripes - 1)]);
+}
+
+concurrent_hash_map_t *new_concurrent_hash_map(size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, size_t num_stripes) {
+    if (ks == 0 || hf == NULL || ef == NULL) {
+        return NULL;
+    }
+
+    if (num_stripes == 0) {
+        num_stripes = CHM_DEFAULT_STRIPES;
+    }
+
+    // Stripes are picked with 16 bits of hash.
+    if (num_stripes > 0x10000) {
+        num_stripes = 0x10000;
+    }
+
+    size_t p = 1;
+    while (p < num_stripes) {
+        p *= 2;
+    }
+    num_stripes = p;
+
+    concurrent_hash_map_t *chm = (concurrent_hash_map_t *)safe_malloc(sizeof(concurrent_hash_map_t));
+
+    chm->key_size = ks;
+    chm->value_size = vs;
+    chm->hash_func = hf;
+    chm->eq_func = ef;
+
+    chm->num_stripes = num_stripes;
+
+    // safe_malloc only aligns to 16 bytes, so stripes could straddle cache lines.
+    chm->stripes_mem = safe_malloc((sizeof(chm_stripe_t) * num_stripes) + CHM_STRIPE_SIZE - 1);
+    chm->stripes = (chm_stripe_t *)(((uintptr_t)(chm->stripes_mem) + CHM_STRIPE_SIZE - 1) &
+            ~((uintptr_t)CHM_STRIPE_SIZE - 1));
+
+    for (size_t i = 0; i < num_stripes; i++) {
+        chm_stripe_t *stripe = &(chm->stripes[i]);
+
+        safe_pthread_rwlock_init(&(stripe->lock), NULL);
+        stripe->hm = new_hash_map(ks, vs, hf, ef);
+
+        // A resize only ever stalls the writer which triggered it by a bounded amount.
+        hm_set_incremental_resize(stripe->hm, true);
+    }
+
+    atomic_init(&(chm->num_keys), 0);
+
+    return chm;
+}
+
+void delete_concurrent_hash_map(concurrent_hash_map_t *chm) {
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        chm_stripe_t *stripe = &(chm->stripes[i]);
+
+        delete_hash_map(stripe->hm);
+        safe_pthread_rwlock_destroy(&(stripe->lock));
+    }
+
+    safe_free(chm->stripes_mem);
+    safe_free(chm);
+}
+
+void chm_put(concurrent_hash_map_t *chm, const void *key, const void *value) {
+    uint32_t hash_val = chm->hash_func(key);
+    chm_stripe_t *stripe = chm_stripe(chm, hash_val);
+
+    safe_pthread_rwlock_wrlock(&(stripe->lock));
+
+    bool added = hm_upsert_hashed(stripe->hm, key, hash_val, value);
+
+    safe_pthread_rwlock_unlock(&(stripe->lock));
+
+    if (added) {
+        atomic_fetch_add(&(chm->num_keys), 1);
+    }
+}
+
+bool chm_put_if_absent(concurrent_hash_map_t *chm, const void *key, const void *value) {
+    uint32_t hash_val = chm->hash_func(key);
+    chm_stripe_t *stripe = chm_stripe(chm, hash_val);
+
+    safe_pthread_rwlock_wrlock(&(stripe->lock));
+
+    bool absent;
+    hm_get_or_insert_hashed(stripe->hm, key, hash_val, value, &absent);
+
+    safe_pthread_rwlock_unlock(&(stripe->lock));
+
+    if (absent) {
+        atomic_fetch_add(&(chm->num_keys), 1);
+    }
+
+    return absent;
+}
+
+bool chm_get_copy(concurrent_hash_map_t *chm, const void *key, void *dest) {
+    uint32_t hash_val = chm->hash_func(key);
+    chm_stripe_t *stripe = chm_stripe(chm, hash_val);
+
+    safe_pthread_rwlock_rdlock(&(stripe->lock));
+
+    void *val = hm_get_hashed(stripe->hm, key, hash_val);
+    if (val && dest) {
+        memcpy(dest, val, chm->value_size);
+    }
+
+    safe_pthread_rwlock_unlock(&(stripe->lock));
+
+    return val != NULL;
+}
+
+bool chm_remove(concurrent_hash_map_t *chm, const void *key, void *old_value) {
+    uint32_t hash_val = chm->hash_func(key);
+    chm_stripe_t *stripe = chm_stripe(chm, hash_val);
+
+    safe_pthread_rwlock_wrlock(&(stripe->lock));
+
+    bool removed = false;
+
+    void *val = hm_get_hashed(stripe->hm, key, hash_val);
+    if (val) {
+        if (old_value) {
+            memcpy(old_value, val, chm->value_size);
+        }
+
+        hm_remove_hashed(stripe->hm, key, hash_val);
+        removed = true;
+    }
+
+    safe_pthread_rwlock_unlock(&(stripe->lock));
+
+    if (removed) {
+        atomic_fetch_sub(&(chm->num_keys), 1);
+    }
+
+    return removed;
+}
+
+bool chm_update(concurrent_hash_map_t *chm, const void *key, chm_update_ft f, void *arg) {
+    uint32_t hash_val = chm->hash_func(key);
+    chm_stripe_t *stripe = chm_stripe(chm, hash_val);
+
+    safe_pthread_rwlock_wrlock(&(stripe->lock));
+
+    bool found = false;
+
+    void *val = hm_get_hashed(stripe->hm, key, hash_val);
+    if (val) {
+        // The key lives right before its value.
+        f((uint8_t *)val - chm->key_size, val, arg);
+        found = true;
+    }
+
+    safe_pthread_rwlock_unlock(&(stripe->lock));
+
+    return found;
+}
+
+// Visits every pair of a stripe's map, the stripe must be locked.
+//
+// NOTE: A cursor is used since other readers may be iterating the same stripe.
+static void chm_visit_stripe(hash_map_t *hm, chm_visit_ft f, void *arg) {
+    hash_map_cursor_t cur;
+    key_val_pair_t kvp;
+
+    hm_cursor_init(hm, &cur);
+    while ((kvp = hm_cursor_next(hm, &cur)) != HASH_MAP_EXHAUSTED) {
+        f(kvp_key(hm, kvp), kvp_val(hm, kvp), arg);
+    }
+}
+
+void chm_for_each(concurrent_hash_map_t *chm, chm_visit_ft f, void *arg) {
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        chm_stripe_t *stripe = &(chm->stripes[i]);
+
+        safe_pthread_rwlock_rdlock(&(stripe->lock));
+        chm_visit_stripe(stripe->hm, f, arg);
+        safe_pthread_rwlock_unlock(&(stripe->lock));
+    }
+}
+
+static void chm_snapshot_visit(const void *key, const void *val, void *arg) {
+    hash_map_t *snap = (hash_map_t *)arg;
+    hm_put(snap, key, val);
+}
+
+hash_map_t *chm_snapshot(concurrent_hash_map_t *chm) {
+    hash_map_t *snap = new_hash_map(chm->key_size, chm->value_size, chm->hash_func, chm->eq_func);
+
+    // Writers only ever hold one stripe lock, so locking in order can't deadlock.
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        safe_pthread_rwlock_rdlock(&(chm->stripes[i].lock));
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        total += hm_num_keys(chm->stripes[i].hm);
+    }
+    hm_reserve(snap, total);
+
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        chm_visit_stripe(chm->stripes[i].hm, chm_snapshot_visit, snap);
+    }
+
+    for (size_t i = 0; i < chm->num_stripes; i++) {
+        safe_pthread_rwlock_unlock(&(chm->stripes[i].lock));
+    }
+
+    return snap;
+}
@@ -0,0 +1,347 @@
+#include "chutil/flat_map.h"
+#include "chutil/hash.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define FHM_EMPTY 0x80
+
+// Smallest table, a table must hold at least one full group.
+#define FHM_MIN_CAP FHM_GROUP_WIDTH
+
+// Max load factor of 7/8.
+#define FHM_MAX_LOAD(cap) (((cap) / 8) * 7)
+
+// The user's hash function may be weak (e.g. an identity function), so
+// its bits are mixed before use.
+static inline uint32_t fhm_mix(uint32_t h) {
+    return hash_mix32(h);
+}
+
+// The low bits of a hash pick its home slot, the top 7 are kept in its control byte.
+static inline uint8_t fhm_h2(uint32_t h) {
+    return (uint8_t)(h >> 25);
+}
+
+// Group bitmasks, bit i refers to control byte i of the group.
+
+#if defined(__SSE2__)
+
+static inline uint32_t fhm_group_match(const uint8_t *g, uint8_t b) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+}
+
+// Only EMPTY has its high bit set.
+static inline uint32_t fhm_group_full(const uint8_t *g) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return ~((uint32_t)_mm_movemask_epi8(ctrl)) & 0xFFFFU;
+}
+
+#else
+
+static inline uint32_t fhm_group_match(const uint8_t *g, uint8_t b) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < FHM_GROUP_WIDTH; i++) {
+        if (g[i] == b) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+}
+
+static inline uint32_t fhm_group_full(const uint8_t *g) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < FHM_GROUP_WIDTH; i++) {
+        if (!(g[i] & FHM_EMPTY)) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+}
+
+#endif
+
+static inline uint32_t fhm_group_empty(const uint8_t *g) {
+    return fhm_group_match(g, FHM_EMPTY);
+}
+
+static inline uint8_t *fhm_slot(flat_hash_map_t *fhm, size_t i) {
+    return fhm->slots + (i * fhm->slot_size);
+}
+
+static inline void fhm_set_ctrl(flat_hash_map_t *fhm, size_t i, uint8_t b) {
+    fhm->ctrl[i] = b;
+
+    // Keep the copies at the end in sync.
+    if (i < FHM_GROUP_WIDTH - 1) {
+        fhm->ctrl[fhm->cap + i] = b;
+    }
+}
+
+// Sets up an empty table of the given capacity.
+// Tables of at least SAFE_LARGE_THRESHOLD bytes are large buffers. (See chsys/mem.h)
+static void fhm_alloc_table(flat_hash_map_t *fhm, size_t cap) {
+    size_t slots_size = cap * fhm->slot_size;
+    size_t hashes_size = cap * sizeof(uint32_t);
+    size_t ctrl_size = cap + FHM_GROUP_WIDTH - 1;
+
+    fhm->cap = cap;
+    fhm->table_size = slots_size + hashes_size + ctrl_size;
+    fhm->table = fhm->table_size >= SAFE_LARGE_THRESHOLD
+        ? safe_malloc_large(fhm->table_size)
+        : safe_malloc(fhm->table_size);
+
+    // cap is a multiple of 16, so the hashes are always aligned.
+    fhm->slots = (uint8_t *)fhm->table;
+    fhm->hashes = (uint32_t *)(fhm->slots + slots_size);
+    fhm->ctrl = (uint8_t *)fhm->hashes + hashes_size;
+
+    memset(fhm->ctrl, FHM_EMPTY, ctrl_size);
+}
+
+static void fhm_free_table(void *table, size_t table_size) {
+    if (table_size >= SAFE_LARGE_THRESHOLD) {
+        safe_free_large(table);
+    } else {
+        safe_free(table);
+    }
+}
+
+// Returns the first empty slot of h's probe sequence.
+static size_t fhm_find_empty(flat_hash_map_t *fhm, uint32_t h) {
+    size_t mask = fhm->cap - 1;
+    size_t pos = h & mask;
+
+    while (true) {
+        uint32_t empty = fhm_group_empty(fhm->ctrl + pos);
+        if (empty) {
+            return (pos + (size_t)__builtin_ctz(empty)) & mask;
+        }
+
+        pos = (pos + FHM_GROUP_WIDTH) & mask;
+    }
+}
+
+// Returns the slot holding key, or cap if key is not in the map.
+static size_t fhm_find(flat_hash_map_t *fhm, const void *key, uint32_t h) {
+    size_t mask = fhm->cap - 1;
+    size_t pos = h & mask;
+    uint8_t h2 = fhm_h2(h);
+
+    while (true) {
+        const uint8_t *g = fhm->ctrl + pos;
+
+        uint32_t match = fhm_group_match(g, h2);
+        while (match) {
+            size_t i = (pos + (size_t)__builtin_ctz(match)) & mask;
+
+            if (fhm->eq_func(fhm_slot(fhm, i), key)) {
+                return i;
+            }
+
+            match &= match - 1;
+        }
+
+        // A probe run never spans an empty slot, so the key can't be any further.
+        if (fhm_group_empty(g)) {
+            return fhm->cap;
+        }
+
+        pos = (pos + FHM_GROUP_WIDTH) & mask;
+    }
+}
+
+static void fhm_grow(flat_hash_map_t *fhm) {
+    size_t old_cap = fhm->cap;
+    void *old_table = fhm->table;
+    size_t old_table_size = fhm->table_size;
+
+    uint8_t *old_slots = fhm->slots;
+    uint32_t *old_hashes = fhm->hashes;
+    uint8_t *old_ctrl = fhm->ctrl;
+
+    fhm_alloc_table(fhm, old_cap * 2);
+
+    // All keys are known to be unique, so no comparisons are needed.
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_ctrl[i] & FHM_EMPTY) {
+            continue;
+        }
+
+        uint32_t h = old_hashes[i];
+        size_t j = fhm_find_empty(fhm, h);
+
+        fhm_set_ctrl(fhm, j, old_ctrl[i]);
+        fhm->hashes[j] = h;
+        memcpy(fhm_slot(fhm, j), old_slots + (i * fhm->slot_size), fhm->slot_size);
+    }
+
+    fhm_free_table(old_table, old_table_size);
+}
+
+flat_hash_map_t *new_flat_hash_map(size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef) {
+    if (ks == 0 || hf == NULL || ef == NULL) {
+        return NULL;
+    }
+
+    // NOTE: value size CAN be 0 (hash set)
+
+    flat_hash_map_t *fhm = (flat_hash_map_t *)safe_malloc(sizeof(flat_hash_map_t));
+
+    fhm->key_size = ks;
+    fhm->value_size = vs;
+
+    // Small slots are padded to a power of 2, all others to a multiple of 8.
+    size_t slot_size = ks + vs;
+    if (slot_size < 8) {
+        size_t p = 1;
+        while (p < slot_size) {
+            p *= 2;
+        }
+        slot_size = p;
+    } else {
+        slot_size = (slot_size + 7) & ~((size_t)7);
+    }
+    fhm->slot_size = slot_size;
+
+    fhm->hash_func = hf;
+    fhm->eq_func = ef;
+
+    fhm->num_keys = 0;
+    fhm->iter_ind = 0;
+
+    fhm_alloc_table(fhm, FHM_MIN_CAP);
+
+    return fhm;
+}
+
+void delete_flat_hash_map(flat_hash_map_t *fhm) {
+    fhm_free_table(fhm->table, fhm->table_size);
+    safe_free(fhm);
+}
+
+void fhm_reset_iterator(flat_hash_map_t *fhm) {
+    fhm->iter_ind = 0;
+}
+
+key_val_pair_t fhm_next_kvp(flat_hash_map_t *fhm) {
+    while (fhm->iter_ind < fhm->cap) {
+        uint32_t full = fhm_group_full(fhm->ctrl + fhm->iter_ind);
+
+        // Ignore the copied control bytes past the end.
+        size_t left = fhm->cap - fhm->iter_ind;
+        if (left < FHM_GROUP_WIDTH) {
+            full &= (1U << left) - 1;
+        }
+
+        if (full) {
+            size_t i = fhm->iter_ind + (size_t)__builtin_ctz(full);
+            fhm->iter_ind = i + 1;
+
+            return fhm_slot(fhm, i);
+        }
+
+        fhm->iter_ind += FHM_GROUP_WIDTH;
+    }
+
+    return HASH_MAP_EXHAUSTED;
+}
+
+void fhm_put(flat_hash_map_t *fhm, const void *key, const void *value) {
+    uint32_t h = fhm_mix(fhm->hash_func(key));
+
+    size_t i = fhm_find(fhm, key, h);
+    if (i < fhm->cap) {
+        memcpy(fhm_slot(fhm, i) + fhm->key_size, value, fhm->value_size);
+        return; // We can just exit after an update.
+    }
+
+    if (fhm->num_keys + 1 > FHM_MAX_LOAD(fhm->cap)) {
+        fhm_grow(fhm);
+    }
+
+    i = fhm_find_empty(fhm, h);
+
+    fhm_set_ctrl(fhm, i, fhm_h2(h));
+    fhm->hashes[i] = h;
+
+    uint8_t *slot = fhm_slot(fhm, i);
+    memcpy(slot, key, fhm->key_size);
+    memcpy(slot + fhm->key_size, value, fhm->value_size);
+
+    fhm->num_keys++;
+}
+
+void *fhm_get(flat_hash_map_t *fhm, const void *key) {
+    uint32_t h = fhm_mix(fhm->hash_func(key));
+
+    size_t i = fhm_find(fhm, key, h);
+    if (i == fhm->cap) {
+        return NULL;
+    }
+
+    return fhm_slot(fhm, i) + fhm->key_size;
+}
+
+bool fhm_remove(flat_hash_map_t *fhm, const void *key) {
+    uint32_t h = fhm_mix(fhm->hash_func(key));
+
+    size_t i = fhm_find(fhm, key, h);
+    if (i == fhm->cap) {
+        return false; // No match.
+    }
+
+    // Backward shift deletion.
+    // Every entry after the hole which is allowed to sit at the hole (i.e. its home
+    // is not between the hole and itself) is moved into it, leaving a new hole.
+    // This continues until the end of the probe run.
+    size_t mask = fhm->cap - 1;
+    size_t j = (i + 1) & mask;
+
+    while (!(fhm->ctrl[j] & FHM_EMPTY)) {
+        size_t home = fhm->hashes[j] & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            fhm_set_ctrl(fhm, i, fhm->ctrl[j]);
+            fhm->hashes[i] = fhm->hashes[j];
+            memcpy(fhm_slot(fhm, i), fhm_slot(fhm, j), fhm->slot_size);
+
+            i = j;
+        }
+
+        j = (j + 1) & mask;
+    }
+
+    fhm_set_ctrl(fhm, i, FHM_EMPTY);
+    fhm->num_keys--;
+
+    return true;
+}
+
+bool fhm_equals(flat_hash_map_t *fhm1, flat_hash_map_t *fhm2, hash_map_val_eq_ft val_eq) {
+    if (fhm_num_keys(fhm1) != fhm_num_keys(fhm2)) {
+        return false;
+    }
+
+    // Walks the table directly, so the caller's iteration of fhm1 is left alone.
+    for (size_t i = 0; i < fhm1->cap; i++) {
+        if (fhm1->ctrl[i] & FHM_EMPTY) {
+            continue;
+        }
+
+        key_val_pair_t kvp = fhm_slot(fhm1, i);
+        const void *fhm2_val = fhm_get(fhm2, fhm_kvp_key(fhm1, kvp));
+
+        if (!fhm2_val || !val_eq(fhm_kvp_val(fhm1, kvp), fhm2_val)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,116 @@
+#include "chutil/hash.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t HASH_SECRET[4] = {
+    0x2D358DCCAA6C78A5ULL, 0x8BB84B93962EACC9ULL,
+    0x4B33A62ED433D4A3ULL, 0x4D5A2DA51DE1AA47ULL
+};
+
+// Full 64x64 => 128 bit multiply, the low half is written to a, the high to b.
+static inline void hash_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 hash_u128_t;
+
+    hash_u128_t r = (hash_u128_t)(*a) * (*b);
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)(*a), lb = (uint32_t)(*b);
+
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hash_mum_mix(uint64_t a, uint64_t b) {
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+// Unaligned reads.
+
+static inline uint64_t hash_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 1 to 3 bytes.
+static inline uint64_t hash_read3(const uint8_t *p, size_t len) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    seed ^= hash_mum_mix(seed ^ HASH_SECRET[0], HASH_SECRET[1]);
+
+    uint64_t a;
+    uint64_t b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two (possibly overlapping) reads from each end.
+            size_t off = (len >> 3) << 2;
+            a = (hash_read4(p) << 32) | hash_read4(p + off);
+            b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - off);
+        } else if (len > 0) {
+            a = hash_read3(p, len);
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        if (i > 48) {
+            // 3 independent lanes, so the multiplies can overlap.
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+
+            do {
+                seed = hash_mum_mix(hash_read8(p) ^ HASH_SECRET[1], hash_read8(p + 8) ^ seed);
+                see1 = hash_mum_mix(hash_read8(p + 16) ^ HASH_SECRET[2], hash_read8(p + 24) ^ see1);
+                see2 = hash_mum_mix(hash_read8(p + 32) ^ HASH_SECRET[3], hash_read8(p + 40) ^ see2);
+
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = hash_mum_mix(hash_read8(p) ^ HASH_SECRET[1], hash_read8(p + 8) ^ seed);
+
+            p += 16;
+            i -= 16;
+        }
+
+        // The last 16 bytes, overlapping what came before.
+        a = hash_read8(p + i - 16);
+        b = hash_read8(p + i - 8);
+    }
+
+    a ^= HASH_SECRET[1];
+    b ^= seed;
+    hash_mum(&a, &b);
+
+    return hash_mum_mix(a ^ HASH_SECRET[0] ^ len, b ^ HASH_SECRET[1]);
+}
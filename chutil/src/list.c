@@ -1,5 +1,6 @@
 #include "chutil/list.h"
 #include "chsys/mem.h"
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -63,6 +64,12 @@ void *delete_and_move_list(list_t *l) {
 
 // Array List 
 
+// Once an array list's table reaches SAFE_LARGE_THRESHOLD bytes, it is moved
+// to a large buffer. (See chsys/mem.h) Tables never shrink, so this happens at most once.
+static inline bool al_table_is_large(size_t table_size) {
+    return table_size >= SAFE_LARGE_THRESHOLD;
+}
+
 array_list_t *new_array_list(size_t cs) {
     if (cs == 0) {
         return NULL;
@@ -74,13 +81,23 @@ array_list_t *new_array_list(size_t cs) {
     al->len = 0;
     al->cell_size = cs;
 
-    al->arr = safe_malloc(al->cell_size * al->cap);
+    // Even a single cell can reach the threshold, so the first table needs the same
+    // check as every other table of the list.
+    size_t table_size = al->cell_size * al->cap;
+    al->arr = al_table_is_large(table_size) 
+        ? safe_malloc_large(table_size) 
+        : safe_malloc(table_size);
 
     return al;
 }
 
 void delete_array_list(array_list_t *al) {
-    safe_free(al->arr);
+    if (al_table_is_large(al->cell_size * al->cap)) {
+        safe_free_large(al->arr);
+    } else {
+        safe_free(al->arr);
+    }
+
     safe_free(al);
 }
 
@@ -90,8 +107,19 @@ void *delete_and_move_array_list(array_list_t *al) {
         return NULL;
     }
 
-    // NOTE: The given table is realloc'd before being removed!
-    void *res = safe_realloc(al->arr, al->cell_size * al->len);
+    void *res;
+
+    if (al_table_is_large(al->cell_size * al->cap)) {
+        // The caller expects memory which can be given to safe_free, 
+        // so large tables must be copied out.
+        res = safe_malloc(al->cell_size * al->len);
+        memcpy(res, al->arr, al->cell_size * al->len);
+        safe_free_large(al->arr);
+    } else {
+        // NOTE: The given table is realloc'd before being removed!
+        res = safe_realloc(al->arr, al->cell_size * al->len);
+    }
+
     safe_free(al);
     return res;
 }
@@ -100,7 +128,21 @@ void al_push(array_list_t *al, const void *src) {
     if (al->len == al->cap) {
         // Resize time!
         size_t new_cap = al->cap * 2;
-        al->arr = safe_realloc(al->arr, al->cell_size * new_cap);
+
+        size_t table_size = al->cell_size * al->cap;
+        size_t new_table_size = al->cell_size * new_cap;
+
+        if (al_table_is_large(table_size)) {
+            al->arr = safe_realloc_large(al->arr, new_table_size);
+        } else if (al_table_is_large(new_table_size)) {
+            void *new_arr = safe_malloc_large(new_table_size);
+            memcpy(new_arr, al->arr, table_size);
+            safe_free(al->arr);
+            al->arr = new_arr;
+        } else {
+            al->arr = safe_realloc(al->arr, new_table_size);
+        }
+
         al->cap = new_cap;
     }
 
@@ -155,7 +197,31 @@ void *al_next(array_list_t *al) {
 
 // Linked List
 
+static inline size_t ll_node_size(linked_list_t *ll) {
+    return sizeof(linked_list_node_hdr_t) + ll->cell_size;
+}
+
+static linked_list_node_hdr_t *ll_alloc_node(linked_list_t *ll) {
+    if (ll->pool) {
+        return (linked_list_node_hdr_t *)pool_alloc(ll->pool, ll_node_size(ll));
+    }
+
+    return (linked_list_node_hdr_t *)safe_malloc(ll_node_size(ll));
+}
+
+static void ll_free_node(linked_list_t *ll, linked_list_node_hdr_t *node) {
+    if (ll->pool) {
+        pool_free(ll->pool, node, ll_node_size(ll));
+    } else {
+        safe_free(node);
+    }
+}
+
 linked_list_t *new_linked_list(size_t cs) {
+    return new_linked_list_with_pool(cs, NULL);
+}
+
+linked_list_t *new_linked_list_with_pool(size_t cs, pool_t *pool) {
     if (cs == 0) {
         return NULL;
     }
@@ -163,6 +229,7 @@ linked_list_t *new_linked_list(size_t cs) {
     linked_list_t *ll = safe_malloc(sizeof(linked_list_t));
     ll->cell_size = cs;
     ll->len = 0;
+    ll->pool = pool;
     ll->first = NULL;
     ll->last = NULL;
 
@@ -175,7 +242,7 @@ void delete_linked_list(linked_list_t *ll) {
 
     while (curr) {
         next = curr->next;
-        safe_free(curr);
+        ll_free_node(ll, curr);
 
         curr = next;
     }
@@ -226,8 +293,7 @@ void *ll_get(linked_list_t *ll, size_t i) {
 }
 
 void ll_push(linked_list_t *ll, const void *src) {
-    linked_list_node_hdr_t *node = 
-        safe_malloc(sizeof(linked_list_node_hdr_t) + ll->cell_size);
+    linked_list_node_hdr_t *node = ll_alloc_node(ll);
 
     node->next = NULL;
     node->prev = ll->last;
@@ -268,7 +334,7 @@ void ll_pop(linked_list_t *ll, void *dest) {
 
     ll->len--;
 
-    safe_free(last);
+    ll_free_node(ll, last);
 }
 
 void ll_poll(linked_list_t *ll, void *dest) {
@@ -292,7 +358,7 @@ void ll_poll(linked_list_t *ll, void *dest) {
 
     ll->len--;
 
-    safe_free(first);
+    ll_free_node(ll, first);
 }
 
 void *ll_next(linked_list_t *ll) {
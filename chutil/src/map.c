@@ -7,48 +7,162 @@ static inline key_val_pair_t kvh_to_kvp(key_val_header_t *kvh) {
     return (uint8_t *)kvh + sizeof(key_val_header_t);
 }
 
+static inline size_t hm_kvh_size(hash_map_t *hm) {
+    return sizeof(key_val_header_t) + hm->key_size + hm->value_size;
+}
+
+static key_val_header_t *hm_alloc_kvh(hash_map_t *hm) {
+    if (hm->pool) {
+        return (key_val_header_t *)pool_alloc(hm->pool, hm_kvh_size(hm));
+    }
+
+    return (key_val_header_t *)safe_malloc(hm_kvh_size(hm));
+}
+
+static void hm_free_kvh(hash_map_t *hm, key_val_header_t *kvh) {
+    if (hm->pool) {
+        pool_free(hm->pool, kvh, hm_kvh_size(hm));
+    } else {
+        safe_free(kvh);
+    }
+}
+
+// Chain tables of at least SAFE_LARGE_THRESHOLD bytes are large buffers. (See chsys/mem.h)
+static key_val_header_t **hm_alloc_chains(size_t cap) {
+    size_t table_size = sizeof(key_val_header_t *) * cap;
+
+    if (table_size >= SAFE_LARGE_THRESHOLD) {
+        return (key_val_header_t **)safe_malloc_large(table_size);
+    }
+
+    return (key_val_header_t **)safe_malloc(table_size);
+}
+
+static void hm_free_chains(key_val_header_t **chains, size_t cap) {
+    if (sizeof(key_val_header_t *) * cap >= SAFE_LARGE_THRESHOLD) {
+        safe_free_large(chains);
+    } else {
+        safe_free(chains);
+    }
+}
+
 // Once the number of elements in the map is greater
 // than (1 / HM_FILL_FACTOR) * chains_cap, resize! 
 #define HM_FILL_FACTOR 2
 
-static void hm_check_resize(hash_map_t *hm) {
-    if (hm->num_keys * HM_FILL_FACTOR <= hm->chains_cap) {
-        return;
-    }
-
-    size_t new_cap = hm->chains_cap * 2;
-    key_val_header_t **new_chains = safe_malloc(sizeof(key_val_header_t *) * new_cap);
-    for (size_t i = 0; i < new_cap; i++) {
-        new_chains[i] = NULL;
+// In incremental mode, the number of old chains moved by each put or remove.
+//
+// A resize starts once num_keys > chains_cap / 2, and the next cannot start
+// until num_keys > chains_cap. So, when at least 2 chains are moved per put,
+// the old table is always gone before the next resize.
+#define HM_MIGRATE_CHAINS 8
+
+static void hm_migrate(hash_map_t *hm, size_t num_chains) {
+    size_t end = hm->migrate_ind + num_chains;
+    if (end > hm->old_chains_cap) {
+        end = hm->old_chains_cap;
     }
 
-    for (size_t i = 0; i < hm->chains_cap; i++) {
-        key_val_header_t *iter = hm->chains[i];
+    for (size_t i = hm->migrate_ind; i < end; i++) {
+        key_val_header_t *iter = hm->old_chains[i];
         key_val_header_t *next;
 
         while (iter) {
             next = iter->next;
 
-            size_t new_ind = iter->hash_val % new_cap;
-            iter->next = new_chains[new_ind];
-            new_chains[new_ind] = iter;
+            size_t new_ind = iter->hash_val % hm->chains_cap;
+            iter->next = hm->chains[new_ind];
+            hm->chains[new_ind] = iter;
             
             iter = next;
         }
+
+        hm->old_chains[i] = NULL;
     }
 
-    // NOTE: we have moved all kvps over to the new chain...
-    // so they themselves need not be freed as they still are in use.
-    //
-    // Only the actual table must be freed.
-    safe_free(hm->chains);
+    hm->migrate_ind = end;
+
+    if (hm->migrate_ind == hm->old_chains_cap) {
+        // NOTE: we have moved all kvps over to the new chain...
+        // so they themselves need not be freed as they still are in use.
+        //
+        // Only the actual table must be freed.
+        hm_free_chains(hm->old_chains, hm->old_chains_cap);
+
+        hm->old_chains = NULL;
+        hm->old_chains_cap = 0;
+        hm->migrate_ind = 0;
+    }
+}
+
+// Makes the current table the old table, and allocates a new one of size new_cap.
+// No pairs are moved.
+static void hm_grow(hash_map_t *hm, size_t new_cap) {
+    // Only one resize can be in progress at once.
+    if (hm->old_chains) {
+        hm_migrate(hm, hm->old_chains_cap);
+    }
+
+    key_val_header_t **new_chains = hm_alloc_chains(new_cap);
+    for (size_t i = 0; i < new_cap; i++) {
+        new_chains[i] = NULL;
+    }
+
+    hm->old_chains = hm->chains;
+    hm->old_chains_cap = hm->chains_cap;
+    hm->migrate_ind = 0;
 
-    hm->chains_cap = new_cap;
     hm->chains = new_chains;
+    hm->chains_cap = new_cap;
+}
+
+static void hm_check_resize(hash_map_t *hm) {
+    if (hm->num_keys * HM_FILL_FACTOR <= hm->chains_cap) {
+        return;
+    }
+
+    hm_grow(hm, hm->chains_cap * 2);
+
+    if (!(hm->incremental)) {
+        hm_migrate(hm, hm->old_chains_cap);
+    }
+}
+
+// Returns the link (i.e. the chain slot or next field) pointing to key's header,
+// or NULL if key is not in the map.
+static key_val_header_t **hm_find_in(hash_map_t *hm, key_val_header_t **chains, size_t cap,
+        const void *key, uint32_t hash_val) {
+    key_val_header_t **link = &(chains[hash_val % cap]);
+
+    while (*link) {
+        key_val_header_t *kvh = *link;
+        if (kvh->hash_val == hash_val && hm->eq_func(kvp_key(hm, kvh_to_kvp(kvh)), key)) {
+            return link;
+        }
+
+        link = &(kvh->next);
+    }
+
+    return NULL;
+}
+
+static key_val_header_t **hm_find(hash_map_t *hm, const void *key, uint32_t hash_val) {
+    key_val_header_t **link = hm_find_in(hm, hm->chains, hm->chains_cap, key, hash_val);
+
+    if (!link && hm->old_chains) {
+        link = hm_find_in(hm, hm->old_chains, hm->old_chains_cap, key, hash_val);
+    }
+
+    return link;
 }
 
 hash_map_t *new_hash_map(size_t ks, size_t vs, 
         hash_map_hash_ft hf, hash_map_key_eq_ft ef) {
+    return new_hash_map_with_pool(ks, vs, hf, ef, NULL);
+}
+
+hash_map_t *new_hash_map_with_pool(size_t ks, size_t vs, 
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, pool_t *pool) {
     if (ks == 0 || hf == NULL || ef == NULL) {
         return NULL;
     }
@@ -63,91 +177,171 @@ hash_map_t *new_hash_map(size_t ks, size_t vs,
     hm->eq_func = ef;
 
     hm->num_keys = 0;
+    hm->pool = pool;
 
     // Start with table size of 8, arb choice.
     hm->chains_cap = 8;
 
-    hm->chains = safe_malloc(sizeof(key_val_header_t *) * hm->chains_cap);
+    hm->chains = hm_alloc_chains(hm->chains_cap);
     for (size_t i = 0; i < hm->chains_cap; i++) {
         hm->chains[i] = NULL;
     }
 
+    hm->incremental = false;
+    hm->old_chains_cap = 0;
+    hm->old_chains = NULL;
+    hm->migrate_ind = 0;
+
+    hm->iter.chain_ind = 0;
+    hm->iter.end_chain_ind = 0;
+    hm->iter.iter = NULL;
+
     return hm;
 }
 
-void delete_hash_map(hash_map_t *hm) {
-    for (size_t i = 0; i < hm->chains_cap; i++) {
-        key_val_header_t *iter = hm->chains[i];
+static void hm_free_all_kvhs(hash_map_t *hm, key_val_header_t **chains, size_t cap) {
+    for (size_t i = 0; i < cap; i++) {
+        key_val_header_t *iter = chains[i];
         key_val_header_t *next;
 
         while (iter) {
             next = iter->next;
-            safe_free(iter);
+            hm_free_kvh(hm, iter);
             iter = next;
         }
     }
+}
+
+void delete_hash_map(hash_map_t *hm) {
+    hm_free_all_kvhs(hm, hm->chains, hm->chains_cap);
+    hm_free_chains(hm->chains, hm->chains_cap);
+
+    if (hm->old_chains) {
+        hm_free_all_kvhs(hm, hm->old_chains, hm->old_chains_cap);
+        hm_free_chains(hm->old_chains, hm->old_chains_cap);
+    }
 
-    safe_free(hm->chains);
     safe_free(hm);
 }
 
-void hm_reset_iterator(hash_map_t *hm) {
-    for (size_t chain_ind = 0; chain_ind < hm->chains_cap; chain_ind++) {
-        if (hm->chains[chain_ind]) {
-            hm->iter_chain_ind = chain_ind;
-            hm->iter = hm->chains[chain_ind];
+void hm_set_incremental_resize(hash_map_t *hm, bool incremental) {
+    hm->incremental = incremental;
+
+    // Leaving incremental mode, finish up.
+    if (!incremental && hm->old_chains) {
+        hm_migrate(hm, hm->old_chains_cap);
+    }
+}
+
+void hm_reserve(hash_map_t *hm, size_t n) {
+    size_t new_cap = hm->chains_cap;
+    while (n * HM_FILL_FACTOR > new_cap) {
+        new_cap *= 2;
+    }
+
+    if (new_cap > hm->chains_cap) {
+        hm_grow(hm, new_cap);
+    }
+
+    if (hm->old_chains) {
+        hm_migrate(hm, hm->old_chains_cap);
+    }
+}
+
+// Iteration treats old_chains as if it was appended to chains.
+static inline size_t hm_iter_num_chains(hash_map_t *hm) {
+    return hm->chains_cap + hm->old_chains_cap;
+}
+
+static inline key_val_header_t *hm_iter_chain(hash_map_t *hm, size_t chain_ind) {
+    return chain_ind < hm->chains_cap 
+        ? hm->chains[chain_ind] 
+        : hm->old_chains[chain_ind - hm->chains_cap];
+}
+
+// Moves cur to the first pair at or after chain start_ind (within its range).
+static void hm_cursor_seek(hash_map_t *hm, hash_map_cursor_t *cur, size_t start_ind) {
+    for (size_t chain_ind = start_ind; chain_ind < cur->end_chain_ind; chain_ind++) {
+        key_val_header_t *chain = hm_iter_chain(hm, chain_ind);
+
+        if (chain) {
+            cur->chain_ind = chain_ind;
+            cur->iter = chain;
             return;
         }
     }
 
-    // Our map is empty...
-    hm->iter = NULL;
+    // Nothing left...
+    cur->chain_ind = cur->end_chain_ind;
+    cur->iter = NULL;
 }
 
-key_val_pair_t hm_next_kvp(hash_map_t *hm) {
-    if (!(hm->iter)) {
+void hm_cursor_init(hash_map_t *hm, hash_map_cursor_t *cur) {
+    cur->end_chain_ind = hm_iter_num_chains(hm);
+    hm_cursor_seek(hm, cur, 0);
+}
+
+void hm_cursor_init_partition(hash_map_t *hm, hash_map_cursor_t *cur, size_t part, size_t num_parts) {
+    // No such part. (Also covers num_parts == 0)
+    if (part >= num_parts) {
+        cur->end_chain_ind = 0;
+        cur->chain_ind = 0;
+        cur->iter = NULL;
+        return;
+    }
+
+    size_t num_chains = hm_iter_num_chains(hm);
+
+    // Done in two steps to avoid overflowing num_chains * part.
+    size_t per_part = num_chains / num_parts;
+    size_t extra = num_chains % num_parts;
+
+    // The first extra parts each get one more chain.
+    size_t start = (part * per_part) + (part < extra ? part : extra);
+    size_t end = start + per_part + (part < extra ? 1 : 0);
+
+    cur->end_chain_ind = end;
+    hm_cursor_seek(hm, cur, start);
+}
+
+key_val_pair_t hm_cursor_next(hash_map_t *hm, hash_map_cursor_t *cur) {
+    if (!(cur->iter)) {
         return HASH_MAP_EXHAUSTED;
     }
 
-    key_val_pair_t ret_kvp = kvh_to_kvp(hm->iter);
+    key_val_pair_t ret_kvp = kvh_to_kvp(cur->iter);
 
-    if (hm->iter->next) {
-        hm->iter = hm->iter->next;
+    if (cur->iter->next) {
+        cur->iter = cur->iter->next;
     } else {
         // Find the next non null chain (if it exists)
-        hm->iter_chain_ind++;
-
-        while (hm->iter_chain_ind < hm->chains_cap && 
-                !(hm->chains[hm->iter_chain_ind])) {
-            hm->iter_chain_ind++;
-        }
-        
-        hm->iter = hm->iter_chain_ind < hm->chains_cap 
-            ? hm->chains[hm->iter_chain_ind] 
-            : NULL;
+        hm_cursor_seek(hm, cur, cur->chain_ind + 1);
     }
     
     return ret_kvp;
 }
 
-void hm_put(hash_map_t *hm, const void *key, const void *value) {
-    uint32_t hash_val = hm->hash_func(key);
-    size_t chain_ind = hash_val % hm->chains_cap;
+void hm_reset_iterator(hash_map_t *hm) {
+    hm_cursor_init(hm, &(hm->iter));
+}
 
-    key_val_header_t *iter = hm->chains[chain_ind];
-    while (iter) {
-        key_val_pair_t kvp = kvh_to_kvp(iter);
-        if (iter->hash_val == hash_val && hm->eq_func(kvp_key(hm, kvp), key)) {
-            memcpy(kvp_val(hm, kvp), value, hm->value_size);
-            return; // We can just exit after an update.
-        }
-        
-        iter = iter->next;
+key_val_pair_t hm_next_kvp(hash_map_t *hm) {
+    return hm_cursor_next(hm, &(hm->iter));
+}
+
+// In a hash set, value may be NULL.
+static inline void hm_set_val(hash_map_t *hm, key_val_pair_t kvp, const void *value) {
+    if (hm->value_size > 0) {
+        memcpy(kvp_val(hm, kvp), value, hm->value_size);
     }
+}
 
-    // No match... new kvp must be made...
-    key_val_header_t *new_kvh = safe_malloc(sizeof(key_val_header_t) + 
-            hm->key_size + hm->value_size);
+// Puts a new pair in the current table, key must NOT already be in the map.
+// Returns the new pair. (The value is left uninitialized)
+static key_val_pair_t hm_insert_new(hash_map_t *hm, const void *key, uint32_t hash_val) {
+    // New pairs always go in the current table.
+    size_t chain_ind = hash_val % hm->chains_cap;
+    key_val_header_t *new_kvh = hm_alloc_kvh(hm);
     
     // Place our header in the chain.
     new_kvh->next = hm->chains[chain_ind]; 
@@ -156,68 +350,190 @@ void hm_put(hash_map_t *hm, const void *key, const void *value) {
     new_kvh->hash_val = hash_val;
 
     key_val_pair_t kvp = kvh_to_kvp(new_kvh);
-
-    // populate the fields.
     memcpy((void *)kvp_key(hm, kvp), key, hm->key_size);
-    memcpy(kvp_val(hm, kvp), value, hm->value_size);
 
     // Finally, increase our number of keys and check resize!
+    // (Resizing never moves pairs themselves, so kvp stays valid)
     hm->num_keys++;
     hm_check_resize(hm);
+
+    return kvp;
 }
 
-void *hm_get(hash_map_t *hm, const void *key) {
-    uint32_t hash_val = hm->hash_func(key);
-    size_t chain_ind = hash_val % hm->chains_cap;
+void hm_put(hash_map_t *hm, const void *key, const void *value) {
+    hm_upsert_hashed(hm, key, hm->hash_func(key), value);
+}
+
+void hm_put_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, const void *value) {
+    hm_upsert_hashed(hm, key, hash_val, value);
+}
+
+bool hm_upsert(hash_map_t *hm, const void *key, const void *value) {
+    return hm_upsert_hashed(hm, key, hm->hash_func(key), value);
+}
+
+bool hm_upsert_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, const void *value) {
+    if (hm->old_chains) {
+        hm_migrate(hm, HM_MIGRATE_CHAINS);
+    }
+
+    key_val_header_t **link = hm_find(hm, key, hash_val);
+    if (link) {
+        hm_set_val(hm, kvh_to_kvp(*link), value);
+        return false; // We can just exit after an update.
+    }
 
-    key_val_header_t *iter = hm->chains[chain_ind];
-    while (iter) {
-        key_val_pair_t kvp = kvh_to_kvp(iter);
-        if (iter->hash_val == hash_val && hm->eq_func(kvp_key(hm, kvp), key)) {
-            return kvp_val(hm, kvp);
+    // No match... new kvp must be made...
+    key_val_pair_t kvp = hm_insert_new(hm, key, hash_val);
+    hm_set_val(hm, kvp, value);
+
+    return true;
+}
+
+void *hm_get_or_insert(hash_map_t *hm, const void *key, const void *init_val, bool *inserted) {
+    return hm_get_or_insert_hashed(hm, key, hm->hash_func(key), init_val, inserted);
+}
+
+void *hm_get_or_insert_hashed(hash_map_t *hm, const void *key, uint32_t hash_val, 
+        const void *init_val, bool *inserted) {
+    if (hm->old_chains) {
+        hm_migrate(hm, HM_MIGRATE_CHAINS);
+    }
+
+    key_val_header_t **link = hm_find(hm, key, hash_val);
+    if (link) {
+        if (inserted) {
+            *inserted = false;
         }
-        
-        iter = iter->next;
+
+        return kvp_val(hm, kvh_to_kvp(*link));
     }
 
-    return NULL;
+    void *val = kvp_val(hm, hm_insert_new(hm, key, hash_val));
+
+    if (init_val) {
+        memcpy(val, init_val, hm->value_size);
+    } else {
+        memset(val, 0, hm->value_size);
+    }
+
+    if (inserted) {
+        *inserted = true;
+    }
+
+    return val;
+}
+
+void *hm_get(hash_map_t *hm, const void *key) {
+    return hm_get_hashed(hm, key, hm->hash_func(key));
+}
+
+void *hm_get_hashed(hash_map_t *hm, const void *key, uint32_t hash_val) {
+    key_val_header_t **link = hm_find(hm, key, hash_val);
+    if (!link) {
+        return NULL;
+    }
+
+    return kvp_val(hm, kvh_to_kvp(*link));
 }
 
 bool hm_remove(hash_map_t *hm, const void *key) {
-    uint32_t hash_val = hm->hash_func(key);
-    size_t chain_ind = hash_val % hm->chains_cap;
+    return hm_remove_hashed(hm, key, hm->hash_func(key));
+}
 
-    key_val_header_t *prev = NULL;
-    key_val_header_t *iter = hm->chains[chain_ind];
-    while (iter) {
-        key_val_pair_t kvp = kvh_to_kvp(iter);
-        if (iter->hash_val == hash_val && hm->eq_func(kvp_key(hm, kvp), key)) {
-            break;
-        }
-        
-        prev = iter;
-        iter = iter->next;
+bool hm_remove_hashed(hash_map_t *hm, const void *key, uint32_t hash_val) {
+    if (hm->old_chains) {
+        hm_migrate(hm, HM_MIGRATE_CHAINS);
     }
 
-    if (!iter) {
+    key_val_header_t **link = hm_find(hm, key, hash_val);
+    if (!link) {
         return false; // No match.
     }
 
-    if (prev) {
-        prev->next = iter->next;
-    } else {
-        // When iter is the front of a chain.
-        hm->chains[chain_ind] = iter->next;
-    }
+    // Unlink from the chain.
+    key_val_header_t *kvh = *link;
+    *link = kvh->next;
 
     // Finally FREE!!!
-    safe_free(iter);
+    hm_free_kvh(hm, kvh);
     
     hm->num_keys--;
 
     return true;
 }
 
+// Number of keys hashed and prefetched at once by the batched calls.
+// Large enough to overlap many misses, small enough that the prefetched
+// lines are still cached when each key is resolved.
+#define HM_BATCH_SIZE 16
+
+// Hashes n (<= HM_BATCH_SIZE) keys, and prefetches their chain slots, then the first
+// pair of each chain. (The slot reads of the second pass should hit the cache by then)
+static void hm_prefetch_batch(hash_map_t *hm, const uint8_t *keys, size_t n, uint32_t *hashes) {
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = hm->hash_func(keys + (i * hm->key_size));
+
+        __builtin_prefetch(&(hm->chains[hashes[i] % hm->chains_cap]));
+        if (hm->old_chains) {
+            __builtin_prefetch(&(hm->old_chains[hashes[i] % hm->old_chains_cap]));
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        key_val_header_t *head = hm->chains[hashes[i] % hm->chains_cap];
+        if (head) {
+            __builtin_prefetch(head);
+        }
+        
+        if (hm->old_chains) {
+            head = hm->old_chains[hashes[i] % hm->old_chains_cap];
+            if (head) {
+                __builtin_prefetch(head);
+            }
+        }
+    }
+}
+
+void hm_get_batch(hash_map_t *hm, const void *keys, size_t n, void **vals) {
+    const uint8_t *key_iter = (const uint8_t *)keys;
+    uint32_t hashes[HM_BATCH_SIZE];
+
+    for (size_t start = 0; start < n; start += HM_BATCH_SIZE) {
+        size_t batch = n - start < HM_BATCH_SIZE ? n - start : HM_BATCH_SIZE;
+
+        hm_prefetch_batch(hm, key_iter, batch, hashes);
+
+        for (size_t i = 0; i < batch; i++) {
+            vals[start + i] = hm_get_hashed(hm, key_iter + (i * hm->key_size), hashes[i]);
+        }
+
+        key_iter += batch * hm->key_size;
+    }
+}
+
+void hm_put_batch(hash_map_t *hm, const void *keys, const void *values, size_t n) {
+    const uint8_t *key_iter = (const uint8_t *)keys;
+    const uint8_t *val_iter = (const uint8_t *)values;
+    uint32_t hashes[HM_BATCH_SIZE];
+
+    for (size_t start = 0; start < n; start += HM_BATCH_SIZE) {
+        size_t batch = n - start < HM_BATCH_SIZE ? n - start : HM_BATCH_SIZE;
+
+        // A put within the batch may resize the map, that only makes
+        // some prefetches useless, the hashes are still correct.
+        hm_prefetch_batch(hm, key_iter, batch, hashes);
+
+        for (size_t i = 0; i < batch; i++) {
+            hm_upsert_hashed(hm, key_iter + (i * hm->key_size), hashes[i], 
+                    val_iter + (i * hm->value_size));
+        }
+
+        key_iter += batch * hm->key_size;
+        val_iter += batch * hm->value_size;
+    }
+}
+
 bool hm_equals(hash_map_t *hm1, hash_map_t *hm2, hash_map_val_eq_ft val_eq) {
     if (hm_num_keys(hm1) != hm_num_keys(hm2)) {
         return false;
@@ -229,8 +545,10 @@ bool hm_equals(hash_map_t *hm1, hash_map_t *hm2, hash_map_val_eq_ft val_eq) {
 
     const void *hm2_val;
     
-    hm_reset_iterator(hm1);
-    while ((hm1_kvp = hm_next_kvp(hm1)) != HASH_MAP_EXHAUSTED) {
+    // A cursor of our own, so the caller's iteration of hm1 is left alone.
+    hash_map_cursor_t cur;
+    hm_cursor_init(hm1, &cur);
+    while ((hm1_kvp = hm_cursor_next(hm1, &cur)) != HASH_MAP_EXHAUSTED) {
         hm1_key = kvp_key(hm1, hm1_kvp); 
         hm1_val = kvp_val(hm1, hm1_kvp);
 
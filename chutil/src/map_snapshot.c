@@ -0,0 +1,357 @@
+#include "chutil/map_snapshot.h"
+#include "chutil/hash.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(hm_snapshot_header_t) <= HM_SNAPSHOT_HEADER_SIZE,
+        "Snapshot header must fit within HM_SNAPSHOT_HEADER_SIZE");
+
+static inline size_t hms_round8(size_t s) {
+    return (s + 7) & ~((size_t)7);
+}
+
+// Same padding as flat_hash_map_t, small slots are padded to a power of 2,
+// all others to a multiple of 8.
+static size_t hms_slot_size(size_t ks, size_t vs) {
+    size_t slot_size = ks + vs;
+
+    if (slot_size < 8) {
+        size_t p = 1;
+        while (p < slot_size) {
+            p *= 2;
+        }
+        return p;
+    }
+
+    return hms_round8(slot_size);
+}
+
+// The user's hash may be weak in its low bits, which pick the bucket.
+static inline size_t hms_bucket(uint32_t hash_val, size_t num_buckets) {
+    return hash_mix32(hash_val) & (num_buckets - 1);
+}
+
+// Offsets of each section, all derived from the header.
+typedef struct _hms_layout_t {
+    size_t slot_size;
+
+    size_t bucket_starts_offset;
+    size_t hashes_offset;
+    size_t slots_offset;
+
+    size_t file_size;
+} hms_layout_t;
+
+static void hms_compute_layout(hms_layout_t *l, size_t ks, size_t vs, size_t num_keys, size_t num_buckets) {
+    l->slot_size = hms_slot_size(ks, vs);
+
+    l->bucket_starts_offset = HM_SNAPSHOT_HEADER_SIZE;
+    l->hashes_offset = l->bucket_starts_offset + ((num_buckets + 1) * sizeof(uint64_t));
+    l->slots_offset = hms_round8(l->hashes_offset + (num_keys * sizeof(uint32_t)));
+    l->file_size = l->slots_offset + (num_keys * l->slot_size);
+}
+
+static inline uint64_t hms_checksum(const uint8_t *image, size_t file_size) {
+    return hash_bytes(image + HM_SNAPSHOT_HEADER_SIZE, file_size - HM_SNAPSHOT_HEADER_SIZE, HASH_DEFAULT_SEED);
+}
+
+// Fills in a zeroed image. hm's pairs are grouped by bucket.
+static void hms_fill_image(hash_map_t *hm, uint8_t *image, const hms_layout_t *l, size_t num_buckets) {
+    size_t ks = hm->key_size;
+    size_t vs = hm->value_size;
+
+    uint64_t *bucket_starts = (uint64_t *)(image + l->bucket_starts_offset);
+    uint32_t *hashes = (uint32_t *)(image + l->hashes_offset);
+    uint8_t *slots = image + l->slots_offset;
+
+    hash_map_cursor_t cur;
+    key_val_pair_t kvp;
+
+    // First count the pairs of each bucket. (In bucket_starts[b + 1])
+    hm_cursor_init(hm, &cur);
+    while ((kvp = hm_cursor_next(hm, &cur)) != HASH_MAP_EXHAUSTED) {
+        bucket_starts[hms_bucket(kvp_hash(hm, kvp), num_buckets) + 1]++;
+    }
+
+    for (size_t b = 0; b < num_buckets; b++) {
+        bucket_starts[b + 1] += bucket_starts[b];
+    }
+
+    // Then place each pair at the next free slot of its bucket.
+    size_t fill_size = sizeof(uint64_t) * num_buckets;
+    uint64_t *fill = fill_size >= SAFE_LARGE_THRESHOLD
+        ? (uint64_t *)safe_malloc_large(fill_size)
+        : (uint64_t *)safe_malloc(fill_size);
+
+    memcpy(fill, bucket_starts, fill_size);
+
+    hm_cursor_init(hm, &cur);
+    while ((kvp = hm_cursor_next(hm, &cur)) != HASH_MAP_EXHAUSTED) {
+        const void *key = kvp_key(hm, kvp);
+        uint32_t hash_val = kvp_hash(hm, kvp);
+
+        size_t i = fill[hms_bucket(hash_val, num_buckets)]++;
+
+        hashes[i] = hash_val;
+        memcpy(slots + (i * l->slot_size), key, ks);
+        memcpy(slots + (i * l->slot_size) + ks, kvp_val(hm, kvp), vs);
+    }
+
+    if (fill_size >= SAFE_LARGE_THRESHOLD) {
+        safe_free_large(fill);
+    } else {
+        safe_free(fill);
+    }
+}
+
+hm_snapshot_status_t hm_write_snapshot(hash_map_t *hm, const char *path) {
+    size_t num_keys = hm_num_keys(hm);
+
+    // About one pair per bucket.
+    size_t num_buckets = 1;
+    while (num_buckets < num_keys) {
+        num_buckets *= 2;
+    }
+
+    hms_layout_t l;
+    hms_compute_layout(&l, hm->key_size, hm->value_size, num_keys, num_buckets);
+
+    // A unique name in the same directory, so concurrent writers never share
+    // a temporary file, and the final rename stays within one filesystem.
+    size_t tmp_path_len = strlen(path) + sizeof(".XXXXXX");
+    char *tmp_path = (char *)safe_malloc(tmp_path_len);
+    snprintf(tmp_path, tmp_path_len, "%s.XXXXXX", path);
+
+    hm_snapshot_status_t status = HM_SNAPSHOT_IO_ERROR;
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        goto end;
+    }
+
+    // mkstemp only gives the owner access.
+    if (fchmod(fd, 0644) < 0) {
+        goto fail;
+    }
+
+    // The file is written through a shared mapping, so no copy of the image is ever
+    // held in our own memory.
+    //
+    // The blocks are allocated up front (and zero filled). Otherwise, running out of
+    // space while writing the mapping would raise SIGBUS instead of returning an error.
+    int alloc_res = posix_fallocate(fd, 0, (off_t)l.file_size);
+    if (alloc_res != 0) {
+        errno = alloc_res;
+        goto fail;
+    }
+
+    uint8_t *image = (uint8_t *)mmap(NULL, l.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        goto fail;
+    }
+
+    hms_fill_image(hm, image, &l, num_buckets);
+
+    hm_snapshot_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    memcpy(hdr.magic, HM_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = HM_SNAPSHOT_VERSION;
+    hdr.key_size = hm->key_size;
+    hdr.value_size = hm->value_size;
+    hdr.num_keys = num_keys;
+    hdr.num_buckets = num_buckets;
+    hdr.file_size = l.file_size;
+    hdr.checksum = hms_checksum(image, l.file_size);
+
+    memcpy(image, &hdr, sizeof(hdr));
+
+    int msync_res = msync(image, l.file_size, MS_SYNC);
+    munmap(image, l.file_size);
+
+    if (msync_res < 0) {
+        goto fail;
+    }
+
+    if (close(fd) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+
+    // Readers only ever see the old file or the complete new one.
+    if (rename(tmp_path, path) < 0) {
+        goto fail;
+    }
+
+    status = HM_SNAPSHOT_SUCCESS;
+    goto end;
+
+fail:
+    // Keep errno from the failed call.
+    {
+        int err = errno;
+
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(tmp_path);
+
+        errno = err;
+    }
+
+end:
+    safe_free(tmp_path);
+    return status;
+}
+
+// Checks that the header describes a file of exactly file_size bytes.
+static hm_snapshot_status_t hms_check_header(const hm_snapshot_header_t *hdr, size_t file_size,
+        size_t ks, size_t vs, hms_layout_t *l) {
+    if (memcmp(hdr->magic, HM_SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != HM_SNAPSHOT_VERSION) {
+        return HM_SNAPSHOT_BAD_FORMAT;
+    }
+
+    if (hdr->key_size != ks || hdr->value_size != vs) {
+        return HM_SNAPSHOT_SIZE_MISMATCH;
+    }
+
+    // Power of 2, and no more buckets or keys than could ever fit in the file.
+    // (So the layout below can't overflow)
+    if (hdr->num_buckets == 0 || (hdr->num_buckets & (hdr->num_buckets - 1)) != 0 ||
+            hdr->num_buckets > file_size / sizeof(uint64_t) ||
+            hdr->num_keys > file_size / sizeof(uint32_t)) {
+        return HM_SNAPSHOT_BAD_FORMAT;
+    }
+
+    hms_compute_layout(l, ks, vs, hdr->num_keys, hdr->num_buckets);
+
+    if (hdr->file_size != file_size || l->file_size != file_size) {
+        return HM_SNAPSHOT_BAD_FORMAT;
+    }
+
+    return HM_SNAPSHOT_SUCCESS;
+}
+
+hm_snapshot_status_t new_hm_snapshot(hm_snapshot_t **snap, const char *path, size_t ks, size_t vs,
+        hash_map_hash_ft hf, hash_map_key_eq_ft ef, bool verify) {
+    if (ks == 0 || hf == NULL || ef == NULL) {
+        return HM_SNAPSHOT_SIZE_MISMATCH;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return HM_SNAPSHOT_IO_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+
+        return HM_SNAPSHOT_IO_ERROR;
+    }
+
+    size_t file_size = (size_t)st.st_size;
+    if (file_size < HM_SNAPSHOT_HEADER_SIZE) {
+        close(fd);
+        return HM_SNAPSHOT_BAD_FORMAT;
+    }
+
+    const uint8_t *image = (const uint8_t *)mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid once the file is closed.
+    int err = errno;
+    close(fd);
+
+    if (image == MAP_FAILED) {
+        errno = err;
+        return HM_SNAPSHOT_IO_ERROR;
+    }
+
+    hm_snapshot_header_t hdr;
+    memcpy(&hdr, image, sizeof(hdr));
+
+    hms_layout_t l;
+    hm_snapshot_status_t status = hms_check_header(&hdr, file_size, ks, vs, &l);
+
+    if (status == HM_SNAPSHOT_SUCCESS && verify && hms_checksum(image, file_size) != hdr.checksum) {
+        status = HM_SNAPSHOT_BAD_CHECKSUM;
+    }
+
+    const uint64_t *bucket_starts = (const uint64_t *)(image + l.bucket_starts_offset);
+
+    // Cheap sanity check for when the checksum is skipped.
+    if (status == HM_SNAPSHOT_SUCCESS &&
+            (bucket_starts[0] != 0 || bucket_starts[hdr.num_buckets] != hdr.num_keys)) {
+        status = HM_SNAPSHOT_BAD_FORMAT;
+    }
+
+    if (status != HM_SNAPSHOT_SUCCESS) {
+        munmap((void *)image, file_size);
+        return status;
+    }
+
+    hm_snapshot_t *s = (hm_snapshot_t *)safe_malloc(sizeof(hm_snapshot_t));
+
+    s->key_size = ks;
+    s->value_size = vs;
+    s->slot_size = l.slot_size;
+
+    s->hash_func = hf;
+    s->eq_func = ef;
+
+    s->num_keys = hdr.num_keys;
+    s->num_buckets = hdr.num_buckets;
+
+    s->image = image;
+    s->image_size = file_size;
+
+    s->bucket_starts = bucket_starts;
+    s->hashes = (const uint32_t *)(image + l.hashes_offset);
+    s->slots = image + l.slots_offset;
+
+    *snap = s;
+
+    return HM_SNAPSHOT_SUCCESS;
+}
+
+void delete_hm_snapshot(hm_snapshot_t *snap) {
+    munmap((void *)(snap->image), snap->image_size);
+    safe_free(snap);
+}
+
+const void *hms_get(hm_snapshot_t *snap, const void *key) {
+    uint32_t hash_val = snap->hash_func(key);
+    size_t b = hms_bucket(hash_val, snap->num_buckets);
+
+    size_t start = snap->bucket_starts[b];
+    size_t end = snap->bucket_starts[b + 1];
+
+    // Without verification, a corrupt file could hold any offsets here.
+    if (end > snap->num_keys) {
+        end = snap->num_keys;
+    }
+
+    if (start > end) {
+        return NULL;
+    }
+
+    for (size_t i = start; i < end; i++) {
+        if (snap->hashes[i] == hash_val && snap->eq_func(hms_key(snap, i), key)) {
+            return hms_val(snap, i);
+        }
+    }
+
+    return NULL;
+}
@@ -1,5 +1,6 @@
 
 #include "chutil/string.h"
+#include "chutil/hash.h"
 #include "chsys/mem.h"
 #include <stdlib.h>
 #include <string.h>
@@ -95,12 +96,7 @@ bool s_equals(const string_t *s1, const string_t *s2) {
 }
 
 uint32_t s_hash(const string_t *s) {
-    uint32_t hash_val = 23;    
-    for (size_t i = 0; i < s_len(s); i++) {
-        hash_val = (hash_val * 31) + s_get_char(s, i);
-    }
-
-    return hash_val;
+    return hash_fold32(hash_bytes(s_get_cstr(s), s_len(s), HASH_DEFAULT_SEED));
 }
 
 string_t *s_substring(const string_t *s, size_t start, size_t end) {
@@ -0,0 +1,368 @@
+#include "chutil/btree.h"
+#include "chutil/hash.h"
+#include "chsys/mem.h"
+
+#include "unity/unity.h"
+#include "unity/unity_internals.h"
+
+static int u64_cmp_f(const uint64_t *k1, const uint64_t *k2) {
+    return *k1 < *k2 ? -1 : (*k1 > *k2 ? 1 : 0);
+}
+
+static btree_t *new_u64_btree(void) {
+    btree_t *bt = new_btree(sizeof(uint64_t), sizeof(uint64_t), (btree_key_cmp_ft)u64_cmp_f);
+    TEST_ASSERT_NOT_NULL(bt);
+    return bt;
+}
+
+// Walks the whole tree in order, checking node sizes and that every key is
+// between its bounds. Returns the number of keys seen.
+static size_t bt_check_node(btree_t *bt, bt_node_t *node, size_t depth,
+        const uint64_t *lo, const uint64_t *hi) {
+    bool root = depth == 1;
+
+    if (node->leaf) {
+        TEST_ASSERT_EQUAL_size_t(bt->height, depth);
+        TEST_ASSERT_TRUE(node->num_keys <= bt->leaf_cap);
+        if (!root) {
+            TEST_ASSERT_TRUE(node->num_keys >= bt->leaf_cap / 2);
+        }
+
+        const uint64_t *keys = (const uint64_t *)((uint8_t *)node + sizeof(bt_node_t));
+        for (size_t i = 0; i < node->num_keys; i++) {
+            if (i > 0) {
+                TEST_ASSERT_TRUE(keys[i - 1] < keys[i]);
+            }
+            if (lo) {
+                TEST_ASSERT_TRUE(*lo <= keys[i]);
+            }
+            if (hi) {
+                TEST_ASSERT_TRUE(keys[i] < *hi);
+            }
+        }
+
+        return node->num_keys;
+    }
+
+    TEST_ASSERT_TRUE(node->num_keys <= bt->internal_cap);
+    TEST_ASSERT_TRUE(node->num_keys >= (root ? 1 : (bt->internal_cap - 1) / 2));
+
+    bt_node_t **children = (bt_node_t **)((uint8_t *)node + sizeof(bt_node_t));
+    const uint64_t *keys = (const uint64_t *)((uint8_t *)children + bt->internal_keys_offset);
+
+    size_t total = 0;
+    for (size_t i = 0; i <= node->num_keys; i++) {
+        const uint64_t *child_lo = i == 0 ? lo : &(keys[i - 1]);
+        const uint64_t *child_hi = i == node->num_keys ? hi : &(keys[i]);
+
+        total += bt_check_node(bt, children[i], depth + 1, child_lo, child_hi);
+    }
+
+    return total;
+}
+
+static void bt_check(btree_t *bt) {
+    TEST_ASSERT_EQUAL_size_t(bt_num_keys(bt), bt_check_node(bt, bt->root, 1, NULL, NULL));
+
+    // The leaf chain must visit every key in order too.
+    btree_cursor_t cur;
+    const void *key;
+    size_t count = 0;
+    uint64_t prev = 0;
+
+    bt_cursor_init(bt, &cur);
+    while (bt_cursor_next(bt, &cur, &key, NULL)) {
+        uint64_t k = *(const uint64_t *)key;
+        if (count > 0) {
+            TEST_ASSERT_TRUE(prev < k);
+        }
+        prev = k;
+        count++;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(bt_num_keys(bt), count);
+}
+
+static void test_bt_construct_and_destruct(void) {
+    btree_t *bt = new_u64_btree();
+    TEST_ASSERT_TRUE(bt->leaf_cap >= BT_MIN_FANOUT);
+    TEST_ASSERT_TRUE(bt->leaf_size <= BT_NODE_SIZE);
+    TEST_ASSERT_TRUE(bt->internal_size <= BT_NODE_SIZE);
+    delete_btree(bt);
+
+    TEST_ASSERT_NULL(new_btree(0, 8, (btree_key_cmp_ft)u64_cmp_f));
+    TEST_ASSERT_NULL(new_btree(8, 8, NULL));
+}
+
+static void test_bt_put_get_remove(void) {
+    btree_t *bt = new_u64_btree();
+
+    const uint64_t NUM_KEYS = 5000;
+    uint64_t key, val;
+
+    // A permutation of [0, NUM_KEYS), so splits happen all over the tree.
+    for (uint64_t i = 0; i < NUM_KEYS; i++) {
+        key = (i * 2654435761ULL) % NUM_KEYS;
+        val = key * 3;
+        bt_put(bt, &key, &val);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, bt_num_keys(bt));
+    TEST_ASSERT_TRUE(bt->height > 1);
+    bt_check(bt);
+
+    // Overwrite.
+    key = 17; val = 1;
+    bt_put(bt, &key, &val);
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, bt_num_keys(bt));
+    TEST_ASSERT_TRUE(bt_get_copy(bt, &key, &val));
+    TEST_ASSERT_EQUAL_UINT64(1, val);
+
+    key = NUM_KEYS;
+    TEST_ASSERT_FALSE(bt_contains(bt, &key));
+    TEST_ASSERT_FALSE(bt_remove(bt, &key));
+
+    // Remove every odd key.
+    for (uint64_t i = 0; i < NUM_KEYS; i++) {
+        key = (i * 2654435761ULL) % NUM_KEYS;
+        if (key % 2 == 1) {
+            TEST_ASSERT_TRUE(bt_remove(bt, &key));
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS / 2, bt_num_keys(bt));
+    bt_check(bt);
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        bool found = bt_get_copy(bt, &key, &val);
+        TEST_ASSERT_EQUAL(key % 2 == 0, found);
+        if (found && key != 17) {
+            TEST_ASSERT_EQUAL_UINT64(key * 3, val);
+        }
+    }
+
+    // Remove the rest, the tree should shrink back to a single leaf.
+    for (key = 0; key < NUM_KEYS; key += 2) {
+        TEST_ASSERT_TRUE(bt_remove(bt, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, bt_num_keys(bt));
+    TEST_ASSERT_EQUAL_size_t(1, bt->height);
+    bt_check(bt);
+
+    delete_btree(bt);
+}
+
+static void test_bt_random_ops(void) {
+    btree_t *bt = new_u64_btree();
+
+    // Reference, present[k] is whether k is in the tree.
+    #define BT_RANDOM_KEY_SPACE 3000
+    bool present[BT_RANDOM_KEY_SPACE] = {false};
+    size_t expected = 0;
+
+    uint64_t seed = 7;
+    for (size_t i = 0; i < 40000; i++) {
+        seed = hash_mix64(seed + i);
+        uint64_t key = seed % BT_RANDOM_KEY_SPACE;
+
+        // Mostly puts early on, mostly removes later.
+        bool put = (seed >> 32) % 40000 > i;
+
+        if (put) {
+            bt_put(bt, &key, &key);
+            if (!present[key]) {
+                present[key] = true;
+                expected++;
+            }
+        } else {
+            TEST_ASSERT_EQUAL(present[key], bt_remove(bt, &key));
+            if (present[key]) {
+                present[key] = false;
+                expected--;
+            }
+        }
+
+        if (i % 5000 == 0) {
+            bt_check(bt);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(expected, bt_num_keys(bt));
+    bt_check(bt);
+
+    for (uint64_t key = 0; key < BT_RANDOM_KEY_SPACE; key++) {
+        TEST_ASSERT_EQUAL(present[key], bt_contains(bt, &key));
+    }
+
+    #undef BT_RANDOM_KEY_SPACE
+
+    delete_btree(bt);
+}
+
+static void test_bt_range(void) {
+    btree_t *bt = new_u64_btree();
+
+    uint64_t key, val;
+
+    // Only multiples of 10.
+    for (key = 0; key < 10000; key += 10) {
+        val = key + 1;
+        bt_put(bt, &key, &val);
+    }
+
+    btree_cursor_t cur;
+    const void *k;
+    void *v;
+
+    uint64_t lo = 995, hi = 2000;
+    uint64_t expected = 1000;
+
+    bt_cursor_init_range(bt, &cur, &lo, &hi);
+    while (bt_cursor_next(bt, &cur, &k, &v)) {
+        TEST_ASSERT_EQUAL_UINT64(expected, *(const uint64_t *)k);
+        TEST_ASSERT_EQUAL_UINT64(expected + 1, *(uint64_t *)v);
+        expected += 10;
+    }
+    TEST_ASSERT_EQUAL_UINT64(2000, expected);
+
+    // Inclusive start.
+    lo = 5000;
+    bt_cursor_init_range(bt, &cur, &lo, NULL);
+    TEST_ASSERT_TRUE(bt_cursor_next(bt, &cur, &k, NULL));
+    TEST_ASSERT_EQUAL_UINT64(5000, *(const uint64_t *)k);
+
+    size_t count = 1;
+    while (bt_cursor_next(bt, &cur, NULL, NULL)) {
+        count++;
+    }
+    TEST_ASSERT_EQUAL_size_t(500, count);
+
+    // Empty ranges.
+    lo = 20000;
+    bt_cursor_init_range(bt, &cur, &lo, NULL);
+    TEST_ASSERT_FALSE(bt_cursor_next(bt, &cur, NULL, NULL));
+
+    lo = 41; hi = 49;
+    bt_cursor_init_range(bt, &cur, &lo, &hi);
+    TEST_ASSERT_FALSE(bt_cursor_next(bt, &cur, NULL, NULL));
+
+    // Everything before hi.
+    hi = 35;
+    count = 0;
+    bt_cursor_init_range(bt, &cur, NULL, &hi);
+    while (bt_cursor_next(bt, &cur, NULL, NULL)) {
+        count++;
+    }
+    TEST_ASSERT_EQUAL_size_t(4, count);
+
+    delete_btree(bt);
+}
+
+static void test_bt_from_sorted(void) {
+    #define BT_SORTED_KEYS 10007
+    uint64_t *keys = (uint64_t *)safe_malloc(sizeof(uint64_t) * BT_SORTED_KEYS);
+    uint64_t *vals = (uint64_t *)safe_malloc(sizeof(uint64_t) * BT_SORTED_KEYS);
+
+    for (uint64_t i = 0; i < BT_SORTED_KEYS; i++) {
+        keys[i] = i * 2;
+        vals[i] = i;
+    }
+
+    // Every size from empty to a few levels.
+    size_t sizes[] = {0, 1, 2, 30, 31, 32, 33, 500, 1000, BT_SORTED_KEYS};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        btree_t *bt = new_btree_from_sorted(sizeof(uint64_t), sizeof(uint64_t),
+                (btree_key_cmp_ft)u64_cmp_f, keys, vals, sizes[s]);
+        TEST_ASSERT_NOT_NULL(bt);
+        TEST_ASSERT_EQUAL_size_t(sizes[s], bt_num_keys(bt));
+        bt_check(bt);
+
+        // Odd keys fill the gaps, then even keys are all removed.
+        for (uint64_t i = 0; i < sizes[s]; i++) {
+            uint64_t key = (i * 2) + 1;
+            bt_put(bt, &key, &i);
+        }
+        bt_check(bt);
+
+        for (uint64_t i = 0; i < sizes[s]; i++) {
+            uint64_t key = i * 2;
+            uint64_t val;
+
+            TEST_ASSERT_TRUE(bt_get_copy(bt, &key, &val));
+            TEST_ASSERT_EQUAL_UINT64(i, val);
+            TEST_ASSERT_TRUE(bt_remove(bt, &key));
+        }
+        bt_check(bt);
+
+        TEST_ASSERT_EQUAL_size_t(sizes[s], bt_num_keys(bt));
+        delete_btree(bt);
+    }
+
+    // Out of order and duplicate keys are rejected.
+    keys[3] = keys[2];
+    TEST_ASSERT_NULL(new_btree_from_sorted(sizeof(uint64_t), sizeof(uint64_t),
+                (btree_key_cmp_ft)u64_cmp_f, keys, vals, 10));
+
+    #undef BT_SORTED_KEYS
+
+    safe_free(keys);
+    safe_free(vals);
+}
+
+typedef struct _bt_big_key_t {
+    uint64_t id;
+    uint8_t pad[200];
+} bt_big_key_t;
+
+static int big_key_cmp_f(const bt_big_key_t *k1, const bt_big_key_t *k2) {
+    return u64_cmp_f(&(k1->id), &(k2->id));
+}
+
+static void test_bt_big_keys(void) {
+    // Keys too big for BT_NODE_SIZE, and no values. (An ordered set)
+    btree_t *bt = new_btree(sizeof(bt_big_key_t), 0, (btree_key_cmp_ft)big_key_cmp_f);
+    TEST_ASSERT_EQUAL_size_t(BT_MIN_FANOUT, bt->leaf_cap);
+
+    bt_big_key_t key;
+    memset(&key, 0, sizeof(key));
+
+    for (uint64_t i = 0; i < 1000; i++) {
+        key.id = (i * 7919) % 1000;
+        bt_put(bt, &key, NULL);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(1000, bt_num_keys(bt));
+
+    for (uint64_t i = 0; i < 1000; i += 3) {
+        key.id = i;
+        TEST_ASSERT_TRUE(bt_remove(bt, &key));
+    }
+
+    btree_cursor_t cur;
+    const void *k;
+    uint64_t expected = 1;
+
+    bt_cursor_init(bt, &cur);
+    while (bt_cursor_next(bt, &cur, &k, NULL)) {
+        TEST_ASSERT_EQUAL_UINT64(expected, ((const bt_big_key_t *)k)->id);
+
+        expected++;
+        if (expected % 3 == 0) {
+            expected++;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(1000, expected);
+
+    delete_btree(bt);
+}
+
+void btree_tests(void) {
+    RUN_TEST(test_bt_construct_and_destruct);
+    RUN_TEST(test_bt_put_get_remove);
+    RUN_TEST(test_bt_random_ops);
+    RUN_TEST(test_bt_range);
+    RUN_TEST(test_bt_from_sorted);
+    RUN_TEST(test_bt_big_keys);
+}
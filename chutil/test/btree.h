@@ -0,0 +1,6 @@
+#ifndef TEST_CHUTIL_BTREE_H
+#define TEST_CHUTIL_BTREE_H
+
+void btree_tests(void);
+
+#endif
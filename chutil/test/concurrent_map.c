@@ -0,0 +1,206 @@
+#include "chutil/concurrent_map.h"
+#include "chutil/hash.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+#include "chsys/wrappers.h"
+
+#include "unity/unity.h"
+#include "unity/unity_internals.h"
+
+#include <pthread.h>
+
+static bool u64_eq_f(const uint64_t *k1, const uint64_t *k2) {
+    return *k1 == *k2;
+}
+
+static concurrent_hash_map_t *new_u64_chm(size_t num_stripes) {
+    concurrent_hash_map_t *chm = new_concurrent_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, num_stripes);
+    TEST_ASSERT_NOT_NULL(chm);
+    return chm;
+}
+
+static void test_chm_single_thread(void) {
+    concurrent_hash_map_t *chm = new_u64_chm(0);
+    TEST_ASSERT_EQUAL_size_t(CHM_DEFAULT_STRIPES, chm->num_stripes);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)(chm->stripes) % CHM_STRIPE_SIZE);
+
+    uint64_t key, val;
+
+    for (key = 0; key < 500; key++) {
+        val = key * 2;
+        chm_put(chm, &key, &val);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(500, chm_num_keys(chm));
+
+    key = 10;
+    val = 1;
+    TEST_ASSERT_FALSE(chm_put_if_absent(chm, &key, &val));
+    TEST_ASSERT_TRUE(chm_get_copy(chm, &key, &val));
+    TEST_ASSERT_EQUAL_UINT64(20, val);
+
+    for (key = 0; key < 500; key += 2) {
+        TEST_ASSERT_TRUE(chm_remove(chm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(key * 2, val);
+        TEST_ASSERT_FALSE(chm_contains(chm, &key));
+    }
+
+    TEST_ASSERT_EQUAL_size_t(250, chm_num_keys(chm));
+
+    key = 0;
+    TEST_ASSERT_TRUE(chm_put_if_absent(chm, &key, &val));
+
+    delete_concurrent_hash_map(chm);
+}
+
+#define CHM_TEST_THREADS 8
+#define CHM_TEST_KEYS_PER_THREAD 2000
+
+typedef struct _chm_test_arg_t {
+    concurrent_hash_map_t *chm;
+    uint64_t id;
+} chm_test_arg_t;
+
+static void chm_test_inc(const void *key, void *val, void *arg) {
+    (void)key;
+    (void)arg;
+    (*(uint64_t *)val)++;
+}
+
+static void *chm_test_routine(void *arg) {
+    chm_test_arg_t *a = (chm_test_arg_t *)arg;
+
+    // Each thread owns its own range of keys, but all share the counter key.
+    uint64_t base = (a->id + 1) * 1000000;
+    uint64_t counter_key = 0;
+
+    for (uint64_t i = 0; i < CHM_TEST_KEYS_PER_THREAD; i++) {
+        uint64_t key = base + i;
+        uint64_t val = key;
+        chm_put(a->chm, &key, &val);
+
+        chm_update(a->chm, &counter_key, chm_test_inc, NULL);
+
+        // Remove every other key of the thread, a little while after putting it.
+        if (i % 2 == 1) {
+            uint64_t rm_key = key - 1;
+            chm_remove(a->chm, &rm_key, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_chm_parallel(void) {
+    concurrent_hash_map_t *chm = new_u64_chm(16);
+
+    uint64_t counter_key = 0;
+    uint64_t zero = 0;
+    chm_put(chm, &counter_key, &zero);
+
+    pthread_t threads[CHM_TEST_THREADS];
+    chm_test_arg_t args[CHM_TEST_THREADS];
+
+    for (size_t i = 0; i < CHM_TEST_THREADS; i++) {
+        args[i].chm = chm;
+        args[i].id = i;
+        safe_pthread_create(&(threads[i]), NULL, chm_test_routine, &(args[i]));
+    }
+
+    for (size_t i = 0; i < CHM_TEST_THREADS; i++) {
+        safe_pthread_join(threads[i], NULL);
+    }
+
+    uint64_t count;
+    TEST_ASSERT_TRUE(chm_get_copy(chm, &counter_key, &count));
+    TEST_ASSERT_EQUAL_UINT64(CHM_TEST_THREADS * CHM_TEST_KEYS_PER_THREAD, count);
+
+    TEST_ASSERT_EQUAL_size_t(1 + (CHM_TEST_THREADS * CHM_TEST_KEYS_PER_THREAD / 2), chm_num_keys(chm));
+
+    for (uint64_t t = 0; t < CHM_TEST_THREADS; t++) {
+        for (uint64_t i = 0; i < CHM_TEST_KEYS_PER_THREAD; i++) {
+            uint64_t key = ((t + 1) * 1000000) + i;
+            uint64_t val;
+
+            bool found = chm_get_copy(chm, &key, &val);
+            TEST_ASSERT_EQUAL(i % 2 == 1, found);
+            if (found) {
+                TEST_ASSERT_EQUAL_UINT64(key, val);
+            }
+        }
+    }
+
+    delete_concurrent_hash_map(chm);
+}
+
+typedef struct _chm_pair_writer_arg_t {
+    concurrent_hash_map_t *chm;
+    atomic_bool stop;
+} chm_pair_writer_arg_t;
+
+// Keys come in pairs (2k, 2k + 1), keys of a pair are almost always in different stripes.
+// The writer moves a single token back and forth between the pairs.
+static void *chm_pair_writer_routine(void *arg) {
+    chm_pair_writer_arg_t *a = (chm_pair_writer_arg_t *)arg;
+
+    uint64_t at = 0;
+    uint64_t val = 1;
+
+    while (!atomic_load(&(a->stop))) {
+        uint64_t next = (at + 1) % 64;
+
+        // Put first, then remove, so a snapshot sees 1 or 2 tokens, never 0.
+        chm_put(a->chm, &next, &val);
+        chm_remove(a->chm, &at, NULL);
+
+        at = next;
+    }
+
+    return NULL;
+}
+
+static void chm_test_count_visit(const void *key, const void *val, void *arg) {
+    (void)key;
+    (void)val;
+    (*(size_t *)arg)++;
+}
+
+static void test_chm_snapshot(void) {
+    concurrent_hash_map_t *chm = new_u64_chm(8);
+
+    uint64_t key = 0;
+    uint64_t val = 1;
+    chm_put(chm, &key, &val);
+
+    chm_pair_writer_arg_t arg;
+    arg.chm = chm;
+    atomic_init(&(arg.stop), false);
+
+    pthread_t writer;
+    safe_pthread_create(&writer, NULL, chm_pair_writer_routine, &arg);
+
+    for (size_t i = 0; i < 200; i++) {
+        hash_map_t *snap = chm_snapshot(chm);
+
+        size_t n = hm_num_keys(snap);
+        TEST_ASSERT_TRUE(n == 1 || n == 2);
+
+        delete_hash_map(snap);
+    }
+
+    atomic_store(&(arg.stop), true);
+    safe_pthread_join(writer, NULL);
+
+    size_t visited = 0;
+    chm_for_each(chm, chm_test_count_visit, &visited);
+    TEST_ASSERT_EQUAL_size_t(1, visited);
+
+    delete_concurrent_hash_map(chm);
+}
+
+void concurrent_map_tests(void) {
+    RUN_TEST(test_chm_single_thread);
+    RUN_TEST(test_chm_parallel);
+    RUN_TEST(test_chm_snapshot);
+}
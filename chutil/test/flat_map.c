@@ -0,0 +1,231 @@
+#include "chutil/flat_map.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+
+#include "unity/unity.h"
+#include "unity/unity_internals.h"
+
+static bool u64_eq_f(const uint64_t *k1, const uint64_t *k2) {
+    return *k1 == *k2;
+}
+
+static uint32_t u64_hash_f(const uint64_t *k) {
+    return (uint32_t)*k;
+}
+
+// Every key collides, so every key lands in one long probe run.
+static uint32_t u64_const_hash_f(const uint64_t *k) {
+    (void)k;
+    return 7;
+}
+
+static flat_hash_map_t *new_u64_fhm(hash_map_hash_ft hf) {
+    flat_hash_map_t *fhm = new_flat_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            hf, (hash_map_key_eq_ft)u64_eq_f);
+    TEST_ASSERT_NOT_NULL(fhm);
+    return fhm;
+}
+
+static void test_fhm_construct_and_destruct(void) {
+    flat_hash_map_t *fhm = new_u64_fhm((hash_map_hash_ft)u64_hash_f);
+    TEST_ASSERT_EQUAL_size_t(0, fhm_num_keys(fhm));
+    delete_flat_hash_map(fhm);
+}
+
+static void test_fhm_put_and_get(void) {
+    flat_hash_map_t *fhm = new_u64_fhm((hash_map_hash_ft)u64_hash_f);
+
+    const uint64_t NUM_KEYS = 1000;
+    uint64_t key, val;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key * 5;
+        fhm_put(fhm, &key, &val);
+
+        TEST_ASSERT_TRUE(fhm_get_copy(fhm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(key * 5, val);
+    }
+
+    // Updates don't add keys.
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key + 1;
+        fhm_put(fhm, &key, &val);
+    }
+
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, fhm_num_keys(fhm));
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        TEST_ASSERT_TRUE(fhm_get_copy(fhm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(key + 1, val);
+    }
+
+    key = NUM_KEYS;
+    TEST_ASSERT_NULL(fhm_get(fhm, &key));
+
+    delete_flat_hash_map(fhm);
+}
+
+static void test_fhm_remove_collisions(void) {
+    flat_hash_map_t *fhm = new_u64_fhm((hash_map_hash_ft)u64_const_hash_f);
+
+    const uint64_t NUM_KEYS = 100;
+    uint64_t key, val;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key * key;
+        fhm_put(fhm, &key, &val);
+    }
+
+    // Removing from the middle of the run must keep the rest reachable.
+    for (key = 0; key < NUM_KEYS; key += 3) {
+        TEST_ASSERT_TRUE(fhm_remove(fhm, &key));
+        TEST_ASSERT_FALSE(fhm_remove(fhm, &key));
+    }
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        if (key % 3 == 0) {
+            TEST_ASSERT_FALSE(fhm_contains(fhm, &key));
+        } else {
+            TEST_ASSERT_TRUE(fhm_get_copy(fhm, &key, &val));
+            TEST_ASSERT_EQUAL_UINT64(key * key, val);
+        }
+    }
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        if (key % 3 != 0) {
+            TEST_ASSERT_TRUE(fhm_remove(fhm, &key));
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(0, fhm_num_keys(fhm));
+
+    delete_flat_hash_map(fhm);
+}
+
+static void test_fhm_iterator(void) {
+    flat_hash_map_t *fhm = new_u64_fhm((hash_map_hash_ft)u64_hash_f);
+
+    const uint64_t NUM_KEYS = 300;
+    bool seen[300];
+
+    uint64_t key, val;
+    for (key = 0; key < NUM_KEYS; key++) {
+        seen[key] = false;
+        val = key * 3;
+        fhm_put(fhm, &key, &val);
+    }
+
+    size_t count = 0;
+    key_val_pair_t kvp;
+
+    fhm_reset_iterator(fhm);
+    while ((kvp = fhm_next_kvp(fhm)) != HASH_MAP_EXHAUSTED) {
+        const uint64_t *key_ptr = fhm_kvp_key(fhm, kvp);
+        const uint64_t *val_ptr = fhm_kvp_val(fhm, kvp);
+
+        TEST_ASSERT_TRUE(*key_ptr < NUM_KEYS);
+        TEST_ASSERT_EQUAL_UINT64(*key_ptr * 3, *val_ptr);
+
+        TEST_ASSERT_FALSE(seen[*key_ptr]);
+        seen[*key_ptr] = true;
+        count++;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, count);
+
+    delete_flat_hash_map(fhm);
+}
+
+static bool u8_eq_f(const uint8_t *k1, const uint8_t *k2) {
+    return *k1 == *k2;
+}
+
+static uint32_t u8_hash_f(const uint8_t *k) {
+    return *k;
+}
+
+static void test_fhm_set(void) {
+    // A value size of 0 makes a set.
+    flat_hash_map_t *fhm = new_flat_hash_map(sizeof(uint8_t), 0,
+            (hash_map_hash_ft)u8_hash_f, (hash_map_key_eq_ft)u8_eq_f);
+
+    for (uint8_t k = 0; k < 200; k += 2) {
+        fhm_put(fhm, &k, NULL);
+    }
+
+    for (uint8_t k = 0; k < 200; k++) {
+        TEST_ASSERT_EQUAL(k % 2 == 0, fhm_contains(fhm, &k));
+    }
+
+    delete_flat_hash_map(fhm);
+}
+
+static bool u64_val_eq_f(const uint64_t *v1, const uint64_t *v2) {
+    return *v1 == *v2;
+}
+
+// Random puts and removes, checked against a hash_map_t.
+static void test_fhm_against_hm(void) {
+    flat_hash_map_t *fhm = new_u64_fhm((hash_map_hash_ft)u64_hash_f);
+    flat_hash_map_t *fhm2 = new_u64_fhm((hash_map_hash_ft)u64_hash_f);
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    uint64_t state = 12345;
+
+    for (size_t i = 0; i < 50000; i++) {
+        state = (state * 6364136223846793005ULL) + 1442695040888963407ULL;
+
+        uint64_t key = (state >> 33) % 4096;
+        uint64_t val = state;
+
+        if ((state >> 20) % 3 == 0) {
+            TEST_ASSERT_EQUAL(hm_remove(hm, &key), fhm_remove(fhm, &key));
+        } else {
+            hm_put(hm, &key, &val);
+            fhm_put(fhm, &key, &val);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(hm_num_keys(hm), fhm_num_keys(fhm));
+
+    key_val_pair_t kvp;
+    hm_reset_iterator(hm);
+    while ((kvp = hm_next_kvp(hm)) != HASH_MAP_EXHAUSTED) {
+        uint64_t val;
+        TEST_ASSERT_TRUE(fhm_get_copy(fhm, kvp_key(hm, kvp), &val));
+        TEST_ASSERT_EQUAL_UINT64(*(uint64_t *)kvp_val(hm, kvp), val);
+
+        fhm_put(fhm2, kvp_key(hm, kvp), kvp_val(hm, kvp));
+    }
+
+    TEST_ASSERT_TRUE(fhm_equals(fhm, fhm2, (hash_map_val_eq_ft)u64_val_eq_f));
+
+    // Comparing in the middle of an iteration must not disturb it.
+    size_t visited = 0;
+    fhm_reset_iterator(fhm);
+    while ((kvp = fhm_next_kvp(fhm)) != HASH_MAP_EXHAUSTED) {
+        if (visited++ == 10) {
+            TEST_ASSERT_TRUE(fhm_equals(fhm, fhm2, (hash_map_val_eq_ft)u64_val_eq_f));
+        }
+    }
+    TEST_ASSERT_EQUAL_size_t(fhm_num_keys(fhm), visited);
+
+    uint64_t key = 5000;
+    uint64_t val = 1;
+    fhm_put(fhm2, &key, &val);
+    TEST_ASSERT_FALSE(fhm_equals(fhm, fhm2, (hash_map_val_eq_ft)u64_val_eq_f));
+
+    delete_hash_map(hm);
+    delete_flat_hash_map(fhm2);
+    delete_flat_hash_map(fhm);
+}
+
+void flat_map_tests(void) {
+    RUN_TEST(test_fhm_construct_and_destruct);
+    RUN_TEST(test_fhm_put_and_get);
+    RUN_TEST(test_fhm_remove_collisions);
+    RUN_TEST(test_fhm_iterator);
+    RUN_TEST(test_fhm_set);
+    RUN_TEST(test_fhm_against_hm);
+}
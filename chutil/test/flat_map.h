@@ -0,0 +1,6 @@
+#ifndef TEST_CHUTIL_FLAT_MAP_H
+#define TEST_CHUTIL_FLAT_MAP_H
+
+void flat_map_tests(void);
+
+#endif
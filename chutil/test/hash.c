@@ -0,0 +1,124 @@
+#include "chutil/hash.h"
+#include "chutil/string.h"
+#include "chsys/mem.h"
+
+#include "unity/unity.h"
+#include "unity/unity_internals.h"
+
+#include <string.h>
+
+static void test_hash_bytes_deterministic(void) {
+    const char *msg = "The quick brown fox jumps over the lazy dog, many many times over.";
+    size_t len = strlen(msg);
+
+    for (size_t l = 0; l <= len; l++) {
+        TEST_ASSERT_EQUAL_UINT64(hash_bytes(msg, l, HASH_DEFAULT_SEED), hash_bytes(msg, l, HASH_DEFAULT_SEED));
+    }
+
+    // The seed matters.
+    TEST_ASSERT_TRUE(hash_bytes(msg, len, 1) != hash_bytes(msg, len, 2));
+}
+
+static void test_hash_bytes_unaligned(void) {
+    uint8_t buf[256 + 8];
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)(i * 7);
+    }
+
+    uint8_t copy[256 + 8];
+
+    // The same bytes must hash the same, no matter their alignment.
+    for (size_t off = 1; off < 8; off++) {
+        memcpy(copy + off, buf, 256);
+
+        for (size_t l = 0; l <= 256; l += 5) {
+            TEST_ASSERT_EQUAL_UINT64(hash_bytes(buf, l, 0), hash_bytes(copy + off, l, 0));
+        }
+    }
+}
+
+static void test_hash_bytes_lengths(void) {
+    // A prefix must hash differently from the whole. (Covers every code path)
+    uint8_t buf[200];
+    memset(buf, 0, sizeof(buf));
+
+    uint64_t hashes[201];
+    for (size_t l = 0; l <= 200; l++) {
+        hashes[l] = hash_bytes(buf, l, HASH_DEFAULT_SEED);
+
+        for (size_t j = 0; j < l; j++) {
+            TEST_ASSERT_TRUE(hashes[j] != hashes[l]);
+        }
+    }
+}
+
+static size_t popcount64(uint64_t x) {
+    size_t c = 0;
+    while (x) {
+        x &= x - 1;
+        c++;
+    }
+    return c;
+}
+
+static void test_hash_bytes_avalanche(void) {
+    uint8_t buf[64];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)(i * 13 + 1);
+    }
+
+    // Flipping any single bit should flip about half of the output bits.
+    const size_t lens[] = {3, 8, 16, 40, 64};
+
+    for (size_t li = 0; li < sizeof(lens) / sizeof(lens[0]); li++) {
+        size_t len = lens[li];
+        uint64_t base = hash_bytes(buf, len, HASH_DEFAULT_SEED);
+
+        size_t total = 0;
+        for (size_t bit = 0; bit < len * 8; bit++) {
+            buf[bit / 8] ^= (uint8_t)(1U << (bit % 8));
+            total += popcount64(base ^ hash_bytes(buf, len, HASH_DEFAULT_SEED));
+            buf[bit / 8] ^= (uint8_t)(1U << (bit % 8));
+        }
+
+        size_t avg = total / (len * 8);
+        TEST_ASSERT_TRUE(avg >= 24 && avg <= 40);
+    }
+}
+
+static void test_hash_mixers(void) {
+    // Neighbouring integers should land far apart.
+    for (uint64_t x = 0; x < 1000; x++) {
+        size_t diff64 = popcount64(hash_mix64(x) ^ hash_mix64(x + 1));
+        TEST_ASSERT_TRUE(diff64 >= 8);
+
+        size_t diff32 = popcount64(hash_mix32((uint32_t)x) ^ hash_mix32((uint32_t)x + 1));
+        TEST_ASSERT_TRUE(diff32 >= 4);
+    }
+
+    uint64_t k = 5;
+    TEST_ASSERT_EQUAL_UINT32(hash_fold32(hash_mix64(5)), hash_u64_key(&k));
+}
+
+static void test_hash_s_hash(void) {
+    string_t *s1 = new_string_from_cstr("hello world");
+    string_t *s2 = new_string_from_literal("hello world");
+    string_t *s3 = new_string_from_literal("hello worle");
+
+    TEST_ASSERT_EQUAL_UINT32(s_hash(s1), s_hash(s2));
+    TEST_ASSERT_TRUE(s_hash(s1) != s_hash(s3));
+
+    delete_string(s1);
+    delete_string(s2);
+    delete_string(s3);
+}
+
+void hash_tests(void) {
+    RUN_TEST(test_hash_bytes_deterministic);
+    RUN_TEST(test_hash_bytes_unaligned);
+    RUN_TEST(test_hash_bytes_lengths);
+    RUN_TEST(test_hash_bytes_avalanche);
+    RUN_TEST(test_hash_mixers);
+    RUN_TEST(test_hash_s_hash);
+}
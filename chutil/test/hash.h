@@ -0,0 +1,6 @@
+#ifndef TEST_CHUTIL_HASH_H
+#define TEST_CHUTIL_HASH_H
+
+void hash_tests(void);
+
+#endif
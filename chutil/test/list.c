@@ -220,7 +220,61 @@ static void linked_list_tests(void) {
     test_l(LINKED_LIST_IMPL);
 }
 
+static void pooled_linked_list_tests(void) {
+    pool_t *pool = new_pool();
+    linked_list_t *ll = new_linked_list_with_pool(sizeof(uint64_t), pool);
+
+    uint64_t in, out;
+
+    // Push and poll a few times to make sure nodes are being reused.
+    for (size_t round = 0; round < 5; round++) {
+        for (in = 0; in < 500; in++) {
+            ll_push(ll, &in);
+        }
+
+        for (uint64_t i = 0; i < 500; i++) {
+            ll_poll(ll, &out);
+            TEST_ASSERT_EQUAL_UINT64(i, out);
+        }
+    }
+
+    for (in = 0; in < 10; in++) {
+        ll_push(ll, &in);
+    }
+
+    // Deleting the list should return its nodes to the pool.
+    delete_linked_list(ll);
+    delete_pool(pool);
+}
+
+static void large_array_list_tests(void) {
+    // Enough cells to push the table over the large buffer threshold.
+    const uint64_t NUM_CELLS = (SAFE_LARGE_THRESHOLD / sizeof(uint64_t)) * 2;
+
+    array_list_t *al = new_array_list(sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < NUM_CELLS; i++) {
+        al_push(al, &i);
+    }
+
+    for (uint64_t i = 0; i < NUM_CELLS; i++) {
+        TEST_ASSERT_EQUAL_UINT64(i, *(uint64_t *)al_get(al, i));
+    }
+
+    // Moved memory should be freeable with safe_free.
+    uint64_t *arr = (uint64_t *)delete_and_move_array_list(al);
+    TEST_ASSERT_EQUAL_UINT64(NUM_CELLS - 1, arr[NUM_CELLS - 1]);
+    safe_free(arr);
+
+    // A single cell past the threshold, so the very first table is large.
+    al = new_array_list(SAFE_LARGE_THRESHOLD);
+    TEST_ASSERT_NOT_NULL(al);
+    delete_array_list(al);
+}
+
 void list_tests(void) {
     RUN_TEST(array_list_tests);
     RUN_TEST(linked_list_tests);
+    RUN_TEST(pooled_linked_list_tests);
+    RUN_TEST(large_array_list_tests);
 }
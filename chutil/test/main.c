@@ -3,6 +3,11 @@
 
 
 #include "map.h"
+#include "flat_map.h"
+#include "concurrent_map.h"
+#include "btree.h"
+#include "map_snapshot.h"
+#include "hash.h"
 #include "queue.h"
 #include "list.h"
 #include "heap.h"
@@ -19,7 +24,7 @@ void setUp(void) {
 }
 
 void tearDown(void) {
-    TEST_ASSERT_EQUAL_size_t(0, sys_get_malloc_count());
+    TEST_ASSERT_EQUAL_size_t(0, sys_get_malloc_count_exact());
 }
 
 
@@ -30,6 +35,11 @@ int main(void) {
     list_tests();
     list_helpers_tests();
     map_tests();
+    flat_map_tests();
+    concurrent_map_tests();
+    btree_tests();
+    map_snapshot_tests();
+    hash_tests();
     queue_tests();
     heap_tests();
     string_tests(); 
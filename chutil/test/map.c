@@ -1,6 +1,8 @@
 
 #include "chutil/map.h"
 #include "chsys/mem.h"
+#include "chsys/wrappers.h"
+#include <pthread.h>
 #include <stdio.h>
 
 #include "unity/unity.h"
@@ -233,6 +235,382 @@ static void test_hm_equals_big(void) {
     delete_hash_map(hm2);
 }
 
+static void test_hm_with_pool(void) {
+    pool_t *pool = new_pool();
+
+    hash_map_t *hm = new_hash_map_with_pool(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f, pool);
+
+    const uint64_t NUM_KEYS = 1000;
+    uint64_t key, val;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key + 1;
+        hm_put(hm, &key, &val);
+    }
+
+    for (key = 0; key < NUM_KEYS; key += 2) {
+        TEST_ASSERT_TRUE(hm_remove(hm, &key));
+    }
+
+    // Removed pairs should be reused here.
+    for (key = 0; key < NUM_KEYS; key += 2) {
+        val = key + 1;
+        hm_put(hm, &key, &val);
+    }
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        TEST_ASSERT_TRUE(hm_get_copy(hm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(key + 1, val);
+    }
+
+    delete_hash_map(hm);
+    delete_pool(pool);
+}
+
+static void test_hm_incremental_resize(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+    hm_set_incremental_resize(hm, true);
+
+    const uint64_t NUM_KEYS = 5000;
+    uint64_t key, val;
+    bool saw_resize = false;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key * 7;
+        hm_put(hm, &key, &val);
+
+        if (hm->old_chains) {
+            saw_resize = true;
+        }
+
+        // Every 3rd key is removed again, sometimes mid resize.
+        if (key % 3 == 0) {
+            uint64_t rm_key = key / 2;
+            if (rm_key % 3 != 0) {
+                rm_key = key;
+            }
+            hm_remove(hm, &rm_key);
+        }
+    }
+
+    TEST_ASSERT_TRUE(saw_resize);
+
+    size_t expected = 0;
+    for (key = 0; key < NUM_KEYS; key++) {
+        if (hm_get_copy(hm, &key, &val)) {
+            TEST_ASSERT_EQUAL_UINT64(key * 7, val);
+            expected++;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(expected, hm_num_keys(hm));
+
+    // Iteration must see pairs in both tables exactly once.
+    // Grow right up to a resize, then one more put starts it.
+    while (!(hm->old_chains)) {
+        val = key * 7;
+        hm_put(hm, &key, &val);
+        key++;
+        expected++;
+    }
+
+    size_t count = 0;
+    key_val_pair_t kvp;
+    hm_reset_iterator(hm);
+    while ((kvp = hm_next_kvp(hm)) != HASH_MAP_EXHAUSTED) {
+        TEST_ASSERT_EQUAL_UINT64(*(const uint64_t *)kvp_key(hm, kvp) * 7, *(uint64_t *)kvp_val(hm, kvp));
+        count++;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(expected, count);
+
+    // Deleting mid resize must free both tables.
+    delete_hash_map(hm);
+}
+
+static void test_hm_reserve(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    const uint64_t NUM_KEYS = 1000;
+    uint64_t key, val;
+
+    key = 0; val = 1;
+    hm_put(hm, &key, &val);
+
+    hm_reserve(hm, NUM_KEYS);
+
+    size_t cap = hm->chains_cap;
+    TEST_ASSERT_TRUE(cap >= NUM_KEYS * 2);
+    TEST_ASSERT_NULL(hm->old_chains);
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key + 1;
+        hm_put(hm, &key, &val);
+    }
+
+    // No resizing needed.
+    TEST_ASSERT_EQUAL_size_t(cap, hm->chains_cap);
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        TEST_ASSERT_TRUE(hm_get_copy(hm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(key + 1, val);
+    }
+
+    delete_hash_map(hm);
+}
+
+static void test_hm_get_or_insert_and_upsert(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    uint64_t key, val;
+    uint64_t *val_ptr;
+    bool inserted;
+
+    // Counting occurrences, the usual get or insert pattern.
+    for (uint64_t i = 0; i < 300; i++) {
+        key = i % 30;
+
+        val_ptr = hm_get_or_insert(hm, &key, NULL, &inserted);
+        TEST_ASSERT_NOT_NULL(val_ptr);
+        TEST_ASSERT_EQUAL(i < 30, inserted);
+
+        (*val_ptr)++;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(30, hm_num_keys(hm));
+
+    for (key = 0; key < 30; key++) {
+        TEST_ASSERT_TRUE(hm_get_copy(hm, &key, &val));
+        TEST_ASSERT_EQUAL_UINT64(10, val);
+    }
+
+    key = 100; val = 5;
+    val_ptr = hm_get_or_insert(hm, &key, &val, NULL);
+    TEST_ASSERT_EQUAL_UINT64(5, *val_ptr);
+
+    val = 6;
+    TEST_ASSERT_FALSE(hm_upsert(hm, &key, &val));
+    TEST_ASSERT_EQUAL_UINT64(6, *(uint64_t *)hm_get(hm, &key));
+
+    key = 101;
+    TEST_ASSERT_TRUE(hm_upsert(hm, &key, &val));
+    TEST_ASSERT_EQUAL_size_t(32, hm_num_keys(hm));
+
+    // Precomputed hashes.
+    key = 200; val = 7;
+    uint32_t h = hm_hash(hm, &key);
+
+    TEST_ASSERT_NULL(hm_get_hashed(hm, &key, h));
+    hm_put_hashed(hm, &key, h, &val);
+    TEST_ASSERT_EQUAL_UINT64(7, *(uint64_t *)hm_get_hashed(hm, &key, h));
+    TEST_ASSERT_TRUE(hm_remove_hashed(hm, &key, h));
+    TEST_ASSERT_FALSE(hm_contains(hm, &key));
+
+    delete_hash_map(hm);
+}
+
+static void test_hm_batch(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    // Not a multiple of the batch size.
+    #define BATCH_TEST_KEYS 1003
+    uint64_t keys[BATCH_TEST_KEYS];
+    uint64_t vals[BATCH_TEST_KEYS];
+
+    for (uint64_t i = 0; i < BATCH_TEST_KEYS; i++) {
+        // Every key appears twice, the later value must win.
+        keys[i] = i / 2;
+        vals[i] = i;
+    }
+
+    // Incremental mode, so that batches run across resizes.
+    hm_set_incremental_resize(hm, true);
+    hm_put_batch(hm, keys, vals, BATCH_TEST_KEYS);
+
+    TEST_ASSERT_EQUAL_size_t((BATCH_TEST_KEYS + 1) / 2, hm_num_keys(hm));
+
+    // Look up every key, plus some missing ones.
+    for (uint64_t i = 0; i < BATCH_TEST_KEYS; i++) {
+        keys[i] = i;
+    }
+
+    void *out[BATCH_TEST_KEYS];
+    hm_get_batch(hm, keys, BATCH_TEST_KEYS, out);
+
+    for (uint64_t i = 0; i < BATCH_TEST_KEYS; i++) {
+        if (i < (BATCH_TEST_KEYS + 1) / 2) {
+            TEST_ASSERT_NOT_NULL(out[i]);
+
+            uint64_t expected = (i * 2) + 1 < BATCH_TEST_KEYS ? (i * 2) + 1 : i * 2;
+            TEST_ASSERT_EQUAL_UINT64(expected, *(uint64_t *)out[i]);
+        } else {
+            TEST_ASSERT_NULL(out[i]);
+        }
+    }
+
+    #undef BATCH_TEST_KEYS
+
+    delete_hash_map(hm);
+}
+
+static void test_hm_cursors(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    const uint64_t NUM_KEYS = 200;
+    uint64_t key, val;
+
+    for (key = 0; key < NUM_KEYS; key++) {
+        val = key;
+        hm_put(hm, &key, &val);
+    }
+
+    // Two cursors at once, one running twice as fast as the other.
+    hash_map_cursor_t slow, fast;
+    hm_cursor_init(hm, &slow);
+    hm_cursor_init(hm, &fast);
+
+    uint64_t slow_sum = 0, fast_sum = 0;
+    size_t slow_count = 0, fast_count = 0;
+    key_val_pair_t kvp;
+
+    while ((kvp = hm_cursor_next(hm, &slow)) != HASH_MAP_EXHAUSTED) {
+        slow_sum += *(uint64_t *)kvp_val(hm, kvp);
+        slow_count++;
+
+        for (int i = 0; i < 2; i++) {
+            if ((kvp = hm_cursor_next(hm, &fast)) != HASH_MAP_EXHAUSTED) {
+                fast_sum += *(uint64_t *)kvp_val(hm, kvp);
+                fast_count++;
+            }
+        }
+    }
+
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, slow_count);
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, fast_count);
+    TEST_ASSERT_EQUAL_UINT64((NUM_KEYS * (NUM_KEYS - 1)) / 2, slow_sum);
+    TEST_ASSERT_EQUAL_UINT64(slow_sum, fast_sum);
+
+    // hm_equals must not disturb the map's own iterator.
+    size_t count = 0;
+    hm_reset_iterator(hm);
+    while ((kvp = hm_next_kvp(hm)) != HASH_MAP_EXHAUSTED) {
+        if (count == NUM_KEYS / 2) {
+            TEST_ASSERT_TRUE(hm_equals(hm, hm, (hash_map_val_eq_ft)u64_eq_f));
+        }
+        count++;
+    }
+    TEST_ASSERT_EQUAL_size_t(NUM_KEYS, count);
+
+    delete_hash_map(hm);
+}
+
+#define HM_TEST_PARTS 5
+
+typedef struct _hm_part_arg_t {
+    hash_map_t *hm;
+    size_t part;
+    uint64_t sum;
+    size_t count;
+} hm_part_arg_t;
+
+static void *hm_part_routine(void *arg) {
+    hm_part_arg_t *a = (hm_part_arg_t *)arg;
+
+    hash_map_cursor_t cur;
+    key_val_pair_t kvp;
+
+    hm_cursor_init_partition(a->hm, &cur, a->part, HM_TEST_PARTS);
+    while ((kvp = hm_cursor_next(a->hm, &cur)) != HASH_MAP_EXHAUSTED) {
+        a->sum += *(uint64_t *)kvp_val(a->hm, kvp);
+        a->count++;
+    }
+
+    return NULL;
+}
+
+static void test_hm_partitions(void) {
+    hash_map_t *hm = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    // Partitions must cover both tables while mid resize.
+    hm_set_incremental_resize(hm, true);
+
+    uint64_t key = 0, val;
+    uint64_t expected_sum = 0;
+
+    while (key < 1000 || !(hm->old_chains)) {
+        val = key;
+        hm_put(hm, &key, &val);
+
+        expected_sum += key;
+        key++;
+    }
+
+    pthread_t threads[HM_TEST_PARTS];
+    hm_part_arg_t args[HM_TEST_PARTS];
+
+    for (size_t i = 0; i < HM_TEST_PARTS; i++) {
+        args[i].hm = hm;
+        args[i].part = i;
+        args[i].sum = 0;
+        args[i].count = 0;
+
+        safe_pthread_create(&(threads[i]), NULL, hm_part_routine, &(args[i]));
+    }
+
+    uint64_t sum = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < HM_TEST_PARTS; i++) {
+        safe_pthread_join(threads[i], NULL);
+
+        sum += args[i].sum;
+        count += args[i].count;
+    }
+
+    TEST_ASSERT_EQUAL_size_t(hm_num_keys(hm), count);
+    TEST_ASSERT_EQUAL_UINT64(expected_sum, sum);
+
+    // More parts than chains, most are empty.
+    hash_map_t *small = new_hash_map(sizeof(uint64_t), sizeof(uint64_t),
+            (hash_map_hash_ft)u64_hash_f, (hash_map_key_eq_ft)u64_eq_f);
+
+    key = 3; val = 3;
+    hm_put(small, &key, &val);
+
+    count = 0;
+    for (size_t part = 0; part < 100; part++) {
+        hash_map_cursor_t cur;
+        hm_cursor_init_partition(small, &cur, part, 100);
+
+        while (hm_cursor_next(small, &cur) != HASH_MAP_EXHAUSTED) {
+            count++;
+        }
+    }
+    TEST_ASSERT_EQUAL_size_t(1, count);
+
+    // Parts which don't exist are empty.
+    hash_map_cursor_t cur;
+
+    hm_cursor_init_partition(small, &cur, 0, 0);
+    TEST_ASSERT_NULL(hm_cursor_next(small, &cur));
+
+    hm_cursor_init_partition(small, &cur, 100, 100);
+    TEST_ASSERT_NULL(hm_cursor_next(small, &cur));
+
+    hm_cursor_init_partition(hm, &cur, SIZE_MAX, 4);
+    TEST_ASSERT_NULL(hm_cursor_next(hm, &cur));
+
+    delete_hash_map(small);
+    delete_hash_map(hm);
+}
+
 void map_tests(void) {
     RUN_TEST(test_hm_construct_and_destruct); 
     RUN_TEST(test_hm_put_and_get);
@@ -241,5 +619,12 @@ void map_tests(void) {
     RUN_TEST(test_hm_iterator);
     RUN_TEST(test_hm_equals_simple);
     RUN_TEST(test_hm_equals_big);
+    RUN_TEST(test_hm_with_pool);
+    RUN_TEST(test_hm_incremental_resize);
+    RUN_TEST(test_hm_reserve);
+    RUN_TEST(test_hm_get_or_insert_and_upsert);
+    RUN_TEST(test_hm_batch);
+    RUN_TEST(test_hm_cursors);
+    RUN_TEST(test_hm_partitions);
 }
 
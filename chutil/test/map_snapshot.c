@@ -0,0 +1,216 @@
+#include "chutil/map_snapshot.h"
+#include "chutil/hash.h"
+#include "chutil/map.h"
+#include "chsys/mem.h"
+
+#include "unity/unity.h"
+#include "unity/unity_internals.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool u64_eq_f(const uint64_t *k1, const uint64_t *k2) {
+    return *k1 == *k2;
+}
+
+static bool u32_eq_f(const uint32_t *k1, const uint32_t *k2) {
+    return *k1 == *k2;
+}
+
+// Deliberately weak, so many keys share buckets.
+static uint32_t u64_weak_hash_f(const uint64_t *k) {
+    return (uint32_t)(*k % 1000);
+}
+
+// Each test gets its own file, removed at the end of the test.
+static char snap_path[64];
+
+static void make_snap_path(void) {
+    snprintf(snap_path, sizeof(snap_path), "/tmp/chutil_snapshot_XXXXXX");
+
+    int fd = mkstemp(snap_path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+}
+
+static hash_map_t *new_u64_map(hash_map_hash_ft hf) {
+    return new_hash_map(sizeof(uint64_t), sizeof(uint64_t), hf, (hash_map_key_eq_ft)u64_eq_f);
+}
+
+static void test_hms_round_trip(void) {
+    make_snap_path();
+
+    hash_map_hash_ft hashes[2] = {hash_u64_key, (hash_map_hash_ft)u64_weak_hash_f};
+
+    for (size_t h = 0; h < 2; h++) {
+        hash_map_t *hm = new_u64_map(hashes[h]);
+
+        const uint64_t NUM_KEYS = 20000;
+        uint64_t key, val;
+
+        for (key = 0; key < NUM_KEYS; key++) {
+            val = key * 11;
+            hm_put(hm, &key, &val);
+        }
+
+        TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, hm_write_snapshot(hm, snap_path));
+
+        hm_snapshot_t *snap;
+        TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, new_hm_snapshot(&snap, snap_path, 
+                    sizeof(uint64_t), sizeof(uint64_t), hashes[h], (hash_map_key_eq_ft)u64_eq_f, true));
+
+        TEST_ASSERT_EQUAL_size_t(NUM_KEYS, hms_num_keys(snap));
+
+        for (key = 0; key < NUM_KEYS + 100; key++) {
+            bool found = hms_get_copy(snap, &key, &val);
+            TEST_ASSERT_EQUAL(key < NUM_KEYS, found);
+
+            if (found) {
+                TEST_ASSERT_EQUAL_UINT64(key * 11, val);
+            }
+        }
+
+        // Every slot holds a pair of the map.
+        for (size_t i = 0; i < hms_num_keys(snap); i++) {
+            const uint64_t *k = (const uint64_t *)hms_key(snap, i);
+            const uint64_t *v = (const uint64_t *)hms_val(snap, i);
+
+            TEST_ASSERT_EQUAL_UINT64(*k * 11, *v);
+        }
+
+        delete_hm_snapshot(snap);
+        delete_hash_map(hm);
+    }
+
+    unlink(snap_path);
+}
+
+static void test_hms_empty_and_set(void) {
+    make_snap_path();
+
+    hash_map_t *hm = new_u64_map(hash_u64_key);
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, hm_write_snapshot(hm, snap_path));
+
+    hm_snapshot_t *snap;
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, true));
+
+    uint64_t key = 5;
+    TEST_ASSERT_EQUAL_size_t(0, hms_num_keys(snap));
+    TEST_ASSERT_FALSE(hms_contains(snap, &key));
+
+    delete_hm_snapshot(snap);
+    delete_hash_map(hm);
+
+    // A hash set of 32-bit keys. (So slots are smaller than 8 bytes)
+    hm = new_hash_map(sizeof(uint32_t), 0, hash_u32_key, (hash_map_key_eq_ft)u32_eq_f);
+
+    uint32_t key32;
+    for (key32 = 0; key32 < 100; key32 += 2) {
+        hm_put(hm, &key32, NULL);
+    }
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, hm_write_snapshot(hm, snap_path));
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint32_t), 0, hash_u32_key, (hash_map_key_eq_ft)u32_eq_f, true));
+
+    TEST_ASSERT_EQUAL_size_t(sizeof(uint32_t), snap->slot_size);
+
+    for (key32 = 0; key32 < 100; key32++) {
+        TEST_ASSERT_EQUAL(key32 % 2 == 0, hms_contains(snap, &key32));
+    }
+
+    delete_hm_snapshot(snap);
+    delete_hash_map(hm);
+
+    unlink(snap_path);
+}
+
+static void test_hms_bad_files(void) {
+    make_snap_path();
+
+    hm_snapshot_t *snap;
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_IO_ERROR, new_hm_snapshot(&snap, "/tmp/chutil_not_a_snapshot_file/x", 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, true));
+
+    // Empty file.
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_BAD_FORMAT, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, true));
+
+    hash_map_t *hm = new_u64_map(hash_u64_key);
+
+    uint64_t key, val;
+    for (key = 0; key < 1000; key++) {
+        val = key;
+        hm_put(hm, &key, &val);
+    }
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_IO_ERROR, hm_write_snapshot(hm, "/tmp/chutil_not_a_snapshot_file/x"));
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, hm_write_snapshot(hm, snap_path));
+    delete_hash_map(hm);
+
+    // Readable by other users, like any file written with open.
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat(snap_path, &st));
+    TEST_ASSERT_EQUAL(0644, st.st_mode & 0777);
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SIZE_MISMATCH, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint32_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, true));
+
+    // Flip a byte of the last value.
+    int fd = open(snap_path, O_RDWR);
+    TEST_ASSERT_TRUE(fd >= 0);
+
+    off_t end = lseek(fd, 0, SEEK_END);
+    uint8_t b;
+
+    TEST_ASSERT_EQUAL(1, pread(fd, &b, 1, end - 1));
+    b ^= 0xFF;
+    TEST_ASSERT_EQUAL(1, pwrite(fd, &b, 1, end - 1));
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_BAD_CHECKSUM, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, true));
+
+    // Without verifying, the file still opens.
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, false));
+    delete_hm_snapshot(snap);
+
+    // Bucket offsets past the end, and out of order. Only the first and last
+    // are checked when opening, lookups must still stay within the slots.
+    uint64_t bad_starts[2] = {1000000, 1};
+    TEST_ASSERT_EQUAL(sizeof(bad_starts), pwrite(fd, bad_starts, sizeof(bad_starts),
+                HM_SNAPSHOT_HEADER_SIZE + (512 * sizeof(uint64_t))));
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_SUCCESS, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, false));
+
+    for (key = 0; key < 1000; key++) {
+        const uint8_t *v = (const uint8_t *)hms_get(snap, &key);
+        if (v) {
+            TEST_ASSERT_TRUE(v >= snap->slots && v < snap->slots + (1000 * snap->slot_size));
+        }
+    }
+
+    delete_hm_snapshot(snap);
+
+    // Truncated.
+    TEST_ASSERT_EQUAL(0, ftruncate(fd, end - 8));
+    close(fd);
+
+    TEST_ASSERT_EQUAL(HM_SNAPSHOT_BAD_FORMAT, new_hm_snapshot(&snap, snap_path, 
+                sizeof(uint64_t), sizeof(uint64_t), hash_u64_key, (hash_map_key_eq_ft)u64_eq_f, false));
+
+    unlink(snap_path);
+}
+
+void map_snapshot_tests(void) {
+    RUN_TEST(test_hms_round_trip);
+    RUN_TEST(test_hms_empty_and_set);
+    RUN_TEST(test_hms_bad_files);
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_CHUTIL_MAP_SNAPSHOT_H
+#define TEST_CHUTIL_MAP_SNAPSHOT_H
+
+void map_snapshot_tests(void);
+
+#endif